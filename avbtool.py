@@ -51,6 +51,10 @@ AVB_VBMETA_IMAGE_FLAGS_HASHTREE_DISABLED = 1
 # Configuration for enabling logging of calls to avbtool.
 AVB_INVOCATION_LOGFILE = os.environ.get('AVB_INVOCATION_LOGFILE')
 
+# Default directory for the 'verify_image' result cache, see
+# VerificationCache.
+AVB_VERIFY_CACHE_DIR = os.environ.get('AVB_VERIFY_CACHE_DIR')
+
 # Known values for certificate "usage" field. These values must match the
 # libavb_cert implementation.
 #
@@ -1166,6 +1170,127 @@ class ImageHandler(object):
       self.append_dont_care(size - self.image_size)
 
 
+class VerificationCache(object):
+  """On-disk cache of digests calculated by the 'verify_image' command.
+
+  Calculating the digest or hashtree of a large image dominates the time
+  taken by 'verify_image'. When the same unchanged image is verified again,
+  e.g. in later stages of a build pipeline, the digest can instead be looked
+  up here.
+
+  Entries are stored as one JSON file per key, named after the SHA-256 of the
+  key. The key includes the identity of the image file (real path, device,
+  inode, size, mtime and ctime) and every descriptor field the calculation
+  depends on, so any change to the file or the descriptor is a cache miss.
+  Only calculated digests are cached; they are always compared against the
+  descriptor again, so a cache hit never turns a failure into a success.
+
+  Attributes:
+    cache_dir: The directory holding the cache entries.
+  """
+
+  VERSION = 1
+
+  def __init__(self, cache_dir):
+    """Initializes a verification cache.
+
+    Arguments:
+      cache_dir: The directory to store entries in. Created if it doesn't
+          exist.
+    """
+    self.cache_dir = cache_dir
+    os.makedirs(cache_dir, exist_ok=True)
+
+  def _file_identity(self, filename):
+    """Returns the identity of |filename| as a dict, or None on error."""
+    try:
+      st = os.stat(filename)
+    except OSError:
+      return None
+    return {'path': os.path.realpath(filename),
+            'dev': st.st_dev,
+            'ino': st.st_ino,
+            'size': st.st_size,
+            'mtime_ns': st.st_mtime_ns,
+            'ctime_ns': st.st_ctime_ns}
+
+  def _entry_path(self, key):
+    """Returns the path of the entry for |key|."""
+    key_blob = json.dumps(key, sort_keys=True).encode('utf-8')
+    return os.path.join(self.cache_dir,
+                        hashlib.sha256(key_blob).hexdigest() + '.json')
+
+  def _key(self, filename, params):
+    """Returns the key for |filename| and |params|, or None on error."""
+    identity = self._file_identity(filename)
+    if identity is None:
+      return None
+    return {'version': self.VERSION, 'file': identity, 'params': params}
+
+  def lookup(self, filename, params):
+    """Looks up a cached result.
+
+    Arguments:
+      filename: The image file the result was calculated from.
+      params: A dict with the descriptor fields the result depends on.
+
+    Returns:
+      The dict passed to store() or None if there is no valid entry.
+    """
+    key = self._key(filename, params)
+    if key is None:
+      return None
+    try:
+      with open(self._entry_path(key), 'r') as f:
+        entry = json.load(f)
+    except (OSError, ValueError):
+      return None
+    if not isinstance(entry, dict) or entry.get('key') != key:
+      return None
+    result = entry.get('result')
+    if not isinstance(result, dict):
+      return None
+    return result
+
+  def calculate(self, filename, params, func):
+    """Returns the cached result for |filename| or calculates it.
+
+    The result is only stored if the file didn't change while |func| was
+    running.
+
+    Arguments:
+      filename: The image file the result is calculated from.
+      params: A dict with the descriptor fields the result depends on.
+      func: Function calculating the result, must return a JSON-serializable
+          dict.
+
+    Returns:
+      A tuple (result, cached) where |cached| is True if the result was
+      looked up rather than calculated.
+    """
+    result = self.lookup(filename, params)
+    if result is not None:
+      return result, True
+    key = self._key(filename, params)
+    result = func()
+    if key is not None and key == self._key(filename, params):
+      self.store(key, result)
+    return result, False
+
+  def store(self, key, result):
+    """Stores |result| for |key|, ignoring any errors."""
+    entry_path = self._entry_path(key)
+    try:
+      # Write to a temporary file and rename it into place so concurrent
+      # readers never see a partial entry.
+      with tempfile.NamedTemporaryFile('w', dir=self.cache_dir,
+                                       delete=False) as f:
+        json.dump({'key': key, 'result': result}, f, sort_keys=True)
+      os.replace(f.name, entry_path)
+    except OSError:
+      pass
+
+
 class AvbDescriptor(object):
   """Class for AVB descriptor.
 
@@ -1227,7 +1352,8 @@ class AvbDescriptor(object):
     return bytearray(ret)
 
   def verify(self, image_dir, image_ext, expected_chain_partitions_map,
-             image_containing_descriptor, accept_zeroed_hashtree):
+             image_containing_descriptor, accept_zeroed_hashtree,
+             verification_cache=None):
     """Verifies contents of the descriptor - used in verify_image sub-command.
 
     Arguments:
@@ -1238,13 +1364,14 @@ class AvbDescriptor(object):
       image_containing_descriptor: The image the descriptor is in.
       accept_zeroed_hashtree: If True, don't fail if hashtree or FEC data is
           zeroed out.
+      verification_cache: A VerificationCache or None.
 
     Returns:
       True if the descriptor verifies, False otherwise.
     """
     # Deletes unused parameters to prevent pylint warning unused-argument.
     del image_dir, image_ext, expected_chain_partitions_map
-    del image_containing_descriptor, accept_zeroed_hashtree
+    del image_containing_descriptor, accept_zeroed_hashtree, verification_cache
 
     # Nothing to do.
     return True
@@ -1333,7 +1460,8 @@ class AvbPropertyDescriptor(AvbDescriptor):
     return ret
 
   def verify(self, image_dir, image_ext, expected_chain_partitions_map,
-             image_containing_descriptor, accept_zeroed_hashtree):
+             image_containing_descriptor, accept_zeroed_hashtree,
+             verification_cache=None):
     """Verifies contents of the descriptor - used in verify_image sub-command.
 
     Arguments:
@@ -1344,6 +1472,7 @@ class AvbPropertyDescriptor(AvbDescriptor):
       image_containing_descriptor: The image the descriptor is in.
       accept_zeroed_hashtree: If True, don't fail if hashtree or FEC data is
           zeroed out.
+      verification_cache: A VerificationCache or None.
 
     Returns:
       True if the descriptor verifies, False otherwise.
@@ -1507,7 +1636,8 @@ class AvbHashtreeDescriptor(AvbDescriptor):
     return ret
 
   def verify(self, image_dir, image_ext, expected_chain_partitions_map,
-             image_containing_descriptor, accept_zeroed_hashtree):
+             image_containing_descriptor, accept_zeroed_hashtree,
+             verification_cache=None):
     """Verifies contents of the descriptor - used in verify_image sub-command.
 
     Arguments:
@@ -1518,6 +1648,7 @@ class AvbHashtreeDescriptor(AvbDescriptor):
       image_containing_descriptor: The image the descriptor is in.
       accept_zeroed_hashtree: If True, don't fail if hashtree or FEC data is
           zeroed out.
+      verification_cache: A VerificationCache or None.
 
     Returns:
       True if the descriptor verifies, False otherwise.
@@ -1528,38 +1659,61 @@ class AvbHashtreeDescriptor(AvbDescriptor):
     else:
       image_filename = os.path.join(image_dir, self.partition_name + image_ext)
       image = ImageHandler(image_filename, read_only=True)
-    # Generate the hashtree and checks that it matches what's in the file.
-    digest_size = self._hashtree_digest_size()
-    digest_padding = round_to_pow2(digest_size) - digest_size
-    (hash_level_offsets, tree_size) = calc_hash_level_offsets(
-        self.image_size, self.data_block_size, digest_size + digest_padding)
-    root_digest, hash_tree = generate_hash_tree(image, self.image_size,
-                                                self.data_block_size,
-                                                self.hash_algorithm, self.salt,
-                                                digest_padding,
-                                                hash_level_offsets,
-                                                tree_size)
+
+    def calculate():
+      # Generate the hashtree and check it against what's in the file.
+      digest_size = self._hashtree_digest_size()
+      digest_padding = round_to_pow2(digest_size) - digest_size
+      (hash_level_offsets, tree_size) = calc_hash_level_offsets(
+          self.image_size, self.data_block_size, digest_size + digest_padding)
+      root_digest, hash_tree = generate_hash_tree(image, self.image_size,
+                                                  self.data_block_size,
+                                                  self.hash_algorithm,
+                                                  self.salt, digest_padding,
+                                                  hash_level_offsets,
+                                                  tree_size)
+      image.seek(self.tree_offset)
+      hash_tree_ondisk = image.read(self.tree_size)
+      return {'root_digest': root_digest.hex(),
+              'is_zeroed': ((self.tree_size == 0) or
+                            (hash_tree_ondisk[0:8] == b'ZeRoHaSH')),
+              'hash_tree_matches': hash_tree == hash_tree_ondisk}
+
+    cached = False
+    if verification_cache:
+      params = {'type': 'hashtree',
+                'image_size': self.image_size,
+                'tree_offset': self.tree_offset,
+                'tree_size': self.tree_size,
+                'data_block_size': self.data_block_size,
+                'hash_block_size': self.hash_block_size,
+                'hash_algorithm': self.hash_algorithm,
+                'salt': self.salt.hex()}
+      result, cached = verification_cache.calculate(image.filename, params,
+                                                    calculate)
+    else:
+      result = calculate()
+
     # The root digest must match unless it is not embedded in the descriptor.
-    if self.root_digest and root_digest != self.root_digest:
+    if (self.root_digest and
+        bytes.fromhex(result['root_digest']) != self.root_digest):
       sys.stderr.write('hashtree of {} does not match descriptor\n'.
                        format(image_filename))
       return False
     # ... also check that the on-disk hashtree matches
-    image.seek(self.tree_offset)
-    hash_tree_ondisk = image.read(self.tree_size)
-    is_zeroed = (self.tree_size == 0) or (hash_tree_ondisk[0:8] == b'ZeRoHaSH')
-    if is_zeroed and accept_zeroed_hashtree:
+    if result['is_zeroed'] and accept_zeroed_hashtree:
       print('{}: skipping verification since hashtree is zeroed and '
             '--accept_zeroed_hashtree was given'
             .format(self.partition_name))
     else:
-      if hash_tree != hash_tree_ondisk:
+      if not result['hash_tree_matches']:
         sys.stderr.write('hashtree of {} contains invalid data\n'.
                          format(image_filename))
         return False
-      print('{}: Successfully verified {} hashtree of {} for image of {} bytes'
-            .format(self.partition_name, self.hash_algorithm, image.filename,
-                    self.image_size))
+      print('{}: Successfully verified {} hashtree of {} for image of {} '
+            'bytes{}'.format(self.partition_name, self.hash_algorithm,
+                             image.filename, self.image_size,
+                             ' (cached)' if cached else ''))
     # TODO(zeuthen): we could also verify that the FEC stored in the image is
     # correct but this a) currently requires the 'fec' binary; and b) takes a
     # long time; and c) is not strictly needed for verification purposes as
@@ -1675,7 +1829,8 @@ class AvbHashDescriptor(AvbDescriptor):
     return ret
 
   def verify(self, image_dir, image_ext, expected_chain_partitions_map,
-             image_containing_descriptor, accept_zeroed_hashtree):
+             image_containing_descriptor, accept_zeroed_hashtree,
+             verification_cache=None):
     """Verifies contents of the descriptor - used in verify_image sub-command.
 
     Arguments:
@@ -1686,6 +1841,7 @@ class AvbHashDescriptor(AvbDescriptor):
       image_containing_descriptor: The image the descriptor is in.
       accept_zeroed_hashtree: If True, don't fail if hashtree or FEC data is
           zeroed out.
+      verification_cache: A VerificationCache or None.
 
     Returns:
       True if the descriptor verifies, False otherwise.
@@ -1696,19 +1852,33 @@ class AvbHashDescriptor(AvbDescriptor):
     else:
       image_filename = os.path.join(image_dir, self.partition_name + image_ext)
       image = ImageHandler(image_filename, read_only=True)
-    data = image.read(self.image_size)
-    ha = hashlib.new(self.hash_algorithm)
-    ha.update(self.salt)
-    ha.update(data)
-    digest = ha.digest()
+
+    def calculate():
+      data = image.read(self.image_size)
+      ha = hashlib.new(self.hash_algorithm)
+      ha.update(self.salt)
+      ha.update(data)
+      return {'digest': ha.hexdigest()}
+
+    cached = False
+    if verification_cache:
+      params = {'type': 'hash',
+                'image_size': self.image_size,
+                'hash_algorithm': self.hash_algorithm,
+                'salt': self.salt.hex()}
+      result, cached = verification_cache.calculate(image.filename, params,
+                                                    calculate)
+    else:
+      result = calculate()
+    digest = bytes.fromhex(result['digest'])
     # The digest must match unless there is no digest in the descriptor.
     if self.digest and digest != self.digest:
       sys.stderr.write('{} digest of {} does not match digest in descriptor\n'.
                        format(self.hash_algorithm, image_filename))
       return False
-    print('{}: Successfully verified {} hash of {} for image of {} bytes'
+    print('{}: Successfully verified {} hash of {} for image of {} bytes{}'
           .format(self.partition_name, self.hash_algorithm, image.filename,
-                  self.image_size))
+                  self.image_size, ' (cached)' if cached else ''))
     return True
 
 
@@ -1788,7 +1958,8 @@ class AvbKernelCmdlineDescriptor(AvbDescriptor):
     return ret
 
   def verify(self, image_dir, image_ext, expected_chain_partitions_map,
-             image_containing_descriptor, accept_zeroed_hashtree):
+             image_containing_descriptor, accept_zeroed_hashtree,
+             verification_cache=None):
     """Verifies contents of the descriptor - used in verify_image sub-command.
 
     Arguments:
@@ -1799,6 +1970,7 @@ class AvbKernelCmdlineDescriptor(AvbDescriptor):
       image_containing_descriptor: The image the descriptor is in.
       accept_zeroed_hashtree: If True, don't fail if hashtree or FEC data is
           zeroed out.
+      verification_cache: A VerificationCache or None.
 
     Returns:
       True if the descriptor verifies, False otherwise.
@@ -1902,7 +2074,8 @@ class AvbChainPartitionDescriptor(AvbDescriptor):
     return ret
 
   def verify(self, image_dir, image_ext, expected_chain_partitions_map,
-             image_containing_descriptor, accept_zeroed_hashtree):
+             image_containing_descriptor, accept_zeroed_hashtree,
+             verification_cache=None):
     """Verifies contents of the descriptor - used in verify_image sub-command.
 
     Arguments:
@@ -1913,6 +2086,7 @@ class AvbChainPartitionDescriptor(AvbDescriptor):
       image_containing_descriptor: The image the descriptor is in.
       accept_zeroed_hashtree: If True, don't fail if hashtree or FEC data is
           zeroed out.
+      verification_cache: A VerificationCache or None.
 
     Returns:
       True if the descriptor verifies, False otherwise.
@@ -2508,7 +2682,8 @@ class Avb(object):
       print_certificate(psk)
 
   def verify_image(self, image_filename, key_path, expected_chain_partitions,
-                   follow_chain_partitions, accept_zeroed_hashtree):
+                   follow_chain_partitions, accept_zeroed_hashtree,
+                   verification_cache=None):
     """Implements the 'verify_image' command.
 
     Arguments:
@@ -2521,6 +2696,8 @@ class Avb(object):
           the --expected_chain_partition option
       accept_zeroed_hashtree: If True, don't fail if hashtree or FEC data is
           zeroed out.
+      verification_cache: A VerificationCache to look up and store calculated
+          digests in, or None to always calculate them.
 
     Raises:
       AvbError: If verification of the image fails.
@@ -2596,7 +2773,7 @@ class Avb(object):
               .format(desc.partition_name, desc.rollback_index_location,
                       hashlib.sha1(desc.public_key).hexdigest()))
       elif not desc.verify(image_dir, image_ext, expected_chain_partitions_map,
-                           image, accept_zeroed_hashtree):
+                           image, accept_zeroed_hashtree, verification_cache):
         raise AvbError('Error verifying descriptor.')
       # Honor --follow_chain_partitions - add '--' to make the output more
       # readable.
@@ -2606,7 +2783,7 @@ class Avb(object):
         chained_image_filename = os.path.join(image_dir,
                                               desc.partition_name + image_ext)
         self.verify_image(chained_image_filename, key_path, None, False,
-                          accept_zeroed_hashtree)
+                          accept_zeroed_hashtree, verification_cache)
 
   def print_partition_digests(self, image_filename, output, as_json):
     """Implements the 'print_partition_digests' command.
@@ -4596,6 +4773,16 @@ class AvbTool(object):
         '--accept_zeroed_hashtree',
         help=('Accept images where the hashtree or FEC data is zeroed out'),
         action='store_true')
+    sub_parser.add_argument(
+        '--cache_dir',
+        help=('Directory to cache calculated digests in. Defaults to the '
+              'AVB_VERIFY_CACHE_DIR environment variable if set'),
+        metavar='DIR',
+        default=AVB_VERIFY_CACHE_DIR)
+    sub_parser.add_argument(
+        '--no_cache',
+        help='Always calculate digests, even if a cache directory is set',
+        action='store_true')
     sub_parser.set_defaults(func=self.verify_image)
 
     sub_parser = subparsers.add_parser(
@@ -4941,10 +5128,14 @@ Please use '--hash_algorithm sha256'.
 
   def verify_image(self, args):
     """Implements the 'verify_image' sub-command."""
+    verification_cache = None
+    if args.cache_dir and not args.no_cache:
+      verification_cache = VerificationCache(args.cache_dir)
     self.avb.verify_image(args.image.name, args.key,
                           args.expected_chain_partition,
                           args.follow_chain_partitions,
-                          args.accept_zeroed_hashtree)
+                          args.accept_zeroed_hashtree,
+                          verification_cache)
 
   def print_partition_digests(self, args):
     """Implements the 'print_partition_digests' sub-command."""
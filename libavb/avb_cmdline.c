@@ -23,6 +23,7 @@
  */
 
 #include "avb_cmdline.h"
+#include "avb_hashtree_descriptor.h"
 #include "avb_sha.h"
 #include "avb_util.h"
 #include "avb_version.h"
@@ -207,6 +208,308 @@ static int cmdline_append_hex(AvbSlotVerifyData* slot_data,
   return ret;
 }
 
+/* Returns true if |str| can be used as-is in a dm-mod.create table,
+ * i.e. doesn't contain any separators or quotes.
+ */
+static bool dm_mod_create_is_safe(const char* str) {
+  for (; *str != '\0'; str++) {
+    if (*str == ' ' || *str == ',' || *str == ';' || *str == '"' ||
+        *str == '\\' || (uint8_t)*str < 0x20) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Returns the non-NULL strings in |words| joined by spaces, or NULL
+ * on OOM. Free with avb_free().
+ */
+static char* dm_mod_create_join(const char* const* words, size_t num_words) {
+  size_t total_len = 0;
+  size_t n;
+  char* ret;
+  char* dest;
+
+  for (n = 0; n < num_words; n++) {
+    if (words[n] != NULL) {
+      total_len += avb_strlen(words[n]) + 1;
+    }
+  }
+  ret = avb_malloc(total_len + 1);
+  if (ret == NULL) {
+    return NULL;
+  }
+  dest = ret;
+  for (n = 0; n < num_words; n++) {
+    if (words[n] != NULL) {
+      size_t len = avb_strlen(words[n]);
+      if (dest != ret) {
+        *dest++ = ' ';
+      }
+      avb_memcpy(dest, words[n], len);
+      dest += len;
+    }
+  }
+  *dest = '\0';
+  return ret;
+}
+
+/* Builds the dm-mod.create device for the hashtree descriptor
+ * |descriptor|. The verity mode and, if the root digest is stored in
+ * a persistent value, the root digest are left as variables to be
+ * substituted later. On success, the result is returned in
+ * |out_device| and must be freed with avb_free().
+ */
+static AvbSlotVerifyResult dm_mod_create_device(AvbOps* ops,
+                                                const char* ab_suffix,
+                                                const AvbDescriptor* descriptor,
+                                                char** out_device) {
+  AvbHashtreeDescriptor desc;
+  const uint8_t* desc_partition_name;
+  const uint8_t* desc_salt;
+  const uint8_t* desc_root_digest;
+  char name[AVB_PART_NAME_MAX_SIZE];
+  char part_name[AVB_PART_NAME_MAX_SIZE];
+  char hash_algorithm[sizeof desc.hash_algorithm + 1];
+  char guid_buf[37];
+  char* device = NULL;
+  char* table = NULL;
+  char* salt = NULL;
+  char* root_digest = NULL;
+  char* dev = NULL;
+  char version[AVB_MAX_DIGITS_UINT64];
+  char num_sectors[AVB_MAX_DIGITS_UINT64];
+  char num_opt_args[AVB_MAX_DIGITS_UINT64];
+  char data_block_size[AVB_MAX_DIGITS_UINT64];
+  char hash_block_size[AVB_MAX_DIGITS_UINT64];
+  char num_data_blocks[AVB_MAX_DIGITS_UINT64];
+  char hash_start_block[AVB_MAX_DIGITS_UINT64];
+  char fec_roots[AVB_MAX_DIGITS_UINT64];
+  char fec_blocks[AVB_MAX_DIGITS_UINT64];
+  bool check_at_most_once;
+  bool fec;
+  AvbSlotVerifyResult ret;
+  AvbIOResult io_ret;
+
+  if (!avb_hashtree_descriptor_validate_and_byteswap(
+          (const AvbHashtreeDescriptor*)descriptor, &desc)) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+  desc_partition_name =
+      ((const uint8_t*)descriptor) + sizeof(AvbHashtreeDescriptor);
+  desc_salt = desc_partition_name + desc.partition_name_len;
+  desc_root_digest = desc_salt + desc.salt_len;
+
+  if (desc.partition_name_len >= AVB_PART_NAME_MAX_SIZE) {
+    avb_error("Partition name does not fit.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+  avb_memcpy(name, desc_partition_name, desc.partition_name_len);
+  name[desc.partition_name_len] = '\0';
+  avb_memcpy(hash_algorithm, desc.hash_algorithm, sizeof desc.hash_algorithm);
+  hash_algorithm[sizeof desc.hash_algorithm] = '\0';
+  if (avb_strlen(name) != desc.partition_name_len ||
+      !dm_mod_create_is_safe(name) || !dm_mod_create_is_safe(hash_algorithm)) {
+    avb_error(name, ": Unsupported characters in hashtree descriptor.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+  if (desc.data_block_size == 0 || desc.hash_block_size == 0) {
+    avb_error(name, ": Invalid block size in hashtree descriptor.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+
+  if (!avb_str_concat(part_name,
+                      sizeof part_name,
+                      name,
+                      desc.partition_name_len,
+                      ab_suffix,
+                      (desc.flags & AVB_HASHTREE_DESCRIPTOR_FLAGS_DO_NOT_USE_AB)
+                          ? 0
+                          : avb_strlen(ab_suffix))) {
+    avb_error("Partition name and suffix does not fit.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+  io_ret = ops->get_unique_guid_for_partition(
+      ops, part_name, guid_buf, sizeof guid_buf);
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    avb_error(part_name, ": Error getting unique GUID for partition.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+  }
+
+  ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  dev = avb_strdupv("PARTUUID=", guid_buf, NULL);
+  salt = desc.salt_len > 0 ? avb_bin2hex(desc_salt, desc.salt_len)
+                           : avb_strdup("-");
+  if (desc.root_digest_len > 0) {
+    root_digest = avb_bin2hex(desc_root_digest, desc.root_digest_len);
+  } else {
+    /* Substituted along with the rest of the command-line, see
+     * avb_add_root_digest_substitution().
+     */
+    root_digest = avb_strdupv("$(AVB_", name, "_ROOT_DIGEST)", NULL);
+    if (root_digest != NULL) {
+      avb_uppercase(root_digest);
+    }
+  }
+  if (dev == NULL || salt == NULL || root_digest == NULL) {
+    goto out;
+  }
+
+  fec = desc.fec_num_roots > 0;
+  check_at_most_once =
+      (desc.flags & AVB_HASHTREE_DESCRIPTOR_FLAGS_CHECK_AT_MOST_ONCE) != 0;
+  avb_uint64_to_base10(desc.image_size / 512, num_sectors);
+  avb_uint64_to_base10(desc.dm_verity_version, version);
+  avb_uint64_to_base10(desc.data_block_size, data_block_size);
+  avb_uint64_to_base10(desc.hash_block_size, hash_block_size);
+  avb_uint64_to_base10(desc.image_size / desc.data_block_size,
+                       num_data_blocks);
+  avb_uint64_to_base10(desc.tree_offset / desc.hash_block_size,
+                       hash_start_block);
+  avb_uint64_to_base10(2 + (check_at_most_once ? 1 : 0) + (fec ? 8 : 0),
+                       num_opt_args);
+  avb_uint64_to_base10(desc.fec_num_roots, fec_roots);
+  avb_uint64_to_base10(desc.fec_offset / desc.data_block_size, fec_blocks);
+
+  {
+    /* Same table as avbtool uses for dm="..." with the legacy
+     * --generate_dm_verity_cmdline_from_hashtree option. NULL entries
+     * are left out.
+     */
+    const char* words[] = {
+        "0",                                        /* start */
+        num_sectors,                                /* size (# sectors) */
+        "verity",                                   /* type */
+        version,                                    /* version */
+        dev,                                        /* data_dev */
+        dev,                                        /* hash_dev */
+        data_block_size,                            /* data_block */
+        hash_block_size,                            /* hash_block */
+        num_data_blocks,                            /* #blocks */
+        hash_start_block,                           /* hash_offset */
+        hash_algorithm,                             /* hash_alg */
+        root_digest,                                /* root_digest */
+        salt,                                       /* salt */
+        num_opt_args,                               /* # of optional args */
+        check_at_most_once ? "check_at_most_once" : NULL,
+        "$(ANDROID_VERITY_MODE)",
+        "ignore_zero_blocks",
+        fec ? "use_fec_from_device" : NULL,
+        fec ? dev : NULL,
+        fec ? "fec_roots" : NULL,
+        fec ? fec_roots : NULL,
+        fec ? "fec_blocks" : NULL,
+        fec ? fec_blocks : NULL,
+        fec ? "fec_start" : NULL,
+        fec ? fec_blocks : NULL,
+    };
+    table = dm_mod_create_join(words, sizeof words / sizeof words[0]);
+  }
+  if (table == NULL) {
+    goto out;
+  }
+  device = avb_strdupv(name, ",,,ro,", table, NULL);
+  if (device == NULL) {
+    goto out;
+  }
+
+  *out_device = device;
+  ret = AVB_SLOT_VERIFY_RESULT_OK;
+
+out:
+  if (table != NULL) {
+    avb_free(table);
+  }
+  if (dev != NULL) {
+    avb_free(dev);
+  }
+  if (salt != NULL) {
+    avb_free(salt);
+  }
+  if (root_digest != NULL) {
+    avb_free(root_digest);
+  }
+  return ret;
+}
+
+/* Appends a dm-mod.create option with a dm-verity device for each
+ * hashtree descriptor in the vbmeta images in |slot_data|.
+ */
+static AvbSlotVerifyResult cmdline_append_dm_mod_create(
+    AvbOps* ops, AvbSlotVerifyData* slot_data) {
+  AvbSlotVerifyResult ret = AVB_SLOT_VERIFY_RESULT_OK;
+  const AvbDescriptor** descriptors = NULL;
+  char* devices = NULL;
+  size_t n, m, num_descriptors;
+
+  for (n = 0; n < slot_data->num_vbmeta_images; n++) {
+    descriptors =
+        avb_descriptor_get_all(slot_data->vbmeta_images[n].vbmeta_data,
+                               slot_data->vbmeta_images[n].vbmeta_size,
+                               &num_descriptors);
+    if (descriptors == NULL) {
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+      goto out;
+    }
+    for (m = 0; m < num_descriptors; m++) {
+      AvbDescriptor desc;
+      char* device;
+      char* new_devices;
+
+      if (!avb_descriptor_validate_and_byteswap(descriptors[m], &desc)) {
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+        goto out;
+      }
+      if (desc.tag != AVB_DESCRIPTOR_TAG_HASHTREE) {
+        continue;
+      }
+      ret = dm_mod_create_device(
+          ops, slot_data->ab_suffix, descriptors[m], &device);
+      if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+        goto out;
+      }
+      if (devices == NULL) {
+        new_devices = avb_strdupv("\"", device, NULL);
+      } else {
+        new_devices = avb_strdupv(devices, ";", device, NULL);
+      }
+      avb_free(device);
+      if (new_devices == NULL) {
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+        goto out;
+      }
+      if (devices != NULL) {
+        avb_free(devices);
+      }
+      devices = new_devices;
+    }
+    avb_free(descriptors);
+    descriptors = NULL;
+  }
+
+  if (devices != NULL) {
+    char* value = avb_strdupv(devices, "\"", NULL);
+    if (value == NULL || !cmdline_append_option(
+                             slot_data, "dm-mod.create", value)) {
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+    }
+    if (value != NULL) {
+      avb_free(value);
+    }
+  }
+
+out:
+  if (descriptors != NULL) {
+    avb_free(descriptors);
+  }
+  if (devices != NULL) {
+    avb_free(devices);
+  }
+  return ret;
+}
+
 AvbSlotVerifyResult avb_append_options(
     AvbOps* ops,
     AvbSlotVerifyFlags flags,
@@ -321,6 +624,13 @@ AvbSlotVerifyResult avb_append_options(
     const char* dm_verity_mode;
     char* new_ret;
 
+    if (flags & AVB_SLOT_VERIFY_FLAGS_DM_MOD_CREATE) {
+      ret = cmdline_append_dm_mod_create(ops, slot_data);
+      if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+        goto out;
+      }
+    }
+
     switch (resolved_hashtree_error_mode) {
       case AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE:
         if (!cmdline_append_option(
@@ -38,6 +38,52 @@ bool avb_descriptor_validate_and_byteswap(const AvbDescriptor* src,
   return true;
 }
 
+bool avb_descriptor_array_foreach(const uint8_t* descriptors,
+                                  size_t descriptors_size,
+                                  AvbDescriptorForeachFunc foreach_func,
+                                  void* user_data) {
+  const uint8_t* desc_end = descriptors + descriptors_size;
+  const uint8_t* p;
+
+  for (p = descriptors; p < desc_end;) {
+    uint64_t nb_following;
+    uint64_t nb_total = 0;
+    const AvbDescriptor* dh;
+
+    if (sizeof(AvbDescriptor) > (size_t)(desc_end - p)) {
+      avb_error("Invalid descriptor length.\n");
+      return false;
+    }
+
+    dh = (const AvbDescriptor*)p;
+    avb_assert_aligned(dh);
+    nb_following = avb_be64toh(dh->num_bytes_following);
+
+    if (!avb_safe_add(&nb_total, sizeof(AvbDescriptor), nb_following)) {
+      avb_error("Invalid descriptor length.\n");
+      return false;
+    }
+
+    if ((nb_total & 7) != 0) {
+      avb_error("Invalid descriptor length.\n");
+      return false;
+    }
+
+    if (nb_total > (uint64_t)(desc_end - p)) {
+      avb_error("Invalid data in descriptors array.\n");
+      return false;
+    }
+
+    if (foreach_func(dh, user_data) == 0) {
+      return false;
+    }
+
+    p += nb_total;
+  }
+
+  return true;
+}
+
 bool avb_descriptor_foreach(const uint8_t* image_data,
                             size_t image_size,
                             AvbDescriptorForeachFunc foreach_func,
@@ -46,8 +92,6 @@ bool avb_descriptor_foreach(const uint8_t* image_data,
   bool ret = false;
   const uint8_t* image_end;
   const uint8_t* desc_start;
-  const uint8_t* desc_end;
-  const uint8_t* p;
   uint64_t desc_offset = 0;
   uint64_t desc_size = 0;
 
@@ -111,45 +155,8 @@ bool avb_descriptor_foreach(const uint8_t* image_data,
     goto out;
   }
 
-  desc_end = desc_start + desc_size;
-
-  for (p = desc_start; p < desc_end;) {
-    uint64_t nb_following;
-    uint64_t nb_total = 0;
-    const AvbDescriptor* dh;
-
-    if (sizeof(AvbDescriptor) > (size_t)(desc_end - p)) {
-      avb_error("Invalid descriptor length.\n");
-      goto out;
-    }
-
-    dh = (const AvbDescriptor*)p;
-    avb_assert_aligned(dh);
-    nb_following = avb_be64toh(dh->num_bytes_following);
-
-    if (!avb_safe_add(&nb_total, sizeof(AvbDescriptor), nb_following)) {
-      avb_error("Invalid descriptor length.\n");
-      goto out;
-    }
-
-    if ((nb_total & 7) != 0) {
-      avb_error("Invalid descriptor length.\n");
-      goto out;
-    }
-
-    if (nb_total > (uint64_t)(desc_end - p)) {
-      avb_error("Invalid data in descriptors array.\n");
-      goto out;
-    }
-
-    if (foreach_func(dh, user_data) == 0) {
-      goto out;
-    }
-
-    p += nb_total;
-  }
-
-  ret = true;
+  ret = avb_descriptor_array_foreach(
+      desc_start, (size_t)desc_size, foreach_func, user_data);
 
 out:
   return ret;
@@ -105,6 +105,16 @@ bool avb_descriptor_foreach(const uint8_t* image_data,
                             AvbDescriptorForeachFunc foreach_func,
                             void* user_data);
 
+/* Like avb_descriptor_foreach() but iterates over the descriptors
+ * array of |descriptors_size| bytes at |descriptors| instead of the
+ * one in a vbmeta image. The same rules apply: the array must come
+ * from a verified image and be word-aligned.
+ */
+bool avb_descriptor_array_foreach(const uint8_t* descriptors,
+                                  size_t descriptors_size,
+                                  AvbDescriptorForeachFunc foreach_func,
+                                  void* user_data);
+
 /* Gets all descriptors in a vbmeta image.
  *
  * The return value is a NULL-pointer terminated array of
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "avb_handoff.h"
+#include "avb_util.h"
+
+/* The CRC-32 covers everything after the |crc32| field. */
+#define HANDOFF_CRC32_START \
+  (offsetof(AvbHandoffHeader, crc32) + sizeof(uint32_t))
+
+static uint64_t handoff_align(uint64_t value) {
+  return (value + AVB_HANDOFF_ALIGNMENT - 1) &
+         ~((uint64_t)AVB_HANDOFF_ALIGNMENT - 1);
+}
+
+/* Returns the space needed for |str| including the terminator. NULL
+ * is stored as an empty string.
+ */
+static uint64_t handoff_string_size(const char* str) {
+  return (str != NULL ? avb_strlen(str) : 0) + 1;
+}
+
+/* Copies |str| to |buf| at |*pos|, advances |*pos| past it and
+ * returns its length.
+ */
+static uint32_t handoff_write_string(uint8_t* buf,
+                                     uint64_t* pos,
+                                     const char* str) {
+  size_t len = 0;
+
+  if (str != NULL) {
+    len = avb_strlen(str);
+    avb_memcpy(buf + *pos, str, len);
+  }
+  buf[*pos + len] = '\0';
+  *pos += len + 1;
+  return (uint32_t)len;
+}
+
+size_t avb_handoff_get_size(const AvbSlotVerifyData* data) {
+  uint64_t size;
+  size_t n;
+
+  size = sizeof(AvbHandoffHeader);
+  size += data->num_vbmeta_images * (uint64_t)sizeof(AvbHandoffVBMetaEntry);
+  size += data->num_loaded_partitions *
+          (uint64_t)sizeof(AvbHandoffPartitionEntry);
+  for (n = 0; n < data->num_vbmeta_images; n++) {
+    size += handoff_align(data->vbmeta_images[n].vbmeta_size);
+    size += handoff_string_size(data->vbmeta_images[n].partition_name);
+  }
+  for (n = 0; n < data->num_loaded_partitions; n++) {
+    size += handoff_string_size(data->loaded_partitions[n].partition_name);
+  }
+  size += handoff_string_size(data->ab_suffix);
+  size += handoff_string_size(data->cmdline);
+
+  if (size > 0xffffffffU) {
+    return 0;
+  }
+  return (size_t)size;
+}
+
+bool avb_handoff_write(const AvbSlotVerifyData* data,
+                       uint8_t* buf,
+                       size_t buf_size,
+                       size_t* out_size) {
+  AvbHandoffHeader h;
+  size_t partition_entries_offset;
+  uint64_t data_pos;
+  uint64_t pos;
+  uint32_t crc;
+  size_t size;
+  size_t n;
+
+  size = avb_handoff_get_size(data);
+  if (size == 0) {
+    avb_error("Slot verify data too big for handoff blob.\n");
+    return false;
+  }
+  if (buf_size < size) {
+    avb_error("Buffer too small for handoff blob.\n");
+    return false;
+  }
+  avb_memset(buf, 0, size);
+  partition_entries_offset =
+      sizeof(AvbHandoffHeader) +
+      data->num_vbmeta_images * sizeof(AvbHandoffVBMetaEntry);
+
+  avb_memset(&h, 0, sizeof(AvbHandoffHeader));
+  avb_memcpy(h.magic, AVB_HANDOFF_MAGIC, AVB_HANDOFF_MAGIC_LEN);
+  h.version_major = avb_htobe32(AVB_HANDOFF_VERSION_MAJOR);
+  h.version_minor = avb_htobe32(AVB_HANDOFF_VERSION_MINOR);
+  h.total_size = avb_htobe32((uint32_t)size);
+  h.resolved_hashtree_error_mode =
+      avb_htobe32((uint32_t)data->resolved_hashtree_error_mode);
+  h.vbmeta_entries_offset = avb_htobe32(sizeof(AvbHandoffHeader));
+  h.num_vbmeta_images = avb_htobe32((uint32_t)data->num_vbmeta_images);
+  h.partition_entries_offset = avb_htobe32((uint32_t)partition_entries_offset);
+  h.num_partitions = avb_htobe32((uint32_t)data->num_loaded_partitions);
+  avb_slot_verify_data_calculate_vbmeta_digest(
+      data, AVB_DIGEST_TYPE_SHA256, h.vbmeta_digest_sha256);
+  for (n = 0; n < AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS; n++) {
+    h.rollback_indexes[n] = avb_htobe64(data->rollback_indexes[n]);
+  }
+
+  /* The vbmeta images go first since they need to be aligned, then
+   * all the strings.
+   */
+  data_pos = partition_entries_offset +
+             data->num_loaded_partitions * sizeof(AvbHandoffPartitionEntry);
+  pos = data_pos;
+  for (n = 0; n < data->num_vbmeta_images; n++) {
+    pos += handoff_align(data->vbmeta_images[n].vbmeta_size);
+  }
+  for (n = 0; n < data->num_vbmeta_images; n++) {
+    const AvbVBMetaData* vbmeta = &data->vbmeta_images[n];
+    AvbHandoffVBMetaEntry e;
+    avb_memset(&e, 0, sizeof(AvbHandoffVBMetaEntry));
+    e.partition_name_offset = avb_htobe32((uint32_t)pos);
+    e.partition_name_size =
+        avb_htobe32(handoff_write_string(buf, &pos, vbmeta->partition_name));
+    avb_memcpy(buf + data_pos, vbmeta->vbmeta_data, vbmeta->vbmeta_size);
+    e.vbmeta_offset = avb_htobe32((uint32_t)data_pos);
+    e.vbmeta_size = avb_htobe32((uint32_t)vbmeta->vbmeta_size);
+    e.verify_result = avb_htobe32((uint32_t)vbmeta->verify_result);
+    data_pos += handoff_align(vbmeta->vbmeta_size);
+    avb_memcpy(
+        buf + sizeof(AvbHandoffHeader) + n * sizeof(AvbHandoffVBMetaEntry),
+        &e,
+        sizeof(AvbHandoffVBMetaEntry));
+  }
+  for (n = 0; n < data->num_loaded_partitions; n++) {
+    const AvbPartitionData* part = &data->loaded_partitions[n];
+    AvbHandoffPartitionEntry e;
+    avb_memset(&e, 0, sizeof(AvbHandoffPartitionEntry));
+    e.partition_name_offset = avb_htobe32((uint32_t)pos);
+    e.partition_name_size =
+        avb_htobe32(handoff_write_string(buf, &pos, part->partition_name));
+    e.data_size = avb_htobe64(part->data_size);
+    e.verify_result = avb_htobe32((uint32_t)part->verify_result);
+    avb_assert(part->digest_len <= sizeof e.digest);
+    e.digest_len = avb_htobe32((uint32_t)part->digest_len);
+    avb_memcpy(e.digest, part->digest, part->digest_len);
+    avb_memcpy(buf + partition_entries_offset +
+                   n * sizeof(AvbHandoffPartitionEntry),
+               &e,
+               sizeof(AvbHandoffPartitionEntry));
+  }
+  h.ab_suffix_offset = avb_htobe32((uint32_t)pos);
+  h.ab_suffix_size =
+      avb_htobe32(handoff_write_string(buf, &pos, data->ab_suffix));
+  h.cmdline_offset = avb_htobe32((uint32_t)pos);
+  h.cmdline_size = avb_htobe32(handoff_write_string(buf, &pos, data->cmdline));
+  avb_assert(pos == size);
+
+  avb_memcpy(buf, &h, sizeof(AvbHandoffHeader));
+  crc = avb_htobe32(
+      avb_crc32(buf + HANDOFF_CRC32_START, size - HANDOFF_CRC32_START));
+  avb_memcpy(buf + offsetof(AvbHandoffHeader, crc32), &crc, sizeof crc);
+
+  *out_size = size;
+  return true;
+}
+
+/* Returns true if there is a NUL-terminated string of |size| bytes at
+ * |offset| in the |total_size| bytes long |blob|.
+ */
+static bool handoff_check_string(const uint8_t* blob,
+                                 uint64_t total_size,
+                                 uint32_t offset,
+                                 uint32_t size) {
+  return (uint64_t)offset + size < total_size && blob[offset + size] == '\0';
+}
+
+/* Returns true if all |size| bytes at |buf| are zero. */
+static bool handoff_is_zero(const uint8_t* buf, size_t size) {
+  size_t n;
+
+  for (n = 0; n < size; n++) {
+    if (buf[n] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void handoff_read_vbmeta_entry(const AvbHandoff* handoff,
+                                      size_t n,
+                                      AvbHandoffVBMetaEntry* out_entry) {
+  avb_memcpy(out_entry,
+             handoff->blob + handoff->vbmeta_entries_offset +
+                 n * sizeof(AvbHandoffVBMetaEntry),
+             sizeof(AvbHandoffVBMetaEntry));
+  out_entry->partition_name_offset =
+      avb_be32toh(out_entry->partition_name_offset);
+  out_entry->partition_name_size = avb_be32toh(out_entry->partition_name_size);
+  out_entry->vbmeta_offset = avb_be32toh(out_entry->vbmeta_offset);
+  out_entry->vbmeta_size = avb_be32toh(out_entry->vbmeta_size);
+  out_entry->verify_result = avb_be32toh(out_entry->verify_result);
+}
+
+static void handoff_read_partition_entry(const AvbHandoff* handoff,
+                                         size_t n,
+                                         AvbHandoffPartitionEntry* out_entry) {
+  avb_memcpy(out_entry,
+             handoff->blob + handoff->partition_entries_offset +
+                 n * sizeof(AvbHandoffPartitionEntry),
+             sizeof(AvbHandoffPartitionEntry));
+  out_entry->partition_name_offset =
+      avb_be32toh(out_entry->partition_name_offset);
+  out_entry->partition_name_size = avb_be32toh(out_entry->partition_name_size);
+  out_entry->data_size = avb_be64toh(out_entry->data_size);
+  out_entry->verify_result = avb_be32toh(out_entry->verify_result);
+  out_entry->digest_len = avb_be32toh(out_entry->digest_len);
+}
+
+bool avb_handoff_parse(const uint8_t* blob,
+                       size_t blob_size,
+                       AvbHandoff* out_handoff) {
+  AvbHandoffHeader h;
+  uint64_t entries_end;
+  size_t n;
+
+  if (blob_size < sizeof(AvbHandoffHeader)) {
+    avb_error("Handoff blob too small.\n");
+    return false;
+  }
+  /* The vbmeta images are used in place, so they must be aligned. */
+  if (((uintptr_t)blob & (AVB_HANDOFF_ALIGNMENT - 1)) != 0) {
+    avb_error("Handoff blob is not aligned.\n");
+    return false;
+  }
+  avb_memcpy(&h, blob, sizeof(AvbHandoffHeader));
+
+  if (avb_safe_memcmp(h.magic, AVB_HANDOFF_MAGIC, AVB_HANDOFF_MAGIC_LEN) !=
+      0) {
+    avb_error("Handoff blob magic is incorrect.\n");
+    return false;
+  }
+  h.version_major = avb_be32toh(h.version_major);
+  if (h.version_major != AVB_HANDOFF_VERSION_MAJOR) {
+    avb_error("No support for handoff blob version.\n");
+    return false;
+  }
+  h.total_size = avb_be32toh(h.total_size);
+  if (h.total_size < sizeof(AvbHandoffHeader) || h.total_size > blob_size) {
+    avb_error("Handoff blob size is invalid.\n");
+    return false;
+  }
+  if (avb_crc32(blob + HANDOFF_CRC32_START,
+                h.total_size - HANDOFF_CRC32_START) !=
+      avb_be32toh(h.crc32)) {
+    avb_error("Handoff blob checksum mismatch.\n");
+    return false;
+  }
+  if (!handoff_is_zero(h.reserved, sizeof h.reserved)) {
+    avb_error("Handoff blob reserved fields are not zero.\n");
+    return false;
+  }
+
+  h.resolved_hashtree_error_mode = avb_be32toh(h.resolved_hashtree_error_mode);
+  h.ab_suffix_offset = avb_be32toh(h.ab_suffix_offset);
+  h.ab_suffix_size = avb_be32toh(h.ab_suffix_size);
+  h.cmdline_offset = avb_be32toh(h.cmdline_offset);
+  h.cmdline_size = avb_be32toh(h.cmdline_size);
+  h.vbmeta_entries_offset = avb_be32toh(h.vbmeta_entries_offset);
+  h.num_vbmeta_images = avb_be32toh(h.num_vbmeta_images);
+  h.partition_entries_offset = avb_be32toh(h.partition_entries_offset);
+  h.num_partitions = avb_be32toh(h.num_partitions);
+
+  entries_end = (uint64_t)h.vbmeta_entries_offset +
+                (uint64_t)h.num_vbmeta_images * sizeof(AvbHandoffVBMetaEntry);
+  if (h.vbmeta_entries_offset < sizeof(AvbHandoffHeader) ||
+      entries_end > h.total_size) {
+    avb_error("Handoff blob vbmeta entries out of bounds.\n");
+    return false;
+  }
+  entries_end =
+      (uint64_t)h.partition_entries_offset +
+      (uint64_t)h.num_partitions * sizeof(AvbHandoffPartitionEntry);
+  if (h.partition_entries_offset < sizeof(AvbHandoffHeader) ||
+      entries_end > h.total_size) {
+    avb_error("Handoff blob partition entries out of bounds.\n");
+    return false;
+  }
+  if (!handoff_check_string(
+          blob, h.total_size, h.ab_suffix_offset, h.ab_suffix_size) ||
+      !handoff_check_string(
+          blob, h.total_size, h.cmdline_offset, h.cmdline_size)) {
+    avb_error("Handoff blob string out of bounds.\n");
+    return false;
+  }
+
+  avb_memset(out_handoff, 0, sizeof(AvbHandoff));
+  out_handoff->blob = blob;
+  out_handoff->vbmeta_entries_offset = h.vbmeta_entries_offset;
+  out_handoff->partition_entries_offset = h.partition_entries_offset;
+
+  for (n = 0; n < h.num_vbmeta_images; n++) {
+    AvbHandoffVBMetaEntry e;
+    handoff_read_vbmeta_entry(out_handoff, n, &e);
+    if (!handoff_check_string(blob,
+                              h.total_size,
+                              e.partition_name_offset,
+                              e.partition_name_size) ||
+        (uint64_t)e.vbmeta_offset + e.vbmeta_size > h.total_size) {
+      avb_error("Handoff blob vbmeta entry out of bounds.\n");
+      return false;
+    }
+    if ((e.vbmeta_offset & (AVB_HANDOFF_ALIGNMENT - 1)) != 0 ||
+        !handoff_is_zero(e.reserved, sizeof e.reserved)) {
+      avb_error("Handoff blob vbmeta entry is invalid.\n");
+      return false;
+    }
+  }
+  for (n = 0; n < h.num_partitions; n++) {
+    AvbHandoffPartitionEntry e;
+    handoff_read_partition_entry(out_handoff, n, &e);
+    if (!handoff_check_string(blob,
+                              h.total_size,
+                              e.partition_name_offset,
+                              e.partition_name_size) ||
+        e.digest_len > sizeof e.digest ||
+        !handoff_is_zero(e.reserved, sizeof e.reserved)) {
+      avb_error("Handoff blob partition entry is invalid.\n");
+      return false;
+    }
+  }
+
+  out_handoff->ab_suffix = (const char*)blob + h.ab_suffix_offset;
+  out_handoff->cmdline = (const char*)blob + h.cmdline_offset;
+  out_handoff->num_vbmeta_images = h.num_vbmeta_images;
+  out_handoff->num_partitions = h.num_partitions;
+  out_handoff->vbmeta_digest_sha256 =
+      blob + offsetof(AvbHandoffHeader, vbmeta_digest_sha256);
+  for (n = 0; n < AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS; n++) {
+    out_handoff->rollback_indexes[n] = avb_be64toh(h.rollback_indexes[n]);
+  }
+  out_handoff->resolved_hashtree_error_mode =
+      (AvbHashtreeErrorMode)h.resolved_hashtree_error_mode;
+  return true;
+}
+
+void avb_handoff_get_vbmeta_image(const AvbHandoff* handoff,
+                                  size_t n,
+                                  AvbHandoffVBMetaImage* out_image) {
+  AvbHandoffVBMetaEntry e;
+
+  avb_assert(n < handoff->num_vbmeta_images);
+  handoff_read_vbmeta_entry(handoff, n, &e);
+  out_image->partition_name =
+      (const char*)handoff->blob + e.partition_name_offset;
+  out_image->vbmeta_data = handoff->blob + e.vbmeta_offset;
+  out_image->vbmeta_size = e.vbmeta_size;
+  out_image->verify_result = (AvbVBMetaVerifyResult)e.verify_result;
+}
+
+void avb_handoff_get_partition(const AvbHandoff* handoff,
+                               size_t n,
+                               AvbHandoffPartition* out_partition) {
+  AvbHandoffPartitionEntry e;
+  size_t entry_offset;
+
+  avb_assert(n < handoff->num_partitions);
+  handoff_read_partition_entry(handoff, n, &e);
+  entry_offset = handoff->partition_entries_offset +
+                 n * sizeof(AvbHandoffPartitionEntry);
+  out_partition->partition_name =
+      (const char*)handoff->blob + e.partition_name_offset;
+  out_partition->data_size = e.data_size;
+  out_partition->verify_result = (AvbSlotVerifyResult)e.verify_result;
+  out_partition->digest = handoff->blob + entry_offset +
+                          offsetof(AvbHandoffPartitionEntry, digest);
+  out_partition->digest_len = e.digest_len;
+}
+
+bool avb_handoff_find_partition(const AvbHandoff* handoff,
+                                const char* partition_name,
+                                AvbHandoffPartition* out_partition) {
+  size_t n;
+
+  for (n = 0; n < handoff->num_partitions; n++) {
+    avb_handoff_get_partition(handoff, n, out_partition);
+    if (avb_strcmp(out_partition->partition_name, partition_name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
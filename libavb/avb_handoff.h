@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#if !defined(AVB_INSIDE_LIBAVB_H) && !defined(AVB_COMPILATION)
+#error "Never include this file directly, include libavb.h instead."
+#endif
+
+#ifndef AVB_HANDOFF_H_
+#define AVB_HANDOFF_H_
+
+#include "avb_slot_verify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Magic for the handoff blob. */
+#define AVB_HANDOFF_MAGIC "AVBh"
+#define AVB_HANDOFF_MAGIC_LEN 4
+
+/* The current handoff blob version. */
+#define AVB_HANDOFF_VERSION_MAJOR 1
+#define AVB_HANDOFF_VERSION_MINOR 0
+
+/* Alignment of the vbmeta images within the blob. */
+#define AVB_HANDOFF_ALIGNMENT 8
+
+/* A handoff blob carries the result of a successful avb_slot_verify()
+ * from the bootloader to later boot stages so they don't have to load
+ * and verify the vbmeta images again. It contains everything in
+ * AvbSlotVerifyData except the loaded partition data itself: the
+ * vbmeta images, the digests of the loaded partitions, the rollback
+ * indexes and the resolved hashtree error mode.
+ *
+ * The blob starts with an AvbHandoffHeader, followed by
+ * |num_vbmeta_images| AvbHandoffVBMetaEntry structs and
+ * |num_partitions| AvbHandoffPartitionEntry structs. All strings and
+ * vbmeta images follow after that. All offsets are relative to the
+ * start of the blob so it can be placed at any address aligned to
+ * AVB_HANDOFF_ALIGNMENT, e.g. in reserved memory, and all integers are
+ * in network byte order. Strings are
+ * NUL-terminated and sizes don't include the terminator.
+ *
+ * The blob is protected by a CRC-32 against accidental corruption
+ * only. Consumers must get it through a channel they trust as much as
+ * the bootloader, since nothing in it is verified again.
+ */
+typedef struct AvbHandoffHeader {
+  /*   0: Four bytes equal to "AVBh" (AVB_HANDOFF_MAGIC). */
+  uint8_t magic[AVB_HANDOFF_MAGIC_LEN];
+  /*   4: The major version of the blob format. */
+  uint32_t version_major;
+  /*   8: The minor version of the blob format. */
+  uint32_t version_minor;
+  /*  12: The size of the blob, including this header. */
+  uint32_t total_size;
+  /*  16: CRC-32 of the blob from offset 20 to |total_size|. */
+  uint32_t crc32;
+
+  /*  20: The |resolved_hashtree_error_mode| from AvbSlotVerifyData. */
+  uint32_t resolved_hashtree_error_mode;
+
+  /*  24: Offset and size of the A/B suffix string. */
+  uint32_t ab_suffix_offset;
+  uint32_t ab_suffix_size;
+
+  /*  32: Offset and size of the kernel command-line string. */
+  uint32_t cmdline_offset;
+  uint32_t cmdline_size;
+
+  /*  40: Offset and number of AvbHandoffVBMetaEntry structs. */
+  uint32_t vbmeta_entries_offset;
+  uint32_t num_vbmeta_images;
+
+  /*  48: Offset and number of AvbHandoffPartitionEntry structs. */
+  uint32_t partition_entries_offset;
+  uint32_t num_partitions;
+
+  /*  56: SHA-256 digest of all vbmeta images, see
+   * avb_slot_verify_data_calculate_vbmeta_digest().
+   */
+  uint8_t vbmeta_digest_sha256[AVB_SHA256_DIGEST_SIZE];
+
+  /*  88: The |rollback_indexes| from AvbSlotVerifyData. */
+  uint64_t rollback_indexes[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
+
+  /* 344: Padding to ensure struct is size 384 bytes. This must be set
+   * to zeroes.
+   */
+  uint8_t reserved[40];
+} AVB_ATTR_PACKED AvbHandoffHeader;
+
+/* Describes a vbmeta image in a handoff blob. */
+typedef struct AvbHandoffVBMetaEntry {
+  /*   0: Offset and size of the partition name string. */
+  uint32_t partition_name_offset;
+  uint32_t partition_name_size;
+  /*   8: Offset and size of the vbmeta image. */
+  uint32_t vbmeta_offset;
+  uint32_t vbmeta_size;
+  /*  16: The AvbVBMetaVerifyResult for the image. */
+  uint32_t verify_result;
+  /*  20: Padding. This must be set to zeroes. */
+  uint8_t reserved[12];
+} AVB_ATTR_PACKED AvbHandoffVBMetaEntry;
+
+/* Describes a loaded partition in a handoff blob. */
+typedef struct AvbHandoffPartitionEntry {
+  /*   0: Offset and size of the partition name string. */
+  uint32_t partition_name_offset;
+  uint32_t partition_name_size;
+  /*   8: The size of the image that was loaded. */
+  uint64_t data_size;
+  /*  16: The AvbSlotVerifyResult for the partition. */
+  uint32_t verify_result;
+  /*  20: Number of bytes used in |digest|, zero if there's none. */
+  uint32_t digest_len;
+  /*  24: Digest of the image, see AvbPartitionData. */
+  uint8_t digest[AVB_SHA512_DIGEST_SIZE];
+  /*  88: Padding. This must be set to zeroes. */
+  uint8_t reserved[8];
+} AVB_ATTR_PACKED AvbHandoffPartitionEntry;
+
+/* Returns the size of the handoff blob for |data|, or zero if |data|
+ * is too big to fit in one.
+ */
+size_t avb_handoff_get_size(const AvbSlotVerifyData* data);
+
+/* Writes the handoff blob for |data| to |buf|, which must be at least
+ * avb_handoff_get_size() bytes. The number of bytes written is
+ * returned in |out_size|. Returns false if |buf_size| is too small.
+ */
+bool avb_handoff_write(const AvbSlotVerifyData* data,
+                       uint8_t* buf,
+                       size_t buf_size,
+                       size_t* out_size) AVB_ATTR_WARN_UNUSED_RESULT;
+
+/* A parsed handoff blob. All pointers point into the blob, which must
+ * outlive this struct.
+ */
+typedef struct AvbHandoff {
+  const char* ab_suffix;
+  const char* cmdline;
+  size_t num_vbmeta_images;
+  size_t num_partitions;
+  const uint8_t* vbmeta_digest_sha256;
+  uint64_t rollback_indexes[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
+  AvbHashtreeErrorMode resolved_hashtree_error_mode;
+
+  /* For libavb internal use only. */
+  const uint8_t* blob;
+  size_t vbmeta_entries_offset;
+  size_t partition_entries_offset;
+} AvbHandoff;
+
+/* A vbmeta image in a handoff blob, see AvbVBMetaData. */
+typedef struct AvbHandoffVBMetaImage {
+  const char* partition_name;
+  const uint8_t* vbmeta_data;
+  size_t vbmeta_size;
+  AvbVBMetaVerifyResult verify_result;
+} AvbHandoffVBMetaImage;
+
+/* A loaded partition in a handoff blob, see AvbPartitionData. */
+typedef struct AvbHandoffPartition {
+  const char* partition_name;
+  uint64_t data_size;
+  AvbSlotVerifyResult verify_result;
+  const uint8_t* digest;
+  size_t digest_len;
+} AvbHandoffPartition;
+
+/* Checks the |blob_size| bytes long handoff blob in |blob| and sets
+ * up |out_handoff| to access it. Nothing is copied, so |blob| must
+ * remain valid while |out_handoff| is in use, and it must be aligned
+ * to AVB_HANDOFF_ALIGNMENT so the vbmeta images can be used in place.
+ * Returns false if the blob is unaligned, corrupt or of an unsupported
+ * version, including if reserved fields aren't zero.
+ *
+ * Since all offsets are checked here, the accessors below can't fail.
+ */
+bool avb_handoff_parse(const uint8_t* blob,
+                       size_t blob_size,
+                       AvbHandoff* out_handoff) AVB_ATTR_WARN_UNUSED_RESULT;
+
+/* Gets the vbmeta image at index |n| in |handoff|, which must be less
+ * than |num_vbmeta_images|.
+ */
+void avb_handoff_get_vbmeta_image(const AvbHandoff* handoff,
+                                  size_t n,
+                                  AvbHandoffVBMetaImage* out_image);
+
+/* Gets the partition at index |n| in |handoff|, which must be less
+ * than |num_partitions|.
+ */
+void avb_handoff_get_partition(const AvbHandoff* handoff,
+                               size_t n,
+                               AvbHandoffPartition* out_partition);
+
+/* Looks up the partition named |partition_name| (without A/B suffix)
+ * in |handoff|. Returns false if there is no such partition.
+ */
+bool avb_handoff_find_partition(const AvbHandoff* handoff,
+                                const char* partition_name,
+                                AvbHandoffPartition* out_partition)
+    AVB_ATTR_WARN_UNUSED_RESULT;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVB_HANDOFF_H_ */
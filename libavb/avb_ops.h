@@ -29,6 +29,7 @@
 #ifndef AVB_OPS_H_
 #define AVB_OPS_H_
 
+#include "avb_crypto.h"
 #include "avb_sysdeps.h"
 
 #ifdef __cplusplus
@@ -38,6 +39,7 @@ extern "C" {
 /* Well-known names of named persistent values. */
 #define AVB_NPV_PERSISTENT_DIGEST_PREFIX "avb.persistent_digest."
 #define AVB_NPV_MANAGED_VERITY_MODE "avb.managed_verity_mode"
+#define AVB_NPV_GENERATION_CACHE_PREFIX "avb.generation_cache."
 
 /* Return codes used for I/O operations.
  *
@@ -76,6 +78,24 @@ typedef enum {
   AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE,
 } AvbIOResult;
 
+/* Maximum number of extra measurement digests per partition, see the
+ * get_partition_measurements() operation.
+ */
+#define AVB_MAX_NUMBER_OF_MEASUREMENTS 4
+
+/* An extra digest of a partition calculated in the same pass as the
+ * digest used for verification, e.g. for measured boot. The digest
+ * is calculated using |digest_type| over the same image data as the
+ * hash descriptor covers, preceded by the salt from the descriptor if
+ * |salted| is true. The result is |digest_len| bytes in |digest|.
+ */
+typedef struct {
+  AvbDigestType digest_type;
+  bool salted;
+  uint8_t digest[AVB_SHA512_DIGEST_SIZE];
+  size_t digest_len;
+} AvbPartitionMeasurement;
+
 struct AvbOps;
 typedef struct AvbOps AvbOps;
 
@@ -331,6 +351,146 @@ struct AvbOps {
       size_t public_key_metadata_length,
       bool* out_is_trusted,
       uint32_t* out_rollback_index_location);
+
+  /* Calculates the digest of a loaded hash partition, e.g. using a hardware
+   * hash engine. The digest is computed using |hash_algorithm| (currently
+   * either "sha256" or "sha512") over the |salt_size| bytes in |salt|
+   * followed by the |data_size| bytes in |data|, and is written to
+   * |out_digest| which must point to |digest_buf_size| bytes. On success the
+   * digest size is returned in |out_digest_size|.
+   *
+   * If the operation is not available for the given partition or
+   * algorithm, return AVB_IO_RESULT_OK with |out_digest_size| set to zero
+   * and libavb will calculate the digest in software. Any other error is
+   * treated as an I/O error.
+   *
+   * This operation is optional and may be set to NULL, in which case
+   * libavb always calculates the digest itself.
+   */
+  AvbIOResult (*calculate_digest)(AvbOps* ops,
+                                  const char* partition,
+                                  const char* hash_algorithm,
+                                  const uint8_t* salt,
+                                  size_t salt_size,
+                                  const uint8_t* data,
+                                  size_t data_size,
+                                  uint8_t* out_digest,
+                                  size_t digest_buf_size,
+                                  size_t* out_digest_size);
+
+  /* Gets a trusted generation stamp for |partition| and returns it in
+   * |out_generation|. The stamp must change every time the partition
+   * contents may have changed, e.g. a secure monotonic write counter or
+   * an RPMB-backed generation number, and must not be controllable by
+   * anything that can write to the partition without also changing the
+   * stamp.
+   *
+   * If this is implemented, libavb keeps a record of the generation
+   * stamp and hash descriptor a partition was last successfully
+   * verified against in the named persistent value
+   * AVB_NPV_GENERATION_CACHE_PREFIX + |partition|. If both still match
+   * on a later call to avb_slot_verify() the partition is loaded but not
+   * hashed again. Only partitions with a digest in their hash descriptor
+   * are cached, and the cache is never used if
+   * AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR is set or for
+   * partitions returned by get_preloaded_partition(). This requires
+   * read_persistent_value() and write_persistent_value() to be
+   * implemented.
+   *
+   * VERY IMPORTANT: cache entries are NOT sealed or authenticated.
+   * They only carry an unkeyed checksum, which anyone can compute, so
+   * whoever can write the persistent value can forge an entry and make
+   * libavb skip hashing the partition. Only implement this operation if
+   * the persistent value storage is tamper-proof, e.g. RPMB or storage
+   * only the boot loader can write, and not just tamper-evident.
+   *
+   * Returns AVB_IO_RESULT_OK on success. If there is no trusted stamp
+   * for |partition|, returns AVB_IO_RESULT_ERROR_NO_SUCH_VALUE and the
+   * partition is always hashed. Any other error also makes libavb fall
+   * back to hashing the partition.
+   *
+   * This operation is optional and may be set to NULL.
+   */
+  AvbIOResult (*read_partition_generation)(AvbOps* ops,
+                                           const char* partition,
+                                           uint64_t* out_generation);
+
+  /* allocate_io_buffer() and free_io_buffer() are a pair: either both
+   * are set or libavb uses neither and allocates buffers for partition
+   * data with avb_malloc().
+   *
+   * allocate_io_buffer() allocates a |size| byte buffer which libavb
+   * will read data from |partition| into using read_from_partition().
+   * This can be used to return memory meeting the DMA alignment and
+   * cache-line requirements of the storage driver, so it can transfer
+   * directly into the buffer instead of bouncing through one of its
+   * own. Returns NULL if no such buffer can be allocated, in which case
+   * verification fails with AVB_SLOT_VERIFY_RESULT_ERROR_OOM.
+   *
+   * free_io_buffer() frees |buffer| returned by allocate_io_buffer().
+   * This may happen as part of avb_slot_verify_data_free(), so if
+   * buffers from allocate_io_buffer() end up in AvbSlotVerifyData the
+   * AvbOps must outlive it.
+   *
+   * These operations are optional and may be set to NULL.
+   */
+  void* (*allocate_io_buffer)(AvbOps* ops, const char* partition, size_t size);
+  void (*free_io_buffer)(AvbOps* ops, void* buffer);
+
+  /* Like read_rollback_index() but gets the rollback indexes for all
+   * |num_locations| locations in |rollback_index_locations| at once,
+   * e.g. in a single round trip to secure storage. The values are
+   * returned in |out_rollback_indexes| which has room for
+   * |num_locations| entries. Returns AVB_IO_RESULT_OK if all rollback
+   * indexes were retrieved, otherwise an error code.
+   *
+   * This operation is optional and may be set to NULL, in which case
+   * read_rollback_index() is called for each location.
+   */
+  AvbIOResult (*read_rollback_indexes)(AvbOps* ops,
+                                       const size_t* rollback_index_locations,
+                                       size_t num_locations,
+                                       uint64_t* out_rollback_indexes);
+
+  /* Like write_rollback_index() but sets the rollback index for all
+   * |num_locations| locations in |rollback_index_locations| to the
+   * corresponding value in |rollback_indexes|. The update should be done
+   * in a single transaction, i.e. either all rollback indexes are set or
+   * none are. Returns AVB_IO_RESULT_OK if all rollback indexes were set,
+   * otherwise an error code.
+   *
+   * This operation is optional and may be set to NULL, in which case
+   * write_rollback_index() is called for each location.
+   */
+  AvbIOResult (*write_rollback_indexes)(AvbOps* ops,
+                                        const size_t* rollback_index_locations,
+                                        const uint64_t* rollback_indexes,
+                                        size_t num_locations);
+
+  /* Gets the extra measurement digests to calculate for |partition|
+   * while it is hashed for verification against a hash descriptor. Up
+   * to AVB_MAX_NUMBER_OF_MEASUREMENTS entries in |out_measurements|
+   * can be set up by filling in their |digest_type| and |salted|
+   * fields, and the number of entries used is returned in
+   * |out_num_measurements|. The digests are returned in the
+   * |measurements| field of AvbPartitionData.
+   *
+   * This avoids reading the partition data a second time to extend
+   * measurements using a different algorithm or no salt. Measurements
+   * are calculated even if the digest used for verification is
+   * calculated by calculate_digest() or the partition is unchanged
+   * according to read_partition_generation().
+   *
+   * Returns AVB_IO_RESULT_OK on success, otherwise an error code.
+   *
+   * This operation is optional and may be set to NULL, in which case
+   * no extra digests are calculated.
+   */
+  AvbIOResult (*get_partition_measurements)(
+      AvbOps* ops,
+      const char* partition,
+      AvbPartitionMeasurement* out_measurements,
+      size_t* out_num_measurements);
 };
 
 #ifdef __cplusplus
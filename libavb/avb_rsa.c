@@ -37,6 +37,15 @@
 #include "avb_util.h"
 #include "avb_vbmeta_image.h"
 
+#if defined(AVB_USE_ARM_UMAAL)
+#if !defined(__arm__) || __ARM_ARCH < 6
+#error "AVB_USE_ARM_UMAAL needs 32-bit ARM, ARMv6 or later."
+#endif
+#if __ARM_ARCH_PROFILE == 'M' && !defined(__ARM_FEATURE_DSP)
+#error "AVB_USE_ARM_UMAAL needs ARMv7E-M on M-profile cores."
+#endif
+#endif
+
 typedef struct IAvbKey {
   unsigned int len; /* Length of n[] in number of uint32_t */
   uint32_t n0inv;   /* -1 / n[0] mod 2^32 */
@@ -133,19 +142,20 @@ static int geM(const IAvbKey* key, uint32_t* a) {
   return 1; /* equal */
 }
 
-/* montgomery c[] += a * b[] / R % mod */
-static void montMulAdd(const IAvbKey* key,
-                       uint32_t* c,
-                       const uint32_t a,
-                       const uint32_t* b) {
+uint32_t avb_rsa_mont_mul_add(uint32_t* c,
+                              const uint32_t a,
+                              const uint32_t* b,
+                              const uint32_t* n,
+                              const uint32_t n0inv,
+                              size_t len) {
   uint64_t A = (uint64_t)a * b[0] + c[0];
-  uint32_t d0 = (uint32_t)A * key->n0inv;
-  uint64_t B = (uint64_t)d0 * key->n[0] + (uint32_t)A;
-  uint32_t i;
+  uint32_t d0 = (uint32_t)A * n0inv;
+  uint64_t B = (uint64_t)d0 * n[0] + (uint32_t)A;
+  size_t i;
 
-  for (i = 1; i < key->len; ++i) {
+  for (i = 1; i < len; ++i) {
     A = (A >> 32) + (uint64_t)a * b[i] + c[i];
-    B = (B >> 32) + (uint64_t)d0 * key->n[i] + (uint32_t)A;
+    B = (B >> 32) + (uint64_t)d0 * n[i] + (uint32_t)A;
     c[i - 1] = (uint32_t)B;
   }
 
@@ -153,7 +163,22 @@ static void montMulAdd(const IAvbKey* key,
 
   c[i - 1] = (uint32_t)A;
 
-  if (A >> 32) {
+  return (uint32_t)(A >> 32);
+}
+
+/* montgomery c[] += a * b[] / R % mod */
+static void montMulAdd(const IAvbKey* key,
+                       uint32_t* c,
+                       const uint32_t a,
+                       const uint32_t* b) {
+  uint32_t carry;
+
+#if defined(AVB_USE_ARM_UMAAL)
+  carry = avb_rsa_mont_mul_add_umaal(c, a, b, key->n, key->n0inv, key->len);
+#else
+  carry = avb_rsa_mont_mul_add(c, a, b, key->n, key->n0inv, key->len);
+#endif
+  if (carry) {
     subM(key, c);
   }
 }
@@ -225,75 +250,302 @@ out:
   }
 }
 
-/* Verify a RSA PKCS1.5 signature against an expected hash.
- * Returns false on failure, true on success.
+/* Like montMulAdd() but for two independent operations whose keys have
+ * the same length. Interleaving them gives the CPU two independent
+ * multiply-accumulate chains, which hides multiplier latency on in-order
+ * cores.
  */
-bool avb_rsa_verify(const uint8_t* key,
-                    size_t key_num_bytes,
-                    const uint8_t* sig,
-                    size_t sig_num_bytes,
-                    const uint8_t* hash,
-                    size_t hash_num_bytes,
-                    const uint8_t* padding,
-                    size_t padding_num_bytes) {
-  uint8_t* buf = NULL;
+static void montMulAdd2(const IAvbKey* key0,
+                        const IAvbKey* key1,
+                        uint32_t* c0,
+                        uint32_t* c1,
+                        const uint32_t a0,
+                        const uint32_t a1,
+                        const uint32_t* b0,
+                        const uint32_t* b1) {
+#if defined(AVB_USE_ARM_UMAAL)
+  /* The assembly kernel is already scheduled for the multiplier, so
+   * just do the two operations one after the other.
+   */
+  montMulAdd(key0, c0, a0, b0);
+  montMulAdd(key1, c1, a1, b1);
+#else
+  uint64_t A0 = (uint64_t)a0 * b0[0] + c0[0];
+  uint64_t A1 = (uint64_t)a1 * b1[0] + c1[0];
+  uint32_t d0 = (uint32_t)A0 * key0->n0inv;
+  uint32_t d1 = (uint32_t)A1 * key1->n0inv;
+  uint64_t B0 = (uint64_t)d0 * key0->n[0] + (uint32_t)A0;
+  uint64_t B1 = (uint64_t)d1 * key1->n[0] + (uint32_t)A1;
+  uint32_t i;
+
+  for (i = 1; i < key0->len; ++i) {
+    A0 = (A0 >> 32) + (uint64_t)a0 * b0[i] + c0[i];
+    A1 = (A1 >> 32) + (uint64_t)a1 * b1[i] + c1[i];
+    B0 = (B0 >> 32) + (uint64_t)d0 * key0->n[i] + (uint32_t)A0;
+    B1 = (B1 >> 32) + (uint64_t)d1 * key1->n[i] + (uint32_t)A1;
+    c0[i - 1] = (uint32_t)B0;
+    c1[i - 1] = (uint32_t)B1;
+  }
+
+  A0 = (A0 >> 32) + (B0 >> 32);
+  A1 = (A1 >> 32) + (B1 >> 32);
+
+  c0[i - 1] = (uint32_t)A0;
+  c1[i - 1] = (uint32_t)A1;
+
+  if (A0 >> 32) {
+    subM(key0, c0);
+  }
+  if (A1 >> 32) {
+    subM(key1, c1);
+  }
+#endif
+}
+
+/* montgomery c0[] = a0[] * b0[] / R % mod0, c1[] = a1[] * b1[] / R % mod1 */
+static void montMul2(const IAvbKey* key0,
+                     const IAvbKey* key1,
+                     uint32_t* c0,
+                     uint32_t* c1,
+                     uint32_t* a0,
+                     uint32_t* a1,
+                     uint32_t* b0,
+                     uint32_t* b1) {
+  uint32_t i;
+  for (i = 0; i < key0->len; ++i) {
+    c0[i] = 0;
+    c1[i] = 0;
+  }
+  for (i = 0; i < key0->len; ++i) {
+    montMulAdd2(key0, key1, c0, c1, a0[i], a1[i], b0, b1);
+  }
+}
+
+/* Converts a big endian byte array to a little endian word array. */
+static void bytes_to_words(const IAvbKey* key,
+                           const uint8_t* in,
+                           uint32_t* out) {
+  int i;
+  for (i = 0; i < (int)key->len; ++i) {
+    out[i] = ((uint32_t)in[((key->len - 1 - i) * 4) + 0] << 24) |
+             ((uint32_t)in[((key->len - 1 - i) * 4) + 1] << 16) |
+             ((uint32_t)in[((key->len - 1 - i) * 4) + 2] << 8) |
+             ((uint32_t)in[((key->len - 1 - i) * 4) + 3] << 0);
+  }
+}
+
+/* Reduces |a| below the modulus and converts it to a big endian byte
+ * array.
+ */
+static void words_to_bytes(const IAvbKey* key, uint32_t* a, uint8_t* out) {
+  int i;
+
+  /* Make sure a < mod; a is at most 1x mod too large. */
+  if (geM(key, a)) {
+    subM(key, a);
+  }
+
+  for (i = (int)key->len - 1; i >= 0; --i) {
+    uint32_t tmp = a[i];
+    *out++ = (uint8_t)(tmp >> 24);
+    *out++ = (uint8_t)(tmp >> 16);
+    *out++ = (uint8_t)(tmp >> 8);
+    *out++ = (uint8_t)(tmp >> 0);
+  }
+}
+
+/* Like modpowF4() but for two signatures at once. Both keys must have
+ * the same length.
+ */
+static void modpowF4x2(const IAvbKey* key0,
+                       const IAvbKey* key1,
+                       uint8_t* inout0,
+                       uint8_t* inout1) {
+  uint32_t len = key0->len;
+  uint32_t* words;
+  uint32_t *a0, *a1, *aR0, *aR1, *aaR0, *aaR1;
+  int i;
+
+  avb_assert(key1->len == len);
+  words = (uint32_t*)avb_malloc(6 * len * sizeof(uint32_t));
+  if (words == NULL) {
+    return;
+  }
+  a0 = words;
+  a1 = a0 + len;
+  aR0 = a1 + len;
+  aR1 = aR0 + len;
+  aaR0 = aR1 + len;
+  aaR1 = aaR0 + len;
+
+  bytes_to_words(key0, inout0, a0);
+  bytes_to_words(key1, inout1, a1);
+
+  /* See modpowF4() for what each step computes. */
+  montMul2(key0, key1, aR0, aR1, a0, a1, key0->rr, key1->rr);
+  for (i = 0; i < 16; i += 2) {
+    montMul2(key0, key1, aaR0, aaR1, aR0, aR1, aR0, aR1);
+    montMul2(key0, key1, aR0, aR1, aaR0, aaR1, aaR0, aaR1);
+  }
+  montMul2(key0, key1, aaR0, aaR1, aR0, aR1, a0, a1);
+
+  words_to_bytes(key0, aaR0, inout0);
+  words_to_bytes(key1, aaR1, inout1);
+
+  avb_free(words);
+}
+
+/* Checks the inputs for a signature check and parses the key. On success
+ * |out_key| is set to the parsed key and |out_buf| to a copy of the
+ * signature, both of which must be freed by the caller.
+ */
+static bool rsa_verify_prepare(const AvbRSAVerifyInput* input,
+                               IAvbKey** out_key,
+                               uint8_t** out_buf) {
   IAvbKey* parsed_key = NULL;
-  bool success = false;
+  uint8_t* buf = NULL;
 
-  if (key == NULL || sig == NULL || hash == NULL || padding == NULL) {
+  if (input->key == NULL || input->sig == NULL || input->hash == NULL ||
+      input->padding == NULL) {
     avb_error("Invalid input.\n");
-    goto out;
+    goto fail;
   }
 
-  parsed_key = iavb_parse_key_data(key, key_num_bytes);
+  parsed_key = iavb_parse_key_data(input->key, input->key_num_bytes);
   if (parsed_key == NULL) {
     avb_error("Error parsing key.\n");
-    goto out;
+    goto fail;
   }
 
-  if (sig_num_bytes != (parsed_key->len * sizeof(uint32_t))) {
+  if (input->sig_num_bytes != (parsed_key->len * sizeof(uint32_t))) {
     avb_error("Signature length does not match key length.\n");
-    goto out;
+    goto fail;
   }
 
-  if (padding_num_bytes != sig_num_bytes - hash_num_bytes) {
+  if (input->padding_num_bytes !=
+      input->sig_num_bytes - input->hash_num_bytes) {
     avb_error("Padding length does not match hash and signature lengths.\n");
-    goto out;
+    goto fail;
   }
 
-  buf = (uint8_t*)avb_malloc(sig_num_bytes);
+  buf = (uint8_t*)avb_malloc(input->sig_num_bytes);
   if (buf == NULL) {
     avb_error("Error allocating memory.\n");
-    goto out;
+    goto fail;
   }
-  avb_memcpy(buf, sig, sig_num_bytes);
+  avb_memcpy(buf, input->sig, input->sig_num_bytes);
 
-  modpowF4(parsed_key, buf);
+  *out_key = parsed_key;
+  *out_buf = buf;
+  return true;
+
+fail:
+  if (parsed_key != NULL) {
+    iavb_free_parsed_key(parsed_key);
+  }
+  return false;
+}
 
+/* Checks the result |buf| of exponentiating the signature in |input|. */
+static bool rsa_verify_check_result(const AvbRSAVerifyInput* input,
+                                    const uint8_t* buf) {
   /* Check padding bytes.
    *
    * Even though there are probably no timing issues here, we use
    * avb_safe_memcmp() just to be on the safe side.
    */
-  if (avb_safe_memcmp(buf, padding, padding_num_bytes)) {
+  if (avb_safe_memcmp(buf, input->padding, input->padding_num_bytes)) {
     avb_error("Padding check failed.\n");
-    goto out;
+    return false;
   }
 
   /* Check hash. */
-  if (avb_safe_memcmp(buf + padding_num_bytes, hash, hash_num_bytes)) {
+  if (avb_safe_memcmp(
+          buf + input->padding_num_bytes, input->hash, input->hash_num_bytes)) {
     avb_error("Hash check failed.\n");
-    goto out;
+    return false;
   }
 
-  success = true;
+  return true;
+}
 
-out:
-  if (parsed_key != NULL) {
-    iavb_free_parsed_key(parsed_key);
-  }
-  if (buf != NULL) {
-    avb_free(buf);
+/* Verify a RSA PKCS1.5 signature against an expected hash.
+ * Returns false on failure, true on success.
+ */
+bool avb_rsa_verify(const uint8_t* key,
+                    size_t key_num_bytes,
+                    const uint8_t* sig,
+                    size_t sig_num_bytes,
+                    const uint8_t* hash,
+                    size_t hash_num_bytes,
+                    const uint8_t* padding,
+                    size_t padding_num_bytes) {
+  AvbRSAVerifyInput input;
+  IAvbKey* parsed_key;
+  uint8_t* buf;
+  bool success;
+
+  input.key = key;
+  input.key_num_bytes = key_num_bytes;
+  input.sig = sig;
+  input.sig_num_bytes = sig_num_bytes;
+  input.hash = hash;
+  input.hash_num_bytes = hash_num_bytes;
+  input.padding = padding;
+  input.padding_num_bytes = padding_num_bytes;
+
+  if (!rsa_verify_prepare(&input, &parsed_key, &buf)) {
+    return false;
   }
+
+  modpowF4(parsed_key, buf);
+  success = rsa_verify_check_result(&input, buf);
+
+  iavb_free_parsed_key(parsed_key);
+  avb_free(buf);
   return success;
 }
+
+bool avb_rsa_verify_batch(const AvbRSAVerifyInput* inputs,
+                          size_t num_inputs,
+                          bool* out_valid) {
+  IAvbKey* keys[2];
+  uint8_t* bufs[2];
+  bool all_valid = true;
+  size_t n, num, l;
+
+  /* Take the signatures two at a time. If both are well-formed and their
+   * keys have the same size, exponentiate them together.
+   */
+  for (n = 0; n < num_inputs; n += num) {
+    num = num_inputs - n < 2 ? num_inputs - n : 2;
+
+    for (l = 0; l < num; l++) {
+      out_valid[n + l] = rsa_verify_prepare(&inputs[n + l], &keys[l], &bufs[l]);
+    }
+
+    if (num == 2 && out_valid[n] && out_valid[n + 1] &&
+        keys[0]->len == keys[1]->len) {
+      modpowF4x2(keys[0], keys[1], bufs[0], bufs[1]);
+    } else {
+      for (l = 0; l < num; l++) {
+        if (out_valid[n + l]) {
+          modpowF4(keys[l], bufs[l]);
+        }
+      }
+    }
+
+    for (l = 0; l < num; l++) {
+      if (out_valid[n + l]) {
+        out_valid[n + l] = rsa_verify_check_result(&inputs[n + l], bufs[l]);
+        iavb_free_parsed_key(keys[l]);
+        avb_free(bufs[l]);
+      }
+      if (!out_valid[n + l]) {
+        all_valid = false;
+      }
+    }
+  }
+
+  return all_valid;
+}
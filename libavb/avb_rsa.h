@@ -66,6 +66,64 @@ bool avb_rsa_verify(const uint8_t* key,
                     const uint8_t* padding,
                     size_t padding_num_bytes) AVB_ATTR_WARN_UNUSED_RESULT;
 
+/* A single signature check for avb_rsa_verify_batch(). The fields
+ * have the same meaning as the parameters of avb_rsa_verify().
+ */
+typedef struct {
+  const uint8_t* key;
+  size_t key_num_bytes;
+  const uint8_t* sig;
+  size_t sig_num_bytes;
+  const uint8_t* hash;
+  size_t hash_num_bytes;
+  const uint8_t* padding;
+  size_t padding_num_bytes;
+} AvbRSAVerifyInput;
+
+/* Like avb_rsa_verify() but checks the |num_inputs| signatures in
+ * |inputs| together. The modular exponentiations of signatures whose
+ * keys have the same size are interleaved, which is faster than
+ * checking them one at a time.
+ *
+ * The result of each check is stored in the corresponding element
+ * of |out_valid|, which must have room for |num_inputs| elements.
+ *
+ * Returns true if all signatures are valid, false otherwise.
+ */
+bool avb_rsa_verify_batch(const AvbRSAVerifyInput* inputs,
+                          size_t num_inputs,
+                          bool* out_valid) AVB_ATTR_WARN_UNUSED_RESULT;
+
+/* Montgomery multiply-accumulate, the inner step of RSA verification.
+ * Adds |a| * |b| and the multiple of |n| that makes the sum divisible
+ * by 2^32 to |c| and shifts it down by one word, where |c|, |b| and
+ * |n| are |len| word little-endian numbers and |n0inv| is
+ * -1 / |n|[0] mod 2^32.
+ *
+ * Returns the carry out of the top word, in which case the caller
+ * must subtract |n| from |c|.
+ */
+uint32_t avb_rsa_mont_mul_add(uint32_t* c,
+                              const uint32_t a,
+                              const uint32_t* b,
+                              const uint32_t* n,
+                              const uint32_t n0inv,
+                              size_t len);
+
+#if defined(AVB_USE_ARM_UMAAL)
+/* Same as avb_rsa_mont_mul_add() but in UMAAL-based assembly for
+ * 32-bit ARM, see avb_rsa_arm.S. The |len| must be a non-zero
+ * multiple of 8. Used for verification when libavb is built with
+ * AVB_USE_ARM_UMAAL.
+ */
+uint32_t avb_rsa_mont_mul_add_umaal(uint32_t* c,
+                                    uint32_t a,
+                                    const uint32_t* b,
+                                    const uint32_t* n,
+                                    uint32_t n0inv,
+                                    size_t len);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -65,6 +65,17 @@ typedef struct {
   uint8_t buf[AVB_SHA512_DIGEST_SIZE]; /* Used for storing the final digest. */
 } AvbSHA512Ctx;
 
+/* Input message for avb_sha256_multi() and avb_sha512_multi(). The
+ * message hashed is |salt_len| bytes from |salt| followed by
+ * |data_len| bytes from |data|. Either part may be empty.
+ */
+typedef struct {
+  const uint8_t* salt;
+  size_t salt_len;
+  const uint8_t* data;
+  size_t data_len;
+} AvbSHAMultiInput;
+
 /* Initializes the SHA-256 context. */
 void avb_sha256_init(AvbSHA256Ctx* ctx);
 
@@ -74,6 +85,20 @@ void avb_sha256_update(AvbSHA256Ctx* ctx, const uint8_t* data, size_t len);
 /* Returns the SHA-256 digest. */
 uint8_t* avb_sha256_final(AvbSHA256Ctx* ctx) AVB_ATTR_WARN_UNUSED_RESULT;
 
+/* Calculates the SHA-256 digests of the |num_inputs| independent
+ * messages in |inputs| and stores them back-to-back in
+ * |out_digests|, which must be at least |num_inputs| *
+ * AVB_SHA256_DIGEST_SIZE bytes.
+ *
+ * This is intended for hashing many small messages, for example the
+ * blocks of a hashtree. Implementations may hash several messages in
+ * parallel, which is most effective if runs of consecutive inputs
+ * have the same total length.
+ */
+void avb_sha256_multi(const AvbSHAMultiInput* inputs,
+                      size_t num_inputs,
+                      uint8_t* out_digests);
+
 /* Initializes the SHA-512 context. */
 void avb_sha512_init(AvbSHA512Ctx* ctx);
 
@@ -83,6 +108,13 @@ void avb_sha512_update(AvbSHA512Ctx* ctx, const uint8_t* data, size_t len);
 /* Returns the SHA-512 digest. */
 uint8_t* avb_sha512_final(AvbSHA512Ctx* ctx) AVB_ATTR_WARN_UNUSED_RESULT;
 
+/* Like avb_sha256_multi() but for SHA-512. The |out_digests| buffer
+ * must be at least |num_inputs| * AVB_SHA512_DIGEST_SIZE bytes.
+ */
+void avb_sha512_multi(const AvbSHAMultiInput* inputs,
+                      size_t num_inputs,
+                      uint8_t* out_digests);
+
 #ifdef __cplusplus
 }
 #endif
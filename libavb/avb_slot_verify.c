@@ -32,6 +32,7 @@
 #include "avb_sha.h"
 #include "avb_util.h"
 #include "avb_vbmeta_image.h"
+#include "avb_vbmeta_stream.h"
 #include "avb_version.h"
 
 /* Maximum number of partitions that can be loaded with avb_slot_verify(). */
@@ -40,9 +41,16 @@
 /* Maximum number of vbmeta images that can be loaded with avb_slot_verify(). */
 #define MAX_NUMBER_OF_VBMETA_IMAGES 32
 
-/* Maximum size of a vbmeta image - 64 KiB. */
+/* Maximum size of a vbmeta image - 64 KiB. Only the actual size of
+ * the image is allocated, but that is still done in one block.
+ */
 #define VBMETA_MAX_SIZE (64 * 1024)
 
+/* Partitions are loaded and hashed step-wise in multiples of this
+ * size, so reads stay block-aligned whatever budget is given.
+ */
+#define HASH_PARTITION_STEP_BLOCK_SIZE 4096
+
 /* Test buffer used to check the existence of a partition. */
 #define TEST_BUFFER_SIZE 1
 
@@ -77,7 +85,164 @@ static inline bool result_should_continue(AvbSlotVerifyResult result) {
   return false;
 }
 
+/* Returns |ops| if I/O buffers are allocated with its
+ * allocate_io_buffer() operation, NULL if they are allocated with
+ * avb_malloc(). This is what goes in the |io_buffer_ops| field of
+ * AvbPartitionData and AvbVBMetaData.
+ */
+static AvbOps* io_buffer_ops(AvbOps* ops) {
+  if (ops->allocate_io_buffer == NULL || ops->free_io_buffer == NULL) {
+    return NULL;
+  }
+  return ops;
+}
+
+/* Frees |buf| using the free_io_buffer() operation of |io_buffer_ops|,
+ * or avb_free() if it's NULL.
+ */
+static void release_io_buffer(AvbOps* io_buffer_ops, uint8_t* buf) {
+  if (io_buffer_ops != NULL) {
+    io_buffer_ops->free_io_buffer(io_buffer_ops, buf);
+  } else {
+    avb_free(buf);
+  }
+}
+
+/* Memory used by a single verification, see
+ * avb_slot_verify_set_memory_budget(). Only the big allocations are
+ * accounted for: I/O buffers, hash partition jobs, descriptor arrays
+ * and the AvbSlotVerifyData bookkeeping. Partition names and kernel
+ * command-line strings are small and not counted.
+ */
+typedef struct AvbSlotVerifyMemory {
+  size_t budget; /* 0 means no limit. */
+  size_t in_use;
+  size_t peak;
+} AvbSlotVerifyMemory;
+
+/* Returns true if |size| more bytes fit in the budget of |memory|. */
+static bool memory_fits(const AvbSlotVerifyMemory* memory, size_t size) {
+  return memory->budget == 0 || (memory->in_use <= memory->budget &&
+                                 size <= memory->budget - memory->in_use);
+}
+
+/* Accounts for |size| more bytes being used. Returns false, without
+ * accounting for anything, if that would exceed the budget.
+ */
+static bool memory_reserve(AvbSlotVerifyMemory* memory, size_t size) {
+  if (!memory_fits(memory, size) || size > SIZE_MAX - memory->in_use) {
+    return false;
+  }
+  memory->in_use += size;
+  if (memory->in_use > memory->peak) {
+    memory->peak = memory->in_use;
+  }
+  return true;
+}
+
+/* Accounts for |size| bytes from memory_reserve() being released. */
+static void memory_release(AvbSlotVerifyMemory* memory, size_t size) {
+  avb_assert(size <= memory->in_use);
+  memory->in_use -= size;
+}
+
+/* Returns the size of an array from avb_descriptor_get_all(). */
+static size_t descriptors_size(size_t num_descriptors) {
+  return sizeof(const AvbDescriptor*) * (num_descriptors + 1);
+}
+
+/* Allocates a buffer for reading |size| bytes from |part_name|, using
+ * the allocate_io_buffer() operation if available, and accounts for it
+ * in |memory|. Returns NULL if out of memory or if the buffer doesn't
+ * fit in the budget. The buffer must be freed with free_io_buffer() or,
+ * once moved to AvbSlotVerifyData, with release_io_buffer() and
+ * io_buffer_ops(|ops|).
+ */
+static uint8_t* allocate_io_buffer(AvbOps* ops,
+                                   AvbSlotVerifyMemory* memory,
+                                   const char* part_name,
+                                   size_t size) {
+  void* buf;
+
+  if (!memory_reserve(memory, size)) {
+    avb_error(part_name, ": Loading data would exceed memory budget.\n");
+    return NULL;
+  }
+  if (io_buffer_ops(ops) != NULL) {
+    buf = ops->allocate_io_buffer(ops, part_name, size);
+    if (buf == NULL) {
+      avb_error(part_name, ": Error allocating I/O buffer.\n");
+    }
+  } else {
+    buf = avb_malloc(size);
+  }
+  if (buf == NULL) {
+    memory_release(memory, size);
+  }
+  return buf;
+}
+
+/* Frees a buffer of |size| bytes from allocate_io_buffer(). */
+static void free_io_buffer(AvbOps* ops,
+                           AvbSlotVerifyMemory* memory,
+                           uint8_t* buf,
+                           size_t size) {
+  release_io_buffer(io_buffer_ops(ops), buf);
+  memory_release(memory, size);
+}
+
+/* Gets the contents of |part_name| if the whole partition is preloaded
+ * in memory, see the get_preloaded_partition() operation. On success,
+ * |*out_data| is set to the preloaded data, or NULL if it's not
+ * available, and |*out_size| to the size of the partition.
+ *
+ * Errors other than OOM only make this return no data, the caller is
+ * expected to fall back to read_from_partition() which reports them.
+ */
+static AvbSlotVerifyResult get_preloaded_partition_data(AvbOps* ops,
+                                                        const char* part_name,
+                                                        uint8_t** out_data,
+                                                        size_t* out_size) {
+  uint64_t partition_size;
+  uint8_t* data = NULL;
+  size_t num_preloaded = 0;
+  AvbIOResult io_ret;
+
+  *out_data = NULL;
+  *out_size = 0;
+
+  if (ops->get_preloaded_partition == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_OK;
+  }
+
+  io_ret = ops->get_size_of_partition(ops, part_name, &partition_size);
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK ||
+             partition_size != (size_t)partition_size) {
+    return AVB_SLOT_VERIFY_RESULT_OK;
+  }
+
+  io_ret = ops->get_preloaded_partition(
+      ops, part_name, partition_size, &data, &num_preloaded);
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    return AVB_SLOT_VERIFY_RESULT_OK;
+  }
+
+  /* Footers are at the end of the partition, so only use the preloaded
+   * data if all of it is there.
+   */
+  if (data != NULL && num_preloaded == partition_size) {
+    *out_data = data;
+    *out_size = num_preloaded;
+  }
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
 static AvbSlotVerifyResult load_full_partition(AvbOps* ops,
+                                               AvbSlotVerifyMemory* memory,
                                                const char* part_name,
                                                uint64_t image_size,
                                                uint8_t** out_image_buf,
@@ -118,7 +283,7 @@ static AvbSlotVerifyResult load_full_partition(AvbOps* ops,
 
   /* Allocate and copy the partition. */
   if (!*out_image_preloaded) {
-    *out_image_buf = avb_malloc(image_size);
+    *out_image_buf = allocate_io_buffer(ops, memory, part_name, image_size);
     if (*out_image_buf == NULL) {
       return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     }
@@ -273,86 +438,332 @@ static AvbSlotVerifyResult initialize_persistent_digest(
   return ret;
 }
 
-static AvbSlotVerifyResult load_and_verify_hash_partition(
+/* Record stored in the AVB_NPV_GENERATION_CACHE_PREFIX persistent value
+ * for a partition, see the read_partition_generation() operation. All
+ * integers are big-endian.
+ */
+typedef struct AvbGenerationCacheEntry {
+  uint8_t magic[4];
+  uint32_t reserved;
+  uint64_t generation;
+  uint8_t descriptor_digest[AVB_SHA256_DIGEST_SIZE];
+  uint8_t check[AVB_SHA256_DIGEST_SIZE];
+} AVB_ATTR_PACKED AvbGenerationCacheEntry;
+
+#define AVB_GENERATION_CACHE_MAGIC "AGEN"
+
+/* Builds the cache entry for |part_name| at |generation|. The check
+ * value covers the partition name so an entry is never used for another
+ * partition, and lets corrupted entries be told apart from valid ones.
+ * It's an unkeyed hash, not a MAC, so it doesn't protect the entry
+ * against tampering at all. The persistent value storage must be
+ * tamper-proof for the cache to be safe, see read_partition_generation().
+ */
+static void generation_cache_entry_init(const char* part_name,
+                                        uint64_t generation,
+                                        const uint8_t* descriptor_digest,
+                                        AvbGenerationCacheEntry* entry) {
+  AvbSHA256Ctx ctx;
+
+  avb_memset(entry, 0, sizeof(AvbGenerationCacheEntry));
+  avb_memcpy(entry->magic, AVB_GENERATION_CACHE_MAGIC, sizeof(entry->magic));
+  entry->generation = avb_htobe64(generation);
+  avb_memcpy(entry->descriptor_digest,
+             descriptor_digest,
+             AVB_SHA256_DIGEST_SIZE);
+
+  avb_sha256_init(&ctx);
+  avb_sha256_update(&ctx, (const uint8_t*)part_name, avb_strlen(part_name) + 1);
+  avb_sha256_update(&ctx,
+                    (const uint8_t*)entry,
+                    sizeof(AvbGenerationCacheEntry) - sizeof(entry->check));
+  avb_memcpy(entry->check, avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE);
+}
+
+/* Checks whether |part_name| was already verified against the hash
+ * descriptor with digest |descriptor_digest| at |generation|. Errors
+ * other than OOM are treated as a cache miss.
+ */
+static AvbSlotVerifyResult generation_cache_lookup(
+    AvbOps* ops,
+    const char* part_name,
+    uint64_t generation,
+    const uint8_t* descriptor_digest,
+    bool* out_hit) {
+  AvbGenerationCacheEntry expected;
+  AvbGenerationCacheEntry stored;
+  char* persistent_value_name = NULL;
+  size_t stored_size = 0;
+  AvbIOResult io_ret;
+
+  *out_hit = false;
+
+  persistent_value_name =
+      avb_strdupv(AVB_NPV_GENERATION_CACHE_PREFIX, part_name, NULL);
+  if (persistent_value_name == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  io_ret = ops->read_persistent_value(ops,
+                                      persistent_value_name,
+                                      sizeof(AvbGenerationCacheEntry),
+                                      (uint8_t*)&stored,
+                                      &stored_size);
+  avb_free(persistent_value_name);
+
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK ||
+             stored_size != sizeof(AvbGenerationCacheEntry)) {
+    return AVB_SLOT_VERIFY_RESULT_OK;
+  }
+
+  generation_cache_entry_init(
+      part_name, generation, descriptor_digest, &expected);
+  *out_hit = avb_safe_memcmp(&stored, &expected, sizeof expected) == 0;
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
+/* Records that |part_name| was verified against the hash descriptor with
+ * digest |descriptor_digest| at |generation|. Failing to update the
+ * cache only costs a full hash on the next boot, so only OOM is fatal.
+ */
+static AvbSlotVerifyResult generation_cache_update(
     AvbOps* ops,
+    const char* part_name,
+    uint64_t generation,
+    const uint8_t* descriptor_digest) {
+  AvbGenerationCacheEntry entry;
+  char* persistent_value_name = NULL;
+  AvbIOResult io_ret;
+
+  persistent_value_name =
+      avb_strdupv(AVB_NPV_GENERATION_CACHE_PREFIX, part_name, NULL);
+  if (persistent_value_name == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  generation_cache_entry_init(part_name, generation, descriptor_digest, &entry);
+  io_ret = ops->write_persistent_value(ops,
+                                       persistent_value_name,
+                                       sizeof(AvbGenerationCacheEntry),
+                                       (const uint8_t*)&entry);
+  avb_free(persistent_value_name);
+
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    avb_error(part_name, ": Error updating generation cache.\n");
+  }
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
+/* State for loading and verifying a single partition with a hash
+ * descriptor. The work is split up so it can either be done in one go,
+ * see load_and_verify_hash_partition(), or in bounded steps, see
+ * avb_slot_verify_step().
+ */
+/* Hash state for an extra measurement digest. */
+typedef union {
+  AvbSHA256Ctx sha256_ctx;
+  AvbSHA512Ctx sha512_ctx;
+} AvbMeasurementCtx;
+
+typedef struct AvbHashPartitionJob {
+  /* Set up by hash_partition_job_init(). */
+  AvbSlotVerifyMemory* memory;
+  AvbHashDescriptor hash_desc;
+  const uint8_t* desc_salt;
+  const uint8_t* desc_digest;
+  const char* found;
+  char part_name[AVB_PART_NAME_MAX_SIZE];
+  uint64_t image_size;
+  size_t image_size_to_hash;
+  const char* hash_algorithm;
+  size_t digest_len;
+  bool use_generation_cache;
+  bool generation_cache_hit;
+  uint64_t generation;
+  uint8_t descriptor_digest[AVB_SHA256_DIGEST_SIZE];
+  AvbPartitionMeasurement measurements[AVB_MAX_NUMBER_OF_MEASUREMENTS];
+  size_t num_measurements;
+
+  /* Progress made by hash_partition_job_step(). */
+  uint8_t* image_buf;
+  bool image_preloaded;
+  size_t num_loaded;
+  bool hashing_started;
+  size_t num_hashed;
+  const uint8_t* digest;
+  uint8_t offload_digest_buf[AVB_SHA512_DIGEST_SIZE];
+  AvbSHA256Ctx sha256_ctx;
+  AvbSHA512Ctx sha512_ctx;
+  AvbMeasurementCtx measurement_ctx[AVB_MAX_NUMBER_OF_MEASUREMENTS];
+  bool measurements_done;
+} AvbHashPartitionJob;
+
+/* Gets the extra measurement digests to calculate for |job| from the
+ * get_partition_measurements() operation, if available.
+ */
+static AvbSlotVerifyResult measurements_init(AvbOps* ops,
+                                             AvbHashPartitionJob* job) {
+  AvbIOResult io_ret;
+  size_t n;
+
+  if (ops->get_partition_measurements == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_OK;
+  }
+  io_ret = ops->get_partition_measurements(
+      ops, job->part_name, job->measurements, &job->num_measurements);
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    avb_error(job->part_name, ": Error getting measurements.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+  }
+  if (job->num_measurements > AVB_MAX_NUMBER_OF_MEASUREMENTS) {
+    avb_error(job->part_name, ": Too many measurements.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+  }
+  for (n = 0; n < job->num_measurements; n++) {
+    switch (job->measurements[n].digest_type) {
+      case AVB_DIGEST_TYPE_SHA256:
+        job->measurements[n].digest_len = AVB_SHA256_DIGEST_SIZE;
+        break;
+      case AVB_DIGEST_TYPE_SHA512:
+        job->measurements[n].digest_len = AVB_SHA512_DIGEST_SIZE;
+        break;
+      default:
+        avb_error(job->part_name, ": Unsupported measurement digest type.\n");
+        return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+    }
+  }
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
+/* Starts calculating the extra measurement digests for |job|. */
+static void measurements_start(AvbHashPartitionJob* job) {
+  size_t n;
+
+  for (n = 0; n < job->num_measurements; n++) {
+    const AvbPartitionMeasurement* m = &job->measurements[n];
+    AvbMeasurementCtx* ctx = &job->measurement_ctx[n];
+    size_t salt_len = m->salted ? job->hash_desc.salt_len : 0;
+    if (m->digest_type == AVB_DIGEST_TYPE_SHA256) {
+      avb_sha256_init(&ctx->sha256_ctx);
+      avb_sha256_update(&ctx->sha256_ctx, job->desc_salt, salt_len);
+    } else {
+      avb_sha512_init(&ctx->sha512_ctx);
+      avb_sha512_update(&ctx->sha512_ctx, job->desc_salt, salt_len);
+    }
+  }
+}
+
+/* Adds |data| to the extra measurement digests for |job|. */
+static void measurements_update(AvbHashPartitionJob* job,
+                                const uint8_t* data,
+                                size_t data_len) {
+  size_t n;
+
+  for (n = 0; n < job->num_measurements; n++) {
+    AvbMeasurementCtx* ctx = &job->measurement_ctx[n];
+    if (job->measurements[n].digest_type == AVB_DIGEST_TYPE_SHA256) {
+      avb_sha256_update(&ctx->sha256_ctx, data, data_len);
+    } else {
+      avb_sha512_update(&ctx->sha512_ctx, data, data_len);
+    }
+  }
+}
+
+/* Completes the extra measurement digests for |job|. */
+static void measurements_finish(AvbHashPartitionJob* job) {
+  size_t n;
+
+  for (n = 0; n < job->num_measurements; n++) {
+    AvbPartitionMeasurement* m = &job->measurements[n];
+    AvbMeasurementCtx* ctx = &job->measurement_ctx[n];
+    if (m->digest_type == AVB_DIGEST_TYPE_SHA256) {
+      avb_memcpy(
+          m->digest, avb_sha256_final(&ctx->sha256_ctx), m->digest_len);
+    } else {
+      avb_memcpy(
+          m->digest, avb_sha512_final(&ctx->sha512_ctx), m->digest_len);
+    }
+  }
+  job->measurements_done = true;
+}
+
+/* Parses the hash descriptor in |descriptor| and sets up |job| for
+ * loading and verifying the partition. If the partition was not
+ * requested, |job->found| is set to NULL and there is nothing to do.
+ *
+ * The descriptor must outlive |job|.
+ */
+static AvbSlotVerifyResult hash_partition_job_init(
+    AvbOps* ops,
+    AvbSlotVerifyMemory* memory,
     const char* const* requested_partitions,
     const char* ab_suffix,
     bool allow_verification_error,
     const AvbDescriptor* descriptor,
-    AvbSlotVerifyData* slot_data) {
-  AvbHashDescriptor hash_desc;
+    AvbHashPartitionJob* job) {
   const uint8_t* desc_partition_name = NULL;
-  const uint8_t* desc_salt;
-  const uint8_t* desc_digest;
-  char part_name[AVB_PART_NAME_MAX_SIZE];
+  AvbHashDescriptor* hash_desc = &job->hash_desc;
   AvbSlotVerifyResult ret;
   AvbIOResult io_ret;
-  uint8_t* image_buf = NULL;
-  bool image_preloaded = false;
-  uint8_t* digest;
-  size_t digest_len;
-  const char* found;
-  uint64_t image_size;
-  size_t expected_digest_len = 0;
-  uint8_t expected_digest_buf[AVB_SHA512_DIGEST_SIZE];
-  const uint8_t* expected_digest = NULL;
+
+  avb_memset(job, 0, sizeof(AvbHashPartitionJob));
+  job->memory = memory;
 
   if (!avb_hash_descriptor_validate_and_byteswap(
-          (const AvbHashDescriptor*)descriptor, &hash_desc)) {
-    ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
-    goto out;
+          (const AvbHashDescriptor*)descriptor, hash_desc)) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
   }
 
   desc_partition_name =
       ((const uint8_t*)descriptor) + sizeof(AvbHashDescriptor);
-  desc_salt = desc_partition_name + hash_desc.partition_name_len;
-  desc_digest = desc_salt + hash_desc.salt_len;
+  job->desc_salt = desc_partition_name + hash_desc->partition_name_len;
+  job->desc_digest = job->desc_salt + hash_desc->salt_len;
 
-  if (!avb_validate_utf8(desc_partition_name, hash_desc.partition_name_len)) {
+  if (!avb_validate_utf8(desc_partition_name, hash_desc->partition_name_len)) {
     avb_error("Partition name is not valid UTF-8.\n");
-    ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
-    goto out;
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
   }
 
   /* Don't bother loading or validating unless the partition was
    * requested in the first place.
    */
-  found = avb_strv_find_str(requested_partitions,
-                            (const char*)desc_partition_name,
-                            hash_desc.partition_name_len);
-  if (found == NULL) {
-    ret = AVB_SLOT_VERIFY_RESULT_OK;
-    goto out;
+  job->found = avb_strv_find_str(requested_partitions,
+                                 (const char*)desc_partition_name,
+                                 hash_desc->partition_name_len);
+  if (job->found == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_OK;
   }
 
-  if ((hash_desc.flags & AVB_HASH_DESCRIPTOR_FLAGS_DO_NOT_USE_AB) != 0) {
+  if ((hash_desc->flags & AVB_HASH_DESCRIPTOR_FLAGS_DO_NOT_USE_AB) != 0) {
     /* No ab_suffix, just copy the partition name as is. */
-    if (hash_desc.partition_name_len >= AVB_PART_NAME_MAX_SIZE) {
+    if (hash_desc->partition_name_len >= AVB_PART_NAME_MAX_SIZE) {
       avb_error("Partition name does not fit.\n");
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
-      goto out;
+      return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
     }
-    avb_memcpy(part_name, desc_partition_name, hash_desc.partition_name_len);
-    part_name[hash_desc.partition_name_len] = '\0';
-  } else if (hash_desc.digest_len == 0 && avb_strlen(ab_suffix) != 0) {
+    avb_memcpy(
+        job->part_name, desc_partition_name, hash_desc->partition_name_len);
+    job->part_name[hash_desc->partition_name_len] = '\0';
+  } else if (hash_desc->digest_len == 0 && avb_strlen(ab_suffix) != 0) {
     /* No ab_suffix allowed for partitions without a digest in the descriptor
      * because these partitions hold data unique to this device and are not
      * updated using an A/B scheme.
      */
     avb_error("Cannot use A/B with a persistent digest.\n");
-    ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
-    goto out;
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
   } else {
     /* Add ab_suffix to the partition name. */
-    if (!avb_str_concat(part_name,
-                        sizeof part_name,
+    if (!avb_str_concat(job->part_name,
+                        sizeof job->part_name,
                         (const char*)desc_partition_name,
-                        hash_desc.partition_name_len,
+                        hash_desc->partition_name_len,
                         ab_suffix,
                         avb_strlen(ab_suffix))) {
       avb_error("Partition name and suffix does not fit.\n");
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
-      goto out;
+      return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
     }
   }
 
@@ -364,131 +775,542 @@ static AvbSlotVerifyResult load_and_verify_hash_partition(
    * boot /path/to/new/and/bigger/boot.img'. We want this to work
    * since it's such a common workflow.
    */
-  image_size = hash_desc.image_size;
+  job->image_size = hash_desc->image_size;
   if (allow_verification_error) {
-    io_ret = ops->get_size_of_partition(ops, part_name, &image_size);
+    io_ret = ops->get_size_of_partition(ops, job->part_name, &job->image_size);
     if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
-      goto out;
+      return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     } else if (io_ret != AVB_IO_RESULT_OK) {
-      avb_error(part_name, ": Error determining partition size.\n");
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
-      goto out;
+      avb_error(job->part_name, ": Error determining partition size.\n");
+      return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
     }
-    avb_debug(part_name, ": Loading entire partition.\n");
+    avb_debug(job->part_name, ": Loading entire partition.\n");
   }
 
-  ret = load_full_partition(
-      ops, part_name, image_size, &image_buf, &image_preloaded);
-  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
-    goto out;
+  /* We are going to implicitly cast image_size from uint64_t to size_t in the
+   * following code, so we need to make sure that the cast is safe. */
+  if (job->image_size != (size_t)(job->image_size)) {
+    avb_error(job->part_name, ": Partition size too large to load.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
   }
-  // Although only one of the type might be used, we have to defined the
-  // structure here so that they would live outside the 'if/else' scope to be
-  // used later.
-  AvbSHA256Ctx sha256_ctx;
-  AvbSHA512Ctx sha512_ctx;
-  size_t image_size_to_hash = hash_desc.image_size;
+
   // If we allow verification error and the whole partition is smaller than
   // image size in hash descriptor, we just hash the whole partition.
-  if (image_size_to_hash > image_size) {
-    image_size_to_hash = image_size;
-  }
-  if (avb_strcmp((const char*)hash_desc.hash_algorithm, "sha256") == 0) {
-    avb_sha256_init(&sha256_ctx);
-    avb_sha256_update(&sha256_ctx, desc_salt, hash_desc.salt_len);
-    avb_sha256_update(&sha256_ctx, image_buf, image_size_to_hash);
-    digest = avb_sha256_final(&sha256_ctx);
-    digest_len = AVB_SHA256_DIGEST_SIZE;
-  } else if (avb_strcmp((const char*)hash_desc.hash_algorithm, "sha512") == 0) {
-    avb_sha512_init(&sha512_ctx);
-    avb_sha512_update(&sha512_ctx, desc_salt, hash_desc.salt_len);
-    avb_sha512_update(&sha512_ctx, image_buf, image_size_to_hash);
-    digest = avb_sha512_final(&sha512_ctx);
-    digest_len = AVB_SHA512_DIGEST_SIZE;
+  job->image_size_to_hash = hash_desc->image_size;
+  if (job->image_size_to_hash > job->image_size) {
+    job->image_size_to_hash = job->image_size;
+  }
+  if (avb_strcmp((const char*)hash_desc->hash_algorithm, "sha256") == 0) {
+    job->hash_algorithm = "sha256";
+    job->digest_len = AVB_SHA256_DIGEST_SIZE;
+  } else if (avb_strcmp((const char*)hash_desc->hash_algorithm, "sha512") ==
+             0) {
+    job->hash_algorithm = "sha512";
+    job->digest_len = AVB_SHA512_DIGEST_SIZE;
   } else {
-    avb_error(part_name, ": Unsupported hash algorithm.\n");
-    ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+    avb_error(job->part_name, ": Unsupported hash algorithm.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+
+  ret = measurements_init(ops, job);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+    return ret;
+  }
+
+  /* The generation stamp must be read before the partition is loaded:
+   * if the partition is written after this point the stamp changes and
+   * the cache entry written after verification will never match.
+   */
+  if (ops->read_partition_generation != NULL &&
+      ops->read_persistent_value != NULL &&
+      ops->write_persistent_value != NULL && !allow_verification_error &&
+      hash_desc->digest_len != 0) {
+    io_ret =
+        ops->read_partition_generation(ops, job->part_name, &job->generation);
+    if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+      return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+    } else if (io_ret == AVB_IO_RESULT_OK) {
+      job->use_generation_cache = true;
+    } else if (io_ret != AVB_IO_RESULT_ERROR_NO_SUCH_VALUE) {
+      avb_error(job->part_name, ": Error reading generation stamp.\n");
+    }
+  }
+  if (job->use_generation_cache) {
+    AvbSHA256Ctx descriptor_sha256_ctx;
+    avb_sha256_init(&descriptor_sha256_ctx);
+    avb_sha256_update(&descriptor_sha256_ctx,
+                      (const uint8_t*)descriptor,
+                      sizeof(AvbDescriptor) +
+                          hash_desc->parent_descriptor.num_bytes_following);
+    avb_memcpy(job->descriptor_digest,
+               avb_sha256_final(&descriptor_sha256_ctx),
+               AVB_SHA256_DIGEST_SIZE);
+
+    ret = generation_cache_lookup(ops,
+                                  job->part_name,
+                                  job->generation,
+                                  job->descriptor_digest,
+                                  &job->generation_cache_hit);
+    if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+      return ret;
+    }
+  }
+
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
+/* Returns how many of the |remaining| bytes of a partition to load or
+ * hash given |budget|: a whole number of blocks, and at least one
+ * block, unless all that remains fits in |budget|.
+ */
+static size_t hash_partition_job_chunk(size_t remaining, size_t budget) {
+  size_t chunk = budget - budget % HASH_PARTITION_STEP_BLOCK_SIZE;
+
+  if (remaining <= budget) {
+    return remaining;
+  }
+  if (chunk == 0) {
+    chunk = HASH_PARTITION_STEP_BLOCK_SIZE;
+  }
+  return chunk < remaining ? chunk : remaining;
+}
+
+/* Loads and hashes the partition for |job|, processing about
+ * |*budget| bytes. The number of bytes processed is subtracted from
+ * |*budget|, clamping at zero. Loading or hashing a byte each count as
+ * one byte, and a call to the calculate_digest() operation counts as
+ * one byte. Data is loaded and hashed in whole blocks of
+ * HASH_PARTITION_STEP_BLOCK_SIZE bytes so reads start on a block
+ * boundary, which means a step may go over |*budget| by less than a
+ * block.
+ *
+ * On success, |*out_done| is set to true once the partition has been
+ * fully loaded and its digest is available in |job->digest|.
+ */
+static AvbSlotVerifyResult hash_partition_job_step(AvbOps* ops,
+                                                   AvbHashPartitionJob* job,
+                                                   size_t* budget,
+                                                   bool* out_done) {
+  size_t part_num_read;
+  size_t chunk;
+  bool verify_digest_needed;
+  AvbIOResult io_ret;
+
+  *out_done = false;
+
+  /* Try use a preloaded partition, otherwise allocate a buffer for it. */
+  if (job->image_buf == NULL) {
+    if (ops->get_preloaded_partition != NULL) {
+      io_ret = ops->get_preloaded_partition(ops,
+                                            job->part_name,
+                                            job->image_size,
+                                            &job->image_buf,
+                                            &part_num_read);
+      if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+        return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+      } else if (io_ret != AVB_IO_RESULT_OK) {
+        avb_error(job->part_name, ": Error loading data from partition.\n");
+        return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+      }
+
+      if (job->image_buf != NULL) {
+        job->image_preloaded = true;
+        /* Preloaded data wasn't read from storage at the generation the
+         * cache is keyed on, so always hash it, and don't let verifying it
+         * vouch for the storage either.
+         */
+        job->use_generation_cache = false;
+        job->generation_cache_hit = false;
+        if (part_num_read != job->image_size) {
+          avb_error(job->part_name, ": Read incorrect number of bytes.\n");
+          return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+        }
+        job->num_loaded = job->image_size;
+      }
+    }
+
+    if (!job->image_preloaded) {
+      /* The entire partition is only loaded to allow for a bigger image
+       * than the descriptor says. If that doesn't fit in the memory
+       * budget, or there isn't enough memory for it, fall back to loading
+       * just the image in the descriptor.
+       */
+      if (!memory_fits(job->memory, job->image_size) &&
+          job->image_size > job->hash_desc.image_size) {
+        avb_debug(job->part_name,
+                  ": Entire partition doesn't fit in memory budget, loading "
+                  "image size from descriptor.\n");
+        job->image_size = job->hash_desc.image_size;
+      }
+      job->image_buf = allocate_io_buffer(
+          ops, job->memory, job->part_name, job->image_size);
+      if (job->image_buf == NULL &&
+          job->image_size > job->hash_desc.image_size) {
+        avb_debug(job->part_name,
+                  ": Entire partition doesn't fit in memory, loading image "
+                  "size from descriptor.\n");
+        job->image_size = job->hash_desc.image_size;
+        job->image_buf = allocate_io_buffer(
+            ops, job->memory, job->part_name, job->image_size);
+      }
+      if (job->image_buf == NULL) {
+        return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+      }
+    }
+  }
+
+  /* Read the partition, one chunk at a time. */
+  while (job->num_loaded < job->image_size) {
+    if (*budget == 0) {
+      return AVB_SLOT_VERIFY_RESULT_OK;
+    }
+    chunk = hash_partition_job_chunk(job->image_size - job->num_loaded,
+                                     *budget);
+    io_ret = ops->read_from_partition(ops,
+                                      job->part_name,
+                                      job->num_loaded,
+                                      chunk,
+                                      job->image_buf + job->num_loaded,
+                                      &part_num_read);
+    if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+      return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+    } else if (io_ret != AVB_IO_RESULT_OK) {
+      avb_error(job->part_name, ": Error loading data from partition.\n");
+      return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+    }
+    if (part_num_read != chunk) {
+      avb_error(job->part_name, ": Read incorrect number of bytes.\n");
+      return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+    }
+    job->num_loaded += chunk;
+    *budget -= chunk < *budget ? chunk : *budget;
+  }
+
+  /* Nothing to hash if the partition is known to be unchanged, unless
+   * extra measurements were requested.
+   */
+  if (job->generation_cache_hit && job->num_measurements == 0) {
+    avb_debug(job->part_name, ": Unchanged since last verification.\n");
+    *out_done = true;
+    return AVB_SLOT_VERIFY_RESULT_OK;
+  }
+
+  if (!job->hashing_started) {
+    if (*budget == 0) {
+      return AVB_SLOT_VERIFY_RESULT_OK;
+    }
+    job->hashing_started = true;
+
+    /* Let the platform calculate the digest if it can, e.g. using a
+     * hardware hash engine. Fall back to software otherwise.
+     */
+    if (!job->generation_cache_hit && ops->calculate_digest != NULL) {
+      size_t offload_digest_len = 0;
+      *budget -= 1;
+      io_ret = ops->calculate_digest(ops,
+                                     job->part_name,
+                                     job->hash_algorithm,
+                                     job->desc_salt,
+                                     job->hash_desc.salt_len,
+                                     job->image_buf,
+                                     job->image_size_to_hash,
+                                     job->offload_digest_buf,
+                                     sizeof job->offload_digest_buf,
+                                     &offload_digest_len);
+      if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+        return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+      } else if (io_ret != AVB_IO_RESULT_OK) {
+        avb_error(job->part_name, ": Error calculating digest.\n");
+        return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+      }
+      if (offload_digest_len != 0) {
+        if (offload_digest_len != job->digest_len) {
+          avb_error(job->part_name,
+                    ": Calculated digest has unexpected size.\n");
+          return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+        }
+        job->digest = job->offload_digest_buf;
+        if (job->num_measurements == 0) {
+          *out_done = true;
+          return AVB_SLOT_VERIFY_RESULT_OK;
+        }
+      }
+    }
+
+    if (job->generation_cache_hit) {
+      avb_debug(job->part_name, ": Unchanged, only measuring.\n");
+    } else if (job->digest == NULL &&
+               job->digest_len == AVB_SHA256_DIGEST_SIZE) {
+      avb_sha256_init(&job->sha256_ctx);
+      avb_sha256_update(
+          &job->sha256_ctx, job->desc_salt, job->hash_desc.salt_len);
+    } else if (job->digest == NULL) {
+      avb_sha512_init(&job->sha512_ctx);
+      avb_sha512_update(
+          &job->sha512_ctx, job->desc_salt, job->hash_desc.salt_len);
+    }
+    measurements_start(job);
+  }
+
+  /* The digest for verification is already known if calculate_digest()
+   * was used and not needed if the partition is unchanged.
+   */
+  verify_digest_needed = !job->generation_cache_hit && job->digest == NULL;
+
+  /* Hash the partition, one chunk at a time, calculating the digest
+   * for verification and any extra measurements in the same pass.
+   */
+  while (job->num_hashed < job->image_size_to_hash) {
+    const uint8_t* data;
+    if (*budget == 0) {
+      return AVB_SLOT_VERIFY_RESULT_OK;
+    }
+    chunk = hash_partition_job_chunk(
+        job->image_size_to_hash - job->num_hashed, *budget);
+    data = job->image_buf + job->num_hashed;
+    if (!verify_digest_needed) {
+      /* Only measuring. */
+    } else if (job->digest_len == AVB_SHA256_DIGEST_SIZE) {
+      avb_sha256_update(&job->sha256_ctx, data, chunk);
+    } else {
+      avb_sha512_update(&job->sha512_ctx, data, chunk);
+    }
+    measurements_update(job, data, chunk);
+    job->num_hashed += chunk;
+    *budget -= chunk < *budget ? chunk : *budget;
+  }
+
+  if (!verify_digest_needed) {
+    /* Only measuring. */
+  } else if (job->digest_len == AVB_SHA256_DIGEST_SIZE) {
+    job->digest = avb_sha256_final(&job->sha256_ctx);
+  } else {
+    job->digest = avb_sha512_final(&job->sha512_ctx);
+  }
+  measurements_finish(job);
+  *out_done = true;
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
+/* Checks the digest calculated for |job| if |ret| is
+ * AVB_SLOT_VERIFY_RESULT_OK, then hands the loaded partition over to
+ * |slot_data| if appropriate. Any remaining resources held by |job| are
+ * released.
+ */
+static AvbSlotVerifyResult hash_partition_job_finish(
+    AvbOps* ops,
+    AvbHashPartitionJob* job,
+    AvbSlotVerifyData* slot_data,
+    AvbSlotVerifyResult ret) {
+  const char* part_name = job->part_name;
+  size_t expected_digest_len = 0;
+  uint8_t expected_digest_buf[AVB_SHA512_DIGEST_SIZE];
+  const uint8_t* expected_digest = NULL;
+
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK || job->generation_cache_hit) {
     goto out;
   }
 
-  if (hash_desc.digest_len == 0) {
+  if (job->hash_desc.digest_len == 0) {
     /* Expect a match to a persistent digest. */
     avb_debug(part_name, ": No digest, using persistent digest.\n");
-    expected_digest_len = digest_len;
+    expected_digest_len = job->digest_len;
     expected_digest = expected_digest_buf;
     avb_assert(expected_digest_len <= sizeof(expected_digest_buf));
     /* Pass |digest| as the |initial_digest| so devices not yet initialized get
      * initialized to the current partition digest.
      */
     ret = read_persistent_digest(
-        ops, part_name, digest_len, digest, expected_digest_buf);
+        ops, part_name, job->digest_len, job->digest, expected_digest_buf);
     if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
       goto out;
     }
   } else {
     /* Expect a match to the digest in the descriptor. */
-    expected_digest_len = hash_desc.digest_len;
-    expected_digest = desc_digest;
+    expected_digest_len = job->hash_desc.digest_len;
+    expected_digest = job->desc_digest;
   }
 
-  if (digest_len != expected_digest_len) {
+  if (job->digest_len != expected_digest_len) {
     avb_error(part_name, ": Digest in descriptor not of expected size.\n");
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
     goto out;
   }
 
-  if (avb_safe_memcmp(digest, expected_digest, digest_len) != 0) {
+  if (avb_safe_memcmp(job->digest, expected_digest, job->digest_len) != 0) {
     avb_error(part_name,
               ": Hash of data does not match digest in descriptor.\n");
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION;
     goto out;
   }
 
+  if (job->use_generation_cache) {
+    ret = generation_cache_update(
+        ops, part_name, job->generation, job->descriptor_digest);
+    if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+      goto out;
+    }
+  }
+
   ret = AVB_SLOT_VERIFY_RESULT_OK;
 
 out:
 
   /* If it worked and something was loaded, copy to slot_data. */
   if ((ret == AVB_SLOT_VERIFY_RESULT_OK || result_should_continue(ret)) &&
-      image_buf != NULL) {
+      job->image_buf != NULL) {
     AvbPartitionData* loaded_partition;
+    char* partition_name;
     if (slot_data->num_loaded_partitions == MAX_NUMBER_OF_LOADED_PARTITIONS) {
       avb_error(part_name, ": Too many loaded partitions.\n");
       ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
       goto fail;
     }
+    partition_name = avb_strdup(job->found);
+    if (partition_name == NULL) {
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+      goto fail;
+    }
     loaded_partition =
         &slot_data->loaded_partitions[slot_data->num_loaded_partitions++];
-    loaded_partition->partition_name = avb_strdup(found);
-    loaded_partition->data_size = image_size;
-    loaded_partition->data = image_buf;
-    loaded_partition->preloaded = image_preloaded;
+    loaded_partition->partition_name = partition_name;
+    loaded_partition->data_size = job->image_size;
+    loaded_partition->data = job->image_buf;
+    loaded_partition->preloaded = job->image_preloaded;
+    if (!job->image_preloaded) {
+      loaded_partition->io_buffer_ops = io_buffer_ops(ops);
+    }
     loaded_partition->verify_result = ret;
-    image_buf = NULL;
+    if (job->digest != NULL) {
+      avb_memcpy(loaded_partition->digest, job->digest, job->digest_len);
+      loaded_partition->digest_len = job->digest_len;
+    } else if (job->generation_cache_hit &&
+               job->hash_desc.digest_len == job->digest_len) {
+      /* Not hashed, but the cache says it matches the descriptor. */
+      avb_memcpy(loaded_partition->digest, job->desc_digest, job->digest_len);
+      loaded_partition->digest_len = job->digest_len;
+    }
+    if (job->measurements_done) {
+      avb_memcpy(loaded_partition->measurements,
+                 job->measurements,
+                 sizeof job->measurements);
+      loaded_partition->num_measurements = job->num_measurements;
+    }
+    job->image_buf = NULL;
   }
 
 fail:
-  if (image_buf != NULL && !image_preloaded) {
-    avb_free(image_buf);
+  if (job->image_buf != NULL && !job->image_preloaded) {
+    free_io_buffer(ops, job->memory, job->image_buf, job->image_size);
   }
+  job->image_buf = NULL;
   return ret;
 }
 
+static AvbSlotVerifyResult load_and_verify_hash_partition(
+    AvbOps* ops,
+    AvbSlotVerifyMemory* memory,
+    const char* const* requested_partitions,
+    const char* ab_suffix,
+    bool allow_verification_error,
+    const AvbDescriptor* descriptor,
+    AvbSlotVerifyData* slot_data) {
+  AvbHashPartitionJob job;
+  AvbSlotVerifyResult ret;
+  size_t budget = SIZE_MAX;
+  bool done = false;
+
+  ret = hash_partition_job_init(ops,
+                                memory,
+                                requested_partitions,
+                                ab_suffix,
+                                allow_verification_error,
+                                descriptor,
+                                &job);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK || job.found == NULL) {
+    return ret;
+  }
+  ret = hash_partition_job_step(ops, &job, &budget, &done);
+  avb_assert(ret != AVB_SLOT_VERIFY_RESULT_OK || done);
+  return hash_partition_job_finish(ops, &job, slot_data, ret);
+}
+
+/* Frees |job| from queue_hash_partition() and its buffer, if any. */
+static void hash_partition_job_free(AvbHashPartitionJob* job) {
+  AvbSlotVerifyMemory* memory = job->memory;
+
+  avb_assert(job->image_buf == NULL || job->image_preloaded);
+  avb_free(job);
+  memory_release(memory, sizeof(AvbHashPartitionJob));
+}
+
+/* Hash partitions which have been found while verifying vbmeta but not
+ * yet loaded and verified, see avb_slot_verify_step().
+ */
+typedef struct AvbHashPartitionJobList {
+  AvbHashPartitionJob* jobs[MAX_NUMBER_OF_LOADED_PARTITIONS];
+  size_t num_jobs;
+  size_t next_job;
+} AvbHashPartitionJobList;
+
+/* Like load_and_verify_hash_partition() but only sets up the job and
+ * adds it to |jobs|.
+ */
+static AvbSlotVerifyResult queue_hash_partition(
+    AvbOps* ops,
+    AvbSlotVerifyMemory* memory,
+    const char* const* requested_partitions,
+    const char* ab_suffix,
+    bool allow_verification_error,
+    const AvbDescriptor* descriptor,
+    AvbHashPartitionJobList* jobs) {
+  AvbHashPartitionJob* job;
+  AvbSlotVerifyResult ret;
+
+  if (!memory_reserve(memory, sizeof(AvbHashPartitionJob))) {
+    avb_error("Queueing hash partition would exceed memory budget.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  job = avb_malloc(sizeof(AvbHashPartitionJob));
+  if (job == NULL) {
+    memory_release(memory, sizeof(AvbHashPartitionJob));
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  ret = hash_partition_job_init(ops,
+                                memory,
+                                requested_partitions,
+                                ab_suffix,
+                                allow_verification_error,
+                                descriptor,
+                                job);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK || job->found == NULL) {
+    hash_partition_job_free(job);
+    return ret;
+  }
+  if (jobs->num_jobs == MAX_NUMBER_OF_LOADED_PARTITIONS) {
+    avb_error(job->part_name, ": Too many loaded partitions.\n");
+    hash_partition_job_free(job);
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  jobs->jobs[jobs->num_jobs++] = job;
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
 static AvbSlotVerifyResult load_requested_partitions(
     AvbOps* ops,
+    AvbSlotVerifyMemory* memory,
     const char* const* requested_partitions,
     const char* ab_suffix,
     AvbSlotVerifyData* slot_data) {
   AvbSlotVerifyResult ret;
   uint8_t* image_buf = NULL;
   bool image_preloaded = false;
+  uint64_t image_size = 0;
   size_t n;
 
   for (n = 0; requested_partitions[n] != NULL; n++) {
     char part_name[AVB_PART_NAME_MAX_SIZE];
     AvbIOResult io_ret;
-    uint64_t image_size;
     AvbPartitionData* loaded_partition;
 
     if (!avb_str_concat(part_name,
@@ -514,7 +1336,7 @@ static AvbSlotVerifyResult load_requested_partitions(
     avb_debug(part_name, ": Loading entire partition.\n");
 
     ret = load_full_partition(
-        ops, part_name, image_size, &image_buf, &image_preloaded);
+        ops, memory, part_name, image_size, &image_buf, &image_preloaded);
     if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
       goto out;
     }
@@ -535,6 +1357,9 @@ static AvbSlotVerifyResult load_requested_partitions(
     loaded_partition->data_size = image_size;
     loaded_partition->data = image_buf; /* Transferring the owner. */
     loaded_partition->preloaded = image_preloaded;
+    if (!image_preloaded) {
+      loaded_partition->io_buffer_ops = io_buffer_ops(ops);
+    }
     image_buf = NULL;
     image_preloaded = false;
   }
@@ -544,15 +1369,89 @@ static AvbSlotVerifyResult load_requested_partitions(
 out:
   /* Free the current buffer if any. */
   if (image_buf != NULL && !image_preloaded) {
-    avb_free(image_buf);
+    free_io_buffer(ops, memory, image_buf, (size_t)image_size);
   }
   /* Buffers that are already saved in slot_data will be handled by the caller
    * even on failure. */
   return ret;
 }
 
+/* Reads |num_bytes| at |offset| of |partition| into |buffer| like
+ * read_from_partition() does, but copies from |preloaded_data| instead
+ * if |offset| is within the |preloaded_size| bytes preloaded.
+ */
+static AvbIOResult read_vbmeta_data(AvbOps* ops,
+                                    const char* partition,
+                                    const uint8_t* preloaded_data,
+                                    size_t preloaded_size,
+                                    uint64_t offset,
+                                    size_t num_bytes,
+                                    void* buffer,
+                                    size_t* out_num_read) {
+  if (preloaded_data != NULL && offset <= preloaded_size) {
+    /* Same as read_from_partition(), which stops at the end of the
+     * partition.
+     */
+    if (num_bytes > preloaded_size - (size_t)offset) {
+      num_bytes = preloaded_size - (size_t)offset;
+    }
+    avb_memcpy(buffer, preloaded_data + offset, num_bytes);
+    *out_num_read = num_bytes;
+    return AVB_IO_RESULT_OK;
+  }
+  return ops->read_from_partition(
+      ops, partition, offset, num_bytes, buffer, out_num_read);
+}
+
+/* Digests of the vbmeta images appended to AvbSlotVerifyData so far,
+ * see avb_slot_verify_data_calculate_vbmeta_digest().
+ */
+typedef struct {
+  AvbSHA256Ctx sha256;
+  AvbSHA512Ctx sha512;
+} AvbVBMetaDigestCtx;
+
+/* The descriptors of a verified vbmeta image still to be acted on,
+ * see walk_vbmeta_descriptors().
+ */
+typedef struct {
+  char partition_name[AVB_PART_NAME_MAX_SIZE];
+  const AvbDescriptor** descriptors;
+  size_t num_descriptors;
+  size_t next_descriptor;
+  bool chain_pending;
+  bool is_main_vbmeta;
+  AvbVBMetaImageFlags toplevel_vbmeta_flags;
+  uint32_t rollback_index_location;
+  uint64_t rollback_index;
+  AvbAlgorithmType algorithm_type;
+  AvbAlgorithmType* out_algorithm_type;
+  AvbCmdlineSubstList* out_additional_cmdline_subst;
+  AvbSlotVerifyResult ret;
+} AvbVBMetaWalk;
+
+static AvbSlotVerifyResult walk_vbmeta_descriptors(
+    AvbOps* ops,
+    AvbSlotVerifyMemory* memory,
+    const char* const* requested_partitions,
+    const char* ab_suffix,
+    AvbSlotVerifyFlags flags,
+    bool allow_verification_error,
+    AvbSlotVerifyData* slot_data,
+    AvbVBMetaDigestCtx* vbmeta_digest,
+    AvbHashPartitionJobList* deferred_jobs,
+    AvbVBMetaWalk* walk,
+    bool stop_at_chain);
+
+/* Loads and verifies the vbmeta image in |partition_name| and acts on
+ * its descriptors. If |walk| is not NULL the descriptors are walked
+ * using |walk|, which means that the walk may stop at a chain
+ * partition descriptor and has to be completed by the caller, see
+ * walk_vbmeta_descriptors().
+ */
 static AvbSlotVerifyResult load_and_verify_vbmeta(
     AvbOps* ops,
+    AvbSlotVerifyMemory* memory,
     const char* const* requested_partitions,
     const char* ab_suffix,
     AvbSlotVerifyFlags flags,
@@ -564,24 +1463,34 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
     const uint8_t* expected_public_key,
     size_t expected_public_key_length,
     AvbSlotVerifyData* slot_data,
+    AvbVBMetaDigestCtx* vbmeta_digest,
     AvbAlgorithmType* out_algorithm_type,
     AvbCmdlineSubstList* out_additional_cmdline_subst,
-    bool use_ab_suffix) {
+    bool use_ab_suffix,
+    AvbHashPartitionJobList* deferred_jobs,
+    AvbVBMetaWalk* walk) {
   char full_partition_name[AVB_PART_NAME_MAX_SIZE];
   AvbSlotVerifyResult ret;
   AvbIOResult io_ret;
   uint64_t vbmeta_offset;
   size_t vbmeta_size;
   uint8_t* vbmeta_buf = NULL;
+  bool vbmeta_preloaded = false;
   size_t vbmeta_num_read;
+  uint8_t* preloaded_data = NULL;
+  size_t preloaded_size = 0;
+  AvbVBMetaImageHeader vbmeta_header_data;
+  const uint8_t* vbmeta_header_buf = (const uint8_t*)&vbmeta_header_data;
+  uint64_t vbmeta_image_size = 0;
+  AvbVBMetaStream* vbmeta_stream = NULL;
   AvbVBMetaVerifyResult vbmeta_ret;
-  const uint8_t* pk_data;
-  size_t pk_len;
+  const uint8_t* pk_data = NULL;
+  size_t pk_len = 0;
   AvbVBMetaImageHeader vbmeta_header;
   uint64_t stored_rollback_index;
   const AvbDescriptor** descriptors = NULL;
   size_t num_descriptors;
-  size_t n;
+  AvbVBMetaWalk chained_walk;
   bool is_main_vbmeta;
   bool look_for_vbmeta_footer;
   AvbVBMetaData* vbmeta_image_data = NULL;
@@ -637,6 +1546,15 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
     }
   }
 
+  /* If the whole partition is already in memory, parse the footer and
+   * vbmeta struct in place instead of reading copies of them.
+   */
+  ret = get_preloaded_partition_data(
+      ops, full_partition_name, &preloaded_data, &preloaded_size);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+    goto out;
+  }
+
   /* If we're loading from the main vbmeta partition, the vbmeta struct is in
    * the beginning. Otherwise we may have to locate it via a footer... if no
    * footer is found, we look in the beginning to support e.g. vbmeta_<org>
@@ -647,26 +1565,32 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
   vbmeta_size = VBMETA_MAX_SIZE;
   if (look_for_vbmeta_footer) {
     uint8_t footer_buf[AVB_FOOTER_SIZE];
+    const uint8_t* footer_data = footer_buf;
     size_t footer_num_read;
     AvbFooter footer;
 
-    io_ret = ops->read_from_partition(ops,
-                                      full_partition_name,
-                                      -AVB_FOOTER_SIZE,
-                                      AVB_FOOTER_SIZE,
-                                      footer_buf,
-                                      &footer_num_read);
-    if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
-      goto out;
-    } else if (io_ret != AVB_IO_RESULT_OK) {
-      avb_error(full_partition_name, ": Error loading footer.\n");
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
-      goto out;
+    if (preloaded_data != NULL && preloaded_size >= AVB_FOOTER_SIZE) {
+      footer_data = preloaded_data + preloaded_size - AVB_FOOTER_SIZE;
+      io_ret = AVB_IO_RESULT_OK;
+    } else {
+      io_ret = ops->read_from_partition(ops,
+                                        full_partition_name,
+                                        -AVB_FOOTER_SIZE,
+                                        AVB_FOOTER_SIZE,
+                                        footer_buf,
+                                        &footer_num_read);
+      if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+        goto out;
+      } else if (io_ret != AVB_IO_RESULT_OK) {
+        avb_error(full_partition_name, ": Error loading footer.\n");
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+        goto out;
+      }
+      avb_assert(footer_num_read == AVB_FOOTER_SIZE);
     }
-    avb_assert(footer_num_read == AVB_FOOTER_SIZE);
 
-    if (!avb_footer_validate_and_byteswap((const AvbFooter*)footer_buf,
+    if (!avb_footer_validate_and_byteswap((const AvbFooter*)footer_data,
                                           &footer)) {
       avb_debug(full_partition_name, ": No footer detected.\n");
     } else {
@@ -701,18 +1625,36 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
   }
 
   /* Use result from previous I/O operation to check the existence of the
-   * partition before allocating the big chunk of memory on heap
-   * for vbmeta later. `io_ret` will be used later to decide whether
-   * to fallback on the `boot` partition.
+   * partition before reading the vbmeta header. `io_ret` will be used
+   * later to decide whether to fallback on the `boot` partition.
+   *
+   * The vbmeta struct is only parsed in place if it is suitably
+   * aligned. The offset comes from the footer and can't be trusted, so
+   * otherwise it is copied out of the preloaded data like it would be
+   * read from the partition.
    */
-  if (io_ret != AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION) {
-    vbmeta_buf = avb_malloc(vbmeta_size);
-    if (vbmeta_buf == NULL) {
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
-      goto out;
+  if (preloaded_data != NULL && vbmeta_offset <= preloaded_size &&
+      ((uintptr_t)(preloaded_data + vbmeta_offset) & 7) == 0) {
+    avb_debug("Using preloaded vbmeta struct from partition '",
+              full_partition_name,
+              "'.\n");
+    vbmeta_buf = preloaded_data + vbmeta_offset;
+    vbmeta_header_buf = vbmeta_buf;
+    vbmeta_preloaded = true;
+    /* Same as read_from_partition(), which stops at the end of the
+     * partition.
+     */
+    vbmeta_num_read = preloaded_size - (size_t)vbmeta_offset;
+    if (vbmeta_num_read > vbmeta_size) {
+      vbmeta_num_read = vbmeta_size;
     }
-
-    if (vbmeta_offset != 0) {
+    io_ret = AVB_IO_RESULT_OK;
+  } else if (io_ret != AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION) {
+    if (preloaded_data != NULL && vbmeta_offset <= preloaded_size) {
+      avb_debug("Copying unaligned preloaded vbmeta struct from partition '",
+                full_partition_name,
+                "'.\n");
+    } else if (vbmeta_offset != 0) {
       avb_debug("Loading vbmeta struct in footer from partition '",
                 full_partition_name,
                 "'.\n");
@@ -722,12 +1664,19 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
                 "'.\n");
     }
 
-    io_ret = ops->read_from_partition(ops,
-                                      full_partition_name,
-                                      vbmeta_offset,
-                                      vbmeta_size,
-                                      vbmeta_buf,
-                                      &vbmeta_num_read);
+    /* Only the header is read here. It gives the size of the image
+     * so the buffer for it can be allocated with exactly that size.
+     */
+    io_ret = read_vbmeta_data(ops,
+                              full_partition_name,
+                              preloaded_data,
+                              preloaded_size,
+                              vbmeta_offset,
+                              vbmeta_size < sizeof(AvbVBMetaImageHeader)
+                                  ? vbmeta_size
+                                  : sizeof(AvbVBMetaImageHeader),
+                              &vbmeta_header_data,
+                              &vbmeta_num_read);
   }
   if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
@@ -741,6 +1690,7 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
       avb_debug(full_partition_name,
                 ": No such partition. Trying 'boot' instead.\n");
       ret = load_and_verify_vbmeta(ops,
+                                   memory,
                                    requested_partitions,
                                    ab_suffix,
                                    flags,
@@ -752,9 +1702,12 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
                                    NULL /* expected_public_key */,
                                    0 /* expected_public_key_length */,
                                    slot_data,
+                                   vbmeta_digest,
                                    out_algorithm_type,
                                    out_additional_cmdline_subst,
-                                   use_ab_suffix);
+                                   use_ab_suffix,
+                                   deferred_jobs,
+                                   walk);
       goto out;
     } else {
       avb_error(full_partition_name, ": Error loading vbmeta data.\n");
@@ -764,11 +1717,93 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
   }
   avb_assert(vbmeta_num_read <= vbmeta_size);
 
+  /* Check the header and get the size of the image from it. */
+  vbmeta_ret = AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+  if (vbmeta_num_read >= sizeof(AvbVBMetaImageHeader)) {
+    vbmeta_ret =
+        avb_vbmeta_image_header_validate(vbmeta_header_buf, &vbmeta_header);
+  } else {
+    avb_error(full_partition_name, ": vbmeta header is truncated.\n");
+  }
+  if (vbmeta_ret == AVB_VBMETA_VERIFY_RESULT_OK) {
+    /* No overflow check needed since avb_vbmeta_image_header_validate()
+     * did that.
+     */
+    vbmeta_image_size = sizeof(AvbVBMetaImageHeader) +
+                        vbmeta_header.authentication_data_block_size +
+                        vbmeta_header.auxiliary_data_block_size;
+    if (vbmeta_image_size > vbmeta_size) {
+      avb_error(full_partition_name,
+                ": vbmeta image does not fit in the space for it.\n");
+      vbmeta_ret = AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+    }
+  }
+
   /* Check if the image is properly signed and get the public key used
-   * to sign the image.
+   * to sign the image. The image is passed through the stream verifier
+   * as it's read and is only used once that has checked it. The
+   * verifier keeps copies of the signature and public key, so size
+   * them from the header. Bigger fields than the image can't be valid
+   * and the verifier rejects those.
    */
-  vbmeta_ret =
-      avb_vbmeta_image_verify(vbmeta_buf, vbmeta_num_read, &pk_data, &pk_len);
+  if (vbmeta_ret == AVB_VBMETA_VERIFY_RESULT_OK) {
+    uint64_t max_field_size = 0;
+
+    if (vbmeta_header.algorithm_type != AVB_ALGORITHM_TYPE_NONE) {
+      max_field_size = vbmeta_header.signature_size;
+      if (vbmeta_header.public_key_size > max_field_size) {
+        max_field_size = vbmeta_header.public_key_size;
+      }
+      if (vbmeta_header.public_key_metadata_size > max_field_size) {
+        max_field_size = vbmeta_header.public_key_metadata_size;
+      }
+      if (max_field_size > vbmeta_image_size) {
+        max_field_size = vbmeta_image_size;
+      }
+    }
+    vbmeta_stream = avb_vbmeta_stream_new((size_t)max_field_size, 0);
+    if (vbmeta_stream == NULL) {
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+      goto out;
+    }
+
+    if (!vbmeta_preloaded) {
+      size_t rest_num_read;
+
+      vbmeta_buf = allocate_io_buffer(
+          ops, memory, full_partition_name, (size_t)vbmeta_image_size);
+      if (vbmeta_buf == NULL) {
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+        goto out;
+      }
+      avb_memcpy(vbmeta_buf, vbmeta_header_buf, sizeof(AvbVBMetaImageHeader));
+      io_ret = read_vbmeta_data(
+          ops,
+          full_partition_name,
+          preloaded_data,
+          preloaded_size,
+          vbmeta_offset + sizeof(AvbVBMetaImageHeader),
+          (size_t)vbmeta_image_size - sizeof(AvbVBMetaImageHeader),
+          vbmeta_buf + sizeof(AvbVBMetaImageHeader),
+          &rest_num_read);
+      if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+        goto out;
+      } else if (io_ret != AVB_IO_RESULT_OK) {
+        avb_error(full_partition_name, ": Error loading vbmeta data.\n");
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+        goto out;
+      }
+      vbmeta_num_read = sizeof(AvbVBMetaImageHeader) + rest_num_read;
+    }
+
+    vbmeta_ret =
+        avb_vbmeta_stream_update(vbmeta_stream, vbmeta_buf, vbmeta_num_read);
+    if (vbmeta_ret == AVB_VBMETA_VERIFY_RESULT_OK) {
+      vbmeta_ret = avb_vbmeta_stream_finish(
+          vbmeta_stream, NULL, &pk_data, &pk_len, NULL, NULL);
+    }
+  }
   switch (vbmeta_ret) {
     case AVB_VBMETA_VERIFY_RESULT_OK:
       avb_assert(pk_data != NULL && pk_len > 0);
@@ -926,8 +1961,19 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
     goto out;
   }
   vbmeta_image_data = &slot_data->vbmeta_images[slot_data->num_vbmeta_images++];
-  vbmeta_image_data->partition_name = avb_strdup(partition_name);
+  /* Adopt |vbmeta_buf| before anything can fail so it's released with
+   * |slot_data| either way.
+   */
   vbmeta_image_data->vbmeta_data = vbmeta_buf;
+  vbmeta_image_data->preloaded = vbmeta_preloaded;
+  if (!vbmeta_preloaded) {
+    vbmeta_image_data->io_buffer_ops = io_buffer_ops(ops);
+  }
+  vbmeta_image_data->partition_name = avb_strdup(partition_name);
+  if (vbmeta_image_data->partition_name == NULL) {
+    ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+    goto out;
+  }
   /* Note that |vbmeta_buf| is actually |vbmeta_num_read| bytes long
    * and this includes data past the end of the image. Pass the
    * actual size of the vbmeta image. Also, no need to use
@@ -938,6 +1984,12 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
       vbmeta_header.authentication_data_block_size +
       vbmeta_header.auxiliary_data_block_size;
   vbmeta_image_data->verify_result = vbmeta_ret;
+  avb_sha256_update(&vbmeta_digest->sha256,
+                    vbmeta_image_data->vbmeta_data,
+                    vbmeta_image_data->vbmeta_size);
+  avb_sha512_update(&vbmeta_digest->sha512,
+                    vbmeta_image_data->vbmeta_data,
+                    vbmeta_image_data->vbmeta_size);
 
   /* If verification has been disabled by setting a bit in the image,
    * we're done... except that we need to load the entirety of the
@@ -952,29 +2004,121 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
      * returns true) and we want to convey that error.
      */
     sub_ret = load_requested_partitions(
-        ops, requested_partitions, ab_suffix, slot_data);
+        ops, memory, requested_partitions, ab_suffix, slot_data);
     if (sub_ret != AVB_SLOT_VERIFY_RESULT_OK) {
       ret = sub_ret;
     }
-    goto out;
+    goto out;
+  }
+
+  /* Now go through all descriptors and take the appropriate action:
+   *
+   * - hash descriptor: Load data from partition, calculate hash, and
+   *   checks that it matches what's in the hash descriptor.
+   *
+   * - hashtree descriptor: Do nothing since verification happens
+   *   on-the-fly from within the OS. (Unless the descriptor uses a
+   *   persistent digest, in which case we need to find it).
+   *
+   * - chained partition descriptor: Load the footer, load the vbmeta
+   *   image, verify vbmeta image (includes rollback checks, hash
+   *   checks, bail on chained partitions).
+   */
+  descriptors =
+      avb_descriptor_get_all(vbmeta_buf, vbmeta_num_read, &num_descriptors);
+  if (descriptors == NULL) {
+    ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+    goto out;
+  }
+  if (!memory_reserve(memory, descriptors_size(num_descriptors))) {
+    avb_error(full_partition_name,
+              ": Descriptors would exceed memory budget.\n");
+    avb_free(descriptors);
+    ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+    goto out;
+  }
+  if (walk == NULL) {
+    avb_memset(&chained_walk, 0, sizeof chained_walk);
+    walk = &chained_walk;
+  }
+  avb_assert(walk->descriptors == NULL);
+  avb_memcpy(walk->partition_name,
+             full_partition_name,
+             sizeof full_partition_name);
+  walk->descriptors = descriptors;
+  walk->num_descriptors = num_descriptors;
+  walk->next_descriptor = 0;
+  walk->chain_pending = false;
+  walk->is_main_vbmeta = is_main_vbmeta;
+  walk->toplevel_vbmeta_flags = toplevel_vbmeta_flags;
+  walk->rollback_index_location = rollback_index_location_to_use;
+  walk->rollback_index = vbmeta_header.rollback_index;
+  walk->algorithm_type = (AvbAlgorithmType)vbmeta_header.algorithm_type;
+  walk->out_algorithm_type = out_algorithm_type;
+  walk->out_additional_cmdline_subst = out_additional_cmdline_subst;
+  walk->ret = ret;
+  ret = walk_vbmeta_descriptors(ops,
+                                memory,
+                                requested_partitions,
+                                ab_suffix,
+                                flags,
+                                allow_verification_error,
+                                slot_data,
+                                vbmeta_digest,
+                                deferred_jobs,
+                                walk,
+                                walk != &chained_walk);
+  avb_assert(walk != &chained_walk || walk->descriptors == NULL);
+
+out:
+  /* If |vbmeta_image_data| isn't NULL it means that it adopted
+   * |vbmeta_buf| so in that case don't free it here.
+   */
+  if (vbmeta_image_data == NULL) {
+    if (vbmeta_buf != NULL && !vbmeta_preloaded) {
+      free_io_buffer(ops, memory, vbmeta_buf, (size_t)vbmeta_image_size);
+    }
   }
+  avb_vbmeta_stream_free(vbmeta_stream);
+  return ret;
+}
 
-  /* Now go through all descriptors and take the appropriate action:
-   *
-   * - hash descriptor: Load data from partition, calculate hash, and
-   *   checks that it matches what's in the hash descriptor.
-   *
-   * - hashtree descriptor: Do nothing since verification happens
-   *   on-the-fly from within the OS. (Unless the descriptor uses a
-   *   persistent digest, in which case we need to find it).
-   *
-   * - chained partition descriptor: Load the footer, load the vbmeta
-   *   image, verify vbmeta image (includes rollback checks, hash
-   *   checks, bail on chained partitions).
-   */
-  descriptors =
-      avb_descriptor_get_all(vbmeta_buf, vbmeta_num_read, &num_descriptors);
-  for (n = 0; n < num_descriptors; n++) {
+/* Goes through the descriptors of the vbmeta image in |walk| and takes
+ * the appropriate action, see load_and_verify_vbmeta(). Once all
+ * descriptors have been handled, or on an error which stops
+ * verification, |walk->descriptors| is released and set to NULL.
+ *
+ * If |stop_at_chain| is true the walk returns early with
+ * |walk->descriptors| still set when it gets to a chain partition
+ * descriptor. Calling this function again then verifies the chained
+ * vbmeta image and carries on with the rest of the descriptors. This
+ * way each call verifies at most one vbmeta image.
+ *
+ * Returns the result so far.
+ */
+static AvbSlotVerifyResult walk_vbmeta_descriptors(
+    AvbOps* ops,
+    AvbSlotVerifyMemory* memory,
+    const char* const* requested_partitions,
+    const char* ab_suffix,
+    AvbSlotVerifyFlags flags,
+    bool allow_verification_error,
+    AvbSlotVerifyData* slot_data,
+    AvbVBMetaDigestCtx* vbmeta_digest,
+    AvbHashPartitionJobList* deferred_jobs,
+    AvbVBMetaWalk* walk,
+    bool stop_at_chain) {
+  const char* full_partition_name = walk->partition_name;
+  const AvbDescriptor** descriptors = walk->descriptors;
+  bool is_main_vbmeta = walk->is_main_vbmeta;
+  AvbVBMetaImageFlags toplevel_vbmeta_flags = walk->toplevel_vbmeta_flags;
+  AvbCmdlineSubstList* out_additional_cmdline_subst =
+      walk->out_additional_cmdline_subst;
+  AvbSlotVerifyResult ret = walk->ret;
+  bool use_ab_suffix;
+  size_t n;
+
+  for (n = walk->next_descriptor; n < walk->num_descriptors; n++) {
     AvbDescriptor desc;
 
     if (!avb_descriptor_validate_and_byteswap(descriptors[n], &desc)) {
@@ -986,12 +2130,23 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
     switch (desc.tag) {
       case AVB_DESCRIPTOR_TAG_HASH: {
         AvbSlotVerifyResult sub_ret;
-        sub_ret = load_and_verify_hash_partition(ops,
-                                                 requested_partitions,
-                                                 ab_suffix,
-                                                 allow_verification_error,
-                                                 descriptors[n],
-                                                 slot_data);
+        if (deferred_jobs != NULL) {
+          sub_ret = queue_hash_partition(ops,
+                                         memory,
+                                         requested_partitions,
+                                         ab_suffix,
+                                         allow_verification_error,
+                                         descriptors[n],
+                                         deferred_jobs);
+        } else {
+          sub_ret = load_and_verify_hash_partition(ops,
+                                                   memory,
+                                                   requested_partitions,
+                                                   ab_suffix,
+                                                   allow_verification_error,
+                                                   descriptors[n],
+                                                   slot_data);
+        }
         if (sub_ret != AVB_SLOT_VERIFY_RESULT_OK) {
           ret = sub_ret;
           if (!allow_verification_error || !result_should_continue(ret)) {
@@ -1029,17 +2184,24 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
           ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
           goto out;
         }
-        if ((chain_desc.flags & AVB_HASH_DESCRIPTOR_FLAGS_DO_NOT_USE_AB) != 0){
-          use_ab_suffix = false;
-        }else{
-          use_ab_suffix = true;
-        }
+        use_ab_suffix =
+            (chain_desc.flags & AVB_HASH_DESCRIPTOR_FLAGS_DO_NOT_USE_AB) == 0;
         chain_partition_name = ((const uint8_t*)descriptors[n]) +
                                sizeof(AvbChainPartitionDescriptor);
         chain_public_key = chain_partition_name + chain_desc.partition_name_len;
 
+        /* Leave verifying the chained vbmeta image to the next call. */
+        if (stop_at_chain && !walk->chain_pending) {
+          walk->chain_pending = true;
+          walk->next_descriptor = n;
+          walk->ret = ret;
+          return ret;
+        }
+        walk->chain_pending = false;
+
         sub_ret =
             load_and_verify_vbmeta(ops,
+                                   memory,
                                    requested_partitions,
                                    ab_suffix,
                                    flags,
@@ -1051,9 +2213,12 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
                                    chain_public_key,
                                    chain_desc.public_key_len,
                                    slot_data,
+                                   vbmeta_digest,
                                    NULL, /* out_algorithm_type */
                                    NULL, /* out_additional_cmdline_subst */
-                                   use_ab_suffix);
+                                   use_ab_suffix,
+                                   deferred_jobs,
+                                   NULL /* walk */);
         if (sub_ret != AVB_SLOT_VERIFY_RESULT_OK) {
           ret = sub_ret;
           if (!result_should_continue(ret)) {
@@ -1229,32 +2394,27 @@ static AvbSlotVerifyResult load_and_verify_vbmeta(
     }
   }
 
-  if (rollback_index_location_to_use >=
+  if (walk->rollback_index_location >=
       AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS) {
     avb_error(full_partition_name, ": Invalid rollback_index_location.\n");
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
     goto out;
   }
 
-  slot_data->rollback_indexes[rollback_index_location_to_use] =
-      vbmeta_header.rollback_index;
+  slot_data->rollback_indexes[walk->rollback_index_location] =
+      walk->rollback_index;
 
-  if (out_algorithm_type != NULL) {
-    *out_algorithm_type = (AvbAlgorithmType)vbmeta_header.algorithm_type;
+  if (walk->out_algorithm_type != NULL) {
+    *walk->out_algorithm_type = walk->algorithm_type;
   }
 
 out:
-  /* If |vbmeta_image_data| isn't NULL it means that it adopted
-   * |vbmeta_buf| so in that case don't free it here.
-   */
-  if (vbmeta_image_data == NULL) {
-    if (vbmeta_buf != NULL) {
-      avb_free(vbmeta_buf);
-    }
-  }
-  if (descriptors != NULL) {
-    avb_free(descriptors);
+  if (walk->descriptors != NULL) {
+    avb_free(walk->descriptors);
+    memory_release(memory, descriptors_size(walk->num_descriptors));
+    walk->descriptors = NULL;
   }
+  walk->ret = ret;
   return ret;
 }
 
@@ -1382,20 +2542,67 @@ static bool has_system_partition(AvbOps* ops, const char* ab_suffix) {
   return true;
 }
 
-AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
-                                    const char* const* requested_partitions,
-                                    const char* ab_suffix,
-                                    AvbSlotVerifyFlags flags,
-                                    AvbHashtreeErrorMode hashtree_error_mode,
-                                    AvbSlotVerifyData** out_data) {
+struct AvbSlotVerifyContext {
+  AvbOps* ops;
+  const char* const* requested_partitions;
+  const char* ab_suffix;
+  AvbSlotVerifyFlags flags;
+  AvbHashtreeErrorMode hashtree_error_mode;
+  bool allow_verification_error;
+  bool defer_hashing;
+  bool vbmeta_verified;
+  bool done;
+  AvbSlotVerifyResult ret;
+  AvbSlotVerifyData* slot_data;
+  AvbVBMetaDigestCtx vbmeta_digest;
+  AvbAlgorithmType algorithm_type;
+  AvbCmdlineSubstList* additional_cmdline_subst;
+  size_t num_toplevel_vbmeta;
+  AvbVBMetaWalk vbmeta_walk;
+  AvbHashPartitionJobList jobs;
+  AvbSlotVerifyMemory memory;
+};
+
+/* Releases everything held by |ctx| except |ctx| itself. */
+static void slot_verify_context_free(AvbSlotVerifyContext* ctx) {
+  size_t n;
+
+  if (ctx->vbmeta_walk.descriptors != NULL) {
+    avb_free(ctx->vbmeta_walk.descriptors);
+    memory_release(&ctx->memory,
+                   descriptors_size(ctx->vbmeta_walk.num_descriptors));
+    ctx->vbmeta_walk.descriptors = NULL;
+  }
+  for (n = ctx->jobs.next_job; n < ctx->jobs.num_jobs; n++) {
+    AvbHashPartitionJob* job = ctx->jobs.jobs[n];
+    if (job->image_buf != NULL && !job->image_preloaded) {
+      free_io_buffer(ctx->ops, job->memory, job->image_buf, job->image_size);
+      job->image_buf = NULL;
+    }
+    hash_partition_job_free(job);
+  }
+  ctx->jobs.next_job = ctx->jobs.num_jobs;
+  if (ctx->slot_data != NULL) {
+    avb_slot_verify_data_free(ctx->slot_data);
+    ctx->slot_data = NULL;
+  }
+  if (ctx->additional_cmdline_subst != NULL) {
+    avb_free_cmdline_subst_list(ctx->additional_cmdline_subst);
+    ctx->additional_cmdline_subst = NULL;
+  }
+}
+
+static AvbSlotVerifyResult slot_verify_context_init(
+    AvbSlotVerifyContext* ctx,
+    AvbOps* ops,
+    const char* const* requested_partitions,
+    const char* ab_suffix,
+    AvbSlotVerifyFlags flags,
+    AvbHashtreeErrorMode hashtree_error_mode,
+    bool defer_hashing) {
   AvbSlotVerifyResult ret;
-  AvbSlotVerifyData* slot_data = NULL;
-  AvbAlgorithmType algorithm_type = AVB_ALGORITHM_TYPE_NONE;
-  bool using_boot_for_vbmeta = false;
-  AvbVBMetaImageHeader toplevel_vbmeta;
   bool allow_verification_error =
       (flags & AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR);
-  AvbCmdlineSubstList* additional_cmdline_subst = NULL;
 
   /* Fail early if we're missing the AvbOps needed for slot verification. */
   avb_assert(ops->read_is_device_unlocked != NULL);
@@ -1404,9 +2611,18 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
   avb_assert(ops->read_rollback_index != NULL);
   avb_assert(ops->get_unique_guid_for_partition != NULL);
 
-  if (out_data != NULL) {
-    *out_data = NULL;
-  }
+  avb_memset(ctx, 0, sizeof(AvbSlotVerifyContext));
+  ctx->ops = ops;
+  ctx->requested_partitions = requested_partitions;
+  ctx->ab_suffix = ab_suffix;
+  ctx->flags = flags;
+  ctx->hashtree_error_mode = hashtree_error_mode;
+  ctx->allow_verification_error = allow_verification_error;
+  ctx->defer_hashing = defer_hashing;
+  ctx->ret = AVB_SLOT_VERIFY_RESULT_OK;
+  ctx->algorithm_type = AVB_ALGORITHM_TYPE_NONE;
+  avb_sha256_init(&ctx->vbmeta_digest.sha256);
+  avb_sha512_init(&ctx->vbmeta_digest.sha512);
 
   /* Allowing dm-verity errors defeats the purpose of verified boot so
    * only allow this if set up to allow verification errors
@@ -1448,26 +2664,34 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
     avb_assert(ops->validate_vbmeta_public_key != NULL);
   }
 
-  slot_data = avb_calloc(sizeof(AvbSlotVerifyData));
-  if (slot_data == NULL) {
+  /* Account for the bookkeeping in AvbSlotVerifyData, it's kept until
+   * the caller frees it. The budget, if any, is set after this.
+   */
+  memory_reserve(&ctx->memory,
+                 sizeof(AvbSlotVerifyData) +
+                     sizeof(AvbVBMetaData) * MAX_NUMBER_OF_VBMETA_IMAGES +
+                     sizeof(AvbPartitionData) *
+                         MAX_NUMBER_OF_LOADED_PARTITIONS);
+  ctx->slot_data = avb_calloc(sizeof(AvbSlotVerifyData));
+  if (ctx->slot_data == NULL) {
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     goto fail;
   }
-  slot_data->vbmeta_images =
+  ctx->slot_data->vbmeta_images =
       avb_calloc(sizeof(AvbVBMetaData) * MAX_NUMBER_OF_VBMETA_IMAGES);
-  if (slot_data->vbmeta_images == NULL) {
+  if (ctx->slot_data->vbmeta_images == NULL) {
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     goto fail;
   }
-  slot_data->loaded_partitions =
+  ctx->slot_data->loaded_partitions =
       avb_calloc(sizeof(AvbPartitionData) * MAX_NUMBER_OF_LOADED_PARTITIONS);
-  if (slot_data->loaded_partitions == NULL) {
+  if (ctx->slot_data->loaded_partitions == NULL) {
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     goto fail;
   }
 
-  additional_cmdline_subst = avb_new_cmdline_subst_list();
-  if (additional_cmdline_subst == NULL) {
+  ctx->additional_cmdline_subst = avb_new_cmdline_subst_list();
+  if (ctx->additional_cmdline_subst == NULL) {
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     goto fail;
   }
@@ -1480,49 +2704,178 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
       ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT;
       goto fail;
     }
+  }
 
-    /* No vbmeta partition, go through each of the requested partitions... */
-    for (size_t n = 0; requested_partitions[n] != NULL; n++) {
-      ret = load_and_verify_vbmeta(ops,
-                                   requested_partitions,
-                                   ab_suffix,
-                                   flags,
-                                   allow_verification_error,
-                                   0 /* toplevel_vbmeta_flags */,
-                                   0 /* rollback_index_location */,
-                                   requested_partitions[n],
-                                   avb_strlen(requested_partitions[n]),
-                                   NULL /* expected_public_key */,
-                                   0 /* expected_public_key_length */,
-                                   slot_data,
-                                   &algorithm_type,
-                                   additional_cmdline_subst,
-                                   true /*use_ab_suffix*/);
-      if (!allow_verification_error && ret != AVB_SLOT_VERIFY_RESULT_OK) {
-        goto fail;
-      }
-    }
+  return AVB_SLOT_VERIFY_RESULT_OK;
+
+fail:
+  slot_verify_context_free(ctx);
+  return ret;
+}
+
+/* Verifies the next vbmeta image, i.e. checks its signature and
+ * rollback index, and acts on its descriptors up to the next chain
+ * partition descriptor. Depending on |ctx->defer_hashing|, partitions
+ * with hash descriptors are either verified right away or queued in
+ * |ctx->jobs|. Sets |ctx->vbmeta_verified| once there are no more
+ * vbmeta images to verify.
+ */
+static void slot_verify_context_verify_vbmeta(AvbSlotVerifyContext* ctx) {
+  AvbHashPartitionJobList* deferred_jobs =
+      ctx->defer_hashing ? &ctx->jobs : NULL;
+  AvbVBMetaWalk* walk = &ctx->vbmeta_walk;
+  const char* partition_name;
+  AvbSlotVerifyResult ret;
 
+  if (walk->descriptors != NULL) {
+    /* Verify the chained vbmeta image the walk stopped at... */
+    ret = walk_vbmeta_descriptors(ctx->ops,
+                                  &ctx->memory,
+                                  ctx->requested_partitions,
+                                  ctx->ab_suffix,
+                                  ctx->flags,
+                                  ctx->allow_verification_error,
+                                  ctx->slot_data,
+                                  &ctx->vbmeta_digest,
+                                  deferred_jobs,
+                                  walk,
+                                  true /* stop_at_chain */);
   } else {
-    /* Usual path, load "vbmeta"... */
-    ret = load_and_verify_vbmeta(ops,
-                                 requested_partitions,
-                                 ab_suffix,
-                                 flags,
-                                 allow_verification_error,
+    if (ctx->flags & AVB_SLOT_VERIFY_FLAGS_NO_VBMETA_PARTITION) {
+      /* No vbmeta partition, go through each of the requested
+       * partitions...
+       */
+      partition_name = ctx->requested_partitions[ctx->num_toplevel_vbmeta];
+    } else {
+      /* Usual path, load "vbmeta"... */
+      partition_name = "vbmeta";
+    }
+    ctx->num_toplevel_vbmeta++;
+    ret = load_and_verify_vbmeta(ctx->ops,
+                                 &ctx->memory,
+                                 ctx->requested_partitions,
+                                 ctx->ab_suffix,
+                                 ctx->flags,
+                                 ctx->allow_verification_error,
                                  0 /* toplevel_vbmeta_flags */,
                                  0 /* rollback_index_location */,
-                                 "vbmeta",
-                                 avb_strlen("vbmeta"),
+                                 partition_name,
+                                 avb_strlen(partition_name),
                                  NULL /* expected_public_key */,
                                  0 /* expected_public_key_length */,
-                                 slot_data,
-                                 &algorithm_type,
-                                 additional_cmdline_subst,
-                                 true /*use_ab_suffix*/);
-    if (!allow_verification_error && ret != AVB_SLOT_VERIFY_RESULT_OK) {
-      goto fail;
+                                 ctx->slot_data,
+                                 &ctx->vbmeta_digest,
+                                 &ctx->algorithm_type,
+                                 ctx->additional_cmdline_subst,
+                                 true /*use_ab_suffix*/,
+                                 deferred_jobs,
+                                 walk);
+  }
+  ctx->ret = ret;
+
+  /* Stopped at a chain partition descriptor. */
+  if (walk->descriptors != NULL) {
+    return;
+  }
+
+  if ((ctx->flags & AVB_SLOT_VERIFY_FLAGS_NO_VBMETA_PARTITION) &&
+      ctx->requested_partitions[ctx->num_toplevel_vbmeta] != NULL &&
+      (ctx->allow_verification_error || ret == AVB_SLOT_VERIFY_RESULT_OK)) {
+    return;
+  }
+
+  /* No more vbmeta images will be appended to |ctx->slot_data|. */
+  avb_memcpy(ctx->slot_data->vbmeta_digest_sha256,
+             avb_sha256_final(&ctx->vbmeta_digest.sha256),
+             AVB_SHA256_DIGEST_SIZE);
+  avb_memcpy(ctx->slot_data->vbmeta_digest_sha512,
+             avb_sha512_final(&ctx->vbmeta_digest.sha512),
+             AVB_SHA512_DIGEST_SIZE);
+  ctx->vbmeta_verified = true;
+}
+
+/* Advances verification by one vbmeta image or at most about |budget|
+ * bytes of partition data, see avb_slot_verify_step(). Returns true if
+ * there is more to do.
+ */
+static bool slot_verify_context_step(AvbSlotVerifyContext* ctx,
+                                     size_t budget) {
+  AvbHashPartitionJobList* jobs = &ctx->jobs;
+
+  if (ctx->done) {
+    return false;
+  }
+
+  if (!ctx->vbmeta_verified) {
+    slot_verify_context_verify_vbmeta(ctx);
+    if (!ctx->vbmeta_verified) {
+      return true;
+    }
+    if ((!ctx->allow_verification_error &&
+         ctx->ret != AVB_SLOT_VERIFY_RESULT_OK) ||
+        !result_should_continue(ctx->ret)) {
+      ctx->done = true;
+      return false;
+    }
+    if (jobs->next_job == jobs->num_jobs) {
+      ctx->done = true;
+    }
+    return !ctx->done;
+  }
+
+  while (jobs->next_job < jobs->num_jobs && budget > 0) {
+    AvbHashPartitionJob* job = jobs->jobs[jobs->next_job];
+    AvbSlotVerifyResult sub_ret;
+    bool job_done = false;
+
+    sub_ret = hash_partition_job_step(ctx->ops, job, &budget, &job_done);
+    if (sub_ret == AVB_SLOT_VERIFY_RESULT_OK && !job_done) {
+      /* Out of budget, continue with this job on the next step. */
+      break;
     }
+    sub_ret =
+        hash_partition_job_finish(ctx->ops, job, ctx->slot_data, sub_ret);
+    hash_partition_job_free(job);
+    jobs->jobs[jobs->next_job++] = NULL;
+
+    if (sub_ret != AVB_SLOT_VERIFY_RESULT_OK) {
+      ctx->ret = sub_ret;
+      if (!ctx->allow_verification_error || !result_should_continue(sub_ret)) {
+        ctx->done = true;
+        return false;
+      }
+    }
+  }
+
+  if (jobs->next_job == jobs->num_jobs) {
+    ctx->done = true;
+  }
+  return !ctx->done;
+}
+
+/* Completes verification and releases everything held by |ctx| except
+ * |ctx| itself, see avb_slot_verify_finish().
+ */
+static AvbSlotVerifyResult slot_verify_context_finish(
+    AvbSlotVerifyContext* ctx, AvbSlotVerifyData** out_data) {
+  AvbSlotVerifyResult ret;
+  AvbSlotVerifyData* slot_data = ctx->slot_data;
+  const char* ab_suffix = ctx->ab_suffix;
+  AvbSlotVerifyFlags flags = ctx->flags;
+  AvbHashtreeErrorMode hashtree_error_mode = ctx->hashtree_error_mode;
+  bool using_boot_for_vbmeta = false;
+  AvbVBMetaImageHeader toplevel_vbmeta;
+
+  if (out_data != NULL) {
+    *out_data = NULL;
+  }
+
+  while (slot_verify_context_step(ctx, SIZE_MAX)) {
+  }
+  ret = ctx->ret;
+
+  if (!ctx->allow_verification_error && ret != AVB_SLOT_VERIFY_RESULT_OK) {
+    goto fail;
   }
 
   if (!result_should_continue(ret)) {
@@ -1563,7 +2916,7 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
     // Devices with dynamic partitions won't have system partition.
     // Instead, it has a large super partition to accommodate *.img files.
     // See b/119551429 for details.
-    if (has_system_partition(ops, ab_suffix)) {
+    if (has_system_partition(ctx->ops, ab_suffix)) {
       slot_data->cmdline =
           avb_strdup("root=PARTUUID=$(ANDROID_SYSTEM_PARTUUID)");
     } else {
@@ -1581,7 +2934,7 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
         AVB_HASHTREE_ERROR_MODE_MANAGED_RESTART_AND_EIO) {
       AvbIOResult io_ret;
       io_ret = avb_manage_hashtree_error_mode(
-          ops, flags, slot_data, &resolved_hashtree_error_mode);
+          ctx->ops, flags, slot_data, &resolved_hashtree_error_mode);
       if (io_ret != AVB_IO_RESULT_OK) {
         ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
         if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
@@ -1594,11 +2947,11 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
 
     /* Add options... */
     AvbSlotVerifyResult sub_ret;
-    sub_ret = avb_append_options(ops,
+    sub_ret = avb_append_options(ctx->ops,
                                  flags,
                                  slot_data,
                                  &toplevel_vbmeta,
-                                 algorithm_type,
+                                 ctx->algorithm_type,
                                  hashtree_error_mode,
                                  resolved_hashtree_error_mode);
     if (sub_ret != AVB_SLOT_VERIFY_RESULT_OK) {
@@ -1610,11 +2963,11 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
   /* Substitute $(ANDROID_SYSTEM_PARTUUID) and friends. */
   if (slot_data->cmdline != NULL && avb_strlen(slot_data->cmdline) != 0) {
     char* new_cmdline;
-    new_cmdline = avb_sub_cmdline(ops,
+    new_cmdline = avb_sub_cmdline(ctx->ops,
                                   slot_data->cmdline,
                                   ab_suffix,
                                   using_boot_for_vbmeta,
-                                  additional_cmdline_subst);
+                                  ctx->additional_cmdline_subst);
     if (new_cmdline != slot_data->cmdline) {
       if (new_cmdline == NULL) {
         ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
@@ -1627,25 +2980,249 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
 
   if (out_data != NULL) {
     *out_data = slot_data;
-  } else {
-    avb_slot_verify_data_free(slot_data);
+    ctx->slot_data = NULL;
   }
+  slot_verify_context_free(ctx);
 
-  avb_free_cmdline_subst_list(additional_cmdline_subst);
-  additional_cmdline_subst = NULL;
-
-  if (!allow_verification_error) {
+  if (!ctx->allow_verification_error) {
     avb_assert(ret == AVB_SLOT_VERIFY_RESULT_OK);
   }
 
   return ret;
 
 fail:
-  if (slot_data != NULL) {
-    avb_slot_verify_data_free(slot_data);
+  slot_verify_context_free(ctx);
+  return ret;
+}
+
+AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
+                                    const char* const* requested_partitions,
+                                    const char* ab_suffix,
+                                    AvbSlotVerifyFlags flags,
+                                    AvbHashtreeErrorMode hashtree_error_mode,
+                                    AvbSlotVerifyData** out_data) {
+  AvbSlotVerifyContext ctx;
+  AvbSlotVerifyResult ret;
+
+  if (out_data != NULL) {
+    *out_data = NULL;
+  }
+
+  ret = slot_verify_context_init(&ctx,
+                                 ops,
+                                 requested_partitions,
+                                 ab_suffix,
+                                 flags,
+                                 hashtree_error_mode,
+                                 false /* defer_hashing */);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+    return ret;
+  }
+  return slot_verify_context_finish(&ctx, out_data);
+}
+
+AvbSlotVerifyResult avb_slot_verify_begin(
+    AvbOps* ops,
+    const char* const* requested_partitions,
+    const char* ab_suffix,
+    AvbSlotVerifyFlags flags,
+    AvbHashtreeErrorMode hashtree_error_mode,
+    AvbSlotVerifyContext** out_ctx) {
+  AvbSlotVerifyContext* ctx;
+  AvbSlotVerifyResult ret;
+
+  *out_ctx = NULL;
+
+  ctx = avb_malloc(sizeof(AvbSlotVerifyContext));
+  if (ctx == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  ret = slot_verify_context_init(ctx,
+                                 ops,
+                                 requested_partitions,
+                                 ab_suffix,
+                                 flags,
+                                 hashtree_error_mode,
+                                 true /* defer_hashing */);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+    avb_free(ctx);
+    return ret;
+  }
+
+  *out_ctx = ctx;
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
+void avb_slot_verify_set_memory_budget(AvbSlotVerifyContext* ctx,
+                                       size_t budget) {
+  ctx->memory.budget = budget;
+}
+
+size_t avb_slot_verify_get_peak_memory_usage(const AvbSlotVerifyContext* ctx) {
+  return ctx->memory.peak;
+}
+
+bool avb_slot_verify_step(AvbSlotVerifyContext* ctx, size_t budget) {
+  avb_assert(budget > 0);
+  return slot_verify_context_step(ctx, budget);
+}
+
+AvbSlotVerifyResult avb_slot_verify_finish(AvbSlotVerifyContext* ctx,
+                                           AvbSlotVerifyData** out_data) {
+  AvbSlotVerifyResult ret;
+
+  ret = slot_verify_context_finish(ctx, out_data);
+  avb_free(ctx);
+  return ret;
+}
+
+static bool slot_data_has_partition(const AvbSlotVerifyData* data,
+                                    const char* partition_name) {
+  size_t n;
+  for (n = 0; n < data->num_loaded_partitions; n++) {
+    if (avb_strcmp(data->loaded_partitions[n].partition_name,
+                   partition_name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+AvbSlotVerifyResult avb_slot_verify_add_partitions(
+    AvbOps* ops,
+    const char* const* requested_partitions,
+    AvbSlotVerifyFlags flags,
+    AvbSlotVerifyData* data) {
+  AvbSlotVerifyResult ret = AVB_SLOT_VERIFY_RESULT_OK;
+  AvbSlotVerifyMemory memory = {0, 0, 0};
+  AvbVBMetaImageHeader toplevel_vbmeta;
+  const char** pending = NULL;
+  size_t num_pending = 0;
+  size_t num_loaded_before = data->num_loaded_partitions;
+  bool allow_verification_error =
+      flags & AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR;
+  size_t n, m;
+
+  if (data->num_vbmeta_images == 0) {
+    avb_error("No vbmeta images in slot data.\n");
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT;
+  }
+
+  /* Only extend data which was fully verified unless the caller is
+   * fine with verification errors.
+   */
+  if (!allow_verification_error) {
+    for (n = 0; n < data->num_vbmeta_images; n++) {
+      if (data->vbmeta_images[n].verify_result !=
+          AVB_VBMETA_VERIFY_RESULT_OK) {
+        avb_error(data->vbmeta_images[n].partition_name,
+                  ": vbmeta image was not successfully verified.\n");
+        return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT;
+      }
+    }
+  }
+
+  /* Skip partitions which have already been loaded. */
+  n = 0;
+  while (requested_partitions[n] != NULL) {
+    n++;
+  }
+  pending = avb_calloc(sizeof(const char*) * (n + 1));
+  if (pending == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  for (n = 0; requested_partitions[n] != NULL; n++) {
+    if (!slot_data_has_partition(data, requested_partitions[n])) {
+      pending[num_pending++] = requested_partitions[n];
+    }
+  }
+  if (num_pending == 0) {
+    goto out;
+  }
+
+  avb_vbmeta_image_header_to_host_byte_order(
+      (const AvbVBMetaImageHeader*)data->vbmeta_images[0].vbmeta_data,
+      &toplevel_vbmeta);
+  if (toplevel_vbmeta.flags & AVB_VBMETA_IMAGE_FLAGS_VERIFICATION_DISABLED) {
+    ret = load_requested_partitions(
+        ops, &memory, pending, data->ab_suffix, data);
+    goto out;
+  }
+
+  /* The vbmeta images have already been verified so there is no need
+   * to check signatures, rollback indexes or chain descriptors again;
+   * just look for hash descriptors for the pending partitions.
+   */
+  for (n = 0; n < data->num_vbmeta_images; n++) {
+    AvbVBMetaData* vbmeta = &data->vbmeta_images[n];
+    const AvbDescriptor** descriptors;
+    size_t num_descriptors;
+
+    descriptors = avb_descriptor_get_all(
+        vbmeta->vbmeta_data, vbmeta->vbmeta_size, &num_descriptors);
+    for (m = 0; m < num_descriptors; m++) {
+      AvbDescriptor desc;
+      AvbSlotVerifyResult sub_ret;
+
+      if (!avb_descriptor_validate_and_byteswap(descriptors[m], &desc)) {
+        avb_error(vbmeta->partition_name, ": Descriptor is invalid.\n");
+        ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+        break;
+      }
+      if (desc.tag != AVB_DESCRIPTOR_TAG_HASH) {
+        continue;
+      }
+      sub_ret = load_and_verify_hash_partition(ops,
+                                               &memory,
+                                               pending,
+                                               data->ab_suffix,
+                                               allow_verification_error,
+                                               descriptors[m],
+                                               data);
+      if (sub_ret != AVB_SLOT_VERIFY_RESULT_OK) {
+        ret = sub_ret;
+        if (!allow_verification_error || !result_should_continue(ret)) {
+          break;
+        }
+      }
+    }
+    if (descriptors != NULL) {
+      avb_free(descriptors);
+    }
+    if (ret != AVB_SLOT_VERIFY_RESULT_OK &&
+        (!allow_verification_error || !result_should_continue(ret))) {
+      goto out;
+    }
+  }
+
+  /* Every partition must have had a hash descriptor. */
+  for (n = 0; n < num_pending; n++) {
+    if (!slot_data_has_partition(data, pending[n])) {
+      avb_error(pending[n], ": No hash descriptor for partition.\n");
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT;
+      goto out;
+    }
+  }
+
+out:
+  /* Leave |data| as it was unless errors are allowed. */
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK &&
+      (!allow_verification_error || !result_should_continue(ret))) {
+    for (n = num_loaded_before; n < data->num_loaded_partitions; n++) {
+      AvbPartitionData* loaded_partition = &data->loaded_partitions[n];
+      if (loaded_partition->partition_name != NULL) {
+        avb_free(loaded_partition->partition_name);
+      }
+      if (loaded_partition->data != NULL && !loaded_partition->preloaded) {
+        release_io_buffer(loaded_partition->io_buffer_ops,
+                          loaded_partition->data);
+      }
+      avb_memset(loaded_partition, 0, sizeof(AvbPartitionData));
+    }
+    data->num_loaded_partitions = num_loaded_before;
   }
-  if (additional_cmdline_subst != NULL) {
-    avb_free_cmdline_subst_list(additional_cmdline_subst);
+  if (pending != NULL) {
+    avb_free(pending);
   }
   return ret;
 }
@@ -1664,8 +3241,9 @@ void avb_slot_verify_data_free(AvbSlotVerifyData* data) {
       if (vbmeta_image->partition_name != NULL) {
         avb_free(vbmeta_image->partition_name);
       }
-      if (vbmeta_image->vbmeta_data != NULL) {
-        avb_free(vbmeta_image->vbmeta_data);
+      if (vbmeta_image->vbmeta_data != NULL && !vbmeta_image->preloaded) {
+        release_io_buffer(vbmeta_image->io_buffer_ops,
+                          vbmeta_image->vbmeta_data);
       }
     }
     avb_free(data->vbmeta_images);
@@ -1678,7 +3256,8 @@ void avb_slot_verify_data_free(AvbSlotVerifyData* data) {
         avb_free(loaded_partition->partition_name);
       }
       if (loaded_partition->data != NULL && !loaded_partition->preloaded) {
-        avb_free(loaded_partition->data);
+        release_io_buffer(loaded_partition->io_buffer_ops,
+                          loaded_partition->data);
       }
     }
     avb_free(data->loaded_partitions);
@@ -1732,30 +3311,17 @@ void avb_slot_verify_data_calculate_vbmeta_digest(const AvbSlotVerifyData* data,
                                                   AvbDigestType digest_type,
                                                   uint8_t* out_digest) {
   bool ret = false;
-  size_t n;
 
   switch (digest_type) {
     case AVB_DIGEST_TYPE_SHA256: {
-      AvbSHA256Ctx ctx;
-      avb_sha256_init(&ctx);
-      for (n = 0; n < data->num_vbmeta_images; n++) {
-        avb_sha256_update(&ctx,
-                          data->vbmeta_images[n].vbmeta_data,
-                          data->vbmeta_images[n].vbmeta_size);
-      }
-      avb_memcpy(out_digest, avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE);
+      avb_memcpy(
+          out_digest, data->vbmeta_digest_sha256, AVB_SHA256_DIGEST_SIZE);
       ret = true;
     } break;
 
     case AVB_DIGEST_TYPE_SHA512: {
-      AvbSHA512Ctx ctx;
-      avb_sha512_init(&ctx);
-      for (n = 0; n < data->num_vbmeta_images; n++) {
-        avb_sha512_update(&ctx,
-                          data->vbmeta_images[n].vbmeta_data,
-                          data->vbmeta_images[n].vbmeta_size);
-      }
-      avb_memcpy(out_digest, avb_sha512_final(&ctx), AVB_SHA512_DIGEST_SIZE);
+      avb_memcpy(
+          out_digest, data->vbmeta_digest_sha512, AVB_SHA512_DIGEST_SIZE);
       ret = true;
     } break;
 
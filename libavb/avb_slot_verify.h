@@ -112,7 +112,7 @@ typedef enum {
  * Also, if AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR is set the
  * contents loaded from |requested_partition| will be the contents of
  * the entire partition instead of just the size specified in the hash
- * descriptor.
+ * descriptor, if there is enough memory for it.
  *
  * The AVB_SLOT_VERIFY_FLAGS_RESTART_CAUSED_BY_HASHTREE_CORRUPTION flag
  * should be set if using AVB_HASHTREE_ERROR_MODE_MANAGED_RESTART_AND_EIO
@@ -127,12 +127,22 @@ typedef enum {
  * vbmeta structs. This flag is useful when booting into recovery on a device
  * not using A/B - see section "Booting into recovery" in README.md for
  * more information.
+ *
+ * If the AVB_SLOT_VERIFY_FLAGS_DM_MOD_CREATE flag is set then a
+ * dm-mod.create option is added to the kernel command-line with a
+ * read-only dm-verity device for each hashtree descriptor, so the
+ * kernel can set up verity devices at boot without waiting for
+ * userspace. Each device is named after its partition and refers to
+ * the data, hash tree and FEC by PARTUUID. Nothing is added if
+ * hashtree verification is disabled. The option can be moved to
+ * bootconfig as "kernel.dm-mod.create" if desired.
  */
 typedef enum {
   AVB_SLOT_VERIFY_FLAGS_NONE = 0,
   AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR = (1 << 0),
   AVB_SLOT_VERIFY_FLAGS_RESTART_CAUSED_BY_HASHTREE_CORRUPTION = (1 << 1),
   AVB_SLOT_VERIFY_FLAGS_NO_VBMETA_PARTITION = (1 << 2),
+  AVB_SLOT_VERIFY_FLAGS_DM_MOD_CREATE = (1 << 3),
 } AvbSlotVerifyFlags;
 
 /* Get a textual representation of |result|. */
@@ -147,24 +157,41 @@ const char* avb_slot_verify_result_to_string(AvbSlotVerifyResult result);
  * data which is |data_size| bytes long. If |preloaded| is set to true,
  * this structure dose not own |data|. The caller of |avb_slot_verify|
  * needs to make sure that the preloaded data outlives this
- * |AvbPartitionData| structure.
+ * |AvbPartitionData| structure. If |io_buffer_ops| is not NULL,
+ * |data| was allocated by its allocate_io_buffer() operation and is
+ * freed with its free_io_buffer() operation, otherwise with avb_free().
  *
  * Note that this is strictly less than the partition size - it's only
  * the image stored there, not the entire partition nor any of the
  * metadata.
+ *
+ * If the partition was checked against a hash descriptor, |digest|
+ * contains the |digest_len| bytes long digest of the image using the
+ * hash algorithm from the descriptor. Otherwise |digest_len| is zero.
+ * The |num_measurements| entries in |measurements| are the extra
+ * digests requested by the get_partition_measurements() operation,
+ * calculated in the same pass.
  */
 typedef struct {
   char* partition_name;
   uint8_t* data;
   size_t data_size;
   bool preloaded;
+  AvbOps* io_buffer_ops;
   AvbSlotVerifyResult verify_result;
+  uint8_t digest[AVB_SHA512_DIGEST_SIZE];
+  size_t digest_len;
+  AvbPartitionMeasurement measurements[AVB_MAX_NUMBER_OF_MEASUREMENTS];
+  size_t num_measurements;
 } AvbPartitionData;
 
 /* AvbVBMetaData contains a vbmeta struct loaded from a partition when
  * using avb_slot_verify(). The |partition_name| field contains the
  * name of the partition (without A/B suffix), |vbmeta_data| points to
- * the loaded data which is |vbmeta_size| bytes long.
+ * the loaded data which is |vbmeta_size| bytes long. If |preloaded| is
+ * set to true, |vbmeta_data| points into data returned by the
+ * get_preloaded_partition() operation and this structure does not own
+ * it, see AvbPartitionData. The same goes for |io_buffer_ops|.
  *
  * The |verify_result| field contains the result of
  * avb_vbmeta_image_verify() on the data. This is guaranteed to be
@@ -179,6 +206,8 @@ typedef struct {
   uint8_t* vbmeta_data;
   size_t vbmeta_size;
   AvbVBMetaVerifyResult verify_result;
+  bool preloaded;
+  AvbOps* io_buffer_ops;
 } AvbVBMetaData;
 
 /* AvbSlotVerifyData contains data needed to boot a particular slot
@@ -305,12 +334,21 @@ typedef struct {
   char* cmdline;
   uint64_t rollback_indexes[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
   AvbHashtreeErrorMode resolved_hashtree_error_mode;
+
+  /* Digests of all |vbmeta_images|, calculated as they are loaded.
+   * Use avb_slot_verify_data_calculate_vbmeta_digest() to get these.
+   */
+  uint8_t vbmeta_digest_sha256[AVB_SHA256_DIGEST_SIZE];
+  uint8_t vbmeta_digest_sha512[AVB_SHA512_DIGEST_SIZE];
 } AvbSlotVerifyData;
 
 /* Calculates a digest of all vbmeta images in |data| using
  * the digest indicated by |digest_type|. Stores the result
  * in |out_digest| which must be large enough to hold a digest
  * of the requested type.
+ *
+ * The digests are calculated while the vbmeta images are loaded, so
+ * this doesn't hash any data.
  */
 void avb_slot_verify_data_calculate_vbmeta_digest(const AvbSlotVerifyData* data,
                                                   AvbDigestType digest_type,
@@ -364,7 +402,8 @@ void avb_slot_verify_data_free(AvbSlotVerifyData* data);
  * not signed.
  *
  * AVB_SLOT_VERIFY_RESULT_ERROR_OOM is returned if unable to
- * allocate memory.
+ * allocate memory, including if the budget set with
+ * avb_slot_verify_set_memory_budget() was hit.
  *
  * AVB_SLOT_VERIFY_RESULT_ERROR_IO is returned if an I/O error
  * occurred while trying to load data or get a rollback index.
@@ -395,6 +434,116 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
                                     AvbHashtreeErrorMode hashtree_error_mode,
                                     AvbSlotVerifyData** out_data);
 
+/* Opaque state for step-wise slot verification, see
+ * avb_slot_verify_begin().
+ */
+typedef struct AvbSlotVerifyContext AvbSlotVerifyContext;
+
+/* Like avb_slot_verify() but the work is split up into steps so the
+ * caller can do other things, e.g. bring up the display or feed a
+ * watchdog, in between. The arguments have the same meaning as for
+ * avb_slot_verify() and must remain valid until
+ * avb_slot_verify_finish() is called.
+ *
+ * On success, |out_ctx| is set to a newly allocated context. Call
+ * avb_slot_verify_step() until it returns false (or as long as
+ * desired) and then avb_slot_verify_finish() to get the result and
+ * free the context. If anything other than AVB_SLOT_VERIFY_RESULT_OK
+ * is returned, |out_ctx| is set to NULL and there is nothing to free.
+ */
+AvbSlotVerifyResult avb_slot_verify_begin(
+    AvbOps* ops,
+    const char* const* requested_partitions,
+    const char* ab_suffix,
+    AvbSlotVerifyFlags flags,
+    AvbHashtreeErrorMode hashtree_error_mode,
+    AvbSlotVerifyContext** out_ctx);
+
+/* Does some of the verification work for |ctx|.
+ *
+ * Each of the first calls loads and verifies one vbmeta image, i.e.
+ * checks its signature and rollback index, starting with the
+ * top-level image and followed by each chained partition. Once all
+ * vbmeta images are verified, following calls load and hash the
+ * partitions with hash descriptors, reading or hashing about |budget|
+ * bytes each call. Partitions are read and hashed in whole 4 KiB
+ * blocks so a call may go over |budget| by less than a block. The
+ * |budget| parameter must not be zero.
+ *
+ * Returns true if there is more work to do, false if verification is
+ * complete or has failed. Either way, the result is only available
+ * from avb_slot_verify_finish().
+ */
+bool avb_slot_verify_step(AvbSlotVerifyContext* ctx, size_t budget);
+
+/* Limits the memory used while verifying |ctx| to |budget| bytes, or
+ * removes the limit if |budget| is zero (the default). This counts
+ * partition and vbmeta data, queued hash partitions, descriptor
+ * arrays and the AvbSlotVerifyData bookkeeping, but not small strings
+ * such as partition names and the kernel command-line. Data returned
+ * by get_preloaded_partition() doesn't count towards the limit. Must
+ * be called before the first call to avb_slot_verify_step().
+ *
+ * Loading data that doesn't fit in the budget fails with
+ * AVB_SLOT_VERIFY_RESULT_ERROR_OOM before anything is allocated, with
+ * one exception: if AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR is
+ * set and a partition with a hash descriptor doesn't fit in the
+ * budget, only the image size given in the descriptor is loaded
+ * instead of the entire partition.
+ */
+void avb_slot_verify_set_memory_budget(AvbSlotVerifyContext* ctx,
+                                       size_t budget);
+
+/* Returns the largest amount of memory, in bytes, used at any point
+ * while verifying |ctx| so far. This is the same accounting as for
+ * avb_slot_verify_set_memory_budget() and is useful for choosing a
+ * budget. Must be called before avb_slot_verify_finish().
+ */
+size_t avb_slot_verify_get_peak_memory_usage(
+    const AvbSlotVerifyContext* ctx);
+
+/* Completes verification for |ctx|, doing any work not done by
+ * avb_slot_verify_step(), and frees |ctx|. The return value and
+ * |out_data| are the same as for avb_slot_verify().
+ *
+ * Since hash partitions are only verified after all vbmeta images,
+ * the error returned if a slot has more than one problem may differ
+ * from the one avb_slot_verify() would return.
+ */
+AvbSlotVerifyResult avb_slot_verify_finish(AvbSlotVerifyContext* ctx,
+                                           AvbSlotVerifyData** out_data);
+
+/* Loads and verifies the partitions in |requested_partitions| and
+ * appends them to the |loaded_partitions| array of |data|, which must
+ * have been returned by avb_slot_verify() or avb_slot_verify_finish()
+ * for the same |ops|.
+ *
+ * This is for bootloaders needing an extra partition (e.g. "dtbo" or
+ * "recovery") after the slot has been verified. The vbmeta images in
+ * |data| are not read or verified again - no signature, public key
+ * or rollback index checks are done - the hash descriptors for the
+ * requested partitions are simply looked up in them. Partitions
+ * already in |data| are skipped and the kernel command-line in |data|
+ * is not changed.
+ *
+ * The only flag used from |flags| is
+ * AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR. If it is not set,
+ * every vbmeta image in |data| must have verified successfully or
+ * AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT is returned, and
+ * |data| is left unchanged if an error is returned. If it is set,
+ * partitions failing verification are appended as for
+ * avb_slot_verify() with their |verify_result| set accordingly.
+ *
+ * If no hash descriptor is found for a requested partition
+ * AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT is returned. Other
+ * return values are as for avb_slot_verify().
+ */
+AvbSlotVerifyResult avb_slot_verify_add_partitions(
+    AvbOps* ops,
+    const char* const* requested_partitions,
+    AvbSlotVerifyFlags flags,
+    AvbSlotVerifyData* data);
+
 #ifdef __cplusplus
 }
 #endif
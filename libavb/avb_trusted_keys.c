@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "avb_trusted_keys.h"
+#include "avb_sha.h"
+#include "avb_util.h"
+
+/* Index value for an unused slot in the table. */
+#define AVB_TRUSTED_KEY_SLOT_EMPTY 0xffffffffu
+
+typedef struct AvbTrustedKeySlot {
+  uint8_t digest[AVB_SHA256_DIGEST_SIZE];
+  uint32_t key_index;
+} AvbTrustedKeySlot;
+
+struct AvbTrustedKeySet {
+  const AvbTrustedKey* keys;
+  size_t num_keys;
+  /* Open-addressing table with linear probing, |mask| + 1 slots. */
+  AvbTrustedKeySlot* slots;
+  size_t mask;
+};
+
+static void trusted_key_digest(const uint8_t* public_key_data,
+                               size_t public_key_length,
+                               uint8_t* out_digest) {
+  AvbSHA256Ctx ctx;
+
+  avb_sha256_init(&ctx);
+  avb_sha256_update(&ctx, public_key_data, public_key_length);
+  avb_memcpy(out_digest, avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE);
+}
+
+/* The digest is uniformly distributed so any bytes of it will do. */
+static size_t trusted_key_slot_start(const AvbTrustedKeySet* set,
+                                     const uint8_t* digest) {
+  uint32_t h = ((uint32_t)digest[0] << 24) | ((uint32_t)digest[1] << 16) |
+               ((uint32_t)digest[2] << 8) | ((uint32_t)digest[3]);
+  return h & set->mask;
+}
+
+AvbTrustedKeySet* avb_trusted_key_set_new(const AvbTrustedKey* keys,
+                                          size_t num_keys) {
+  AvbTrustedKeySet* set = NULL;
+  size_t num_slots = 2;
+  size_t n;
+
+  if (num_keys >= AVB_TRUSTED_KEY_SLOT_EMPTY ||
+      num_keys > SIZE_MAX / (4 * sizeof(AvbTrustedKeySlot))) {
+    avb_error("Too many trusted keys.\n");
+    return NULL;
+  }
+
+  /* Keep the load factor at or below one half. */
+  while (num_slots < 2 * num_keys) {
+    num_slots *= 2;
+  }
+
+  set = (AvbTrustedKeySet*)avb_calloc(sizeof(AvbTrustedKeySet));
+  if (set == NULL) {
+    goto fail;
+  }
+  set->slots =
+      (AvbTrustedKeySlot*)avb_malloc(num_slots * sizeof(AvbTrustedKeySlot));
+  if (set->slots == NULL) {
+    goto fail;
+  }
+  for (n = 0; n < num_slots; n++) {
+    set->slots[n].key_index = AVB_TRUSTED_KEY_SLOT_EMPTY;
+  }
+  set->keys = keys;
+  set->num_keys = num_keys;
+  set->mask = num_slots - 1;
+
+  for (n = 0; n < num_keys; n++) {
+    uint8_t digest[AVB_SHA256_DIGEST_SIZE];
+    size_t i;
+
+    trusted_key_digest(
+        keys[n].public_key_data, keys[n].public_key_length, digest);
+    i = trusted_key_slot_start(set, digest);
+    while (set->slots[i].key_index != AVB_TRUSTED_KEY_SLOT_EMPTY) {
+      i = (i + 1) & set->mask;
+    }
+    avb_memcpy(set->slots[i].digest, digest, AVB_SHA256_DIGEST_SIZE);
+    set->slots[i].key_index = (uint32_t)n;
+  }
+
+  return set;
+
+fail:
+  avb_trusted_key_set_free(set);
+  return NULL;
+}
+
+void avb_trusted_key_set_free(AvbTrustedKeySet* set) {
+  if (set == NULL) {
+    return;
+  }
+  if (set->slots != NULL) {
+    avb_free(set->slots);
+  }
+  avb_free(set);
+}
+
+static bool trusted_key_allows_partition(const AvbTrustedKey* key,
+                                         const char* partition) {
+  size_t n;
+
+  if (key->partitions == NULL) {
+    return true;
+  }
+  for (n = 0; key->partitions[n] != NULL; n++) {
+    if (avb_strcmp(key->partitions[n], partition) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool trusted_key_matches(const AvbTrustedKey* key,
+                                const uint8_t* public_key_data,
+                                size_t public_key_length,
+                                const uint8_t* public_key_metadata,
+                                size_t public_key_metadata_length) {
+  if (key->public_key_length != public_key_length ||
+      avb_safe_memcmp(
+          key->public_key_data, public_key_data, public_key_length) != 0) {
+    return false;
+  }
+  if (key->public_key_metadata != NULL) {
+    if (public_key_metadata == NULL ||
+        key->public_key_metadata_length != public_key_metadata_length ||
+        avb_safe_memcmp(key->public_key_metadata,
+                        public_key_metadata,
+                        public_key_metadata_length) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AvbIOResult avb_trusted_key_set_validate(
+    const AvbTrustedKeySet* set,
+    const char* partition,
+    const uint8_t* public_key_data,
+    size_t public_key_length,
+    const uint8_t* public_key_metadata,
+    size_t public_key_metadata_length,
+    bool* out_is_trusted,
+    uint32_t* out_rollback_index_location) {
+  uint8_t digest[AVB_SHA256_DIGEST_SIZE];
+  size_t i;
+
+  avb_assert(set != NULL);
+  avb_assert(partition != NULL);
+  avb_assert(out_is_trusted != NULL);
+
+  *out_is_trusted = false;
+
+  trusted_key_digest(public_key_data, public_key_length, digest);
+
+  /* Several entries may share a key, e.g. with different partition
+   * allow-lists, so keep probing until an empty slot.
+   */
+  for (i = trusted_key_slot_start(set, digest);
+       set->slots[i].key_index != AVB_TRUSTED_KEY_SLOT_EMPTY;
+       i = (i + 1) & set->mask) {
+    const AvbTrustedKey* key = &set->keys[set->slots[i].key_index];
+
+    if (avb_memcmp(set->slots[i].digest, digest, AVB_SHA256_DIGEST_SIZE) !=
+            0 ||
+        !trusted_key_allows_partition(key, partition) ||
+        !trusted_key_matches(key,
+                             public_key_data,
+                             public_key_length,
+                             public_key_metadata,
+                             public_key_metadata_length)) {
+      continue;
+    }
+
+    *out_is_trusted = true;
+    if (out_rollback_index_location != NULL) {
+      *out_rollback_index_location = key->rollback_index_location;
+    }
+    break;
+  }
+
+  return AVB_IO_RESULT_OK;
+}
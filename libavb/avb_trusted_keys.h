@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if !defined(AVB_INSIDE_LIBAVB_H) && !defined(AVB_COMPILATION)
+#error "Never include this file directly, include libavb.h instead."
+#endif
+
+#ifndef AVB_TRUSTED_KEYS_H_
+#define AVB_TRUSTED_KEYS_H_
+
+#include "avb_ops.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A public key trusted for verifying vbmeta images, for use with
+ * AvbTrustedKeySet.
+ *
+ * The |public_key_data| field points to the |public_key_length| bytes
+ * long key in the format described in avb_vbmeta_image.h. If
+ * |public_key_metadata| is not NULL the vbmeta image must also have
+ * exactly this |public_key_metadata_length| bytes long public key
+ * metadata.
+ *
+ * The |partitions| field is a NULL-terminated list of the partitions
+ * the key is trusted for, or NULL if it's trusted for all of them.
+ * Names are compared exactly with the ones passed to
+ * validate_public_key_for_partition(), which include the A/B suffix,
+ * so list each slot, e.g. "system_a" and "system_b". The top-level
+ * vbmeta image is checked as partition "vbmeta". The
+ * |rollback_index_location| field is the rollback index location to
+ * use for partitions verified with the key.
+ */
+typedef struct AvbTrustedKey {
+  const uint8_t* public_key_data;
+  size_t public_key_length;
+  const uint8_t* public_key_metadata;
+  size_t public_key_metadata_length;
+  const char* const* partitions;
+  uint32_t rollback_index_location;
+} AvbTrustedKey;
+
+/* A set of trusted public keys, indexed by the SHA-256 digest of the
+ * key so looking up a key takes constant time however many keys there
+ * are. This can be used to implement the validate_vbmeta_public_key()
+ * and validate_public_key_for_partition() operations by a table
+ * lookup.
+ */
+struct AvbTrustedKeySet;
+typedef struct AvbTrustedKeySet AvbTrustedKeySet;
+
+/* Creates a set of the |num_keys| keys in |keys|. Only pointers to
+ * the key data are kept, so |keys| and everything it points to must
+ * outlive the set. The same key may be listed more than once, e.g.
+ * with different rollback index locations for different partitions.
+ *
+ * Returns NULL on OOM. Free with avb_trusted_key_set_free().
+ */
+AvbTrustedKeySet* avb_trusted_key_set_new(const AvbTrustedKey* keys,
+                                          size_t num_keys);
+
+/* Frees a set created with avb_trusted_key_set_new(). */
+void avb_trusted_key_set_free(AvbTrustedKeySet* set);
+
+/* Looks up the key for |partition| in |set|. The parameters and
+ * return values are the same as for the
+ * validate_public_key_for_partition() operation in AvbOps, so it can
+ * simply call this.
+ *
+ * The final comparison of the key and metadata is done in constant
+ * time.
+ */
+AvbIOResult avb_trusted_key_set_validate(
+    const AvbTrustedKeySet* set,
+    const char* partition,
+    const uint8_t* public_key_data,
+    size_t public_key_length,
+    const uint8_t* public_key_metadata,
+    size_t public_key_metadata_length,
+    bool* out_is_trusted,
+    uint32_t* out_rollback_index_location);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVB_TRUSTED_KEYS_H_ */
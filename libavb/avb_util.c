@@ -325,6 +325,8 @@ char* avb_replace(const char* str, const char* search, const char* replace) {
       num_new = ret_len + num_before + replace_len + 1;
       new_str = avb_malloc(num_new);
       if (new_str == NULL) {
+        avb_free(ret);
+        ret = NULL;
         goto out;
       }
       avb_memcpy(new_str, ret, ret_len);
@@ -350,6 +352,8 @@ char* avb_replace(const char* str, const char* search, const char* replace) {
     size_t num_new = ret_len + num_remaining + 1;
     char* new_str = avb_malloc(num_new);
     if (new_str == NULL) {
+      avb_free(ret);
+      ret = NULL;
       goto out;
     }
     avb_memcpy(new_str, ret, ret_len);
@@ -472,3 +476,138 @@ size_t avb_uint64_to_base10(uint64_t value,
   digits[n] = '\0';
   return n;
 }
+
+/* State of the log ring set up with avb_log_ring_init(). Messages are
+ * stored NUL-terminated and never wrap around the end of |buf|; when
+ * a message doesn't fit before the end, the remaining bytes are filled
+ * with NUL bytes, i.e. empty messages, which are skipped when reading.
+ */
+static struct {
+  char* buf;
+  size_t size;
+  /* Offset of the oldest message. */
+  size_t head;
+  /* Number of bytes in use, starting at |head|. */
+  size_t used;
+  /* Number of messages dropped since the last avb_log_ring_flush(). */
+  uint64_t num_dropped;
+} log_ring;
+
+void avb_log_ring_init(char* buf, size_t size) {
+  log_ring.buf = size > 0 ? buf : NULL;
+  log_ring.size = log_ring.buf != NULL ? size : 0;
+  log_ring.head = 0;
+  log_ring.used = 0;
+  log_ring.num_dropped = 0;
+}
+
+/* Removes the oldest message, which may be empty, from the log ring
+ * and returns it. The log ring must not be empty.
+ */
+static const char* log_ring_remove_oldest(void) {
+  const char* message = log_ring.buf + log_ring.head;
+  size_t size = avb_strlen(message) + 1;
+
+  log_ring.used -= size;
+  log_ring.head += size;
+  if (log_ring.head == log_ring.size || log_ring.used == 0) {
+    log_ring.head = 0;
+  }
+  return message;
+}
+
+/* Returns |size| contiguous bytes at the end of the log ring, dropping
+ * the oldest messages to make room. |size| must not be larger than the
+ * log ring.
+ */
+static char* log_ring_reserve(size_t size) {
+  size_t tail, pad;
+
+  for (;;) {
+    tail = (log_ring.head + log_ring.used) % log_ring.size;
+    pad = tail + size > log_ring.size ? log_ring.size - tail : 0;
+    if (log_ring.size - log_ring.used >= pad + size) {
+      break;
+    }
+    if (*log_ring_remove_oldest() != '\0') {
+      log_ring.num_dropped++;
+    }
+  }
+
+  if (pad > 0) {
+    avb_memset(log_ring.buf + tail, 0, pad);
+    log_ring.used += pad;
+    tail = 0;
+  }
+  log_ring.used += size;
+  return log_ring.buf + tail;
+}
+
+void avb_log_ring_appendv(const char* message, ...) {
+  va_list ap;
+  const char* strings[AVB_STRDUPV_MAX_NUM_STRINGS];
+  size_t lengths[AVB_STRDUPV_MAX_NUM_STRINGS];
+  size_t num_strings, total_length, n;
+  const char* str;
+  char* dest;
+
+  /* Note that avb_error() and friends can't be used in here since
+   * they may end up calling this function.
+   */
+  num_strings = 0;
+  total_length = 0;
+  va_start(ap, message);
+  for (str = message;
+       str != NULL && num_strings < AVB_STRDUPV_MAX_NUM_STRINGS;
+       str = va_arg(ap, const char*)) {
+    strings[num_strings] = str;
+    lengths[num_strings] = avb_strlen(str);
+    total_length += lengths[num_strings];
+    num_strings++;
+  }
+  va_end(ap);
+
+  if (log_ring.buf == NULL) {
+    for (n = 0; n < num_strings; n++) {
+      avb_print(strings[n]);
+    }
+    return;
+  }
+
+  /* Truncate the message if needed, leaving room for the NUL byte. */
+  if (total_length > log_ring.size - 1) {
+    total_length = log_ring.size - 1;
+  }
+  dest = log_ring_reserve(total_length + 1);
+  for (n = 0; n < num_strings && total_length > 0; n++) {
+    size_t len = lengths[n] < total_length ? lengths[n] : total_length;
+    avb_memcpy(dest, strings[n], len);
+    dest += len;
+    total_length -= len;
+  }
+  *dest = '\0';
+}
+
+const char* avb_log_ring_pop(void) {
+  while (log_ring.used > 0) {
+    const char* message = log_ring_remove_oldest();
+    if (*message != '\0') {
+      return message;
+    }
+  }
+  return NULL;
+}
+
+void avb_log_ring_flush(void) {
+  const char* message;
+
+  if (log_ring.num_dropped > 0) {
+    char digits[AVB_MAX_DIGITS_UINT64];
+    avb_uint64_to_base10(log_ring.num_dropped, digits);
+    avb_printv("[", digits, " earlier log messages dropped]\n", NULL);
+    log_ring.num_dropped = 0;
+  }
+  while ((message = avb_log_ring_pop()) != NULL) {
+    avb_print(message);
+  }
+}
@@ -54,7 +54,23 @@ extern "C" {
 #define AVB__REPEAT(n, x) AVB_CONCAT(AVB__REPEAT, n)(x)
 #define AVB_REPEAT(n, x) AVB__REPEAT(n, x)
 
-#ifdef AVB_USE_PRINTF_LOGS
+/* Log levels, used for AVB_LOG_MIN_LEVEL. */
+#define AVB_LOG_LEVEL_DEBUG 0
+#define AVB_LOG_LEVEL_ERROR 1
+#define AVB_LOG_LEVEL_FATAL 2
+
+/* Messages logged at a level lower than AVB_LOG_MIN_LEVEL are compiled
+ * out. Messages passed to avb_fatal() are always logged.
+ */
+#ifndef AVB_LOG_MIN_LEVEL
+#define AVB_LOG_MIN_LEVEL AVB_LOG_LEVEL_DEBUG
+#endif
+
+#if defined(AVB_USE_PRINTF_LOGS) && defined(AVB_USE_LOG_RING)
+#error "AVB_USE_PRINTF_LOGS and AVB_USE_LOG_RING are mutually exclusive."
+#endif
+
+#if defined(AVB_USE_PRINTF_LOGS)
 #define AVB_LOG(level, message, ...)                                        \
   avb_printf("%s:%d: " level                                                \
              ": " AVB_REPEAT(AVB_COUNT_ARGS(message, ##__VA_ARGS__), "%s"), \
@@ -62,6 +78,15 @@ extern "C" {
              __LINE__,                                                      \
              message,                                                       \
              ##__VA_ARGS__)
+#elif defined(AVB_USE_LOG_RING)
+#define AVB_LOG(level, message, ...)            \
+  avb_log_ring_appendv(avb_basename(__FILE__),  \
+                       ":",                     \
+                       AVB_TO_STRING(__LINE__), \
+                       ": " level ": ",         \
+                       message,                 \
+                       ##__VA_ARGS__,           \
+                       NULL)
 #else
 #define AVB_LOG(level, message, ...)  \
   avb_printv(avb_basename(__FILE__),  \
@@ -94,6 +119,12 @@ extern "C" {
     avb_fatal("assert_not_reached()\n"); \
   } while (0)
 
+#else
+#define avb_assert(expr)
+#define avb_assert_not_reached()
+#endif
+
+#if defined(AVB_ENABLE_DEBUG) && AVB_LOG_MIN_LEVEL <= AVB_LOG_LEVEL_DEBUG
 /* Print functions, used for diagnostics.
  *
  * These have no effect unless AVB_ENABLE_DEBUG is defined.
@@ -103,8 +134,6 @@ extern "C" {
     AVB_LOG("DEBUG", message, ##__VA_ARGS__); \
   } while (0)
 #else
-#define avb_assert(expr)
-#define avb_assert_not_reached()
 #define avb_debug(message, ...)
 #endif
 
@@ -115,6 +144,7 @@ extern "C" {
 #define avb_assert_aligned(addr) \
   avb_assert((((uintptr_t)addr) & (AVB_ALIGNMENT_SIZE - 1)) == 0)
 
+#if AVB_LOG_MIN_LEVEL <= AVB_LOG_LEVEL_ERROR
 /* Prints out a message. This is typically used if a runtime-error
  * occurs.
  */
@@ -122,7 +152,21 @@ extern "C" {
   do {                                        \
     AVB_LOG("ERROR", message, ##__VA_ARGS__); \
   } while (0)
+#else
+#define avb_error(message, ...)
+#endif
 
+#ifdef AVB_USE_LOG_RING
+/* Prints out a message and calls avb_abort(), printing anything still
+ * in the log ring first.
+ */
+#define avb_fatal(message, ...)               \
+  do {                                        \
+    AVB_LOG("FATAL", message, ##__VA_ARGS__); \
+    avb_log_ring_flush();                     \
+    avb_abort();                              \
+  } while (0)
+#else
 /* Prints out a message and calls avb_abort().
  */
 #define avb_fatal(message, ...)               \
@@ -130,6 +174,7 @@ extern "C" {
     AVB_LOG("FATAL", message, ##__VA_ARGS__); \
     avb_abort();                              \
   } while (0)
+#endif
 
 #ifndef AVB_USE_PRINTF_LOGS
 /* Deprecated legacy logging functions -- kept for client compatibility.
@@ -139,6 +184,41 @@ extern "C" {
 #define avb_fatalv(message, ...) avb_fatal(message, ##__VA_ARGS__)
 #endif
 
+/* Sets up the log ring to use the |size| bytes at |buf|, discarding
+ * any messages logged so far. Passing NULL disables the log ring.
+ *
+ * If AVB_USE_LOG_RING is defined, messages from avb_debug(),
+ * avb_error() and avb_fatal() are appended to the log ring instead of
+ * being printed right away, so slow consoles such as a serial port are
+ * kept out of the verification path. Once the ring is full the oldest
+ * messages are dropped. The platform should call avb_log_ring_flush()
+ * once verification is done, or on failure. Until the log ring is set
+ * up messages are printed with avb_printv() as usual.
+ *
+ * The log ring is not thread-safe.
+ */
+void avb_log_ring_init(char* buf, size_t size);
+
+/* Appends a vector of strings to the log ring as a single message, or
+ * prints them with avb_printv() if the log ring isn't set up. Each
+ * argument must point to a NUL-terminated string and NULL must be the
+ * last argument. The message is truncated if it doesn't fit in the
+ * log ring.
+ */
+void avb_log_ring_appendv(const char* message, ...) AVB_ATTR_SENTINEL;
+
+/* Removes the oldest message from the log ring and returns it, or
+ * returns NULL if the log ring is empty. The returned string is valid
+ * until the next call to avb_log_ring_appendv() or avb_log_ring_init().
+ */
+const char* avb_log_ring_pop(void);
+
+/* Prints all messages in the log ring with avb_print() and empties it.
+ * If messages were dropped because the log ring was full, a note
+ * saying how many is printed first.
+ */
+void avb_log_ring_flush(void);
+
 /* Converts a 16-bit unsigned integer from big-endian to host byte order. */
 uint16_t avb_be16toh(uint16_t in) AVB_ATTR_WARN_UNUSED_RESULT;
 
@@ -29,41 +29,14 @@
 #include "avb_util.h"
 #include "avb_version.h"
 
-AvbVBMetaVerifyResult avb_vbmeta_image_verify(
-    const uint8_t* data,
-    size_t length,
-    const uint8_t** out_public_key_data,
-    size_t* out_public_key_length) {
-  AvbVBMetaVerifyResult ret;
+AvbVBMetaVerifyResult avb_vbmeta_image_header_validate(
+    const uint8_t* data, AvbVBMetaImageHeader* out_header) {
   AvbVBMetaImageHeader h;
-  uint8_t* computed_hash;
-  const AvbAlgorithmData* algorithm;
-  AvbSHA256Ctx sha256_ctx;
-  AvbSHA512Ctx sha512_ctx;
-  const uint8_t* header_block;
-  const uint8_t* authentication_block;
-  const uint8_t* auxiliary_block;
-  int verification_result;
-
-  ret = AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
-
-  if (out_public_key_data != NULL) {
-    *out_public_key_data = NULL;
-  }
-  if (out_public_key_length != NULL) {
-    *out_public_key_length = 0;
-  }
-
-  /* Before we byteswap or compare Magic, ensure length is long enough. */
-  if (length < sizeof(AvbVBMetaImageHeader)) {
-    avb_error("Length is smaller than header.\n");
-    goto out;
-  }
 
   /* Ensure magic is correct. */
   if (avb_safe_memcmp(data, AVB_MAGIC, AVB_MAGIC_LEN) != 0) {
     avb_error("Magic is incorrect.\n");
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
   }
 
   avb_vbmeta_image_header_to_host_byte_order((const AvbVBMetaImageHeader*)data,
@@ -75,40 +48,28 @@ AvbVBMetaVerifyResult avb_vbmeta_image_verify(
   if ((h.required_libavb_version_major != AVB_VERSION_MAJOR) ||
       (h.required_libavb_version_minor > AVB_VERSION_MINOR)) {
     avb_error("Mismatch between image version and libavb version.\n");
-    ret = AVB_VBMETA_VERIFY_RESULT_UNSUPPORTED_VERSION;
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_UNSUPPORTED_VERSION;
   }
 
   /* Ensure |release_string| ends with a NUL byte. */
   if (h.release_string[AVB_RELEASE_STRING_SIZE - 1] != '\0') {
     avb_error("Release string does not end with a NUL byte.\n");
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
   }
 
   /* Ensure inner block sizes are multiple of 64. */
   if ((h.authentication_data_block_size & 0x3f) != 0 ||
       (h.auxiliary_data_block_size & 0x3f) != 0) {
     avb_error("Block size is not a multiple of 64.\n");
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
   }
 
-  /* Ensure block sizes all add up to at most |length|. */
+  /* Ensure the size of the whole image can be computed. */
   uint64_t block_total = sizeof(AvbVBMetaImageHeader);
   if (!avb_safe_add_to(&block_total, h.authentication_data_block_size) ||
       !avb_safe_add_to(&block_total, h.auxiliary_data_block_size)) {
     avb_error("Overflow while computing size of boot image.\n");
-    goto out;
-  }
-  if (block_total > length) {
-    avb_error("Block sizes add up to more than given length.\n");
-    goto out;
-  }
-
-  uintptr_t data_ptr = (uintptr_t)data;
-  /* Ensure passed in memory doesn't wrap. */
-  if (!avb_safe_add(NULL, (uint64_t)data_ptr, length)) {
-    avb_error("Boot image location and length mismatch.\n");
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
   }
 
   /* Ensure hash and signature are entirely in the Authentication data block. */
@@ -116,13 +77,13 @@ AvbVBMetaVerifyResult avb_vbmeta_image_verify(
   if (!avb_safe_add(&hash_end, h.hash_offset, h.hash_size) ||
       hash_end > h.authentication_data_block_size) {
     avb_error("Hash is not entirely in its block.\n");
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
   }
   uint64_t signature_end;
   if (!avb_safe_add(&signature_end, h.signature_offset, h.signature_size) ||
       signature_end > h.authentication_data_block_size) {
     avb_error("Signature is not entirely in its block.\n");
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
   }
 
   /* Ensure public key is entirely in the Auxiliary data block. */
@@ -130,7 +91,7 @@ AvbVBMetaVerifyResult avb_vbmeta_image_verify(
   if (!avb_safe_add(&pubkey_end, h.public_key_offset, h.public_key_size) ||
       pubkey_end > h.auxiliary_data_block_size) {
     avb_error("Public key is not entirely in its block.\n");
-    goto out;
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
   }
 
   /* Ensure public key metadata (if set) is entirely in the Auxiliary
@@ -142,10 +103,71 @@ AvbVBMetaVerifyResult avb_vbmeta_image_verify(
                       h.public_key_metadata_size) ||
         pubkey_md_end > h.auxiliary_data_block_size) {
       avb_error("Public key metadata is not entirely in its block.\n");
-      goto out;
+      return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
     }
   }
 
+  if (out_header != NULL) {
+    avb_memcpy(out_header, &h, sizeof(AvbVBMetaImageHeader));
+  }
+  return AVB_VBMETA_VERIFY_RESULT_OK;
+}
+
+AvbVBMetaVerifyResult avb_vbmeta_image_verify(
+    const uint8_t* data,
+    size_t length,
+    const uint8_t** out_public_key_data,
+    size_t* out_public_key_length) {
+  AvbVBMetaVerifyResult ret;
+  AvbVBMetaImageHeader h;
+  uint8_t* computed_hash;
+  const AvbAlgorithmData* algorithm;
+  AvbSHA256Ctx sha256_ctx;
+  AvbSHA512Ctx sha512_ctx;
+  const uint8_t* header_block;
+  const uint8_t* authentication_block;
+  const uint8_t* auxiliary_block;
+  int verification_result;
+
+  ret = AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+
+  if (out_public_key_data != NULL) {
+    *out_public_key_data = NULL;
+  }
+  if (out_public_key_length != NULL) {
+    *out_public_key_length = 0;
+  }
+
+  /* Before we byteswap or compare Magic, ensure length is long enough. */
+  if (length < sizeof(AvbVBMetaImageHeader)) {
+    avb_error("Length is smaller than header.\n");
+    goto out;
+  }
+
+  ret = avb_vbmeta_image_header_validate(data, &h);
+  if (ret != AVB_VBMETA_VERIFY_RESULT_OK) {
+    goto out;
+  }
+  ret = AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+
+  /* Ensure block sizes all add up to at most |length|. No overflow
+   * check needed since avb_vbmeta_image_header_validate() did that.
+   */
+  uint64_t block_total = sizeof(AvbVBMetaImageHeader) +
+                         h.authentication_data_block_size +
+                         h.auxiliary_data_block_size;
+  if (block_total > length) {
+    avb_error("Block sizes add up to more than given length.\n");
+    goto out;
+  }
+
+  uintptr_t data_ptr = (uintptr_t)data;
+  /* Ensure passed in memory doesn't wrap. */
+  if (!avb_safe_add(NULL, (uint64_t)data_ptr, length)) {
+    avb_error("Boot image location and length mismatch.\n");
+    goto out;
+  }
+
   /* Bail early if there's no hash or signature. */
   if (h.algorithm_type == AVB_ALGORITHM_TYPE_NONE) {
     ret = AVB_VBMETA_VERIFY_RESULT_OK_NOT_SIGNED;
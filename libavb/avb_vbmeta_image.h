@@ -289,6 +289,21 @@ AvbVBMetaVerifyResult avb_vbmeta_image_verify(
     const uint8_t** out_public_key_data,
     size_t* out_public_key_length) AVB_ATTR_WARN_UNUSED_RESULT;
 
+/* Checks the vbmeta image header at |data|, which must point to at
+ * least sizeof(AvbVBMetaImageHeader) bytes, and copies it in host
+ * byte order to |out_header| if non-NULL. This does all the checks of
+ * avb_vbmeta_image_verify() that only need the header, for example
+ * that the hash, signature and public key are inside their blocks,
+ * but doesn't look at any data following the header.
+ *
+ * Returns AVB_VBMETA_VERIFY_RESULT_OK if the header is valid,
+ * otherwise AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER or
+ * AVB_VBMETA_VERIFY_RESULT_UNSUPPORTED_VERSION.
+ */
+AvbVBMetaVerifyResult avb_vbmeta_image_header_validate(
+    const uint8_t* data,
+    AvbVBMetaImageHeader* out_header) AVB_ATTR_WARN_UNUSED_RESULT;
+
 #ifdef __cplusplus
 }
 #endif
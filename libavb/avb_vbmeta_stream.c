@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "avb_vbmeta_stream.h"
+#include "avb_rsa.h"
+#include "avb_sha.h"
+#include "avb_util.h"
+
+/* Fields are sized by |max_field_size| and |max_descriptors_size|
+ * and follow the struct in the same allocation, descriptors first so
+ * they're word-aligned.
+ */
+struct AvbVBMetaStream {
+  size_t max_field_size;
+  size_t max_descriptors_size;
+
+  /* The first error seen, if any. */
+  AvbVBMetaVerifyResult error;
+  bool failed;
+  /* Set once avb_vbmeta_stream_finish() has accepted the image. */
+  bool verified;
+
+  /* Number of bytes of the image passed in so far. */
+  uint64_t pos;
+
+  uint8_t header_data[sizeof(AvbVBMetaImageHeader)];
+  AvbVBMetaImageHeader header;
+  bool header_done;
+  /* Offset of the auxiliary data block and the size of the whole
+   * image, only set once |header_done| is true.
+   */
+  uint64_t aux_offset;
+  uint64_t total_size;
+
+  const AvbAlgorithmData* algorithm;
+  union {
+    AvbSHA256Ctx sha256;
+    AvbSHA512Ctx sha512;
+  } hash_ctx;
+  uint8_t hash[AVB_SHA512_DIGEST_SIZE];
+
+  uint8_t* descriptors;
+  uint8_t* signature;
+  uint8_t* public_key;
+  uint8_t* public_key_metadata;
+};
+
+AvbVBMetaStream* avb_vbmeta_stream_new(size_t max_field_size,
+                                       size_t max_descriptors_size) {
+  AvbVBMetaStream* stream;
+  size_t struct_size;
+
+  struct_size = (sizeof(AvbVBMetaStream) + 7) & ~(size_t)7;
+  if (max_field_size > (SIZE_MAX - struct_size) / 4 ||
+      max_descriptors_size > SIZE_MAX - struct_size - 3 * max_field_size) {
+    avb_error("Field size too large.\n");
+    return NULL;
+  }
+
+  stream = (AvbVBMetaStream*)avb_calloc(struct_size + max_descriptors_size +
+                                        3 * max_field_size);
+  if (stream == NULL) {
+    return NULL;
+  }
+  stream->max_field_size = max_field_size;
+  stream->max_descriptors_size = max_descriptors_size;
+  stream->descriptors = (uint8_t*)stream + struct_size;
+  stream->signature = stream->descriptors + max_descriptors_size;
+  stream->public_key = stream->signature + max_field_size;
+  stream->public_key_metadata = stream->public_key + max_field_size;
+  return stream;
+}
+
+void avb_vbmeta_stream_free(AvbVBMetaStream* stream) {
+  if (stream != NULL) {
+    avb_free(stream);
+  }
+}
+
+uint64_t avb_vbmeta_stream_bytes_needed(const AvbVBMetaStream* stream) {
+  if (!stream->header_done) {
+    return sizeof(AvbVBMetaImageHeader) - stream->pos;
+  }
+  return stream->total_size - stream->pos;
+}
+
+static AvbVBMetaVerifyResult stream_fail(AvbVBMetaStream* stream,
+                                         AvbVBMetaVerifyResult error) {
+  stream->failed = true;
+  stream->error = error;
+  return error;
+}
+
+static bool stream_is_signed(const AvbVBMetaStream* stream) {
+  return stream->header.algorithm_type != AVB_ALGORITHM_TYPE_NONE;
+}
+
+/* Called when the whole header has been passed in. */
+static AvbVBMetaVerifyResult stream_start(AvbVBMetaStream* stream) {
+  AvbVBMetaImageHeader* h = &stream->header;
+  AvbVBMetaVerifyResult ret;
+  uint64_t desc_end;
+
+  ret = avb_vbmeta_image_header_validate(stream->header_data, h);
+  if (ret != AVB_VBMETA_VERIFY_RESULT_OK) {
+    return ret;
+  }
+
+  /* Unlike avb_descriptor_foreach() there's no image to check the
+   * descriptors against later, so check them against their block now.
+   */
+  if (!avb_safe_add(&desc_end, h->descriptors_offset, h->descriptors_size) ||
+      desc_end > h->auxiliary_data_block_size) {
+    avb_error("Descriptors are not entirely in their block.\n");
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+  }
+  if (stream->max_descriptors_size > 0 &&
+      h->descriptors_size > stream->max_descriptors_size) {
+    avb_error("Descriptors too large for stream.\n");
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+  }
+
+  stream->aux_offset =
+      sizeof(AvbVBMetaImageHeader) + h->authentication_data_block_size;
+  stream->total_size = stream->aux_offset + h->auxiliary_data_block_size;
+  stream->header_done = true;
+
+  if (!stream_is_signed(stream)) {
+    return AVB_VBMETA_VERIFY_RESULT_OK;
+  }
+
+  stream->algorithm = avb_get_algorithm_data(h->algorithm_type);
+  if (!stream->algorithm) {
+    avb_error("Invalid or unknown algorithm.\n");
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+  }
+  if (h->hash_size != stream->algorithm->hash_len) {
+    avb_error("Embedded hash has wrong size.\n");
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+  }
+  if (h->signature_size > stream->max_field_size ||
+      h->public_key_size > stream->max_field_size ||
+      h->public_key_metadata_size > stream->max_field_size) {
+    avb_error("Signature or public key too large for stream.\n");
+    return AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER;
+  }
+
+  if (stream->algorithm->hash_len == AVB_SHA256_DIGEST_SIZE) {
+    avb_sha256_init(&stream->hash_ctx.sha256);
+    avb_sha256_update(&stream->hash_ctx.sha256,
+                      stream->header_data,
+                      sizeof(AvbVBMetaImageHeader));
+  } else {
+    avb_sha512_init(&stream->hash_ctx.sha512);
+    avb_sha512_update(&stream->hash_ctx.sha512,
+                      stream->header_data,
+                      sizeof(AvbVBMetaImageHeader));
+  }
+  return AVB_VBMETA_VERIFY_RESULT_OK;
+}
+
+static uint64_t stream_min(uint64_t a, uint64_t b) {
+  return a < b ? a : b;
+}
+
+static uint64_t stream_max(uint64_t a, uint64_t b) {
+  return a > b ? a : b;
+}
+
+/* Copies the part of the |size| bytes at |data|, which are at
+ * |data_offset| in their block, that overlaps the field at
+ * |field_offset| of size |field_size| in the same block to |dest|.
+ */
+static void stream_capture(const uint8_t* data,
+                           size_t size,
+                           uint64_t data_offset,
+                           uint64_t field_offset,
+                           uint64_t field_size,
+                           uint8_t* dest) {
+  uint64_t start = stream_max(data_offset, field_offset);
+  uint64_t end = stream_min(data_offset + size, field_offset + field_size);
+
+  if (start < end) {
+    avb_memcpy(dest + (start - field_offset),
+               data + (start - data_offset),
+               (size_t)(end - start));
+  }
+}
+
+/* Handles the |size| bytes at |data| which are at |offset| in the
+ * auxiliary data block.
+ */
+static void stream_auxiliary(AvbVBMetaStream* stream,
+                             const uint8_t* data,
+                             size_t size,
+                             uint64_t offset) {
+  const AvbVBMetaImageHeader* h = &stream->header;
+
+  if (stream_is_signed(stream)) {
+    if (stream->algorithm->hash_len == AVB_SHA256_DIGEST_SIZE) {
+      avb_sha256_update(&stream->hash_ctx.sha256, data, size);
+    } else {
+      avb_sha512_update(&stream->hash_ctx.sha512, data, size);
+    }
+    stream_capture(data,
+                   size,
+                   offset,
+                   h->public_key_offset,
+                   h->public_key_size,
+                   stream->public_key);
+    stream_capture(data,
+                   size,
+                   offset,
+                   h->public_key_metadata_offset,
+                   h->public_key_metadata_size,
+                   stream->public_key_metadata);
+  }
+
+  if (stream->max_descriptors_size > 0) {
+    stream_capture(data,
+                   size,
+                   offset,
+                   h->descriptors_offset,
+                   h->descriptors_size,
+                   stream->descriptors);
+  }
+}
+
+AvbVBMetaVerifyResult avb_vbmeta_stream_update(AvbVBMetaStream* stream,
+                                               const uint8_t* data,
+                                               size_t size) {
+  AvbVBMetaVerifyResult ret;
+
+  if (stream->failed) {
+    return stream->error;
+  }
+
+  while (size > 0 && avb_vbmeta_stream_bytes_needed(stream) > 0) {
+    size_t n = (size_t)stream_min(size, avb_vbmeta_stream_bytes_needed(stream));
+
+    if (!stream->header_done) {
+      avb_memcpy(stream->header_data + stream->pos, data, n);
+      stream->pos += n;
+      if (stream->pos == sizeof(AvbVBMetaImageHeader)) {
+        ret = stream_start(stream);
+        if (ret != AVB_VBMETA_VERIFY_RESULT_OK) {
+          return stream_fail(stream, ret);
+        }
+      }
+    } else if (stream->pos < stream->aux_offset) {
+      uint64_t offset = stream->pos - sizeof(AvbVBMetaImageHeader);
+
+      n = (size_t)stream_min(n, stream->aux_offset - stream->pos);
+      if (stream_is_signed(stream)) {
+        stream_capture(data,
+                       n,
+                       offset,
+                       stream->header.hash_offset,
+                       stream->header.hash_size,
+                       stream->hash);
+        stream_capture(data,
+                       n,
+                       offset,
+                       stream->header.signature_offset,
+                       stream->header.signature_size,
+                       stream->signature);
+      }
+      stream->pos += n;
+    } else {
+      stream_auxiliary(stream, data, n, stream->pos - stream->aux_offset);
+      stream->pos += n;
+    }
+
+    data += n;
+    size -= n;
+  }
+
+  return AVB_VBMETA_VERIFY_RESULT_OK;
+}
+
+AvbVBMetaVerifyResult avb_vbmeta_stream_finish(
+    AvbVBMetaStream* stream,
+    AvbVBMetaImageHeader* out_header,
+    const uint8_t** out_public_key_data,
+    size_t* out_public_key_length,
+    const uint8_t** out_public_key_metadata,
+    size_t* out_public_key_metadata_length) {
+  const AvbVBMetaImageHeader* h = &stream->header;
+  uint8_t* computed_hash;
+
+  if (out_public_key_data != NULL) {
+    *out_public_key_data = NULL;
+  }
+  if (out_public_key_length != NULL) {
+    *out_public_key_length = 0;
+  }
+  if (out_public_key_metadata != NULL) {
+    *out_public_key_metadata = NULL;
+  }
+  if (out_public_key_metadata_length != NULL) {
+    *out_public_key_metadata_length = 0;
+  }
+  if (out_header != NULL && stream->header_done) {
+    avb_memcpy(out_header, h, sizeof(AvbVBMetaImageHeader));
+  }
+
+  if (stream->failed) {
+    return stream->error;
+  }
+  if (!stream->header_done || stream->pos < stream->total_size) {
+    avb_error("Image is truncated.\n");
+    return stream_fail(stream, AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER);
+  }
+
+  if (!stream_is_signed(stream)) {
+    stream->verified = true;
+    return AVB_VBMETA_VERIFY_RESULT_OK_NOT_SIGNED;
+  }
+
+  if (stream->algorithm->hash_len == AVB_SHA256_DIGEST_SIZE) {
+    computed_hash = avb_sha256_final(&stream->hash_ctx.sha256);
+  } else {
+    computed_hash = avb_sha512_final(&stream->hash_ctx.sha512);
+  }
+  if (avb_safe_memcmp(stream->hash, computed_hash, h->hash_size) != 0) {
+    avb_error("Hash does not match!\n");
+    return stream_fail(stream, AVB_VBMETA_VERIFY_RESULT_HASH_MISMATCH);
+  }
+
+  if (!avb_rsa_verify(stream->public_key,
+                      h->public_key_size,
+                      stream->signature,
+                      h->signature_size,
+                      stream->hash,
+                      h->hash_size,
+                      stream->algorithm->padding,
+                      stream->algorithm->padding_len)) {
+    return stream_fail(stream, AVB_VBMETA_VERIFY_RESULT_SIGNATURE_MISMATCH);
+  }
+
+  if (h->public_key_size > 0) {
+    if (out_public_key_data != NULL) {
+      *out_public_key_data = stream->public_key;
+    }
+    if (out_public_key_length != NULL) {
+      *out_public_key_length = h->public_key_size;
+    }
+  }
+  if (h->public_key_metadata_size > 0) {
+    if (out_public_key_metadata != NULL) {
+      *out_public_key_metadata = stream->public_key_metadata;
+    }
+    if (out_public_key_metadata_length != NULL) {
+      *out_public_key_metadata_length = h->public_key_metadata_size;
+    }
+  }
+  stream->verified = true;
+  return AVB_VBMETA_VERIFY_RESULT_OK;
+}
+
+bool avb_vbmeta_stream_foreach_descriptor(
+    const AvbVBMetaStream* stream,
+    AvbDescriptorForeachFunc foreach_func,
+    void* user_data) {
+  if (!stream->verified) {
+    avb_error("Image has not been verified.\n");
+    return false;
+  }
+  if (stream->max_descriptors_size == 0) {
+    avb_error("Descriptors were not kept.\n");
+    return false;
+  }
+  return avb_descriptor_array_foreach(stream->descriptors,
+                                      (size_t)stream->header.descriptors_size,
+                                      foreach_func,
+                                      user_data);
+}
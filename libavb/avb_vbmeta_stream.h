@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if !defined(AVB_INSIDE_LIBAVB_H) && !defined(AVB_COMPILATION)
+#error "Never include this file directly, include libavb.h instead."
+#endif
+
+#ifndef AVB_VBMETA_STREAM_H_
+#define AVB_VBMETA_STREAM_H_
+
+#include "avb_descriptor.h"
+#include "avb_vbmeta_image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Verifies a vbmeta image passed in chunks, so it doesn't have to be
+ * read into one contiguous buffer before verification can start.
+ *
+ * The header and auxiliary data are hashed as they are passed in.
+ * The hash, signature, public key and public key metadata are copied
+ * to side buffers and so, optionally, is the descriptors array. The
+ * descriptors are only handed out by
+ * avb_vbmeta_stream_foreach_descriptor() once
+ * avb_vbmeta_stream_finish() has checked the image. All memory is
+ * allocated by avb_vbmeta_stream_new() so nothing is allocated while
+ * streaming.
+ */
+struct AvbVBMetaStream;
+typedef struct AvbVBMetaStream AvbVBMetaStream;
+
+/* Creates a stream verifier. The signature, public key and public
+ * key metadata may each be at most |max_field_size| bytes and images
+ * with bigger ones are rejected as invalid.
+ *
+ * The descriptors array is kept, and may be at most
+ * |max_descriptors_size| bytes, unless |max_descriptors_size| is
+ * zero. Callers that keep the whole image themselves pass zero and
+ * use avb_descriptor_foreach() on it once it has been verified.
+ *
+ * Returns NULL on OOM. Free with avb_vbmeta_stream_free().
+ */
+AvbVBMetaStream* avb_vbmeta_stream_new(size_t max_field_size,
+                                       size_t max_descriptors_size)
+    AVB_ATTR_WARN_UNUSED_RESULT;
+
+/* Frees a stream verifier created with avb_vbmeta_stream_new(). */
+void avb_vbmeta_stream_free(AvbVBMetaStream* stream);
+
+/* Returns how many more bytes of the image |stream| needs. Until the
+ * header has been passed in this is just the remaining size of the
+ * header and after that it's the remaining size of the whole image.
+ * Returns zero once the whole image has been passed in.
+ */
+uint64_t avb_vbmeta_stream_bytes_needed(const AvbVBMetaStream* stream);
+
+/* Passes the next |size| bytes of the image at |data| to |stream|.
+ * Chunks can be of any size. Data past the end of the image is
+ * ignored, same as for avb_vbmeta_image_verify().
+ *
+ * Returns AVB_VBMETA_VERIFY_RESULT_OK if the image is valid so far,
+ * otherwise AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER or
+ * AVB_VBMETA_VERIFY_RESULT_UNSUPPORTED_VERSION. Once an error has
+ * been returned the same error is returned for any further data.
+ */
+AvbVBMetaVerifyResult avb_vbmeta_stream_update(AvbVBMetaStream* stream,
+                                               const uint8_t* data,
+                                               size_t size);
+
+/* Checks the hash and signature of the image passed to |stream|.
+ * Returns the same values as avb_vbmeta_image_verify() and
+ * AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER if the image is
+ * truncated.
+ *
+ * If |out_header| is not NULL and the header has been passed in it's
+ * copied there in host byte order.
+ *
+ * If AVB_VBMETA_VERIFY_RESULT_OK is returned, |out_public_key_data|
+ * and |out_public_key_metadata|, if not NULL, are set to point to
+ * the public key and public key metadata (NULL if none) in |stream|
+ * and their lengths stored in |out_public_key_length| and
+ * |out_public_key_metadata_length|, if not NULL. They are valid until
+ * |stream| is freed.
+ *
+ * The same VERY IMPORTANT notes as for avb_vbmeta_image_verify()
+ * apply.
+ */
+AvbVBMetaVerifyResult avb_vbmeta_stream_finish(
+    AvbVBMetaStream* stream,
+    AvbVBMetaImageHeader* out_header,
+    const uint8_t** out_public_key_data,
+    size_t* out_public_key_length,
+    const uint8_t** out_public_key_metadata,
+    size_t* out_public_key_metadata_length) AVB_ATTR_WARN_UNUSED_RESULT;
+
+/* Calls |foreach_func| with |user_data| for each descriptor kept by
+ * |stream|, same as avb_descriptor_foreach() does for an image.
+ *
+ * Returns false without calling |foreach_func| unless
+ * avb_vbmeta_stream_finish() has returned AVB_VBMETA_VERIFY_RESULT_OK
+ * or AVB_VBMETA_VERIFY_RESULT_OK_NOT_SIGNED and |stream| was created
+ * with a non-zero |max_descriptors_size|. Otherwise returns false if
+ * an invocation of |foreach_func| returned false.
+ *
+ * As with avb_descriptor_foreach(), don't use the descriptors unless
+ * the image is signed by a known good public key.
+ */
+bool avb_vbmeta_stream_foreach_descriptor(
+    const AvbVBMetaStream* stream,
+    AvbDescriptorForeachFunc foreach_func,
+    void* user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVB_VBMETA_STREAM_H_ */
@@ -42,6 +42,23 @@ uint8_t* avb_sha256_final(AvbSHA256Ctx* ctx) {
   return ctx->buf;
 }
 
+/* BoringSSL already uses the fastest single-stream implementation
+ * available on the CPU so just hash one message at a time.
+ */
+void avb_sha256_multi(const AvbSHAMultiInput* inputs,
+                      size_t num_inputs,
+                      uint8_t* out_digests) {
+  SHA256_CTX realCtx;
+  size_t n;
+
+  for (n = 0; n < num_inputs; n++) {
+    SHA256_Init(&realCtx);
+    SHA256_Update(&realCtx, inputs[n].salt, inputs[n].salt_len);
+    SHA256_Update(&realCtx, inputs[n].data, inputs[n].data_len);
+    SHA256_Final(out_digests + n * AVB_SHA256_DIGEST_SIZE, &realCtx);
+  }
+}
+
 /* SHA-512 implementation */
 void avb_sha512_init(AvbSHA512Ctx* ctx) {
   SHA512_CTX* realCtx = (SHA512_CTX*)ctx->reserved;
@@ -58,3 +75,17 @@ uint8_t* avb_sha512_final(AvbSHA512Ctx* ctx) {
   SHA512_Final(ctx->buf, realCtx);
   return ctx->buf;
 }
+
+void avb_sha512_multi(const AvbSHAMultiInput* inputs,
+                      size_t num_inputs,
+                      uint8_t* out_digests) {
+  SHA512_CTX realCtx;
+  size_t n;
+
+  for (n = 0; n < num_inputs; n++) {
+    SHA512_Init(&realCtx);
+    SHA512_Update(&realCtx, inputs[n].salt, inputs[n].salt_len);
+    SHA512_Update(&realCtx, inputs[n].data, inputs[n].data_len);
+    SHA512_Final(out_digests + n * AVB_SHA512_DIGEST_SIZE, &realCtx);
+  }
+}
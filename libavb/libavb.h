@@ -35,15 +35,18 @@
 #include "avb_crypto.h"
 #include "avb_descriptor.h"
 #include "avb_footer.h"
+#include "avb_handoff.h"
 #include "avb_hash_descriptor.h"
 #include "avb_hashtree_descriptor.h"
 #include "avb_kernel_cmdline_descriptor.h"
 #include "avb_ops.h"
 #include "avb_property_descriptor.h"
 #include "avb_slot_verify.h"
+#include "avb_trusted_keys.h"
 #include "avb_sysdeps.h"
 #include "avb_util.h"
 #include "avb_vbmeta_image.h"
+#include "avb_vbmeta_stream.h"
 #include "avb_version.h"
 #undef AVB_INSIDE_LIBAVB_H
 
@@ -404,3 +404,159 @@ uint8_t* avb_sha256_final(AvbSHA256Ctx* avb_ctx) {
 
   return avb_ctx->buf;
 }
+
+/* Number of messages hashed in lock-step by avb_sha256_multi(). The
+ * per-lane loops below have a fixed trip count so the compiler is
+ * able to map them onto whatever SIMD registers the target has.
+ */
+#define SHA256_MULTI_LANES 8
+
+/* Copies |block_size| bytes at |offset| of the padded message
+ * described by |input| into |block|. The message length field is
+ * not included and must be filled in by the caller.
+ */
+static void sha256_multi_load_block(const AvbSHAMultiInput* input,
+                                    uint64_t offset,
+                                    uint8_t* block) {
+  uint64_t msg_len = (uint64_t)input->salt_len + input->data_len;
+  uint64_t pos;
+  size_t n = 0;
+  size_t num;
+
+  while (n < AVB_SHA256_BLOCK_SIZE) {
+    pos = offset + n;
+    num = AVB_SHA256_BLOCK_SIZE - n;
+    if (pos < input->salt_len) {
+      if (num > input->salt_len - pos) {
+        num = input->salt_len - pos;
+      }
+      avb_memcpy(block + n, input->salt + pos, num);
+    } else if (pos < msg_len) {
+      if (num > msg_len - pos) {
+        num = msg_len - pos;
+      }
+      avb_memcpy(block + n, input->data + (pos - input->salt_len), num);
+    } else {
+      avb_memset(block + n, 0, num);
+      if (pos == msg_len) {
+        block[n] = 0x80;
+      }
+    }
+    n += num;
+  }
+}
+
+static void SHA256_transform_multi(
+    uint32_t h[8][SHA256_MULTI_LANES],
+    uint8_t block[SHA256_MULTI_LANES][AVB_SHA256_BLOCK_SIZE]) {
+  uint32_t w[64][SHA256_MULTI_LANES];
+  uint32_t wv[8][SHA256_MULTI_LANES];
+  uint32_t t1, t2;
+  size_t j, l;
+
+  for (j = 0; j < 16; j++) {
+    for (l = 0; l < SHA256_MULTI_LANES; l++) {
+      PACK32(&block[l][j << 2], &w[j][l]);
+    }
+  }
+
+  for (j = 16; j < 64; j++) {
+    for (l = 0; l < SHA256_MULTI_LANES; l++) {
+      w[j][l] = SHA256_F4(w[j - 2][l]) + w[j - 7][l] +
+                SHA256_F3(w[j - 15][l]) + w[j - 16][l];
+    }
+  }
+
+  for (j = 0; j < 8; j++) {
+    for (l = 0; l < SHA256_MULTI_LANES; l++) {
+      wv[j][l] = h[j][l];
+    }
+  }
+
+  for (j = 0; j < 64; j++) {
+    for (l = 0; l < SHA256_MULTI_LANES; l++) {
+      t1 = wv[7][l] + SHA256_F2(wv[4][l]) +
+           CH(wv[4][l], wv[5][l], wv[6][l]) + sha256_k[j] + w[j][l];
+      t2 = SHA256_F1(wv[0][l]) + MAJ(wv[0][l], wv[1][l], wv[2][l]);
+      wv[7][l] = wv[6][l];
+      wv[6][l] = wv[5][l];
+      wv[5][l] = wv[4][l];
+      wv[4][l] = wv[3][l] + t1;
+      wv[3][l] = wv[2][l];
+      wv[2][l] = wv[1][l];
+      wv[1][l] = wv[0][l];
+      wv[0][l] = t1 + t2;
+    }
+  }
+
+  for (j = 0; j < 8; j++) {
+    for (l = 0; l < SHA256_MULTI_LANES; l++) {
+      h[j][l] += wv[j][l];
+    }
+  }
+}
+
+void avb_sha256_multi(const AvbSHAMultiInput* inputs,
+                      size_t num_inputs,
+                      uint8_t* out_digests) {
+  uint32_t h[8][SHA256_MULTI_LANES];
+  uint8_t block[SHA256_MULTI_LANES][AVB_SHA256_BLOCK_SIZE];
+  uint64_t msg_len, len_b, num_blocks, b;
+  size_t n, num_lanes, l, j;
+
+  for (n = 0; n < num_inputs; n += num_lanes) {
+    /* All lanes process the same number of blocks so only batch up
+     * consecutive messages of the same length. For hashtrees this
+     * is every message.
+     */
+    msg_len = (uint64_t)inputs[n].salt_len + inputs[n].data_len;
+    for (num_lanes = 1; num_lanes < SHA256_MULTI_LANES &&
+                        n + num_lanes < num_inputs;
+         num_lanes++) {
+      const AvbSHAMultiInput* input = &inputs[n + num_lanes];
+      if ((uint64_t)input->salt_len + input->data_len != msg_len) {
+        break;
+      }
+    }
+
+    if (num_lanes == 1) {
+      AvbSHA256Ctx ctx;
+      avb_sha256_init(&ctx);
+      avb_sha256_update(&ctx, inputs[n].salt, inputs[n].salt_len);
+      avb_sha256_update(&ctx, inputs[n].data, inputs[n].data_len);
+      avb_memcpy(out_digests + n * AVB_SHA256_DIGEST_SIZE,
+                 avb_sha256_final(&ctx),
+                 AVB_SHA256_DIGEST_SIZE);
+      continue;
+    }
+
+    for (j = 0; j < 8; j++) {
+      for (l = 0; l < SHA256_MULTI_LANES; l++) {
+        h[j][l] = sha256_h0[j];
+      }
+    }
+
+    len_b = msg_len << 3;
+    num_blocks = (msg_len + 9 + AVB_SHA256_BLOCK_SIZE - 1) /
+                 AVB_SHA256_BLOCK_SIZE;
+    for (b = 0; b < num_blocks; b++) {
+      for (l = 0; l < SHA256_MULTI_LANES; l++) {
+        /* Unused lanes just hash another copy of the first message. */
+        sha256_multi_load_block(&inputs[n + (l < num_lanes ? l : 0)],
+                                b * AVB_SHA256_BLOCK_SIZE,
+                                block[l]);
+        if (b == num_blocks - 1) {
+          UNPACK64(len_b, &block[l][AVB_SHA256_BLOCK_SIZE - 8]);
+        }
+      }
+      SHA256_transform_multi(h, block);
+    }
+
+    for (l = 0; l < num_lanes; l++) {
+      for (j = 0; j < 8; j++) {
+        UNPACK32(h[j][l],
+                 &out_digests[(n + l) * AVB_SHA256_DIGEST_SIZE + (j << 2)]);
+      }
+    }
+  }
+}
@@ -202,6 +202,77 @@ static AvbIOResult save_metadata_if_changed(AvbABOps* ab_ops,
   return AVB_IO_RESULT_OK;
 }
 
+/* Updates the stored rollback index for every location where
+ * |rollback_indexes| is non-zero and differs from what is stored.
+ *
+ * All stored values are read first and all updates are written at the
+ * end, using the read_rollback_indexes() and write_rollback_indexes()
+ * operations if available so each is a single call.
+ */
+static AvbABFlowResult update_stored_rollback_indexes(
+    AvbOps* ops, const uint64_t* rollback_indexes) {
+  size_t locations[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
+  uint64_t stored[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
+  size_t update_locations[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
+  uint64_t update_values[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
+  size_t num_locations = 0;
+  size_t num_updates = 0;
+  AvbIOResult io_ret = AVB_IO_RESULT_OK;
+  size_t n;
+
+  for (n = 0; n < AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS; n++) {
+    if (rollback_indexes[n] != 0) {
+      locations[num_locations++] = n;
+    }
+  }
+  if (num_locations == 0) {
+    return AVB_AB_FLOW_RESULT_OK;
+  }
+
+  if (ops->read_rollback_indexes != NULL) {
+    io_ret = ops->read_rollback_indexes(ops, locations, num_locations, stored);
+  } else {
+    for (n = 0; n < num_locations && io_ret == AVB_IO_RESULT_OK; n++) {
+      io_ret = ops->read_rollback_index(ops, locations[n], &stored[n]);
+    }
+  }
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_AB_FLOW_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    avb_error("Error getting rollback index for slot.\n");
+    return AVB_AB_FLOW_RESULT_ERROR_IO;
+  }
+
+  for (n = 0; n < num_locations; n++) {
+    if (stored[n] != rollback_indexes[locations[n]]) {
+      update_locations[num_updates] = locations[n];
+      update_values[num_updates] = rollback_indexes[locations[n]];
+      num_updates++;
+    }
+  }
+  if (num_updates == 0) {
+    return AVB_AB_FLOW_RESULT_OK;
+  }
+
+  if (ops->write_rollback_indexes != NULL) {
+    io_ret = ops->write_rollback_indexes(
+        ops, update_locations, update_values, num_updates);
+  } else {
+    for (n = 0; n < num_updates && io_ret == AVB_IO_RESULT_OK; n++) {
+      io_ret =
+          ops->write_rollback_index(ops, update_locations[n], update_values[n]);
+    }
+  }
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_AB_FLOW_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    avb_error("Error setting stored rollback index.\n");
+    return AVB_AB_FLOW_RESULT_ERROR_IO;
+  }
+
+  return AVB_AB_FLOW_RESULT_OK;
+}
+
 AvbABFlowResult avb_ab_flow(AvbABOps* ab_ops,
                             const char* const* requested_partitions,
                             AvbSlotVerifyFlags flags,
@@ -215,6 +286,7 @@ AvbABFlowResult avb_ab_flow(AvbABOps* ab_ops,
   size_t slot_index_to_boot, n;
   AvbIOResult io_ret;
   bool saw_and_allowed_verification_error = false;
+  uint64_t rollback_indexes[AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS];
 
   io_ret = load_metadata(ab_ops, &ab_data, &ab_data_orig);
   if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
@@ -329,29 +401,11 @@ AvbABFlowResult avb_ab_flow(AvbABOps* ab_ops,
       rollback_index_value = slot_data[1]->rollback_indexes[n];
     }
 
-    if (rollback_index_value != 0) {
-      uint64_t current_rollback_index_value;
-      io_ret = ops->read_rollback_index(ops, n, &current_rollback_index_value);
-      if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
-        ret = AVB_AB_FLOW_RESULT_ERROR_OOM;
-        goto out;
-      } else if (io_ret != AVB_IO_RESULT_OK) {
-        avb_error("Error getting rollback index for slot.\n");
-        ret = AVB_AB_FLOW_RESULT_ERROR_IO;
-        goto out;
-      }
-      if (current_rollback_index_value != rollback_index_value) {
-        io_ret = ops->write_rollback_index(ops, n, rollback_index_value);
-        if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
-          ret = AVB_AB_FLOW_RESULT_ERROR_OOM;
-          goto out;
-        } else if (io_ret != AVB_IO_RESULT_OK) {
-          avb_error("Error setting stored rollback index.\n");
-          ret = AVB_AB_FLOW_RESULT_ERROR_IO;
-          goto out;
-        }
-      }
-    }
+    rollback_indexes[n] = rollback_index_value;
+  }
+  ret = update_stored_rollback_indexes(ops, rollback_indexes);
+  if (ret != AVB_AB_FLOW_RESULT_OK) {
+    goto out;
   }
 
   /* Finally, select this slot. */
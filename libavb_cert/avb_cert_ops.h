@@ -41,6 +41,36 @@ extern "C" {
 struct AvbCertOps;
 typedef struct AvbCertOps AvbCertOps;
 
+/* Maximum number of entries held in an AvbCertVerifiedChainCache. */
+#define AVB_CERT_VERIFIED_CHAIN_CACHE_SIZE 4
+
+/* A certificate chain which was successfully verified by
+ * avb_cert_validate_vbmeta_public_key().
+ *
+ * |permanent_attributes_hash| is the hash read via
+ * read_permanent_attributes_hash() and |metadata_hash| is the SHA-256 of the
+ * AvbCertPublicKeyMetadata holding the PIK and PSK certificates. The chain was
+ * verified against the minimum key versions |pik_minimum_version| and
+ * |psk_minimum_version|.
+ */
+typedef struct AvbCertVerifiedChain {
+  uint8_t permanent_attributes_hash[AVB_SHA256_DIGEST_SIZE];
+  uint8_t metadata_hash[AVB_SHA256_DIGEST_SIZE];
+  uint64_t pik_minimum_version;
+  uint64_t psk_minimum_version;
+} AvbCertVerifiedChain;
+
+/* Memo of verified certificate chains, see AvbCertOps.verified_chain_cache.
+ *
+ * Must be zero-initialized before first use, or cleared with
+ * avb_cert_verified_chain_cache_clear().
+ */
+typedef struct AvbCertVerifiedChainCache {
+  AvbCertVerifiedChain entries[AVB_CERT_VERIFIED_CHAIN_CACHE_SIZE];
+  size_t num_entries;
+  size_t next_entry;
+} AvbCertVerifiedChainCache;
+
 /* An extension to AvbOps required by avb_cert_validate_vbmeta_public_key(). */
 struct AvbCertOps {
   /* Operations from libavb. */
@@ -75,6 +105,31 @@ struct AvbCertOps {
   AvbIOResult (*get_random)(AvbCertOps* cert_ops,
                             size_t num_bytes,
                             uint8_t* output);
+
+  /* Calls |task| once for each of the |num_tasks| pointers in |task_args| and
+   * returns once all calls have completed. The calls may run concurrently,
+   * e.g. on other CPU cores, and are used to check independent certificate
+   * signatures in parallel. Tasks do not call back into |cert_ops| but may
+   * call avb_malloc(), avb_free() and the avb_print*() functions.
+   *
+   * This operation is optional and may be set to NULL, in which case the
+   * tasks are run one at a time on the calling thread.
+   */
+  void (*run_tasks)(AvbCertOps* cert_ops,
+                    void (*task)(void* arg),
+                    void* const* task_args,
+                    size_t num_tasks);
+
+  /* Optional memo of certificate chains already verified by
+   * avb_cert_validate_vbmeta_public_key(), or NULL to disable. When the same
+   * permanent attributes hash, public key metadata and minimum key versions
+   * are seen again, the permanent attributes and certificate signatures are
+   * not checked again.
+   *
+   * The cache must only be shared between calls within a single boot, and
+   * must not outlive any change to the permanent attributes hash.
+   */
+  AvbCertVerifiedChainCache* verified_chain_cache;
 };
 
 #ifdef __cplusplus
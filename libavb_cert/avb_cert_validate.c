@@ -91,33 +91,61 @@ static bool verify_permanent_attributes(
   return true;
 }
 
-/* Verifies the format, key version, usage, and signature of a certificate. */
+/* Sets up |input| to check the signature of |certificate| against
+ * |authority|. The digest of the signed data is stored in |certificate_hash|,
+ * which must outlive |input|.
+ */
+static void init_certificate_signature_check(
+    const AvbCertCertificate* certificate,
+    const uint8_t authority[AVB_CERT_PUBLIC_KEY_SIZE],
+    uint8_t certificate_hash[AVB_SHA512_DIGEST_SIZE],
+    AvbRSAVerifyInput* input) {
+  const AvbAlgorithmData* algorithm_data =
+      avb_get_algorithm_data(AVB_ALGORITHM_TYPE_SHA512_RSA4096);
+  sha512((const uint8_t*)&certificate->signed_data,
+         sizeof(AvbCertCertificateSignedData),
+         certificate_hash);
+  input->key = authority;
+  input->key_num_bytes = AVB_CERT_PUBLIC_KEY_SIZE;
+  input->sig = certificate->signature;
+  input->sig_num_bytes = AVB_RSA4096_NUM_BYTES;
+  input->hash = certificate_hash;
+  input->hash_num_bytes = AVB_SHA512_DIGEST_SIZE;
+  input->padding = algorithm_data->padding;
+  input->padding_num_bytes = algorithm_data->padding_len;
+}
+
+/* Verifies the format, key version, usage, and signature of a certificate.
+ * The signature check is skipped if |check_signature| is false, in which
+ * case the caller must already have checked it.
+ */
 static bool verify_certificate(
     const AvbCertCertificate* certificate,
     const uint8_t authority[AVB_CERT_PUBLIC_KEY_SIZE],
     uint64_t minimum_key_version,
-    const uint8_t expected_usage[AVB_SHA256_DIGEST_SIZE]) {
-  const AvbAlgorithmData* algorithm_data;
+    const uint8_t expected_usage[AVB_SHA256_DIGEST_SIZE],
+    bool check_signature) {
+  AvbRSAVerifyInput signature_check;
   uint8_t certificate_hash[AVB_SHA512_DIGEST_SIZE];
 
   if (certificate->signed_data.version != 1) {
     avb_error("Unsupported certificate format.\n");
     return false;
   }
-  algorithm_data = avb_get_algorithm_data(AVB_ALGORITHM_TYPE_SHA512_RSA4096);
-  sha512((const uint8_t*)&certificate->signed_data,
-         sizeof(AvbCertCertificateSignedData),
-         certificate_hash);
-  if (!avb_rsa_verify(authority,
-                      AVB_CERT_PUBLIC_KEY_SIZE,
-                      certificate->signature,
-                      AVB_RSA4096_NUM_BYTES,
-                      certificate_hash,
-                      AVB_SHA512_DIGEST_SIZE,
-                      algorithm_data->padding,
-                      algorithm_data->padding_len)) {
-    avb_error("Invalid certificate signature.\n");
-    return false;
+  if (check_signature) {
+    init_certificate_signature_check(
+        certificate, authority, certificate_hash, &signature_check);
+    if (!avb_rsa_verify(signature_check.key,
+                        signature_check.key_num_bytes,
+                        signature_check.sig,
+                        signature_check.sig_num_bytes,
+                        signature_check.hash,
+                        signature_check.hash_num_bytes,
+                        signature_check.padding,
+                        signature_check.padding_num_bytes)) {
+      avb_error("Invalid certificate signature.\n");
+      return false;
+    }
   }
   if (certificate->signed_data.key_version < minimum_key_version) {
     avb_error("Key rollback detected.\n");
@@ -136,11 +164,13 @@ static bool verify_certificate(
 static bool verify_pik_certificate(
     const AvbCertCertificate* certificate,
     const uint8_t authority[AVB_CERT_PUBLIC_KEY_SIZE],
-    uint64_t minimum_version) {
+    uint64_t minimum_version,
+    bool check_signature) {
   if (!verify_certificate(certificate,
                           authority,
                           minimum_version,
-                          CERT_USAGE_HASH_INTERMEDIATE_AUTHORITY)) {
+                          CERT_USAGE_HASH_INTERMEDIATE_AUTHORITY,
+                          check_signature)) {
     avb_error("Invalid PIK certificate.\n");
     return false;
   }
@@ -152,11 +182,15 @@ static bool verify_psk_certificate(
     const AvbCertCertificate* certificate,
     const uint8_t authority[AVB_CERT_PUBLIC_KEY_SIZE],
     uint64_t minimum_version,
-    const uint8_t product_id[AVB_CERT_PRODUCT_ID_SIZE]) {
+    const uint8_t product_id[AVB_CERT_PRODUCT_ID_SIZE],
+    bool check_signature) {
   uint8_t expected_subject[AVB_SHA256_DIGEST_SIZE];
 
-  if (!verify_certificate(
-          certificate, authority, minimum_version, CERT_USAGE_HASH_SIGNING)) {
+  if (!verify_certificate(certificate,
+                          authority,
+                          minimum_version,
+                          CERT_USAGE_HASH_SIGNING,
+                          check_signature)) {
     avb_error("Invalid PSK certificate.\n");
     return false;
   }
@@ -178,8 +212,11 @@ static bool verify_puk_certificate(
     const uint8_t product_id[AVB_CERT_PRODUCT_ID_SIZE]) {
   uint8_t expected_subject[AVB_SHA256_DIGEST_SIZE];
 
-  if (!verify_certificate(
-          certificate, authority, minimum_version, CERT_USAGE_HASH_UNLOCK)) {
+  if (!verify_certificate(certificate,
+                          authority,
+                          minimum_version,
+                          CERT_USAGE_HASH_UNLOCK,
+                          true /* check_signature */)) {
     avb_error("Invalid PUK certificate.\n");
     return false;
   }
@@ -193,6 +230,152 @@ static bool verify_puk_certificate(
   return true;
 }
 
+/* Arguments and result for check_certificate_task(). */
+typedef struct CertificateCheck {
+  const AvbCertCertificate* certificate;
+  const uint8_t* authority;
+  uint64_t minimum_version;
+  /* NULL for a PIK certificate, the expected product ID for a PSK. */
+  const uint8_t* product_id;
+  /* False if the signature has already been checked. */
+  bool check_signature;
+  bool is_valid;
+} CertificateCheck;
+
+/* Verifies the PIK or PSK certificate described by |arg|, a CertificateCheck.
+ * Suitable for use with AvbCertOps.run_tasks.
+ */
+static void check_certificate_task(void* arg) {
+  CertificateCheck* check = (CertificateCheck*)arg;
+  if (check->product_id == NULL) {
+    check->is_valid = verify_pik_certificate(check->certificate,
+                                             check->authority,
+                                             check->minimum_version,
+                                             check->check_signature);
+  } else {
+    check->is_valid = verify_psk_certificate(check->certificate,
+                                             check->authority,
+                                             check->minimum_version,
+                                             check->product_id,
+                                             check->check_signature);
+  }
+}
+
+/* Verifies the PIK and PSK certificates in |metadata|. The two signature
+ * checks are independent, so they are run in parallel if |cert_ops| supports
+ * it and are otherwise checked together with avb_rsa_verify_batch().
+ */
+static bool verify_pik_and_psk_certificates(
+    AvbCertOps* cert_ops,
+    const AvbCertPublicKeyMetadata* metadata,
+    const AvbCertPermanentAttributes* permanent_attributes,
+    uint64_t pik_minimum_version,
+    uint64_t psk_minimum_version) {
+  CertificateCheck checks[2];
+  void* check_args[2] = {&checks[0], &checks[1]};
+  AvbRSAVerifyInput signature_checks[2];
+  uint8_t certificate_hashes[2][AVB_SHA512_DIGEST_SIZE];
+  bool signature_valid[2];
+  size_t n;
+
+  checks[0].certificate = &metadata->product_intermediate_key_certificate;
+  checks[0].authority = permanent_attributes->product_root_public_key;
+  checks[0].minimum_version = pik_minimum_version;
+  checks[0].product_id = NULL;
+  checks[1].certificate = &metadata->product_signing_key_certificate;
+  checks[1].authority =
+      metadata->product_intermediate_key_certificate.signed_data.public_key;
+  checks[1].minimum_version = psk_minimum_version;
+  checks[1].product_id = permanent_attributes->product_id;
+  for (n = 0; n < 2; n++) {
+    checks[n].check_signature = true;
+    checks[n].is_valid = false;
+  }
+
+  if (cert_ops->run_tasks != NULL) {
+    cert_ops->run_tasks(cert_ops, check_certificate_task, check_args, 2);
+    return checks[0].is_valid && checks[1].is_valid;
+  }
+
+  for (n = 0; n < 2; n++) {
+    init_certificate_signature_check(checks[n].certificate,
+                                     checks[n].authority,
+                                     certificate_hashes[n],
+                                     &signature_checks[n]);
+  }
+  if (!avb_rsa_verify_batch(signature_checks, 2, signature_valid)) {
+    avb_error("Invalid certificate signature.\n");
+    if (!signature_valid[0]) {
+      avb_error("Invalid PIK certificate.\n");
+    } else {
+      avb_error("Invalid PSK certificate.\n");
+    }
+    return false;
+  }
+  for (n = 0; n < 2; n++) {
+    checks[n].check_signature = false;
+    check_certificate_task(&checks[n]);
+    if (!checks[n].is_valid) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Returns true if |cache| holds a chain matching the given values. */
+static bool verified_chain_cache_lookup(
+    const AvbCertVerifiedChainCache* cache,
+    const uint8_t permanent_attributes_hash[AVB_SHA256_DIGEST_SIZE],
+    const uint8_t metadata_hash[AVB_SHA256_DIGEST_SIZE],
+    uint64_t pik_minimum_version,
+    uint64_t psk_minimum_version) {
+  size_t n;
+
+  for (n = 0; n < cache->num_entries && n < AVB_CERT_VERIFIED_CHAIN_CACHE_SIZE;
+       n++) {
+    const AvbCertVerifiedChain* entry = &cache->entries[n];
+    if (entry->pik_minimum_version == pik_minimum_version &&
+        entry->psk_minimum_version == psk_minimum_version &&
+        avb_safe_memcmp(entry->permanent_attributes_hash,
+                        permanent_attributes_hash,
+                        AVB_SHA256_DIGEST_SIZE) == 0 &&
+        avb_safe_memcmp(entry->metadata_hash,
+                        metadata_hash,
+                        AVB_SHA256_DIGEST_SIZE) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Adds a verified chain to |cache|, replacing the oldest entry if full. */
+static void verified_chain_cache_insert(
+    AvbCertVerifiedChainCache* cache,
+    const uint8_t permanent_attributes_hash[AVB_SHA256_DIGEST_SIZE],
+    const uint8_t metadata_hash[AVB_SHA256_DIGEST_SIZE],
+    uint64_t pik_minimum_version,
+    uint64_t psk_minimum_version) {
+  AvbCertVerifiedChain* entry;
+
+  if (cache->next_entry >= AVB_CERT_VERIFIED_CHAIN_CACHE_SIZE) {
+    cache->next_entry = 0;
+  }
+  entry = &cache->entries[cache->next_entry++];
+  avb_memcpy(entry->permanent_attributes_hash,
+             permanent_attributes_hash,
+             AVB_SHA256_DIGEST_SIZE);
+  avb_memcpy(entry->metadata_hash, metadata_hash, AVB_SHA256_DIGEST_SIZE);
+  entry->pik_minimum_version = pik_minimum_version;
+  entry->psk_minimum_version = psk_minimum_version;
+  if (cache->num_entries < AVB_CERT_VERIFIED_CHAIN_CACHE_SIZE) {
+    cache->num_entries++;
+  }
+}
+
+void avb_cert_verified_chain_cache_clear(AvbCertVerifiedChainCache* cache) {
+  avb_memset(cache, 0, sizeof(AvbCertVerifiedChainCache));
+}
+
 AvbIOResult avb_cert_validate_vbmeta_public_key(
     AvbOps* ops,
     const uint8_t* public_key_data,
@@ -201,32 +384,27 @@ AvbIOResult avb_cert_validate_vbmeta_public_key(
     size_t public_key_metadata_length,
     bool* out_is_trusted) {
   AvbIOResult result = AVB_IO_RESULT_OK;
+  AvbCertOps* cert_ops = ops->cert_ops;
   AvbCertPermanentAttributes permanent_attributes;
   uint8_t permanent_attributes_hash[AVB_SHA256_DIGEST_SIZE];
+  uint8_t metadata_hash[AVB_SHA256_DIGEST_SIZE];
   AvbCertPublicKeyMetadata metadata;
-  uint64_t minimum_version;
+  uint64_t pik_minimum_version;
+  uint64_t psk_minimum_version;
 
   /* Be pessimistic so we can exit early without having to remember to clear.
    */
   *out_is_trusted = false;
 
-  /* Read and verify permanent attributes. */
-  result = ops->cert_ops->read_permanent_attributes(ops->cert_ops,
-                                                    &permanent_attributes);
-  if (result != AVB_IO_RESULT_OK) {
-    avb_error("Failed to read permanent attributes.\n");
-    return result;
-  }
-  result = ops->cert_ops->read_permanent_attributes_hash(
-      ops->cert_ops, permanent_attributes_hash);
+  /* Read the permanent attributes hash. The attributes themselves are only
+   * needed if the chain isn't already known to be valid.
+   */
+  result = cert_ops->read_permanent_attributes_hash(cert_ops,
+                                                    permanent_attributes_hash);
   if (result != AVB_IO_RESULT_OK) {
     avb_error("Failed to read permanent attributes hash.\n");
     return result;
   }
-  if (!verify_permanent_attributes(&permanent_attributes,
-                                   permanent_attributes_hash)) {
-    return AVB_IO_RESULT_OK;
-  }
 
   /* Sanity check public key metadata. */
   if (public_key_metadata_length != sizeof(AvbCertPublicKeyMetadata)) {
@@ -239,32 +417,61 @@ AvbIOResult avb_cert_validate_vbmeta_public_key(
     return AVB_IO_RESULT_OK;
   }
 
-  /* Verify the PIK certificate. */
+  /* Read the minimum key versions. */
   result = ops->read_rollback_index(
-      ops, AVB_CERT_PIK_VERSION_LOCATION, &minimum_version);
+      ops, AVB_CERT_PIK_VERSION_LOCATION, &pik_minimum_version);
   if (result != AVB_IO_RESULT_OK) {
     avb_error("Failed to read PIK minimum version.\n");
     return result;
   }
-  if (!verify_pik_certificate(&metadata.product_intermediate_key_certificate,
-                              permanent_attributes.product_root_public_key,
-                              minimum_version)) {
-    return AVB_IO_RESULT_OK;
-  }
-
-  /* Verify the PSK certificate. */
   result = ops->read_rollback_index(
-      ops, AVB_CERT_PSK_VERSION_LOCATION, &minimum_version);
+      ops, AVB_CERT_PSK_VERSION_LOCATION, &psk_minimum_version);
   if (result != AVB_IO_RESULT_OK) {
     avb_error("Failed to read PSK minimum version.\n");
     return result;
   }
-  if (!verify_psk_certificate(
-          &metadata.product_signing_key_certificate,
-          metadata.product_intermediate_key_certificate.signed_data.public_key,
-          minimum_version,
-          permanent_attributes.product_id)) {
-    return AVB_IO_RESULT_OK;
+
+  if (cert_ops->verified_chain_cache != NULL) {
+    sha256((const uint8_t*)&metadata,
+           sizeof(AvbCertPublicKeyMetadata),
+           metadata_hash);
+  }
+  if (cert_ops->verified_chain_cache != NULL &&
+      verified_chain_cache_lookup(cert_ops->verified_chain_cache,
+                                  permanent_attributes_hash,
+                                  metadata_hash,
+                                  pik_minimum_version,
+                                  psk_minimum_version)) {
+    avb_debug("Using previously verified certificate chain.\n");
+  } else {
+    /* Read and verify permanent attributes. */
+    result = cert_ops->read_permanent_attributes(cert_ops,
+                                                 &permanent_attributes);
+    if (result != AVB_IO_RESULT_OK) {
+      avb_error("Failed to read permanent attributes.\n");
+      return result;
+    }
+    if (!verify_permanent_attributes(&permanent_attributes,
+                                     permanent_attributes_hash)) {
+      return AVB_IO_RESULT_OK;
+    }
+
+    /* Verify the PIK and PSK certificates. */
+    if (!verify_pik_and_psk_certificates(cert_ops,
+                                         &metadata,
+                                         &permanent_attributes,
+                                         pik_minimum_version,
+                                         psk_minimum_version)) {
+      return AVB_IO_RESULT_OK;
+    }
+
+    if (cert_ops->verified_chain_cache != NULL) {
+      verified_chain_cache_insert(cert_ops->verified_chain_cache,
+                                  permanent_attributes_hash,
+                                  metadata_hash,
+                                  pik_minimum_version,
+                                  psk_minimum_version);
+    }
   }
 
   /* Verify the PSK is the same key that verified vbmeta. */
@@ -281,12 +488,12 @@ AvbIOResult avb_cert_validate_vbmeta_public_key(
   }
 
   /* Report the key versions used during verification. */
-  ops->cert_ops->set_key_version(
-      ops->cert_ops,
+  cert_ops->set_key_version(
+      cert_ops,
       AVB_CERT_PIK_VERSION_LOCATION,
       metadata.product_intermediate_key_certificate.signed_data.key_version);
-  ops->cert_ops->set_key_version(
-      ops->cert_ops,
+  cert_ops->set_key_version(
+      cert_ops,
       AVB_CERT_PSK_VERSION_LOCATION,
       metadata.product_signing_key_certificate.signed_data.key_version);
 
@@ -370,7 +577,8 @@ AvbIOResult avb_cert_validate_unlock_credential(
   if (!verify_pik_certificate(
           &unlock_credential->product_intermediate_key_certificate,
           permanent_attributes.product_root_public_key,
-          minimum_version)) {
+          minimum_version,
+          true /* check_signature */)) {
     return AVB_IO_RESULT_OK;
   }
 
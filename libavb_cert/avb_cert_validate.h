@@ -60,6 +60,11 @@ extern "C" {
  *   - Product ID: This value is provided in permanent attributes and is unique
  *                 to a specific product. This value must match the subject of
  *                 the PSK certificate.
+ *
+ * If |ops->cert_ops->verified_chain_cache| is set, chains which were already
+ * verified are looked up there instead of being verified again. If
+ * |ops->cert_ops->run_tasks| is set, the PIK and PSK certificate signatures
+ * are checked in parallel.
  */
 AvbIOResult avb_cert_validate_vbmeta_public_key(
     AvbOps* ops,
@@ -69,6 +74,9 @@ AvbIOResult avb_cert_validate_vbmeta_public_key(
     size_t public_key_metadata_length,
     bool* out_is_trusted);
 
+/* Removes all entries from |cache|, see AvbCertOps.verified_chain_cache. */
+void avb_cert_verified_chain_cache_clear(AvbCertVerifiedChainCache* cache);
+
 /* Generates a challenge which can be used to create an unlock credential. */
 AvbIOResult avb_cert_generate_unlock_challenge(
     AvbCertOps* cert_ops, AvbCertUnlockChallenge* out_unlock_challenge);
@@ -0,0 +1,717 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "avb_pvstore.h"
+
+#include <libavb/avb_sysdeps.h>
+#include <libavb/avb_util.h>
+
+/* The CRC-32 of a record covers everything after the |crc32| field. */
+#define RECORD_CRC32_START \
+  (offsetof(AvbPvStoreRecord, crc32) + sizeof(uint32_t))
+
+/* Records start after the bank header. */
+#define BANK_DATA_START                                         \
+  ((sizeof(AvbPvStoreBankHeader) + AVB_PVSTORE_ALIGNMENT - 1) & \
+   ~((uint64_t)AVB_PVSTORE_ALIGNMENT - 1))
+
+/* An entry in the name index. Deleted values keep their entry, with
+ * |present| set to false, until the next compaction. Entries freed by
+ * a compaction are marked with |tombstone| so lookups keep probing
+ * past them.
+ */
+typedef struct AvbPvStoreEntry {
+  char* name;
+  bool tombstone;
+  bool present;
+  uint32_t value_size;
+  /* Offset of the latest record within the active bank. */
+  uint64_t offset;
+  /* Offset of the copied record within the other bank while
+   * compacting.
+   */
+  uint64_t new_offset;
+} AvbPvStoreEntry;
+
+struct AvbPvStore {
+  AvbPvStoreOps* ops;
+  uint64_t bank_size;
+  size_t active_bank;
+  uint32_t generation;
+
+  /* Offset within the active bank where the next record goes. */
+  uint64_t write_pos;
+  /* Total size of the records for present values. */
+  uint64_t live_size;
+  /* Set if a torn record was found, so nothing can be appended until
+   * the bank has been compacted.
+   */
+  bool needs_compaction;
+
+  /* Open-addressing hash table with |num_slots| entries, a power of
+   * two. |num_entries| counts the names in it, including deleted ones.
+   */
+  AvbPvStoreEntry* entries;
+  size_t num_slots;
+  size_t num_entries;
+  size_t max_values;
+
+  /* Compaction progress, see avb_pvstore_compact_step(). */
+  bool compacting;
+  size_t compact_next_slot;
+  uint64_t compact_pos;
+};
+
+static uint64_t pvstore_align(uint64_t value) {
+  return (value + AVB_PVSTORE_ALIGNMENT - 1) &
+         ~((uint64_t)AVB_PVSTORE_ALIGNMENT - 1);
+}
+
+/* The sum is done in uint64_t so it can't wrap where size_t is 32 bits.
+ * Callers must make sure |value_size| is at most the bank size.
+ */
+static uint64_t record_size(size_t name_len, size_t value_size) {
+  return pvstore_align((uint64_t)sizeof(AvbPvStoreRecord) + name_len +
+                       value_size);
+}
+
+static uint64_t bank_offset(const AvbPvStore* store, size_t bank) {
+  return bank * store->bank_size;
+}
+
+/* Returns the number of zero bytes to write after a record ending at
+ * |end| in a bank to mark the end of the log.
+ *
+ * Storage which isn't erased before a bank is reused may still hold
+ * records from an earlier compaction attempt beyond the end of the
+ * log, with the same generation. Following every record with an
+ * empty record header ensures these are never read.
+ */
+static size_t end_marker_size(const AvbPvStore* store, uint64_t end) {
+  if (store->ops->erase != NULL ||
+      sizeof(AvbPvStoreRecord) > store->bank_size - end) {
+    return 0;
+  }
+  return sizeof(AvbPvStoreRecord);
+}
+
+static AvbIOResult write_end_marker(AvbPvStore* store,
+                                    size_t bank,
+                                    uint64_t end) {
+  uint8_t marker[sizeof(AvbPvStoreRecord)];
+  size_t size = end_marker_size(store, end);
+
+  if (size == 0) {
+    return AVB_IO_RESULT_OK;
+  }
+  avb_memset(marker, 0, sizeof(marker));
+  return store->ops->write(
+      store->ops, bank_offset(store, bank) + end, size, marker);
+}
+
+/* FNV-1a hash of |name|. */
+static uint32_t name_hash(const char* name, size_t name_len) {
+  uint32_t hash = 2166136261u;
+  size_t n;
+
+  for (n = 0; n < name_len; n++) {
+    hash ^= (uint8_t)name[n];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Returns the index entry for |name| if there is one. Otherwise
+ * returns NULL and the slot a new entry should use in |out_free|.
+ */
+static AvbPvStoreEntry* find_entry(AvbPvStore* store,
+                                   const char* name,
+                                   size_t name_len,
+                                   AvbPvStoreEntry** out_free) {
+  size_t mask = store->num_slots - 1;
+  size_t slot = name_hash(name, name_len) & mask;
+  size_t n;
+
+  *out_free = NULL;
+  for (n = 0; n < store->num_slots; n++) {
+    AvbPvStoreEntry* entry = &store->entries[(slot + n) & mask];
+    if (entry->name == NULL) {
+      if (*out_free == NULL) {
+        *out_free = entry;
+      }
+      if (!entry->tombstone) {
+        break;
+      }
+    } else if (avb_strlen(entry->name) == name_len &&
+               avb_memcmp(entry->name, name, name_len) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/* Records in the index that |name| was written to |offset| in the
+ * active bank. Returns false if the index is full.
+ */
+static bool index_update(AvbPvStore* store,
+                         const char* name,
+                         size_t name_len,
+                         uint64_t offset,
+                         uint32_t value_size) {
+  AvbPvStoreEntry* free_entry;
+  AvbPvStoreEntry* entry = find_entry(store, name, name_len, &free_entry);
+
+  if (entry == NULL) {
+    if (value_size == 0) {
+      /* Nothing to delete. */
+      return true;
+    }
+    if (store->num_entries == store->max_values || free_entry == NULL) {
+      return false;
+    }
+    entry = free_entry;
+    entry->name = avb_malloc(name_len + 1);
+    if (entry->name == NULL) {
+      return false;
+    }
+    avb_memcpy(entry->name, name, name_len);
+    entry->name[name_len] = '\0';
+    entry->tombstone = false;
+    store->num_entries++;
+  } else if (entry->present) {
+    store->live_size -= record_size(name_len, entry->value_size);
+  }
+
+  entry->offset = offset;
+  entry->value_size = value_size;
+  entry->present = (value_size != 0);
+  if (entry->present) {
+    store->live_size += record_size(name_len, value_size);
+  }
+  return true;
+}
+
+/* Sets |generation| and the CRC-32 in the |size| byte record in
+ * |buf|.
+ */
+static void record_seal(uint8_t* buf, size_t size, uint32_t generation) {
+  AvbPvStoreRecord* record = (AvbPvStoreRecord*)buf;
+
+  record->generation = avb_htobe32(generation);
+  record->crc32 = avb_htobe32(
+      avb_crc32(buf + RECORD_CRC32_START, size - RECORD_CRC32_START));
+}
+
+static AvbIOResult write_bank_header(AvbPvStore* store,
+                                     size_t bank,
+                                     uint32_t generation) {
+  AvbPvStoreBankHeader h;
+
+  avb_memcpy(h.magic, AVB_PVSTORE_BANK_MAGIC, AVB_PVSTORE_BANK_MAGIC_LEN);
+  h.version = avb_htobe32(AVB_PVSTORE_VERSION);
+  h.generation = avb_htobe32(generation);
+  h.crc32 = avb_htobe32(
+      avb_crc32((const uint8_t*)&h, offsetof(AvbPvStoreBankHeader, crc32)));
+  return store->ops->write(
+      store->ops, bank_offset(store, bank), sizeof(h), (const uint8_t*)&h);
+}
+
+/* Reads the header of |bank|. If it's valid, |out_valid| is set to
+ * true and the generation is returned in |out_generation|.
+ */
+static AvbIOResult read_bank_header(AvbPvStore* store,
+                                    size_t bank,
+                                    bool* out_valid,
+                                    uint32_t* out_generation) {
+  AvbPvStoreBankHeader h;
+  AvbIOResult io_ret;
+
+  *out_valid = false;
+  io_ret = store->ops->read(
+      store->ops, bank_offset(store, bank), sizeof(h), (uint8_t*)&h);
+  if (io_ret != AVB_IO_RESULT_OK) {
+    return io_ret;
+  }
+  if (avb_memcmp(h.magic,
+                 AVB_PVSTORE_BANK_MAGIC,
+                 AVB_PVSTORE_BANK_MAGIC_LEN) != 0 ||
+      avb_be32toh(h.version) != AVB_PVSTORE_VERSION ||
+      avb_be32toh(h.crc32) !=
+          avb_crc32((const uint8_t*)&h,
+                    offsetof(AvbPvStoreBankHeader, crc32))) {
+    return AVB_IO_RESULT_OK;
+  }
+  *out_valid = true;
+  *out_generation = avb_be32toh(h.generation);
+  return AVB_IO_RESULT_OK;
+}
+
+/* Reads the record at |offset| in |bank| into a newly allocated
+ * buffer returned in |out_buf|, with its size in |out_size|.
+ *
+ * If there's no valid record for the current generation there,
+ * |out_buf| is set to NULL. In that case |out_torn| is set to true if
+ * it looks like a record for the current generation which wasn't
+ * completely written.
+ */
+static AvbIOResult read_record(AvbPvStore* store,
+                               size_t bank,
+                               uint64_t offset,
+                               uint8_t** out_buf,
+                               size_t* out_size,
+                               bool* out_torn) {
+  AvbPvStoreRecord h;
+  AvbIOResult io_ret;
+  uint16_t name_len;
+  uint32_t value_size;
+  uint8_t* buf;
+  size_t size;
+
+  *out_buf = NULL;
+  *out_torn = false;
+
+  if (offset + sizeof(h) > store->bank_size) {
+    return AVB_IO_RESULT_OK;
+  }
+  io_ret = store->ops->read(
+      store->ops, bank_offset(store, bank) + offset, sizeof(h), (uint8_t*)&h);
+  if (io_ret != AVB_IO_RESULT_OK) {
+    return io_ret;
+  }
+  if (avb_memcmp(h.magic,
+                 AVB_PVSTORE_RECORD_MAGIC,
+                 AVB_PVSTORE_RECORD_MAGIC_LEN) != 0 ||
+      avb_be32toh(h.generation) != store->generation) {
+    return AVB_IO_RESULT_OK;
+  }
+
+  name_len = avb_be16toh(h.name_len);
+  value_size = avb_be32toh(h.value_size);
+  if (name_len == 0 || name_len > AVB_PVSTORE_MAX_NAME_LEN ||
+      record_size(name_len, value_size) > store->bank_size - offset) {
+    *out_torn = true;
+    return AVB_IO_RESULT_OK;
+  }
+
+  size = sizeof(h) + name_len + value_size;
+  buf = avb_malloc(size);
+  if (buf == NULL) {
+    return AVB_IO_RESULT_ERROR_OOM;
+  }
+  io_ret = store->ops->read(
+      store->ops, bank_offset(store, bank) + offset, size, buf);
+  if (io_ret != AVB_IO_RESULT_OK) {
+    avb_free(buf);
+    return io_ret;
+  }
+  if (avb_be32toh(h.crc32) !=
+      avb_crc32(buf + RECORD_CRC32_START, size - RECORD_CRC32_START)) {
+    avb_free(buf);
+    *out_torn = true;
+    return AVB_IO_RESULT_OK;
+  }
+
+  *out_buf = buf;
+  *out_size = size;
+  return AVB_IO_RESULT_OK;
+}
+
+/* Builds the index from the records in the active bank. */
+static AvbIOResult scan_bank(AvbPvStore* store) {
+  uint64_t pos = BANK_DATA_START;
+
+  while (true) {
+    const AvbPvStoreRecord* record;
+    AvbIOResult io_ret;
+    uint8_t* buf;
+    size_t size;
+    bool torn;
+    uint16_t name_len;
+    uint32_t value_size;
+    uint64_t aligned_size;
+
+    io_ret =
+        read_record(store, store->active_bank, pos, &buf, &size, &torn);
+    if (io_ret != AVB_IO_RESULT_OK) {
+      return io_ret;
+    }
+    if (buf == NULL) {
+      if (torn) {
+        avb_error("Ignoring incomplete persistent value record.\n");
+        store->needs_compaction = true;
+      }
+      break;
+    }
+
+    record = (const AvbPvStoreRecord*)buf;
+    name_len = avb_be16toh(record->name_len);
+    value_size = avb_be32toh(record->value_size);
+    aligned_size = record_size(name_len, value_size);
+    if (avb_be16toh(record->flags) & AVB_PVSTORE_RECORD_FLAGS_DELETED) {
+      value_size = 0;
+    }
+    if (!index_update(store,
+                      (const char*)buf + sizeof(AvbPvStoreRecord),
+                      name_len,
+                      pos,
+                      value_size)) {
+      avb_free(buf);
+      avb_error("Too many persistent values.\n");
+      return AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE;
+    }
+    avb_free(buf);
+    pos += aligned_size;
+  }
+
+  store->write_pos = pos;
+  return AVB_IO_RESULT_OK;
+}
+
+AvbIOResult avb_pvstore_open(AvbPvStoreOps* ops,
+                             uint64_t storage_size,
+                             size_t max_values,
+                             AvbPvStore** out_store) {
+  AvbPvStore* store;
+  AvbIOResult io_ret;
+  bool valid[2];
+  uint32_t generation[2] = {0, 0};
+  size_t n;
+
+  *out_store = NULL;
+
+  store = avb_calloc(sizeof(AvbPvStore));
+  if (store == NULL) {
+    return AVB_IO_RESULT_ERROR_OOM;
+  }
+  store->ops = ops;
+  store->bank_size =
+      (storage_size / 2) & ~((uint64_t)AVB_PVSTORE_ALIGNMENT - 1);
+  store->max_values = max_values;
+  if (store->bank_size < BANK_DATA_START + record_size(1, 0) ||
+      max_values == 0 || max_values > SIZE_MAX / 4) {
+    avb_error("Invalid persistent value store size.\n");
+    io_ret = AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE;
+    goto fail;
+  }
+
+  /* Keep the load factor at or below 50%. */
+  store->num_slots = 1;
+  while (store->num_slots < 2 * max_values) {
+    store->num_slots *= 2;
+  }
+  store->entries = avb_calloc(store->num_slots * sizeof(AvbPvStoreEntry));
+  if (store->entries == NULL) {
+    io_ret = AVB_IO_RESULT_ERROR_OOM;
+    goto fail;
+  }
+
+  /* Use the bank with the highest generation. */
+  for (n = 0; n < 2; n++) {
+    io_ret = read_bank_header(store, n, &valid[n], &generation[n]);
+    if (io_ret != AVB_IO_RESULT_OK) {
+      goto fail;
+    }
+  }
+  if (valid[0] && valid[1]) {
+    store->active_bank = (int32_t)(generation[1] - generation[0]) > 0 ? 1 : 0;
+  } else if (valid[0] || valid[1]) {
+    store->active_bank = valid[1] ? 1 : 0;
+  } else {
+    /* No store yet, create an empty one. */
+    if (ops->erase != NULL) {
+      io_ret = ops->erase(ops, bank_offset(store, 0), store->bank_size);
+      if (io_ret != AVB_IO_RESULT_OK) {
+        goto fail;
+      }
+    }
+    io_ret = write_end_marker(store, 0, BANK_DATA_START);
+    if (io_ret != AVB_IO_RESULT_OK) {
+      goto fail;
+    }
+    io_ret = write_bank_header(store, 0, 1);
+    if (io_ret != AVB_IO_RESULT_OK) {
+      goto fail;
+    }
+    store->active_bank = 0;
+    generation[0] = 1;
+  }
+  store->generation = generation[store->active_bank];
+
+  io_ret = scan_bank(store);
+  if (io_ret != AVB_IO_RESULT_OK) {
+    goto fail;
+  }
+
+  *out_store = store;
+  return AVB_IO_RESULT_OK;
+
+fail:
+  avb_pvstore_close(store);
+  return io_ret;
+}
+
+void avb_pvstore_close(AvbPvStore* store) {
+  size_t n;
+
+  if (store->entries != NULL) {
+    for (n = 0; n < store->num_slots; n++) {
+      if (store->entries[n].name != NULL) {
+        avb_free(store->entries[n].name);
+      }
+    }
+    avb_free(store->entries);
+  }
+  avb_free(store);
+}
+
+AvbIOResult avb_pvstore_read(AvbPvStore* store,
+                             const char* name,
+                             size_t buffer_size,
+                             uint8_t* out_buffer,
+                             size_t* out_num_bytes_read) {
+  AvbPvStoreEntry* free_entry;
+  AvbPvStoreEntry* entry;
+  size_t name_len = avb_strlen(name);
+
+  entry = find_entry(store, name, name_len, &free_entry);
+  if (entry == NULL || !entry->present) {
+    return AVB_IO_RESULT_ERROR_NO_SUCH_VALUE;
+  }
+  *out_num_bytes_read = entry->value_size;
+  if (out_buffer == NULL || buffer_size < entry->value_size) {
+    return AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE;
+  }
+  return store->ops->read(store->ops,
+                          bank_offset(store, store->active_bank) +
+                              entry->offset + sizeof(AvbPvStoreRecord) +
+                              name_len,
+                          entry->value_size,
+                          out_buffer);
+}
+
+AvbIOResult avb_pvstore_write(AvbPvStore* store,
+                              const char* name,
+                              size_t value_size,
+                              const uint8_t* value) {
+  AvbPvStoreEntry* free_entry;
+  AvbPvStoreEntry* entry;
+  AvbPvStoreRecord* record;
+  size_t name_len = avb_strlen(name);
+  uint64_t size;
+  size_t buf_size;
+  uint8_t* buf = NULL;
+  bool new_entry;
+  AvbIOResult io_ret;
+
+  if (name_len == 0 || name_len > AVB_PVSTORE_MAX_NAME_LEN) {
+    return AVB_IO_RESULT_ERROR_NO_SUCH_VALUE;
+  }
+  if (value_size > UINT32_MAX || value_size > store->bank_size) {
+    return AVB_IO_RESULT_ERROR_INVALID_VALUE_SIZE;
+  }
+  size = record_size(name_len, value_size);
+  if (size > store->bank_size - BANK_DATA_START) {
+    return AVB_IO_RESULT_ERROR_INVALID_VALUE_SIZE;
+  }
+
+  entry = find_entry(store, name, name_len, &free_entry);
+  if ((entry == NULL || !entry->present) && value_size == 0) {
+    /* Nothing to delete. */
+    return AVB_IO_RESULT_OK;
+  }
+  new_entry = (entry == NULL);
+
+  /* Make room if needed, which also drops deleted values from the
+   * index. Any compaction in progress must start over since the index
+   * changes below.
+   */
+  if (store->needs_compaction ||
+      size > store->bank_size - store->write_pos ||
+      (new_entry && store->num_entries == store->max_values)) {
+    bool done = false;
+    store->compacting = false;
+    while (!done) {
+      io_ret = avb_pvstore_compact_step(store, SIZE_MAX, &done);
+      if (io_ret != AVB_IO_RESULT_OK) {
+        return io_ret;
+      }
+    }
+    if (size > store->bank_size - store->write_pos ||
+        (new_entry && store->num_entries == store->max_values)) {
+      return AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE;
+    }
+  }
+  store->compacting = false;
+
+  /* The record is written in a single operation, together with the end
+   * marker if one is needed.
+   */
+  buf_size = size + end_marker_size(store, store->write_pos + size);
+  buf = avb_calloc(buf_size);
+  if (buf == NULL) {
+    return AVB_IO_RESULT_ERROR_OOM;
+  }
+  record = (AvbPvStoreRecord*)buf;
+  avb_memcpy(
+      record->magic, AVB_PVSTORE_RECORD_MAGIC, AVB_PVSTORE_RECORD_MAGIC_LEN);
+  record->name_len = avb_htobe16((uint16_t)name_len);
+  if (value_size == 0) {
+    record->flags = avb_htobe16(AVB_PVSTORE_RECORD_FLAGS_DELETED);
+  }
+  record->value_size = avb_htobe32((uint32_t)value_size);
+  avb_memcpy(buf + sizeof(AvbPvStoreRecord), name, name_len);
+  if (value_size > 0) {
+    avb_memcpy(buf + sizeof(AvbPvStoreRecord) + name_len, value, value_size);
+  }
+  record_seal(buf,
+              sizeof(AvbPvStoreRecord) + name_len + value_size,
+              store->generation);
+
+  io_ret = store->ops->write(
+      store->ops,
+      bank_offset(store, store->active_bank) + store->write_pos,
+      buf_size,
+      buf);
+  avb_free(buf);
+  if (io_ret != AVB_IO_RESULT_OK) {
+    /* The record may be partially written. */
+    store->needs_compaction = true;
+    return io_ret;
+  }
+
+  if (!index_update(
+          store, name, name_len, store->write_pos, (uint32_t)value_size)) {
+    /* Only fails on OOM here since there is a free entry. */
+    store->needs_compaction = true;
+    return AVB_IO_RESULT_ERROR_OOM;
+  }
+  store->write_pos += size;
+  return AVB_IO_RESULT_OK;
+}
+
+bool avb_pvstore_needs_compaction(const AvbPvStore* store) {
+  uint64_t used = store->write_pos - BANK_DATA_START;
+  uint64_t reclaimable = used - store->live_size;
+
+  return store->needs_compaction ||
+         (reclaimable > 0 &&
+          reclaimable >= store->bank_size - store->write_pos);
+}
+
+AvbIOResult avb_pvstore_compact_step(AvbPvStore* store,
+                                     size_t budget,
+                                     bool* out_done) {
+  size_t other_bank = 1 - store->active_bank;
+  size_t copied = 0;
+  AvbIOResult io_ret;
+  size_t n;
+
+  *out_done = false;
+
+  if (!store->compacting) {
+    if (store->ops->erase != NULL) {
+      io_ret = store->ops->erase(
+          store->ops, bank_offset(store, other_bank), store->bank_size);
+      if (io_ret != AVB_IO_RESULT_OK) {
+        return io_ret;
+      }
+    }
+    store->compacting = true;
+    store->compact_next_slot = 0;
+    store->compact_pos = BANK_DATA_START;
+  }
+
+  /* Copy the latest record of each present value. */
+  while (store->compact_next_slot < store->num_slots) {
+    AvbPvStoreEntry* entry = &store->entries[store->compact_next_slot];
+    uint8_t* buf;
+    size_t size;
+    bool torn;
+
+    if (entry->name != NULL && entry->present) {
+      uint64_t aligned_size =
+          record_size(avb_strlen(entry->name), entry->value_size);
+      if (copied > 0 && (copied >= budget || aligned_size > budget - copied)) {
+        return AVB_IO_RESULT_OK;
+      }
+      io_ret = read_record(
+          store, store->active_bank, entry->offset, &buf, &size, &torn);
+      if (io_ret != AVB_IO_RESULT_OK) {
+        return io_ret;
+      }
+      if (buf == NULL) {
+        avb_error(entry->name, ": Persistent value record is corrupt.\n");
+        return AVB_IO_RESULT_ERROR_IO;
+      }
+      record_seal(buf, size, store->generation + 1);
+      io_ret = store->ops->write(store->ops,
+                                 bank_offset(store, other_bank) +
+                                     store->compact_pos,
+                                 size,
+                                 buf);
+      avb_free(buf);
+      if (io_ret != AVB_IO_RESULT_OK) {
+        return io_ret;
+      }
+      entry->new_offset = store->compact_pos;
+      store->compact_pos += aligned_size;
+      copied += aligned_size;
+    }
+    store->compact_next_slot++;
+  }
+
+  /* Writing the bank header makes the copy the active bank. */
+  io_ret = write_end_marker(store, other_bank, store->compact_pos);
+  if (io_ret != AVB_IO_RESULT_OK) {
+    return io_ret;
+  }
+  io_ret = write_bank_header(store, other_bank, store->generation + 1);
+  if (io_ret != AVB_IO_RESULT_OK) {
+    return io_ret;
+  }
+  store->active_bank = other_bank;
+  store->generation++;
+  store->write_pos = store->compact_pos;
+  store->needs_compaction = false;
+  store->compacting = false;
+
+  /* Deleted values are gone now, so drop them from the index. */
+  for (n = 0; n < store->num_slots; n++) {
+    AvbPvStoreEntry* entry = &store->entries[n];
+    if (entry->name == NULL) {
+      continue;
+    }
+    if (entry->present) {
+      entry->offset = entry->new_offset;
+    } else {
+      avb_free(entry->name);
+      entry->name = NULL;
+      entry->tombstone = true;
+      store->num_entries--;
+    }
+  }
+
+  *out_done = true;
+  return AVB_IO_RESULT_OK;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if !defined(AVB_INSIDE_LIBAVB_PVSTORE_H) && !defined(AVB_COMPILATION)
+#error \
+    "Never include this file directly, include libavb_pvstore/libavb_pvstore.h instead."
+#endif
+
+#ifndef AVB_PVSTORE_H_
+#define AVB_PVSTORE_H_
+
+#include <libavb/libavb.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Magic for a bank header. */
+#define AVB_PVSTORE_BANK_MAGIC "AVBp"
+#define AVB_PVSTORE_BANK_MAGIC_LEN 4
+
+/* Magic for a record. */
+#define AVB_PVSTORE_RECORD_MAGIC "AVBr"
+#define AVB_PVSTORE_RECORD_MAGIC_LEN 4
+
+/* The current on-storage format version. */
+#define AVB_PVSTORE_VERSION 1
+
+/* Alignment of records within a bank. */
+#define AVB_PVSTORE_ALIGNMENT 8
+
+/* Maximum length of a value name, not including the terminator. */
+#define AVB_PVSTORE_MAX_NAME_LEN 255
+
+/* Record flag set for a deleted value. */
+#define AVB_PVSTORE_RECORD_FLAGS_DELETED (1 << 0)
+
+/* A persistent value store keeps named persistent values (see the
+ * read_persistent_value() and write_persistent_value() operations in
+ * AvbOps) in a log on a raw partition or similar block storage.
+ *
+ * The storage is split into two banks of equal size. Each bank starts
+ * with an AvbPvStoreBankHeader and the bank with the highest valid
+ * generation is the active one. Writing or deleting a value appends
+ * an AvbPvStoreRecord followed by the name and the value to the active
+ * bank, so existing data is never modified and no erase is needed.
+ * The last record for a name wins.
+ *
+ * Each record carries a CRC-32 and the generation of its bank, so a
+ * torn write is detected and ignored when the store is opened, as are
+ * stale records left in a bank from earlier generations. When the
+ * active bank fills up, the live values are copied to the other bank
+ * which then becomes active by writing its header last. This
+ * compaction can also be done incrementally ahead of time, see
+ * avb_pvstore_compact_step().
+ *
+ * When the store is opened the active bank is scanned once to build
+ * an index in RAM, after which reading a value is a single read of
+ * the storage.
+ *
+ * All integers are in network byte order.
+ */
+typedef struct AvbPvStoreBankHeader {
+  /*  0: Four bytes equal to "AVBp" (AVB_PVSTORE_BANK_MAGIC). */
+  uint8_t magic[AVB_PVSTORE_BANK_MAGIC_LEN];
+  /*  4: The format version, AVB_PVSTORE_VERSION. */
+  uint32_t version;
+  /*  8: The generation of the bank, incremented by every compaction. */
+  uint32_t generation;
+  /* 12: CRC-32 of the preceding fields. */
+  uint32_t crc32;
+} AVB_ATTR_PACKED AvbPvStoreBankHeader;
+
+/* A record in a bank. It's followed by the |name_len| bytes of the
+ * name and the |value_size| bytes of the value, and padded to
+ * AVB_PVSTORE_ALIGNMENT bytes.
+ */
+typedef struct AvbPvStoreRecord {
+  /*  0: Four bytes equal to "AVBr" (AVB_PVSTORE_RECORD_MAGIC). */
+  uint8_t magic[AVB_PVSTORE_RECORD_MAGIC_LEN];
+  /*  4: The generation of the bank the record was written to. */
+  uint32_t generation;
+  /*  8: CRC-32 of the record from offset 12, the name and the value. */
+  uint32_t crc32;
+  /* 12: Length of the name. */
+  uint16_t name_len;
+  /* 14: Flags, see AVB_PVSTORE_RECORD_FLAGS_DELETED. */
+  uint16_t flags;
+  /* 16: Size of the value, zero if deleted. */
+  uint32_t value_size;
+} AVB_ATTR_PACKED AvbPvStoreRecord;
+
+struct AvbPvStoreOps;
+typedef struct AvbPvStoreOps AvbPvStoreOps;
+
+/* Operations for accessing the storage backing a persistent value
+ * store. Offsets are relative to the start of the storage.
+ */
+struct AvbPvStoreOps {
+  /* This pointer can be used by the application/bootloader using
+   * libavb_pvstore and is typically used in each operation to get a
+   * pointer to platform-specific resources.
+   */
+  void* user_data;
+
+  /* Reads |num_bytes| from |offset| into |buffer|. Returns
+   * AVB_IO_RESULT_OK if all bytes were read, otherwise an error code.
+   */
+  AvbIOResult (*read)(AvbPvStoreOps* ops,
+                      uint64_t offset,
+                      size_t num_bytes,
+                      uint8_t* buffer);
+
+  /* Writes |num_bytes| from |buffer| to |offset|. Returns
+   * AVB_IO_RESULT_OK if all bytes were written, otherwise an error
+   * code.
+   */
+  AvbIOResult (*write)(AvbPvStoreOps* ops,
+                       uint64_t offset,
+                       size_t num_bytes,
+                       const uint8_t* buffer);
+
+  /* Erases |num_bytes| from |offset|, which is always one entire bank,
+   * so it can be written again. This is only called before a bank is
+   * reused for compaction.
+   *
+   * This operation is optional and may be set to NULL if the storage
+   * can be overwritten without erasing it first.
+   */
+  AvbIOResult (*erase)(AvbPvStoreOps* ops, uint64_t offset, uint64_t num_bytes);
+};
+
+struct AvbPvStore;
+typedef struct AvbPvStore AvbPvStore;
+
+/* Opens the persistent value store in the first |storage_size| bytes
+ * of the storage accessed through |ops|, which must outlive the
+ * store. If there's no valid store, an empty one is created. At most
+ * |max_values| distinct names can be stored.
+ *
+ * On success, AVB_IO_RESULT_OK is returned and the store is returned
+ * in |out_store|, which must be freed with avb_pvstore_close().
+ */
+AvbIOResult avb_pvstore_open(AvbPvStoreOps* ops,
+                             uint64_t storage_size,
+                             size_t max_values,
+                             AvbPvStore** out_store);
+
+/* Frees |store|. */
+void avb_pvstore_close(AvbPvStore* store);
+
+/* Reads the value for |name|. The parameters and return values are
+ * the same as for the read_persistent_value() operation in AvbOps, so
+ * it can simply call this.
+ */
+AvbIOResult avb_pvstore_read(AvbPvStore* store,
+                             const char* name,
+                             size_t buffer_size,
+                             uint8_t* out_buffer,
+                             size_t* out_num_bytes_read);
+
+/* Writes the value for |name|, deleting it if |value_size| is zero.
+ * The parameters and return values are the same as for the
+ * write_persistent_value() operation in AvbOps, so it can simply call
+ * this.
+ *
+ * If there's no room left in the active bank it is compacted first,
+ * and if there still isn't enough room or |max_values| would be
+ * exceeded AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE is returned.
+ */
+AvbIOResult avb_pvstore_write(AvbPvStore* store,
+                              const char* name,
+                              size_t value_size,
+                              const uint8_t* value);
+
+/* Returns true if compacting |store| would free up at least as much
+ * space as is currently free in the active bank.
+ */
+bool avb_pvstore_needs_compaction(const AvbPvStore* store);
+
+/* Does some compaction work for |store|, copying at most |budget|
+ * bytes of live records but at least one record. This allows
+ * compaction to be done in small steps when the device is idle rather
+ * than in a call to avb_pvstore_write().
+ *
+ * Values can be read and written between steps, but writing restarts
+ * the compaction. Returns AVB_IO_RESULT_OK on success, with
+ * |out_done| set to true once the compaction is complete.
+ */
+AvbIOResult avb_pvstore_compact_step(AvbPvStore* store,
+                                     size_t budget,
+                                     bool* out_done);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVB_PVSTORE_H_ */
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "avb_pvstore_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static int file_fd(AvbPvStoreOps* ops) {
+  return (int)(intptr_t)ops->user_data;
+}
+
+static AvbIOResult file_read(AvbPvStoreOps* ops,
+                             uint64_t offset,
+                             size_t num_bytes,
+                             uint8_t* buffer) {
+  int fd = file_fd(ops);
+  size_t num_read = 0;
+
+  if (lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+    return AVB_IO_RESULT_ERROR_IO;
+  }
+  while (num_read < num_bytes) {
+    ssize_t n = read(fd, buffer + num_read, num_bytes - num_read);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return AVB_IO_RESULT_ERROR_IO;
+    }
+    if (n == 0) {
+      /* Past the end of the file, as if never written. */
+      avb_memset(buffer + num_read, 0, num_bytes - num_read);
+      break;
+    }
+    num_read += (size_t)n;
+  }
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult file_write(AvbPvStoreOps* ops,
+                              uint64_t offset,
+                              size_t num_bytes,
+                              const uint8_t* buffer) {
+  int fd = file_fd(ops);
+  size_t num_written = 0;
+
+  if (lseek(fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+    return AVB_IO_RESULT_ERROR_IO;
+  }
+  while (num_written < num_bytes) {
+    ssize_t n = write(fd, buffer + num_written, num_bytes - num_written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return AVB_IO_RESULT_ERROR_IO;
+    }
+    num_written += (size_t)n;
+  }
+  return AVB_IO_RESULT_OK;
+}
+
+bool avb_pvstore_file_ops_init(AvbPvStoreOps* ops, const char* path) {
+  int fd = open(path, O_RDWR | O_CREAT, 0600);
+
+  if (fd < 0) {
+    avb_error("Error opening persistent value store file.\n");
+    return false;
+  }
+  avb_memset(ops, 0, sizeof(AvbPvStoreOps));
+  ops->user_data = (void*)(intptr_t)fd;
+  ops->read = file_read;
+  ops->write = file_write;
+  return true;
+}
+
+void avb_pvstore_file_ops_close(AvbPvStoreOps* ops) {
+  close(file_fd(ops));
+  ops->user_data = (void*)(intptr_t)-1;
+}
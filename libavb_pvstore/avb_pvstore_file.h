@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if !defined(AVB_INSIDE_LIBAVB_PVSTORE_H) && !defined(AVB_COMPILATION)
+#error \
+    "Never include this file directly, include libavb_pvstore/libavb_pvstore.h instead."
+#endif
+
+#ifndef AVB_PVSTORE_FILE_H_
+#define AVB_PVSTORE_FILE_H_
+
+#include "avb_pvstore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sets up |ops| to access a persistent value store kept in the file
+ * at |path|, which is created if it doesn't exist. Parts of the file
+ * which haven't been written read as zeroes. This is intended for
+ * host tools and tests, and needs POSIX file I/O so it's not part of
+ * the libavb_pvstore library itself.
+ *
+ * Returns false if the file can't be opened. On success, free the
+ * resources with avb_pvstore_file_ops_close() once the store using
+ * |ops| has been closed.
+ */
+bool avb_pvstore_file_ops_init(AvbPvStoreOps* ops, const char* path);
+
+/* Closes the file used by |ops|. */
+void avb_pvstore_file_ops_close(AvbPvStoreOps* ops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVB_PVSTORE_FILE_H_ */
@@ -0,0 +1,680 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIBAVB_VIEW_H_
+#define LIBAVB_VIEW_H_
+
+// Header-only C++17 views over serialized vbmeta images, for host-side code.
+//
+// The views are non-owning and read big-endian fields directly from the
+// underlying buffer when accessed, so parsing and iterating over descriptors
+// never copies or allocates. Every view is bounds-checked when it is created
+// (using the same rules as libavb's *_validate_and_byteswap() functions) so
+// accessors cannot read outside the buffer.
+//
+// None of this checks signatures - use avb_vbmeta_image_verify() or
+// avb_slot_verify() for that.
+
+#include <libavb/libavb.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string_view>
+
+namespace avb {
+
+namespace view_internal {
+
+inline uint32_t LoadBE32(const uint8_t* p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline uint64_t LoadBE64(const uint8_t* p) {
+  return (uint64_t(LoadBE32(p)) << 32) | LoadBE32(p + 4);
+}
+
+// Returns true if [offset, offset + size) is inside [0, limit).
+inline bool InBounds(uint64_t offset, uint64_t size, uint64_t limit) {
+  return offset <= limit && size <= limit - offset;
+}
+
+// Returns |data| up to the first NUL byte, if any.
+inline std::string_view TrimAtNul(const uint8_t* data, size_t size) {
+  std::string_view str(reinterpret_cast<const char*>(data), size);
+  return str.substr(0, str.find('\0'));
+}
+
+}  // namespace view_internal
+
+// A non-owning view of a range of bytes.
+class ByteView {
+ public:
+  constexpr ByteView() = default;
+  constexpr ByteView(const uint8_t* data, size_t size)
+      : data_(data), size_(size) {}
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const uint8_t* begin() const { return data_; }
+  const uint8_t* end() const { return data_ + size_; }
+  uint8_t operator[](size_t n) const { return data_[n]; }
+
+  // Returns |size| bytes starting at |offset|, or nullopt if that range is
+  // not inside this view.
+  std::optional<ByteView> Subview(uint64_t offset, uint64_t size) const {
+    if (!view_internal::InBounds(offset, size, size_)) {
+      return std::nullopt;
+    }
+    return ByteView(data_ + offset, size);
+  }
+
+  std::string_view AsStringView() const {
+    return std::string_view(reinterpret_cast<const char*>(data_), size_);
+  }
+
+  bool operator==(const ByteView& other) const {
+    return AsStringView() == other.AsStringView();
+  }
+  bool operator!=(const ByteView& other) const { return !(*this == other); }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// A single descriptor, including its AvbDescriptor header. Use the
+// FromDescriptor() function of the typed views below to access the fields of
+// known descriptor types.
+class DescriptorView {
+ public:
+  uint64_t tag() const { return view_internal::LoadBE64(bytes_.data()); }
+  uint64_t num_bytes_following() const {
+    return bytes_.size() - sizeof(AvbDescriptor);
+  }
+  ByteView bytes() const { return bytes_; }
+
+ private:
+  friend class DescriptorRange;
+
+  DescriptorView() = default;
+  explicit DescriptorView(ByteView bytes) : bytes_(bytes) {}
+
+  ByteView bytes_;
+};
+
+// The descriptors in a vbmeta image. Iteration stops at the end of the
+// descriptors or at the first malformed descriptor, whichever comes first;
+// use IsWellFormed() to tell the two apart.
+class DescriptorRange {
+ public:
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = DescriptorView;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const DescriptorView*;
+    using reference = const DescriptorView&;
+
+    Iterator() = default;
+
+    reference operator*() const { return current_; }
+    pointer operator->() const { return &current_; }
+
+    Iterator& operator++() {
+      Advance();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator it = *this;
+      Advance();
+      return it;
+    }
+
+    bool operator==(const Iterator& other) const {
+      return current_.bytes().data() == other.current_.bytes().data();
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+   private:
+    friend class DescriptorRange;
+
+    explicit Iterator(ByteView remaining) : remaining_(remaining) {
+      Advance();
+    }
+
+    // Splits the next descriptor off |remaining_|. Becomes the end iterator
+    // if there is none or it's malformed.
+    void Advance() {
+      current_ = DescriptorView();
+      if (remaining_.size() < sizeof(AvbDescriptor)) {
+        return;
+      }
+      uint64_t num_bytes_following = view_internal::LoadBE64(
+          remaining_.data() + offsetof(AvbDescriptor, num_bytes_following));
+      if ((num_bytes_following & 0x07) != 0 ||
+          num_bytes_following > remaining_.size() - sizeof(AvbDescriptor)) {
+        remaining_ = ByteView();
+        return;
+      }
+      size_t total = sizeof(AvbDescriptor) + num_bytes_following;
+      current_ = DescriptorView(ByteView(remaining_.data(), total));
+      remaining_ =
+          ByteView(remaining_.data() + total, remaining_.size() - total);
+    }
+
+    DescriptorView current_;
+    ByteView remaining_;
+  };
+
+  DescriptorRange() = default;
+  explicit DescriptorRange(ByteView bytes) : bytes_(bytes) {}
+
+  Iterator begin() const { return Iterator(bytes_); }
+  Iterator end() const { return Iterator(); }
+
+  // Returns true if the descriptors fill the whole range without any
+  // malformed descriptor headers.
+  bool IsWellFormed() const {
+    const uint8_t* next = bytes_.data();
+    for (const DescriptorView& descriptor : *this) {
+      next = descriptor.bytes().end();
+    }
+    return next == bytes_.end();
+  }
+
+ private:
+  ByteView bytes_;
+};
+
+namespace view_internal {
+
+// Returns true if |descriptor| has tag |tag| and is large enough to hold the
+// fixed-size struct T.
+template <typename T>
+inline bool HasFixedPart(const DescriptorView& descriptor, uint64_t tag) {
+  return descriptor.tag() == tag && descriptor.bytes().size() >= sizeof(T);
+}
+
+// Returns true if |variable_size| bytes following the fixed-size struct T are
+// inside |descriptor|.
+template <typename T>
+inline bool HasVariablePart(const DescriptorView& descriptor,
+                            uint64_t variable_size) {
+  return InBounds(sizeof(T), variable_size, descriptor.bytes().size());
+}
+
+// Field access shared by the typed descriptor views.
+class TypedDescriptorView {
+ protected:
+  explicit TypedDescriptorView(ByteView bytes) : bytes_(bytes) {}
+
+  uint32_t Load32(size_t offset) const {
+    return LoadBE32(bytes_.data() + offset);
+  }
+  uint64_t Load64(size_t offset) const {
+    return LoadBE64(bytes_.data() + offset);
+  }
+  // Returns |size| bytes at |offset| in the data following the fixed-size
+  // struct T.
+  template <typename T>
+  ByteView Trailing(uint64_t offset, uint64_t size) const {
+    return ByteView(bytes_.data() + sizeof(T) + offset, size);
+  }
+
+  ByteView bytes_;
+};
+
+}  // namespace view_internal
+
+// An AvbPropertyDescriptor.
+class PropertyDescriptorView : view_internal::TypedDescriptorView {
+ public:
+  static std::optional<PropertyDescriptorView> FromDescriptor(
+      const DescriptorView& descriptor) {
+    using namespace view_internal;
+    if (!HasFixedPart<AvbPropertyDescriptor>(descriptor,
+                                             AVB_DESCRIPTOR_TAG_PROPERTY)) {
+      return std::nullopt;
+    }
+    PropertyDescriptorView view(descriptor.bytes());
+    // Both the key and the value are followed by a NUL byte.
+    uint64_t key_num_bytes = view.key_num_bytes();
+    uint64_t value_num_bytes = view.value_num_bytes();
+    if (key_num_bytes > UINT64_MAX - 2 ||
+        value_num_bytes > UINT64_MAX - 2 - key_num_bytes ||
+        !HasVariablePart<AvbPropertyDescriptor>(
+            descriptor, key_num_bytes + value_num_bytes + 2)) {
+      return std::nullopt;
+    }
+    return view;
+  }
+
+  std::string_view key() const {
+    return Trailing<AvbPropertyDescriptor>(0, key_num_bytes()).AsStringView();
+  }
+  std::string_view value() const {
+    return Trailing<AvbPropertyDescriptor>(key_num_bytes() + 1,
+                                           value_num_bytes())
+        .AsStringView();
+  }
+
+ private:
+  explicit PropertyDescriptorView(ByteView bytes)
+      : TypedDescriptorView(bytes) {}
+
+  uint64_t key_num_bytes() const {
+    return Load64(offsetof(AvbPropertyDescriptor, key_num_bytes));
+  }
+  uint64_t value_num_bytes() const {
+    return Load64(offsetof(AvbPropertyDescriptor, value_num_bytes));
+  }
+};
+
+// An AvbHashDescriptor.
+class HashDescriptorView : view_internal::TypedDescriptorView {
+ public:
+  static std::optional<HashDescriptorView> FromDescriptor(
+      const DescriptorView& descriptor) {
+    using namespace view_internal;
+    if (!HasFixedPart<AvbHashDescriptor>(descriptor,
+                                         AVB_DESCRIPTOR_TAG_HASH)) {
+      return std::nullopt;
+    }
+    HashDescriptorView view(descriptor.bytes());
+    if (!HasVariablePart<AvbHashDescriptor>(
+            descriptor,
+            uint64_t(view.partition_name_len()) + view.salt_len() +
+                view.digest_len())) {
+      return std::nullopt;
+    }
+    return view;
+  }
+
+  uint64_t image_size() const {
+    return Load64(offsetof(AvbHashDescriptor, image_size));
+  }
+  std::string_view hash_algorithm() const {
+    return view_internal::TrimAtNul(
+        bytes_.data() + offsetof(AvbHashDescriptor, hash_algorithm),
+        sizeof(AvbHashDescriptor::hash_algorithm));
+  }
+  uint32_t flags() const { return Load32(offsetof(AvbHashDescriptor, flags)); }
+  std::string_view partition_name() const {
+    return Trailing<AvbHashDescriptor>(0, partition_name_len()).AsStringView();
+  }
+  ByteView salt() const {
+    return Trailing<AvbHashDescriptor>(partition_name_len(), salt_len());
+  }
+  ByteView digest() const {
+    return Trailing<AvbHashDescriptor>(
+        uint64_t(partition_name_len()) + salt_len(), digest_len());
+  }
+
+ private:
+  explicit HashDescriptorView(ByteView bytes) : TypedDescriptorView(bytes) {}
+
+  uint32_t partition_name_len() const {
+    return Load32(offsetof(AvbHashDescriptor, partition_name_len));
+  }
+  uint32_t salt_len() const {
+    return Load32(offsetof(AvbHashDescriptor, salt_len));
+  }
+  uint32_t digest_len() const {
+    return Load32(offsetof(AvbHashDescriptor, digest_len));
+  }
+};
+
+// An AvbHashtreeDescriptor.
+class HashtreeDescriptorView : view_internal::TypedDescriptorView {
+ public:
+  static std::optional<HashtreeDescriptorView> FromDescriptor(
+      const DescriptorView& descriptor) {
+    using namespace view_internal;
+    if (!HasFixedPart<AvbHashtreeDescriptor>(descriptor,
+                                             AVB_DESCRIPTOR_TAG_HASHTREE)) {
+      return std::nullopt;
+    }
+    HashtreeDescriptorView view(descriptor.bytes());
+    if (!HasVariablePart<AvbHashtreeDescriptor>(
+            descriptor,
+            uint64_t(view.partition_name_len()) + view.salt_len() +
+                view.root_digest_len())) {
+      return std::nullopt;
+    }
+    return view;
+  }
+
+  uint32_t dm_verity_version() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, dm_verity_version));
+  }
+  uint64_t image_size() const {
+    return Load64(offsetof(AvbHashtreeDescriptor, image_size));
+  }
+  uint64_t tree_offset() const {
+    return Load64(offsetof(AvbHashtreeDescriptor, tree_offset));
+  }
+  uint64_t tree_size() const {
+    return Load64(offsetof(AvbHashtreeDescriptor, tree_size));
+  }
+  uint32_t data_block_size() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, data_block_size));
+  }
+  uint32_t hash_block_size() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, hash_block_size));
+  }
+  uint32_t fec_num_roots() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, fec_num_roots));
+  }
+  uint64_t fec_offset() const {
+    return Load64(offsetof(AvbHashtreeDescriptor, fec_offset));
+  }
+  uint64_t fec_size() const {
+    return Load64(offsetof(AvbHashtreeDescriptor, fec_size));
+  }
+  std::string_view hash_algorithm() const {
+    return view_internal::TrimAtNul(
+        bytes_.data() + offsetof(AvbHashtreeDescriptor, hash_algorithm),
+        sizeof(AvbHashtreeDescriptor::hash_algorithm));
+  }
+  uint32_t flags() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, flags));
+  }
+  std::string_view partition_name() const {
+    return Trailing<AvbHashtreeDescriptor>(0, partition_name_len())
+        .AsStringView();
+  }
+  ByteView salt() const {
+    return Trailing<AvbHashtreeDescriptor>(partition_name_len(), salt_len());
+  }
+  ByteView root_digest() const {
+    return Trailing<AvbHashtreeDescriptor>(
+        uint64_t(partition_name_len()) + salt_len(), root_digest_len());
+  }
+
+ private:
+  explicit HashtreeDescriptorView(ByteView bytes)
+      : TypedDescriptorView(bytes) {}
+
+  uint32_t partition_name_len() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, partition_name_len));
+  }
+  uint32_t salt_len() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, salt_len));
+  }
+  uint32_t root_digest_len() const {
+    return Load32(offsetof(AvbHashtreeDescriptor, root_digest_len));
+  }
+};
+
+// An AvbKernelCmdlineDescriptor.
+class KernelCmdlineDescriptorView : view_internal::TypedDescriptorView {
+ public:
+  static std::optional<KernelCmdlineDescriptorView> FromDescriptor(
+      const DescriptorView& descriptor) {
+    using namespace view_internal;
+    if (!HasFixedPart<AvbKernelCmdlineDescriptor>(
+            descriptor, AVB_DESCRIPTOR_TAG_KERNEL_CMDLINE)) {
+      return std::nullopt;
+    }
+    KernelCmdlineDescriptorView view(descriptor.bytes());
+    if (!HasVariablePart<AvbKernelCmdlineDescriptor>(
+            descriptor, view.kernel_cmdline_length())) {
+      return std::nullopt;
+    }
+    return view;
+  }
+
+  uint32_t flags() const {
+    return Load32(offsetof(AvbKernelCmdlineDescriptor, flags));
+  }
+  std::string_view kernel_cmdline() const {
+    return Trailing<AvbKernelCmdlineDescriptor>(0, kernel_cmdline_length())
+        .AsStringView();
+  }
+
+ private:
+  explicit KernelCmdlineDescriptorView(ByteView bytes)
+      : TypedDescriptorView(bytes) {}
+
+  uint32_t kernel_cmdline_length() const {
+    return Load32(offsetof(AvbKernelCmdlineDescriptor, kernel_cmdline_length));
+  }
+};
+
+// An AvbChainPartitionDescriptor.
+class ChainPartitionDescriptorView : view_internal::TypedDescriptorView {
+ public:
+  static std::optional<ChainPartitionDescriptorView> FromDescriptor(
+      const DescriptorView& descriptor) {
+    using namespace view_internal;
+    if (!HasFixedPart<AvbChainPartitionDescriptor>(
+            descriptor, AVB_DESCRIPTOR_TAG_CHAIN_PARTITION)) {
+      return std::nullopt;
+    }
+    ChainPartitionDescriptorView view(descriptor.bytes());
+    if (view.rollback_index_location() < 1 ||
+        !HasVariablePart<AvbChainPartitionDescriptor>(
+            descriptor,
+            uint64_t(view.partition_name_len()) + view.public_key_len())) {
+      return std::nullopt;
+    }
+    return view;
+  }
+
+  uint32_t rollback_index_location() const {
+    return Load32(
+        offsetof(AvbChainPartitionDescriptor, rollback_index_location));
+  }
+  uint32_t flags() const {
+    return Load32(offsetof(AvbChainPartitionDescriptor, flags));
+  }
+  std::string_view partition_name() const {
+    return Trailing<AvbChainPartitionDescriptor>(0, partition_name_len())
+        .AsStringView();
+  }
+  ByteView public_key() const {
+    return Trailing<AvbChainPartitionDescriptor>(partition_name_len(),
+                                                 public_key_len());
+  }
+
+ private:
+  explicit ChainPartitionDescriptorView(ByteView bytes)
+      : TypedDescriptorView(bytes) {}
+
+  uint32_t partition_name_len() const {
+    return Load32(offsetof(AvbChainPartitionDescriptor, partition_name_len));
+  }
+  uint32_t public_key_len() const {
+    return Load32(offsetof(AvbChainPartitionDescriptor, public_key_len));
+  }
+};
+
+// A vbmeta image, starting with its AvbVBMetaImageHeader.
+class VBMetaView {
+ public:
+  // Returns a view of the vbmeta image at the start of the |size| bytes at
+  // |data|, or nullopt if the header or the layout of the blocks is invalid.
+  // The required libavb version isn't checked, so host tools can inspect
+  // images made for newer versions of libavb.
+  static std::optional<VBMetaView> Parse(const uint8_t* data, size_t size) {
+    using view_internal::InBounds;
+
+    if (data == nullptr || size < sizeof(AvbVBMetaImageHeader) ||
+        std::string_view(reinterpret_cast<const char*>(data), AVB_MAGIC_LEN) !=
+            std::string_view(AVB_MAGIC, AVB_MAGIC_LEN)) {
+      return std::nullopt;
+    }
+    VBMetaView view(ByteView(data, size));
+
+    if (data[offsetof(AvbVBMetaImageHeader, release_string) +
+             AVB_RELEASE_STRING_SIZE - 1] != '\0') {
+      return std::nullopt;
+    }
+    uint64_t auth_size = view.Header64(
+        offsetof(AvbVBMetaImageHeader, authentication_data_block_size));
+    uint64_t aux_size = view.Header64(
+        offsetof(AvbVBMetaImageHeader, auxiliary_data_block_size));
+    if ((auth_size & 0x3f) != 0 || (aux_size & 0x3f) != 0 ||
+        !InBounds(sizeof(AvbVBMetaImageHeader), auth_size, size) ||
+        !InBounds(sizeof(AvbVBMetaImageHeader) + auth_size, aux_size, size)) {
+      return std::nullopt;
+    }
+    view.bytes_ = ByteView(data, sizeof(AvbVBMetaImageHeader) + auth_size +
+                                     aux_size);
+
+    // Hash and signature live in the authentication block, everything else
+    // in the auxiliary block.
+    ByteView auth = view.authentication_block();
+    ByteView aux = view.auxiliary_block();
+    if (!view.Field(auth,
+                    offsetof(AvbVBMetaImageHeader, hash_offset),
+                    offsetof(AvbVBMetaImageHeader, hash_size)) ||
+        !view.Field(auth,
+                    offsetof(AvbVBMetaImageHeader, signature_offset),
+                    offsetof(AvbVBMetaImageHeader, signature_size)) ||
+        !view.Field(aux,
+                    offsetof(AvbVBMetaImageHeader, public_key_offset),
+                    offsetof(AvbVBMetaImageHeader, public_key_size)) ||
+        !view.Field(aux,
+                    offsetof(AvbVBMetaImageHeader, public_key_metadata_offset),
+                    offsetof(AvbVBMetaImageHeader, public_key_metadata_size)) ||
+        !view.Field(aux,
+                    offsetof(AvbVBMetaImageHeader, descriptors_offset),
+                    offsetof(AvbVBMetaImageHeader, descriptors_size))) {
+      return std::nullopt;
+    }
+    return view;
+  }
+
+  // The whole image: header, authentication and auxiliary blocks.
+  ByteView bytes() const { return bytes_; }
+
+  uint32_t required_libavb_version_major() const {
+    return Header32(
+        offsetof(AvbVBMetaImageHeader, required_libavb_version_major));
+  }
+  uint32_t required_libavb_version_minor() const {
+    return Header32(
+        offsetof(AvbVBMetaImageHeader, required_libavb_version_minor));
+  }
+  AvbAlgorithmType algorithm_type() const {
+    return AvbAlgorithmType(
+        Header32(offsetof(AvbVBMetaImageHeader, algorithm_type)));
+  }
+  uint64_t rollback_index() const {
+    return Header64(offsetof(AvbVBMetaImageHeader, rollback_index));
+  }
+  uint32_t rollback_index_location() const {
+    return Header32(offsetof(AvbVBMetaImageHeader, rollback_index_location));
+  }
+  uint32_t flags() const {
+    return Header32(offsetof(AvbVBMetaImageHeader, flags));
+  }
+  std::string_view release_string() const {
+    return view_internal::TrimAtNul(
+        bytes_.data() + offsetof(AvbVBMetaImageHeader, release_string),
+        AVB_RELEASE_STRING_SIZE);
+  }
+
+  ByteView authentication_block() const {
+    return ByteView(bytes_.data() + sizeof(AvbVBMetaImageHeader),
+                    Header64(offsetof(AvbVBMetaImageHeader,
+                                      authentication_data_block_size)));
+  }
+  ByteView auxiliary_block() const {
+    ByteView auth = authentication_block();
+    return ByteView(auth.end(),
+                    Header64(offsetof(AvbVBMetaImageHeader,
+                                      auxiliary_data_block_size)));
+  }
+
+  ByteView hash() const {
+    return *Field(authentication_block(),
+                  offsetof(AvbVBMetaImageHeader, hash_offset),
+                  offsetof(AvbVBMetaImageHeader, hash_size));
+  }
+  ByteView signature() const {
+    return *Field(authentication_block(),
+                  offsetof(AvbVBMetaImageHeader, signature_offset),
+                  offsetof(AvbVBMetaImageHeader, signature_size));
+  }
+  ByteView public_key() const {
+    return *Field(auxiliary_block(),
+                  offsetof(AvbVBMetaImageHeader, public_key_offset),
+                  offsetof(AvbVBMetaImageHeader, public_key_size));
+  }
+  ByteView public_key_metadata() const {
+    return *Field(auxiliary_block(),
+                  offsetof(AvbVBMetaImageHeader, public_key_metadata_offset),
+                  offsetof(AvbVBMetaImageHeader, public_key_metadata_size));
+  }
+
+  DescriptorRange descriptors() const {
+    return DescriptorRange(
+        *Field(auxiliary_block(),
+               offsetof(AvbVBMetaImageHeader, descriptors_offset),
+               offsetof(AvbVBMetaImageHeader, descriptors_size)));
+  }
+
+  // Like avb_property_lookup(): returns the value of the first property
+  // descriptor with the given key, or nullopt if there is none.
+  std::optional<std::string_view> GetPropertyValue(
+      std::string_view key) const {
+    for (const DescriptorView& descriptor : descriptors()) {
+      auto property = PropertyDescriptorView::FromDescriptor(descriptor);
+      if (property && property->key() == key) {
+        return property->value();
+      }
+    }
+    return std::nullopt;
+  }
+
+ private:
+  explicit VBMetaView(ByteView bytes) : bytes_(bytes) {}
+
+  uint32_t Header32(size_t offset) const {
+    return view_internal::LoadBE32(bytes_.data() + offset);
+  }
+  uint64_t Header64(size_t offset) const {
+    return view_internal::LoadBE64(bytes_.data() + offset);
+  }
+
+  // Returns the range of |block| given by the header fields at
+  // |offset_field| and |size_field|, or nullopt if it's not inside |block|.
+  std::optional<ByteView> Field(ByteView block,
+                                size_t offset_field,
+                                size_t size_field) const {
+    return block.Subview(Header64(offset_field), Header64(size_field));
+  }
+
+  ByteView bytes_;
+};
+
+}  // namespace avb
+
+#endif  // LIBAVB_VIEW_H_
@@ -0,0 +1,214 @@
+// Copyright 2024, The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! libavb_rs benchmarks.
+//!
+//! Covers the full `slot_verify()` path including the Rust <-> C ops trampolines, as well as the
+//! Rust-side descriptor parsing and property lookup.
+
+// Only a subset of the shared test data is needed here.
+#[allow(dead_code)]
+#[path = "../tests/test_data.rs"]
+mod test_data;
+
+use avb::{slot_verify, HashtreeErrorMode, SlotVerifyData, SlotVerifyFlags};
+use avb_test::{FakeVbmetaKey, TestOps};
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
+use std::{ffi::CString, fs, hint::black_box};
+use test_data::*;
+
+// These constants must match the values used to create the bench images in Android.bp.
+const BENCH_LARGE_IMAGE_PATH: &str = "avbrs_bench_large_image.img";
+const BENCH_LARGE_IMAGE_SIZE: usize = 16 * 1024 * 1024;
+const BENCH_VBMETA_PATH: &str = "avbrs_bench_vbmeta.img";
+const BENCH_PARTITION_NAME: &str = "bench_part";
+const BENCH_NUM_PROPERTIES: usize = 64;
+
+/// How the hashed partition contents are provided to libavb.
+#[derive(Clone, Copy)]
+enum Loading {
+    /// Read via `read_from_partition()` into a libavb-allocated buffer.
+    InMemory,
+    /// Borrowed in full via `get_preloaded_partition()`.
+    Preloaded,
+    /// First half via `get_preloaded_partition()`, remainder via `read_from_partition()`.
+    PartiallyPreloaded,
+}
+
+impl Loading {
+    const ALL: [Self; 3] = [Self::InMemory, Self::Preloaded, Self::PartiallyPreloaded];
+
+    fn name(self) -> &'static str {
+        match self {
+            Self::InMemory => "in_memory",
+            Self::Preloaded => "preloaded",
+            Self::PartiallyPreloaded => "partially_preloaded",
+        }
+    }
+}
+
+/// Builds a `TestOps` which will successfully verify `partition` against `vbmeta`.
+fn build_ops<'a>(
+    vbmeta: Vec<u8>,
+    partition: &'static str,
+    image: &'a [u8],
+    loading: Loading,
+) -> TestOps<'a> {
+    let mut ops = TestOps::default();
+    ops.add_partition("vbmeta", vbmeta);
+    match loading {
+        Loading::InMemory => {
+            ops.add_partition(partition, image);
+        }
+        Loading::Preloaded => {
+            ops.add_preloaded_partition(partition, image);
+        }
+        Loading::PartiallyPreloaded => {
+            ops.add_partially_preloaded_partition(partition, &image[..image.len() / 2], image);
+        }
+    }
+    ops.default_vbmeta_key = Some(FakeVbmetaKey::Avb {
+        public_key: fs::read(TEST_PUBLIC_KEY_PATH).unwrap(),
+        public_key_metadata: None,
+    });
+    ops.rollbacks.insert(TEST_VBMETA_ROLLBACK_LOCATION, 0);
+    ops.unlock_state = Ok(false);
+    ops
+}
+
+/// Calls `slot_verify()` for a single partition with standard args.
+fn verify<'a>(ops: &mut TestOps<'a>, partition: &CString) -> SlotVerifyData<'a> {
+    slot_verify(
+        ops,
+        &[partition],
+        None,
+        SlotVerifyFlags::AVB_SLOT_VERIFY_FLAGS_NONE,
+        HashtreeErrorMode::AVB_HASHTREE_ERROR_MODE_EIO,
+    )
+    .unwrap()
+}
+
+/// Benchmarks `slot_verify()` on the small test image.
+///
+/// The image is only 16KiB, so this is dominated by the vbmeta signature check and the fixed
+/// per-call overhead of the ops bridge.
+fn bench_slot_verify_small(c: &mut Criterion) {
+    let image = fs::read(TEST_IMAGE_PATH).unwrap();
+    let partition = CString::new(TEST_PARTITION_NAME).unwrap();
+
+    let mut group = c.benchmark_group("slot_verify_small");
+    for loading in Loading::ALL {
+        let mut ops = build_ops(
+            fs::read(TEST_VBMETA_PATH).unwrap(),
+            TEST_PARTITION_NAME,
+            &image,
+            loading,
+        );
+        group.bench_function(loading.name(), |b| b.iter(|| verify(&mut ops, &partition)));
+    }
+    group.finish();
+}
+
+/// Benchmarks `slot_verify()` on a large image, where loading and hashing dominate.
+fn bench_slot_verify_large(c: &mut Criterion) {
+    let image = fs::read(BENCH_LARGE_IMAGE_PATH).unwrap();
+    assert_eq!(image.len(), BENCH_LARGE_IMAGE_SIZE);
+    let partition = CString::new(BENCH_PARTITION_NAME).unwrap();
+
+    let mut group = c.benchmark_group("slot_verify_large");
+    group.throughput(Throughput::Bytes(BENCH_LARGE_IMAGE_SIZE as u64));
+    for loading in Loading::ALL {
+        let mut ops = build_ops(
+            fs::read(BENCH_VBMETA_PATH).unwrap(),
+            BENCH_PARTITION_NAME,
+            &image,
+            loading,
+        );
+        group.bench_function(loading.name(), |b| b.iter(|| verify(&mut ops, &partition)));
+    }
+    group.finish();
+}
+
+/// Benchmarks Rust-side parsing of the descriptors in an already-verified vbmeta image.
+fn bench_descriptors(c: &mut Criterion) {
+    let image = fs::read(BENCH_LARGE_IMAGE_PATH).unwrap();
+    let partition = CString::new(BENCH_PARTITION_NAME).unwrap();
+    let mut ops = build_ops(
+        fs::read(BENCH_VBMETA_PATH).unwrap(),
+        BENCH_PARTITION_NAME,
+        &image,
+        Loading::Preloaded,
+    );
+    let data = verify(&mut ops, &partition);
+    let vbmeta = &data.vbmeta_data()[0];
+
+    let mut group = c.benchmark_group("descriptors");
+    // The bench vbmeta holds the properties plus one hash descriptor.
+    group.throughput(Throughput::Elements(BENCH_NUM_PROPERTIES as u64 + 1));
+    group.bench_function("iter", |b| {
+        b.iter(|| black_box(vbmeta).descriptor_iter().unwrap().count())
+    });
+    group.bench_function("collect", |b| {
+        b.iter(|| black_box(vbmeta).descriptors().unwrap())
+    });
+    group.bench_function("index", |b| {
+        b.iter(|| black_box(vbmeta).descriptor_index().unwrap())
+    });
+    group.finish();
+}
+
+/// Benchmarks looking up every property in the bench vbmeta image.
+fn bench_get_property_value(c: &mut Criterion) {
+    let image = fs::read(BENCH_LARGE_IMAGE_PATH).unwrap();
+    let partition = CString::new(BENCH_PARTITION_NAME).unwrap();
+    let mut ops = build_ops(
+        fs::read(BENCH_VBMETA_PATH).unwrap(),
+        BENCH_PARTITION_NAME,
+        &image,
+        Loading::Preloaded,
+    );
+    let data = verify(&mut ops, &partition);
+    let vbmeta = &data.vbmeta_data()[0];
+    let keys: Vec<String> = (0..BENCH_NUM_PROPERTIES)
+        .map(|i| format!("bench_prop_{i}"))
+        .collect();
+
+    let mut group = c.benchmark_group("get_property_value");
+    group.throughput(Throughput::Elements(BENCH_NUM_PROPERTIES as u64));
+    group.bench_function("vbmeta_data", |b| {
+        b.iter(|| {
+            for key in &keys {
+                black_box(vbmeta.get_property_value(key).unwrap());
+            }
+        })
+    });
+    group.bench_function("descriptor_index", |b| {
+        b.iter(|| {
+            let index = vbmeta.descriptor_index().unwrap();
+            for key in &keys {
+                black_box(index.get_property_value(key).unwrap());
+            }
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_slot_verify_small,
+    bench_slot_verify_large,
+    bench_descriptors,
+    bench_get_property_value
+);
+criterion_main!(benches);
@@ -0,0 +1,163 @@
+// Copyright 2024, The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Descriptor lookup index.
+
+extern crate alloc;
+
+use super::{
+    ChainPartitionDescriptor, Descriptor, DescriptorIter, DescriptorResult, HashDescriptor,
+    HashtreeDescriptor,
+};
+use alloc::vec::Vec;
+
+/// Pre-parsed descriptors from a single vbmeta image with sorted lookup tables.
+///
+/// Building the index parses every descriptor exactly once; afterwards property and partition
+/// lookups are binary searches rather than a re-parse and linear scan of the image. This is
+/// useful for boot flows which query many properties from the same image.
+///
+/// When a key or partition name appears more than once, lookups return the first occurrence in
+/// image order, matching libavb `avb_property_lookup()`.
+#[derive(Debug)]
+pub struct DescriptorIndex<'a> {
+    /// All descriptors in image order.
+    descriptors: Vec<Descriptor<'a>>,
+    /// Indices into `descriptors` of property descriptors, sorted by key.
+    properties: Vec<usize>,
+    /// Indices into `descriptors` of hash, hashtree, and chain partition descriptors, sorted by
+    /// partition name.
+    partitions: Vec<usize>,
+}
+
+impl<'a> DescriptorIndex<'a> {
+    /// Builds an index from the given descriptors.
+    ///
+    /// # Arguments
+    /// * `iter`: the descriptors to index.
+    ///
+    /// # Returns
+    /// The index, or the first `DescriptorError` encountered while parsing.
+    pub(crate) fn new(iter: DescriptorIter<'a>) -> DescriptorResult<Self> {
+        let descriptors = iter.collect::<DescriptorResult<Vec<_>>>()?;
+
+        let mut properties: Vec<usize> = (0..descriptors.len())
+            .filter(|&i| property_key(&descriptors[i]).is_some())
+            .collect();
+        let mut partitions: Vec<usize> = (0..descriptors.len())
+            .filter(|&i| descriptor_partition_name(&descriptors[i]).is_some())
+            .collect();
+
+        // Stable sorts keep duplicate keys in image order so the first occurrence wins.
+        properties.sort_by_key(|&i| property_key(&descriptors[i]));
+        partitions.sort_by_key(|&i| descriptor_partition_name(&descriptors[i]));
+
+        Ok(Self {
+            descriptors,
+            properties,
+            partitions,
+        })
+    }
+
+    /// Returns all descriptors in image order.
+    pub fn descriptors(&self) -> &[Descriptor<'a>] {
+        &self.descriptors
+    }
+
+    /// Returns the value of the property with the given key, or `None` if not found.
+    pub fn get_property_value(&self, key: &str) -> Option<&'a [u8]> {
+        match self.find(&self.properties, key, property_key)? {
+            Descriptor::Property(p) => Some(p.value),
+            _ => None,
+        }
+    }
+
+    /// Returns the first hash, hashtree, or chain partition descriptor for the given partition
+    /// name, or `None` if not found.
+    pub fn get_partition_descriptor(&self, partition_name: &str) -> Option<&Descriptor<'a>> {
+        self.find(&self.partitions, partition_name, descriptor_partition_name)
+    }
+
+    /// Returns the hash descriptor for the given partition name, or `None` if not found.
+    pub fn get_hash_descriptor(&self, partition_name: &str) -> Option<&HashDescriptor<'a>> {
+        self.partition_matches(partition_name)
+            .find_map(|d| match d {
+                Descriptor::Hash(h) => Some(h),
+                _ => None,
+            })
+    }
+
+    /// Returns the hashtree descriptor for the given partition name, or `None` if not found.
+    pub fn get_hashtree_descriptor(&self, partition_name: &str) -> Option<&HashtreeDescriptor<'a>> {
+        self.partition_matches(partition_name)
+            .find_map(|d| match d {
+                Descriptor::Hashtree(h) => Some(h),
+                _ => None,
+            })
+    }
+
+    /// Returns the chain partition descriptor for the given partition name, or `None` if not
+    /// found.
+    pub fn get_chain_partition_descriptor(
+        &self,
+        partition_name: &str,
+    ) -> Option<&ChainPartitionDescriptor<'a>> {
+        self.partition_matches(partition_name)
+            .find_map(|d| match d {
+                Descriptor::ChainPartition(c) => Some(c),
+                _ => None,
+            })
+    }
+
+    /// Returns the first descriptor in `table` whose key equals `key`.
+    fn find(
+        &self,
+        table: &[usize],
+        key: &str,
+        key_fn: fn(&Descriptor<'a>) -> Option<&'a str>,
+    ) -> Option<&Descriptor<'a>> {
+        let start = table.partition_point(|&i| key_fn(&self.descriptors[i]) < Some(key));
+        let &i = table.get(start)?;
+        let d = &self.descriptors[i];
+        (key_fn(d) == Some(key)).then_some(d)
+    }
+
+    /// Returns all partition descriptors for the given partition name, in image order.
+    fn partition_matches(&self, name: &str) -> impl Iterator<Item = &Descriptor<'a>> {
+        let key = |&i: &usize| descriptor_partition_name(&self.descriptors[i]);
+        let start = self.partitions.partition_point(|i| key(i) < Some(name));
+        let end = self.partitions.partition_point(|i| key(i) <= Some(name));
+        self.partitions[start..end]
+            .iter()
+            .map(|&i| &self.descriptors[i])
+    }
+}
+
+/// Returns the key of a property descriptor, or `None` for other descriptor types.
+fn property_key<'a>(descriptor: &Descriptor<'a>) -> Option<&'a str> {
+    match descriptor {
+        Descriptor::Property(p) => Some(p.key),
+        _ => None,
+    }
+}
+
+/// Returns the partition name of a descriptor which has one, or `None` for other types.
+fn descriptor_partition_name<'a>(descriptor: &Descriptor<'a>) -> Option<&'a str> {
+    match descriptor {
+        Descriptor::Hash(h) => Some(h.partition_name),
+        Descriptor::Hashtree(h) => Some(h.partition_name),
+        Descriptor::ChainPartition(c) => Some(c.partition_name),
+        _ => None,
+    }
+}
@@ -17,31 +17,27 @@
 //! Descriptors are information encoded into vbmeta images which can be
 //! extracted from the resulting data after performing verification.
 
-extern crate alloc;
-
 mod chain;
 mod commandline;
 mod hash;
 mod hashtree;
+mod index;
 mod property;
 mod util;
 
-use crate::VbmetaData;
-use alloc::vec::Vec;
 use avb_bindgen::{
-    avb_descriptor_foreach, avb_descriptor_validate_and_byteswap, AvbDescriptor, AvbDescriptorTag,
-};
-use core::{
-    ffi::{c_void, FromBytesUntilNulError},
-    mem::size_of,
-    slice,
-    str::Utf8Error,
+    avb_descriptor_validate_and_byteswap, avb_vbmeta_image_header_to_host_byte_order,
+    AvbDescriptor, AvbDescriptorTag, AvbVBMetaImageHeader, AVB_MAGIC, AVB_MAGIC_LEN,
 };
+use core::{ffi::FromBytesUntilNulError, mem::size_of, slice, str::Utf8Error};
+use util::{parse_descriptor, split_slice};
+use zerocopy::Ref;
 
 pub use chain::{ChainPartitionDescriptor, ChainPartitionDescriptorFlags};
 pub use commandline::{KernelCommandlineDescriptor, KernelCommandlineDescriptorFlags};
 pub use hash::{HashDescriptor, HashDescriptorFlags};
 pub use hashtree::{HashtreeDescriptor, HashtreeDescriptorFlags};
+pub use index::DescriptorIndex;
 pub use property::PropertyDescriptor;
 
 /// A single descriptor.
@@ -149,82 +145,86 @@ impl<'a> Descriptor<'a> {
     }
 }
 
-/// Returns a vector of descriptors extracted from the given vbmeta image.
+/// Lazily parses the descriptors out of a vbmeta image.
 ///
-/// # Arguments
-/// * `vbmeta`: the `VbmetaData` object to extract descriptors from.
+/// Each call to `next()` extracts a single descriptor directly from the borrowed vbmeta bytes, so
+/// iterating does not allocate. All offsets and sizes are bounds-checked against the image data.
 ///
-/// # Returns
-/// The descriptors, or `DescriptorError` if any error occurred.
-///
-/// # Safety
-/// `vbmeta` must have been validated by `slot_verify()`.
-pub(crate) unsafe fn get_descriptors(vbmeta: &VbmetaData) -> DescriptorResult<Vec<Descriptor>> {
-    let mut result = Ok(Vec::new());
-
-    // Use `avb_descriptor_foreach()` to grab all the descriptor pointers in `vmbeta.data()`.
-    // This implementation processes all the descriptors immediately, so that any error is
-    // detected here and working with descriptors can be error-free.
-    //
-    // SAFETY:
-    // * the caller ensures that `vbmeta` has been validated by `slot_verify()`, which satisfies
-    //   the libavb `avb_vbmeta_image_verify()` requirement.
-    // * `avb_descriptor_foreach()` ensures the validity of each descriptor pointer passed to
-    //   the `fill_descriptors_vec()` callback.
-    // * our lifetimes guarantee that the raw descriptor data in `vbmeta` will remain unchanged for
-    //   the lifetime of the returned `Descriptor` objects.
-    // * the `user_data` param is a valid `DescriptorResult<Vec<Descriptor>>` with no other
-    //   concurrent access.
-    unsafe {
-        // We can ignore the return value of this function since we use the passed-in `result`
-        // to convey success/failure as well as more detailed error info.
-        avb_descriptor_foreach(
-            vbmeta.data().as_ptr(),
-            vbmeta.data().len(),
-            Some(fill_descriptors_vec),
-            &mut result as *mut _ as *mut c_void,
-        );
+/// Iteration stops after the first error is returned.
+#[derive(Clone, Debug)]
+pub struct DescriptorIter<'a> {
+    /// The descriptor bytes which have not been parsed yet.
+    remaining: &'a [u8],
+}
+
+impl<'a> DescriptorIter<'a> {
+    /// Creates an iterator over the descriptors in the given vbmeta image.
+    ///
+    /// # Arguments
+    /// * `vbmeta`: the vbmeta image data, starting with the `AvbVBMetaImageHeader`.
+    ///
+    /// # Returns
+    /// The descriptor iterator, or `DescriptorError` if the header or the descriptor block
+    /// location is invalid.
+    pub(crate) fn new(vbmeta: &'a [u8]) -> DescriptorResult<Self> {
+        let (raw_header, _) = Ref::<_, AvbVBMetaImageHeader>::new_from_prefix(vbmeta)
+            .ok_or(DescriptorError::InvalidHeader)?;
+        let mut header = AvbVBMetaImageHeader::default();
+        // SAFETY: both args point to valid `AvbVBMetaImageHeader` objects, and the function only
+        // accesses memory inside the header.
+        unsafe { avb_vbmeta_image_header_to_host_byte_order(raw_header.into_ref(), &mut header) };
+        if header.magic[..] != AVB_MAGIC[..AVB_MAGIC_LEN as usize] {
+            return Err(DescriptorError::InvalidHeader);
+        }
+
+        // Same layout as `avb_descriptor_foreach()`: the descriptors live in the auxiliary block,
+        // which follows the header and the authentication block.
+        let descriptors_offset = u64::try_from(size_of::<AvbVBMetaImageHeader>())
+            .ok()
+            .and_then(|o| o.checked_add(header.authentication_data_block_size))
+            .and_then(|o| o.checked_add(header.descriptors_offset))
+            .ok_or(DescriptorError::InvalidValue)?;
+        let (_, descriptors) = split_slice(vbmeta, descriptors_offset)?;
+        let (remaining, _) = split_slice(descriptors, header.descriptors_size)?;
+
+        Ok(Self { remaining })
     }
 
-    result
+    /// Splits the next descriptor off the front of `remaining` and parses it.
+    fn parse_next(&mut self) -> DescriptorResult<Descriptor<'a>> {
+        let parsed = parse_descriptor::<AvbDescriptor>(self.remaining)?;
+        // Same rule as `avb_descriptor_foreach()`: descriptors are padded to 8 bytes, anything
+        // else means the array is malformed.
+        if parsed.header.num_bytes_following % 8 != 0 {
+            return Err(DescriptorError::InvalidValue);
+        }
+        let total_size = u64::try_from(size_of::<AvbDescriptor>())
+            .ok()
+            .and_then(|s| s.checked_add(parsed.header.num_bytes_following))
+            .ok_or(DescriptorError::InvalidValue)?;
+        let (contents, remaining) = split_slice(self.remaining, total_size)?;
+        self.remaining = remaining;
+
+        // SAFETY: `contents` holds the full descriptor header plus `num_bytes_following` bytes,
+        // and is borrowed from the vbmeta image for `'a`.
+        unsafe { Descriptor::new(contents.as_ptr() as *const AvbDescriptor) }
+    }
 }
 
-/// Adds the given descriptor to the `Vec` pointed to by `user_data`.
-///
-/// Serves as a C callback for use with `avb_descriptor_foreach()`.
-///
-/// # Returns
-/// True on success, false on failure (which will stop iteration early).
-///
-/// # Safety
-/// * `descriptor` must point to a valid `AvbDescriptor`, including the `num_bytes_following`
-///   data contents, which remains valid and unmodified for the lifetime of the `Descriptor` objects
-///   in `user_data`.
-/// * `user_data` must point to a valid `DescriptorResult<Vec<Descriptor>>` with no other concurrent
-///   access.
-unsafe extern "C" fn fill_descriptors_vec(
-    descriptor: *const AvbDescriptor,
-    user_data: *mut c_void,
-) -> bool {
-    // SAFETY: `user_data` gives exclusive access to a valid `DescriptorResult<Vec<Descriptor>>`.
-    let result = unsafe { (user_data as *mut DescriptorResult<Vec<Descriptor>>).as_mut() };
-    // We can always unwrap here because we never pass a NULL pointer as `user_data`.
-    let result = result.unwrap();
-
-    // SAFETY: caller ensures that `descriptor` points to a valid `AvbDescriptor` with header and
-    // body contents, which remains unmodified at least as long as the new `Descriptor`.
-    match unsafe { Descriptor::new(descriptor) } {
-        Ok(d) => {
-            // We can always unwrap here because this function will never be called with an error
-            // in `result`, since we stop iteration as soon as we encounter an error.
-            result.as_mut().unwrap().push(d);
-            true
+impl<'a> Iterator for DescriptorIter<'a> {
+    type Item = DescriptorResult<Descriptor<'a>>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.remaining.is_empty() {
+            return None;
         }
-        Err(e) => {
-            // Set the error and stop iteration early.
-            *result = Err(e);
-            false
+
+        let result = self.parse_next();
+        if result.is_err() {
+            // Don't try to make sense of anything past a bad descriptor.
+            self.remaining = &[];
         }
+        Some(result)
     }
 }
 
@@ -268,4 +268,58 @@ mod tests {
             DescriptorError::InvalidHeader
         );
     }
+
+    #[test]
+    fn descriptor_iter_short_header_fails() {
+        assert_eq!(
+            DescriptorIter::new(&[0u8; 16]).unwrap_err(),
+            DescriptorError::InvalidHeader
+        );
+    }
+
+    /// Builds a vbmeta image with no authentication block whose descriptors are `descriptors`.
+    fn test_vbmeta(descriptors: &[u8]) -> Vec<u8> {
+        let mut data = vec![0u8; size_of::<AvbVBMetaImageHeader>()];
+        data[..AVB_MAGIC_LEN as usize].copy_from_slice(&AVB_MAGIC[..AVB_MAGIC_LEN as usize]);
+        // `descriptors_size` is at offset 104 of the header.
+        data[104..112].copy_from_slice(&(descriptors.len() as u64).to_be_bytes());
+        data.extend_from_slice(descriptors);
+        data
+    }
+
+    #[test]
+    fn descriptor_iter_success() {
+        let data = test_vbmeta(&[
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, // tag = 0x42u64 (BE)
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, // num_bytes_following = 8u64 (BE)
+            0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, // fake contents
+        ]);
+        let descriptors: Vec<_> = DescriptorIter::new(&data).unwrap().collect();
+        assert_eq!(descriptors.len(), 1);
+        assert!(matches!(descriptors[0], Ok(Descriptor::Unknown(_))));
+    }
+
+    #[test]
+    fn descriptor_iter_unpadded_descriptor_fails() {
+        // Like `avb_descriptor_foreach()`, a descriptor whose size isn't a multiple of 8 is an
+        // error and ends the iteration, even though the next one would be in bounds.
+        let data = test_vbmeta(&[
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, // tag = 0x42u64 (BE)
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, // num_bytes_following = 7u64 (BE)
+            0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, // fake contents
+            0x00, // padding
+        ]);
+        let mut iter = DescriptorIter::new(&data).unwrap();
+        assert!(iter.next().unwrap().is_err());
+        assert!(iter.next().is_none());
+    }
+
+    #[test]
+    fn descriptor_iter_bad_magic_fails() {
+        let data = [0u8; size_of::<AvbVBMetaImageHeader>()];
+        assert_eq!(
+            DescriptorIter::new(&data).unwrap_err(),
+            DescriptorError::InvalidHeader
+        );
+    }
 }
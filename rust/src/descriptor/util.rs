@@ -15,6 +15,7 @@
 //! Descriptor utilities.
 
 use super::{DescriptorError, DescriptorResult};
+use avb_bindgen::{avb_descriptor_validate_and_byteswap, AvbDescriptor};
 use zerocopy::{FromBytes, FromZeroes, Ref};
 
 /// Splits `size` bytes off the front of `data`.
@@ -61,6 +62,12 @@ pub(super) unsafe trait ValidateAndByteswap {
     const VALIDATE_AND_BYTESWAP_FUNC: ValidationFunc<Self>;
 }
 
+// Enable `parse_descriptor()` on a generic `AvbDescriptor` of any sub-type.
+// SAFETY: `VALIDATE_AND_BYTESWAP_FUNC` is the correct libavb validator for this descriptor.
+unsafe impl ValidateAndByteswap for AvbDescriptor {
+    const VALIDATE_AND_BYTESWAP_FUNC: ValidationFunc<Self> = avb_descriptor_validate_and_byteswap;
+}
+
 /// A descriptor that has been extracted, validated, and byteswapped.
 #[derive(Debug)]
 pub(super) struct ParsedDescriptor<'a, T> {
@@ -107,7 +114,7 @@ where
 #[cfg(test)]
 mod tests {
     use super::*;
-    use avb_bindgen::{avb_descriptor_validate_and_byteswap, AvbDescriptor, AvbHashDescriptor};
+    use avb_bindgen::{AvbDescriptor, AvbHashDescriptor};
     use std::mem::size_of;
 
     #[test]
@@ -131,13 +138,6 @@ mod tests {
         assert_eq!(split_slice(data, 5u32), Err(DescriptorError::InvalidSize));
     }
 
-    // Enable `parse_descriptor()` on a generic `AvbDescriptor` of any sub-type.
-    // SAFETY: `VALIDATE_AND_BYTESWAP_FUNC` is the correct libavb validator for this descriptor.
-    unsafe impl ValidateAndByteswap for AvbDescriptor {
-        const VALIDATE_AND_BYTESWAP_FUNC: ValidationFunc<Self> =
-            avb_descriptor_validate_and_byteswap;
-    }
-
     // Hardcoded test descriptor of custom sub-type (tag = 42).
     const TEST_DESCRIPTOR: &[u8] = &[
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, // tag = 0x42u64 (BE)
@@ -39,15 +39,15 @@ pub use cert::{
 };
 pub use descriptor::{
     ChainPartitionDescriptor, ChainPartitionDescriptorFlags, Descriptor, DescriptorError,
-    DescriptorResult, HashDescriptor, HashDescriptorFlags, HashtreeDescriptor,
-    HashtreeDescriptorFlags, KernelCommandlineDescriptor, KernelCommandlineDescriptorFlags,
-    PropertyDescriptor,
+    DescriptorIndex, DescriptorIter, DescriptorResult, HashDescriptor, HashDescriptorFlags,
+    HashtreeDescriptor, HashtreeDescriptorFlags, KernelCommandlineDescriptor,
+    KernelCommandlineDescriptorFlags, PropertyDescriptor,
 };
 pub use error::{
     IoError, IoResult, SlotVerifyError, SlotVerifyNoDataResult, SlotVerifyResult,
     VbmetaVerifyError, VbmetaVerifyResult,
 };
-pub use ops::{Ops, PublicKeyForPartitionInfo};
+pub use ops::{Ops, PartitionRead, PublicKeyForPartitionInfo};
 pub use verify::{
     slot_verify, HashtreeErrorMode, PartitionData, SlotVerifyData, SlotVerifyFlags, VbmetaData,
 };
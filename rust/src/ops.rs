@@ -20,6 +20,7 @@
 extern crate alloc;
 
 use crate::{error::result_to_io_enum, CertOps, IoError, IoResult, SHA256_DIGEST_SIZE};
+use alloc::{ffi::CString, vec::Vec};
 use avb_bindgen::{AvbCertOps, AvbCertPermanentAttributes, AvbIOResult, AvbOps};
 use core::{
     cmp::min,
@@ -66,18 +67,51 @@ pub trait Ops<'a> {
         buffer: &mut [u8],
     ) -> IoResult<usize>;
 
+    /// Reads data from the requested partition on disk for several requests at once.
+    ///
+    /// This allows implementations to submit all the requests to the storage device together,
+    /// e.g. to make use of NVMe or UFS queue depth. libavb itself currently issues a single
+    /// request per call, but all partition reads are routed through this function so it is the
+    /// only one which needs to be overridden.
+    ///
+    /// The default implementation services each request in order via `read_from_partition()`.
+    ///
+    /// # Arguments
+    /// * `partition`: partition name to read from.
+    /// * `reads`: the read requests; on success `bytes_read` is set in each request.
+    ///
+    /// # Returns
+    /// Unit on success, or the first `IoError` encountered. Reading less than `buffer.len()` bytes
+    /// for a request is only allowed if the end of the partition was reached.
+    fn read_from_partition_vectored(
+        &mut self,
+        partition: &CStr,
+        reads: &mut [PartitionRead],
+    ) -> IoResult<()> {
+        for read in reads.iter_mut() {
+            read.bytes_read = self.read_from_partition(partition, read.offset, read.buffer)?;
+        }
+        Ok(())
+    }
+
     /// Returns a reference to preloaded partition contents.
     ///
     /// This is an optional optimization if a partition has already been loaded to provide libavb
     /// with a reference to the data rather than copying it as `read_from_partition()` would.
     ///
+    /// The returned data may also be only the start of the partition, e.g. if a DMA transfer was
+    /// started early but only part of the image is needed before verification. In this case
+    /// libavb loads the partition itself; the preloaded bytes are copied from memory and only the
+    /// remainder is read via `read_from_partition_vectored()`.
+    ///
     /// May be left unimplemented if preloaded partitions are not used.
     ///
     /// # Arguments
     /// * `partition`: partition name to read from.
     ///
     /// # Returns
-    /// * A reference to the entire partition contents if the partition has been preloaded.
+    /// * A reference to the partition contents, or a prefix of them, if the partition has been
+    ///   preloaded.
     /// * `Err<IoError::NotImplemented>` if the requested partition has not been preloaded;
     ///   verification will next attempt to load the partition via `read_from_partition()`.
     /// * Any other `Err<IoError>` if an error occurred; verification will exit immediately.
@@ -85,6 +119,56 @@ pub trait Ops<'a> {
         Err(IoError::NotImplemented)
     }
 
+    /// Calculates the digest of a loaded hash partition.
+    ///
+    /// This is an optional optimization to offload hashing to e.g. a hardware hash engine. The
+    /// digest is computed over `salt` followed by `data`.
+    ///
+    /// May be left unimplemented, in which case libavb calculates the digest in software.
+    ///
+    /// # Arguments
+    /// * `partition`: partition name the data was loaded from.
+    /// * `hash_algorithm`: the hash algorithm, currently either "sha256" or "sha512".
+    /// * `salt`: the salt to hash first.
+    /// * `data`: the partition data to hash.
+    /// * `digest`: buffer to write the digest into.
+    ///
+    /// # Returns
+    /// * The size of the digest written to `digest`.
+    /// * `Err<IoError::NotImplemented>` if the digest cannot be offloaded for this partition or
+    ///   algorithm; libavb will calculate it in software instead.
+    /// * Any other `Err<IoError>` if an error occurred; verification will exit immediately.
+    fn calculate_digest(
+        &mut self,
+        _partition: &CStr,
+        _hash_algorithm: &str,
+        _salt: &[u8],
+        _data: &[u8],
+        _digest: &mut [u8],
+    ) -> IoResult<usize> {
+        Err(IoError::NotImplemented)
+    }
+
+    /// Returns a trusted generation stamp for the given partition.
+    ///
+    /// The stamp must change whenever the partition contents may have changed, e.g. a secure
+    /// monotonic write counter or an RPMB-backed generation number. When implemented alongside
+    /// persistent values, libavb skips re-hashing partitions whose stamp and hash descriptor
+    /// match the last successful verification.
+    ///
+    /// May be left unimplemented, in which case partitions are always hashed.
+    ///
+    /// # Arguments
+    /// * `partition`: partition name.
+    ///
+    /// # Returns
+    /// * The generation stamp.
+    /// * `Err<IoError::NoSuchValue>` if there is no trusted stamp for this partition.
+    /// * Any other `Err<IoError>` if an error occurred; libavb will hash the partition.
+    fn read_partition_generation(&mut self, _partition: &CStr) -> IoResult<u64> {
+        Err(IoError::NoSuchValue)
+    }
+
     /// Checks if the given public key is valid for vbmeta image signing.
     ///
     /// If using libavb_cert, this should forward to `cert_validate_vbmeta_public_key()`.
@@ -261,6 +345,29 @@ pub trait Ops<'a> {
     }
 }
 
+/// A single request passed to `read_from_partition_vectored()`.
+#[derive(Debug)]
+pub struct PartitionRead<'b> {
+    /// Offset in bytes within the partition to read from; a negative value indicates a backwards
+    /// offset from the partition end.
+    pub offset: i64,
+    /// Buffer to read data into.
+    pub buffer: &'b mut [u8],
+    /// Number of bytes actually read into `buffer`, set by `read_from_partition_vectored()`.
+    pub bytes_read: usize,
+}
+
+impl<'b> PartitionRead<'b> {
+    /// Creates a new read request for `buffer.len()` bytes at `offset`.
+    pub fn new(offset: i64, buffer: &'b mut [u8]) -> Self {
+        Self {
+            offset,
+            buffer,
+            bytes_read: 0,
+        }
+    }
+}
+
 /// Info returned from `validate_public_key_for_partition()`.
 #[derive(Clone, Copy, Debug)]
 pub struct PublicKeyForPartitionInfo {
@@ -301,6 +408,10 @@ pub(crate) struct OpsBridge<'o, 'p> {
     cert_ops: AvbCertOps,
     /// Rust `Ops` implementation, which may also provide Rust `CertOps`.
     rust_ops: &'o mut dyn Ops<'p>,
+    /// Results of `Ops::get_preloaded_partition()` so far, `None` for partitions which aren't
+    /// preloaded. libavb reads each partition several times and the result can't change while
+    /// verifying, so each partition is only looked up once.
+    preloaded: Vec<(CString, Option<&'p [u8]>)>,
     /// Remove the `Unpin` trait to indicate this type has address-sensitive state.
     _pin: PhantomPinned,
 }
@@ -324,6 +435,16 @@ impl<'o, 'p> OpsBridge<'o, 'p> {
                 read_persistent_value: Some(read_persistent_value),
                 write_persistent_value: Some(write_persistent_value),
                 validate_public_key_for_partition: Some(validate_public_key_for_partition),
+                calculate_digest: Some(calculate_digest),
+                read_partition_generation: Some(read_partition_generation),
+                // Rust has no DMA constraints to express, let libavb allocate buffers.
+                allocate_io_buffer: None,
+                free_io_buffer: None,
+                // Only used by libavb_ab, which the Rust wrapper doesn't support.
+                read_rollback_indexes: None,
+                write_rollback_indexes: None,
+                // Extra measurement digests aren't exposed by the Rust wrapper yet.
+                get_partition_measurements: None,
             },
             cert_ops: AvbCertOps {
                 ops: ptr::null_mut(), // Set at the time of use.
@@ -331,12 +452,32 @@ impl<'o, 'p> OpsBridge<'o, 'p> {
                 read_permanent_attributes_hash: Some(read_permanent_attributes_hash),
                 set_key_version: Some(set_key_version),
                 get_random: Some(get_random),
+                run_tasks: None,
+                verified_chain_cache: ptr::null_mut(),
             },
             rust_ops: ops,
+            preloaded: Vec::new(),
             _pin: PhantomPinned,
         }
     }
 
+    /// Returns the preloaded data for `partition`, or `None` if it isn't preloaded.
+    ///
+    /// `Ops::get_preloaded_partition()` is only called the first time each partition is asked
+    /// for. Errors other than `IoError::NotImplemented` aren't remembered.
+    fn preloaded_partition(&mut self, partition: &CStr) -> IoResult<Option<&'p [u8]>> {
+        if let Some((_, preloaded)) = self.preloaded.iter().find(|(name, _)| **name == *partition) {
+            return Ok(*preloaded);
+        }
+        let preloaded = match self.rust_ops.get_preloaded_partition(partition) {
+            Ok(preloaded) => Some(preloaded),
+            Err(IoError::NotImplemented) => None,
+            Err(e) => return Err(e),
+        };
+        self.preloaded.push((partition.into(), preloaded));
+        Ok(preloaded)
+    }
+
     /// Initializes and returns the C `AvbOps` structure from an `OpsBridge`.
     ///
     /// If the contained `Ops` supports `CertOps`, the returned `AvbOps` will also be configured
@@ -403,6 +544,17 @@ impl<'o, 'p> OpsBridge<'o, 'p> {
 /// }                         // Actual 'o/'p end
 /// ```
 unsafe fn as_ops<'o, 'p>(avb_ops: *mut AvbOps) -> IoResult<&'o mut dyn Ops<'p>> {
+    // SAFETY: caller must adhere to `as_bridge()` safety requirements.
+    Ok(unsafe { as_bridge(avb_ops) }?.rust_ops)
+}
+
+/// Extracts the `OpsBridge` from a raw `AvbOps`.
+///
+/// Same as `as_ops()` but for callbacks which also need the state kept in the bridge.
+///
+/// # Safety
+/// Same as `as_ops()`.
+unsafe fn as_bridge<'o, 'p>(avb_ops: *mut AvbOps) -> IoResult<&'o mut OpsBridge<'o, 'p>> {
     // SAFETY: we created this AvbOps object and passed it to libavb so we know it meets all
     // the criteria for `as_mut()`.
     let avb_ops = unsafe { avb_ops.as_mut() }.ok_or(IoError::Io)?;
@@ -410,7 +562,7 @@ unsafe fn as_ops<'o, 'p>(avb_ops: *mut AvbOps) -> IoResult<&'o mut dyn Ops<'p>>
     let bridge = avb_ops.user_data as *mut OpsBridge;
     // SAFETY: we created this OpsBridge object and passed it to libavb so we know it meets all
     // the criteria for `as_mut()`.
-    Ok(unsafe { bridge.as_mut() }.ok_or(IoError::Io)?.rust_ops)
+    unsafe { bridge.as_mut() }.ok_or(IoError::Io)
 }
 
 /// Similar to `as_ops()`, but for `CertOps`.
@@ -489,8 +641,8 @@ unsafe fn try_read_from_partition(
 
     // SAFETY:
     // * we only use `ops` objects created via `OpsBridge` as required.
-    // * `ops` is only extracted once and is dropped at the end of the callback.
-    let ops = unsafe { as_ops(ops) }?;
+    // * `bridge` is only extracted once and is dropped at the end of the callback.
+    let bridge = unsafe { as_bridge(ops) }?;
     // SAFETY:
     // * we've checked that the pointer is non-NULL.
     // * libavb gives us a properly-allocated and nul-terminated `partition`.
@@ -504,7 +656,43 @@ unsafe fn try_read_from_partition(
     // * the returned slice is not held past the scope of this callback.
     let buffer = unsafe { slice::from_raw_parts_mut(buffer as *mut u8, num_bytes) };
 
-    let bytes_read = ops.read_from_partition(partition, offset, buffer)?;
+    // Serve as much as possible from preloaded memory. Only non-negative offsets are supported
+    // here since we don't know where a partial preload ends relative to the partition end.
+    let mut preloaded_len = 0;
+    if let Ok(offset) = usize::try_from(offset) {
+        match bridge.preloaded_partition(partition)? {
+            Some(preloaded) if offset < preloaded.len() => {
+                preloaded_len = min(preloaded.len() - offset, buffer.len());
+                buffer[..preloaded_len].copy_from_slice(&preloaded[offset..][..preloaded_len]);
+            }
+            _ => (),
+        }
+    }
+
+    let ops = &mut *bridge.rust_ops;
+    let mut bytes_read = preloaded_len;
+    if preloaded_len < buffer.len() {
+        let remaining_offset = offset
+            .checked_add(i64::try_from(preloaded_len).or(Err(IoError::RangeOutsidePartition))?)
+            .ok_or(IoError::RangeOutsidePartition)?;
+        let mut reads = [PartitionRead::new(
+            remaining_offset,
+            &mut buffer[preloaded_len..],
+        )];
+        match ops.read_from_partition_vectored(partition, &mut reads) {
+            Ok(()) => bytes_read += reads[0].bytes_read,
+            // The preloaded data may end exactly at the partition end, in which case the
+            // remainder starts past the end. Only `read_from_partition()` knows whether that's
+            // so, so redo the whole read through it: it truncates reads which run past the end
+            // and fails for ones which start outside the partition.
+            Err(IoError::RangeOutsidePartition) if preloaded_len > 0 => {
+                let mut reads = [PartitionRead::new(offset, buffer)];
+                ops.read_from_partition_vectored(partition, &mut reads)?;
+                bytes_read = reads[0].bytes_read;
+            }
+            Err(e) => return Err(e),
+        }
+    }
     // SAFETY:
     // * we've checked that the pointer is non-NULL.
     // * libavb gives us a properly-allocated `out_num_read`.
@@ -564,8 +752,8 @@ unsafe fn try_get_preloaded_partition(
 
     // SAFETY:
     // * we only use `ops` objects created via `OpsBridge` as required.
-    // * `ops` is only extracted once and is dropped at the end of the callback.
-    let ops = unsafe { as_ops(ops) }?;
+    // * `bridge` is only extracted once and is dropped at the end of the callback.
+    let bridge = unsafe { as_bridge(ops) }?;
     // SAFETY:
     // * we've checked that the pointer is non-NULL.
     // * libavb gives us a properly-allocated and nul-terminated `partition`.
@@ -573,11 +761,11 @@ unsafe fn try_get_preloaded_partition(
     // * the returned `&CStr` is not held past the scope of this callback.
     let partition = unsafe { CStr::from_ptr(partition) };
 
-    match ops.get_preloaded_partition(partition) {
+    match bridge.preloaded_partition(partition)? {
         // SAFETY:
         // * we've checked that the pointers are non-NULL.
         // * libavb gives us properly-aligned and sized `out` vars.
-        Ok(contents) => unsafe {
+        Some(contents) if contents.len() >= num_bytes => unsafe {
             ptr::write(
                 out_pointer,
                 // Warning: we are casting an immutable &[u8] to a mutable *u8. If libavb actually
@@ -588,13 +776,13 @@ unsafe fn try_get_preloaded_partition(
             ptr::write(
                 out_num_bytes_preloaded,
                 // Truncate here if necessary, we may have more preloaded data than libavb needs.
-                min(contents.len(), num_bytes),
+                num_bytes,
             );
         },
-        // No-op if this partition is not preloaded, we've already reset the out variables to
-        // indicate preloaded data is not available.
-        Err(IoError::NotImplemented) => (),
-        Err(e) => return Err(e),
+        // No-op if this partition is not preloaded or only partially preloaded, we've already
+        // reset the out variables to indicate preloaded data is not available. libavb will fall
+        // back to `read_from_partition()` which copies the preloaded prefix.
+        _ => (),
     };
     Ok(())
 }
@@ -1188,6 +1376,172 @@ unsafe fn try_validate_public_key_for_partition(
     Ok(())
 }
 
+/// Wraps a callback to convert the given `IoResult<>` to raw `AvbIOResult` for libavb.
+///
+/// See corresponding `try_*` function docs.
+unsafe extern "C" fn calculate_digest(
+    ops: *mut AvbOps,
+    partition: *const c_char,
+    hash_algorithm: *const c_char,
+    salt: *const u8,
+    salt_size: usize,
+    data: *const u8,
+    data_size: usize,
+    out_digest: *mut u8,
+    digest_buf_size: usize,
+    out_digest_size: *mut usize,
+) -> AvbIOResult {
+    // SAFETY: see corresponding `try_*` function safety documentation.
+    unsafe {
+        result_to_io_enum(try_calculate_digest(
+            ops,
+            partition,
+            hash_algorithm,
+            salt,
+            salt_size,
+            data,
+            data_size,
+            out_digest,
+            digest_buf_size,
+            out_digest_size,
+        ))
+    }
+}
+
+/// Bounces the C callback into the user-provided Rust implementation.
+///
+/// # Safety
+/// * `ops` must have been created via `OpsBridge`.
+/// * `partition` and `hash_algorithm` must adhere to the requirements of `CStr::from_ptr()`.
+/// * `salt` and `data` must adhere to the requirements of `slice::from_raw_parts()`.
+/// * `out_digest` must adhere to the requirements of `slice::from_raw_parts_mut()`.
+/// * `out_digest_size` must adhere to the requirements of `ptr::write()`.
+#[allow(clippy::too_many_arguments)] // Mirroring libavb C API.
+unsafe fn try_calculate_digest(
+    ops: *mut AvbOps,
+    partition: *const c_char,
+    hash_algorithm: *const c_char,
+    salt: *const u8,
+    salt_size: usize,
+    data: *const u8,
+    data_size: usize,
+    out_digest: *mut u8,
+    digest_buf_size: usize,
+    out_digest_size: *mut usize,
+) -> IoResult<()> {
+    check_nonnull(partition)?;
+    check_nonnull(hash_algorithm)?;
+    check_nonnull(salt)?;
+    check_nonnull(data)?;
+    check_nonnull(out_digest)?;
+    check_nonnull(out_digest_size)?;
+
+    // Initialize the output variables first in case something fails. A size of 0 tells libavb to
+    // fall back to calculating the digest itself.
+    // SAFETY:
+    // * we've checked that the pointer is non-NULL.
+    // * libavb gives us a properly-allocated `out_digest_size`.
+    unsafe { ptr::write(out_digest_size, 0) };
+
+    // SAFETY:
+    // * we only use `ops` objects created via `OpsBridge` as required.
+    // * `ops` is only extracted once and is dropped at the end of the callback.
+    let ops = unsafe { as_ops(ops) }?;
+    // SAFETY:
+    // * we've checked that the pointers are non-NULL.
+    // * libavb gives us properly-allocated and nul-terminated `partition` and `hash_algorithm`.
+    // * the string contents are not modified while the returned `&CStr`s exist.
+    // * the returned `&CStr`s are not held past the scope of this callback.
+    let (partition, hash_algorithm) =
+        unsafe { (CStr::from_ptr(partition), CStr::from_ptr(hash_algorithm)) };
+    // SAFETY:
+    // * we've checked that the pointers are non-NULL.
+    // * libavb gives us properly-allocated `salt` and `data` with sizes `salt_size` and
+    //   `data_size`, and a properly-allocated `out_digest` with size `digest_buf_size`.
+    // * we only access the contents via the returned slices.
+    // * the returned slices are not held past the scope of this callback.
+    let (salt, data, digest) = unsafe {
+        (
+            slice::from_raw_parts(salt, salt_size),
+            slice::from_raw_parts(data, data_size),
+            slice::from_raw_parts_mut(out_digest, digest_buf_size),
+        )
+    };
+
+    let digest_size = match ops.calculate_digest(
+        partition,
+        hash_algorithm.to_str().or(Err(IoError::Io))?,
+        salt,
+        data,
+        digest,
+    ) {
+        Ok(size) if size <= digest_buf_size => size,
+        Ok(_) => return Err(IoError::Io),
+        // Not offloaded, we've already set the size to 0 so libavb will do it instead.
+        Err(IoError::NotImplemented) => return Ok(()),
+        Err(e) => return Err(e),
+    };
+
+    // SAFETY:
+    // * we've checked that the pointer is non-NULL.
+    // * libavb gives us a properly-allocated `out_digest_size`.
+    unsafe { ptr::write(out_digest_size, digest_size) };
+    Ok(())
+}
+
+/// Wraps a callback to convert the given `IoResult<>` to raw `AvbIOResult` for libavb.
+///
+/// See corresponding `try_*` function docs.
+unsafe extern "C" fn read_partition_generation(
+    ops: *mut AvbOps,
+    partition: *const c_char,
+    out_generation: *mut u64,
+) -> AvbIOResult {
+    result_to_io_enum(
+        // SAFETY: see corresponding `try_*` function safety documentation.
+        unsafe { try_read_partition_generation(ops, partition, out_generation) },
+    )
+}
+
+/// Bounces the C callback into the user-provided Rust implementation.
+///
+/// # Safety
+/// * `ops` must have been created via `OpsBridge`.
+/// * `partition` must adhere to the requirements of `CStr::from_ptr()`.
+/// * `out_generation` must adhere to the requirements of `ptr::write()`.
+unsafe fn try_read_partition_generation(
+    ops: *mut AvbOps,
+    partition: *const c_char,
+    out_generation: *mut u64,
+) -> IoResult<()> {
+    check_nonnull(partition)?;
+    check_nonnull(out_generation)?;
+
+    // Initialize the output variables first in case something fails.
+    // SAFETY:
+    // * we've checked that the pointer is non-NULL.
+    // * libavb gives us a properly-allocated `out_generation`.
+    unsafe { ptr::write(out_generation, 0) };
+
+    // SAFETY:
+    // * we only use `ops` objects created via `OpsBridge` as required.
+    // * `ops` is only extracted once and is dropped at the end of the callback.
+    let ops = unsafe { as_ops(ops) }?;
+    // SAFETY:
+    // * we've checked that the pointer is non-NULL.
+    // * libavb gives us a properly-allocated and nul-terminated `partition`.
+    // * the string contents are not modified while the returned `&CStr` exists.
+    // * the returned `&CStr` is not held past the scope of this callback.
+    let partition = unsafe { CStr::from_ptr(partition) };
+    let generation = ops.read_partition_generation(partition)?;
+
+    // SAFETY:
+    // * we've checked that the pointer is non-NULL.
+    // * libavb gives us a properly-allocated `out_generation`.
+    unsafe { ptr::write(out_generation, generation) };
+    Ok(())
+}
+
 /// Wraps a callback to convert the given `IoResult<>` to raw `AvbIOResult` for libavb.
 ///
 /// See corresponding `try_*` function docs.
@@ -20,7 +20,7 @@
 extern crate alloc;
 
 use crate::{
-    descriptor::{get_descriptors, Descriptor, DescriptorResult},
+    descriptor::{Descriptor, DescriptorIndex, DescriptorIter, DescriptorResult},
     error::{
         slot_verify_enum_to_result, vbmeta_verify_enum_to_result, SlotVerifyError,
         SlotVerifyNoDataResult, SlotVerifyResult, VbmetaVerifyResult,
@@ -98,6 +98,17 @@ impl VbmetaData {
         vbmeta_verify_enum_to_result(self.0.verify_result)
     }
 
+    /// Returns an iterator which lazily parses the descriptors from the vbmeta image.
+    ///
+    /// Unlike `descriptors()` this does not allocate; each descriptor is parsed on demand directly
+    /// from `data()`.
+    ///
+    /// # Returns
+    /// The descriptor iterator, or `DescriptorError` if the vbmeta header is invalid.
+    pub fn descriptor_iter(&self) -> DescriptorResult<DescriptorIter> {
+        DescriptorIter::new(self.data())
+    }
+
     /// Extracts the descriptors from the vbmeta image.
     ///
     /// Note that this function allocates memory to hold the `Descriptor` objects.
@@ -105,22 +116,38 @@ impl VbmetaData {
     /// # Returns
     /// A vector of descriptors, or `DescriptorError` on failure.
     pub fn descriptors(&self) -> DescriptorResult<Vec<Descriptor>> {
-        // SAFETY: the only way to get a `VbmetaData` object is via the return value of
-        // `slot_verify()`, so we know we have been properly validated.
-        unsafe { get_descriptors(self) }
+        self.descriptor_iter()?.collect()
+    }
+
+    /// Builds an index over the descriptors in the vbmeta image.
+    ///
+    /// The index should be kept and reused when making repeated property or partition lookups on
+    /// the same image, since it parses all the descriptors once up front.
+    ///
+    /// # Returns
+    /// The descriptor index, or `DescriptorError` on failure.
+    pub fn descriptor_index(&self) -> DescriptorResult<DescriptorIndex> {
+        DescriptorIndex::new(self.descriptor_iter()?)
     }
 
     /// Gets a property from the vbmeta image for the given key
     ///
-    /// This function re-implements the libavb avb_property_lookup logic.
+    /// This function re-implements the libavb avb_property_lookup logic. Descriptors are parsed
+    /// lazily without allocating, but all of them are still parsed so that a malformed image is
+    /// reported the same way as by `descriptors()`; use `descriptor_index()` instead when looking
+    /// up multiple properties.
     ///
     /// # Returns
     /// Byte array with property data or None in case property not found or failure.
     pub fn get_property_value(&self, key: &str) -> Option<&[u8]> {
-        self.descriptors().ok()?.iter().find_map(|d| match d {
-            Descriptor::Property(p) if p.key == key => Some(p.value),
-            _ => None,
-        })
+        let mut value = None;
+        for descriptor in self.descriptor_iter().ok()? {
+            match descriptor.ok()? {
+                Descriptor::Property(p) if value.is_none() && p.key == key => value = Some(p.value),
+                _ => (),
+            }
+        }
+        value
     }
 }
 
@@ -28,6 +28,13 @@ pub enum PartitionContents<'a> {
     FromDisk(Vec<u8>),
     /// Preloaded and passed in.
     Preloaded(&'a [u8]),
+    /// Only the start of the partition is preloaded, the full contents are read from disk.
+    PartiallyPreloaded {
+        /// The preloaded prefix.
+        preloaded: &'a [u8],
+        /// The full on-disk contents.
+        disk: Vec<u8>,
+    },
 }
 
 impl<'a> PartitionContents<'a> {
@@ -36,14 +43,16 @@ impl<'a> PartitionContents<'a> {
         match self {
             Self::FromDisk(v) => v,
             Self::Preloaded(c) => c,
+            Self::PartiallyPreloaded { disk, .. } => disk,
         }
     }
 
-    /// Returns a mutable reference to the `FromDisk` data for test modification. Panicks if the
+    /// Returns a mutable reference to the on-disk data for test modification. Panicks if the
     /// data is actually `Preloaded` instead.
     pub fn as_mut_vec(&mut self) -> &mut Vec<u8> {
         match self {
             Self::FromDisk(v) => v,
+            Self::PartiallyPreloaded { disk, .. } => disk,
             Self::Preloaded(_) => panic!("Cannot mutate preloaded partition data"),
         }
     }
@@ -126,6 +135,20 @@ pub struct TestOps<'a> {
 
     /// Fake RNG values to provide, or `IoError` if there aren't enough.
     pub cert_fake_rng: Vec<u8>,
+
+    /// Digests to return from `calculate_digest()`, keyed by partition name. Partitions not in
+    /// this map return `IoError::NotImplemented` so libavb calculates the digest itself.
+    pub offloaded_digests: HashMap<&'static str, IoResult<Vec<u8>>>,
+
+    /// Generation stamps to return from `read_partition_generation()`, keyed by partition name.
+    /// Partitions not in this map return `IoError::NoSuchValue`.
+    pub partition_generations: HashMap<&'static str, u64>,
+
+    /// Number of times `calculate_digest()` has been called.
+    pub calculate_digest_calls: usize,
+
+    /// Number of times `get_preloaded_partition()` has been called, keyed by partition name.
+    pub get_preloaded_partition_calls: HashMap<String, usize>,
 }
 
 impl<'a> TestOps<'a> {
@@ -166,6 +189,26 @@ impl<'a> TestOps<'a> {
         self.partitions.get_mut(name).unwrap()
     }
 
+    /// Adds a partially-preloaded partition.
+    ///
+    /// `preloaded` is provided via `get_preloaded_partition()`, while `disk` holds the full
+    /// partition contents used by `read_from_partition()`.
+    pub fn add_partially_preloaded_partition<T: Into<Vec<u8>>>(
+        &mut self,
+        name: &'static str,
+        preloaded: &'a [u8],
+        disk: T,
+    ) -> &mut FakePartition<'a> {
+        self.partitions.insert(
+            name,
+            FakePartition::new(PartitionContents::PartiallyPreloaded {
+                preloaded,
+                disk: disk.into(),
+            }),
+        );
+        self.partitions.get_mut(name).unwrap()
+    }
+
     /// Adds a persistent value with the given state.
     ///
     /// Reduces boilerplate by allowing array input:
@@ -223,6 +266,10 @@ impl Default for TestOps<'_> {
             cert_permanent_attributes_hash: None,
             cert_key_versions: HashMap::new(),
             cert_fake_rng: Vec::new(),
+            offloaded_digests: HashMap::new(),
+            partition_generations: HashMap::new(),
+            calculate_digest_calls: 0,
+            get_preloaded_partition_calls: HashMap::new(),
         }
     }
 }
@@ -269,15 +316,46 @@ impl<'a> Ops<'a> for TestOps<'a> {
     }
 
     fn get_preloaded_partition(&mut self, partition: &CStr) -> IoResult<&'a [u8]> {
+        *self
+            .get_preloaded_partition_calls
+            .entry(partition.to_str()?.to_string())
+            .or_default() += 1;
         match self.partitions.get(partition.to_str()?) {
             Some(FakePartition {
-                contents: PartitionContents::Preloaded(preloaded),
+                contents:
+                    PartitionContents::Preloaded(preloaded)
+                    | PartitionContents::PartiallyPreloaded { preloaded, .. },
                 ..
             }) => Ok(&preloaded[..]),
             _ => Err(IoError::NotImplemented),
         }
     }
 
+    fn calculate_digest(
+        &mut self,
+        partition: &CStr,
+        _hash_algorithm: &str,
+        _salt: &[u8],
+        _data: &[u8],
+        digest: &mut [u8],
+    ) -> IoResult<usize> {
+        self.calculate_digest_calls += 1;
+        let offloaded = self
+            .offloaded_digests
+            .get(partition.to_str()?)
+            .ok_or(IoError::NotImplemented)?
+            .clone()?;
+        digest[..offloaded.len()].copy_from_slice(&offloaded);
+        Ok(offloaded.len())
+    }
+
+    fn read_partition_generation(&mut self, partition: &CStr) -> IoResult<u64> {
+        self.partition_generations
+            .get(partition.to_str()?)
+            .copied()
+            .ok_or(IoError::NoSuchValue)
+    }
+
     fn validate_vbmeta_public_key(
         &mut self,
         public_key: &[u8],
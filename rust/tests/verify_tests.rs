@@ -179,6 +179,153 @@ fn preloaded_image_passes_verification() {
     assert!(partition_data.preloaded());
 }
 
+#[test]
+fn partially_preloaded_image_uses_preloaded_prefix() {
+    let image = fs::read(TEST_IMAGE_PATH).unwrap();
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    // Corrupt the on-disk copy within the preloaded range; verification should only pass if the
+    // preloaded prefix is used instead.
+    let mut disk = image.clone();
+    disk[0] ^= 0x01;
+    ops.add_partially_preloaded_partition(TEST_PARTITION_NAME, &image[..image.len() / 2], disk);
+
+    let result = verify_one_image_one_vbmeta(&mut ops);
+
+    let data = result.unwrap();
+    let partition_data = &data.partition_data()[0];
+    assert_eq!(partition_data.data(), image);
+    // libavb needed the full image so the data had to be loaded rather than borrowed.
+    assert!(!partition_data.preloaded());
+}
+
+#[test]
+fn partially_preloaded_image_is_looked_up_once() {
+    let image = fs::read(TEST_IMAGE_PATH).unwrap();
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    ops.add_partially_preloaded_partition(
+        TEST_PARTITION_NAME,
+        &image[..image.len() / 2],
+        image.clone(),
+    );
+
+    let result = verify_one_image_one_vbmeta(&mut ops);
+
+    assert!(result.is_ok());
+    // libavb reads the partition several times, but the preload is only looked up once.
+    assert_eq!(ops.get_preloaded_partition_calls[TEST_PARTITION_NAME], 1);
+}
+
+#[test]
+fn partially_preloaded_image_reads_remainder_from_disk() {
+    let image = fs::read(TEST_IMAGE_PATH).unwrap();
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    // Corrupt the on-disk copy past the preloaded range, which must still be read from disk.
+    let mut disk = image.clone();
+    disk[image.len() - 1] ^= 0x01;
+    ops.add_partially_preloaded_partition(TEST_PARTITION_NAME, &image[..image.len() / 2], disk);
+
+    let result = verify_one_image_one_vbmeta(&mut ops);
+
+    let error = result.unwrap_err();
+    assert!(matches!(error, SlotVerifyError::Verification(None)));
+}
+
+/// Returns the expected digest of `TEST_PARTITION_NAME` from its hash descriptor.
+fn test_partition_digest() -> Vec<u8> {
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    let data = verify_one_image_one_vbmeta(&mut ops).unwrap();
+    let index = data.vbmeta_data()[0].descriptor_index().unwrap();
+    let digest = index
+        .get_hash_descriptor(TEST_PARTITION_NAME)
+        .unwrap()
+        .digest
+        .to_vec();
+    digest
+}
+
+#[test]
+fn offloaded_digest_is_used_for_verification() {
+    let digest = test_partition_digest();
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    // The image is corrupt, but since the digest is offloaded libavb never hashes it itself.
+    modify_partition_contents(&mut ops, TEST_PARTITION_NAME);
+    ops.offloaded_digests
+        .insert(TEST_PARTITION_NAME, Ok(digest));
+
+    let result = verify_one_image_one_vbmeta(&mut ops);
+
+    assert!(result.is_ok());
+}
+
+#[test]
+fn offloaded_digest_mismatch_fails_verification() {
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    ops.offloaded_digests.insert(
+        TEST_PARTITION_NAME,
+        Ok(vec![0; test_partition_digest().len()]),
+    );
+
+    let result = verify_one_image_one_vbmeta(&mut ops);
+
+    let error = result.unwrap_err();
+    assert!(matches!(error, SlotVerifyError::Verification(None)));
+}
+
+#[test]
+fn offloaded_digest_error_fails_verification() {
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    ops.offloaded_digests
+        .insert(TEST_PARTITION_NAME, Err(IoError::Io));
+
+    let result = verify_one_image_one_vbmeta(&mut ops);
+
+    let error = result.unwrap_err();
+    assert!(matches!(error, SlotVerifyError::Io));
+}
+
+#[test]
+fn generation_cache_skips_hash_for_unchanged_partition() {
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    ops.partition_generations.insert(TEST_PARTITION_NAME, 1);
+
+    assert!(verify_one_image_one_vbmeta(&mut ops).is_ok());
+    assert_eq!(ops.calculate_digest_calls, 1);
+
+    ops.calculate_digest_calls = 0;
+    let data = verify_one_image_one_vbmeta(&mut ops).unwrap();
+    assert_eq!(ops.calculate_digest_calls, 0);
+    // The partition is still loaded even though it wasn't hashed.
+    assert_eq!(
+        data.partition_data()[0].data(),
+        fs::read(TEST_IMAGE_PATH).unwrap()
+    );
+}
+
+#[test]
+fn generation_cache_rehashes_changed_partition() {
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    ops.partition_generations.insert(TEST_PARTITION_NAME, 1);
+    assert!(verify_one_image_one_vbmeta(&mut ops).is_ok());
+
+    modify_partition_contents(&mut ops, TEST_PARTITION_NAME);
+    ops.partition_generations.insert(TEST_PARTITION_NAME, 2);
+    let result = verify_one_image_one_vbmeta(&mut ops);
+
+    let error = result.unwrap_err();
+    assert!(matches!(error, SlotVerifyError::Verification(None)));
+}
+
+#[test]
+fn generation_cache_unused_without_generation() {
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+
+    assert!(verify_one_image_one_vbmeta(&mut ops).is_ok());
+    assert!(verify_one_image_one_vbmeta(&mut ops).is_ok());
+
+    assert_eq!(ops.calculate_digest_calls, 2);
+    assert!(ops.persistent_values.is_empty());
+}
+
 // When all images are loaded from disk (rather than preloaded), libavb allocates memory itself for
 // the data, so there is no shared ownership; the returned verification data owns the image data
 // and can hold onto it even after the `ops` goes away.
@@ -659,6 +806,43 @@ fn two_images_gives_two_descriptors() {
     assert_eq!(data.vbmeta_data()[0].descriptors().unwrap().len(), 2);
 }
 
+#[test]
+fn two_images_descriptor_iter_matches_descriptors() {
+    let mut ops = build_test_ops_two_images_one_vbmeta();
+
+    let result = verify_two_images(&mut ops);
+
+    let data = result.unwrap();
+    let vbmeta = &data.vbmeta_data()[0];
+    let lazy = vbmeta
+        .descriptor_iter()
+        .unwrap()
+        .collect::<Result<Vec<_>, _>>()
+        .unwrap();
+    assert_eq!(lazy, vbmeta.descriptors().unwrap());
+}
+
+#[test]
+fn two_images_descriptor_index_finds_hash_descriptors() {
+    let mut ops = build_test_ops_two_images_one_vbmeta();
+
+    let result = verify_two_images(&mut ops);
+
+    let data = result.unwrap();
+    let index = data.vbmeta_data()[0].descriptor_index().unwrap();
+    assert_eq!(index.descriptors().len(), 2);
+    for name in [TEST_PARTITION_NAME, TEST_PARTITION_2_NAME] {
+        let descriptor = index.get_hash_descriptor(name).unwrap();
+        assert_eq!(descriptor.partition_name, name);
+        assert!(matches!(
+            index.get_partition_descriptor(name),
+            Some(Descriptor::Hash(d)) if d == descriptor
+        ));
+    }
+    assert_eq!(index.get_hashtree_descriptor(TEST_PARTITION_NAME), None);
+    assert_eq!(index.get_hash_descriptor("test_part_doesnt_exist"), None);
+}
+
 /// Runs verification on the given contents and checks for a resulting descriptor.
 ///
 /// This test helper performs the following steps:
@@ -822,3 +1006,18 @@ fn verify_get_property_value_not_found() {
         "Expected property not found for not existing key"
     );
 }
+
+#[test]
+fn verify_descriptor_index_get_property_value() {
+    let mut ops = build_test_ops_one_image_one_vbmeta();
+    ops.add_partition("vbmeta", fs::read(TEST_VBMETA_WITH_PROPERTY_PATH).unwrap());
+
+    let data = verify_one_image_one_vbmeta(&mut ops).unwrap();
+    let index = data.vbmeta_data()[0].descriptor_index().unwrap();
+
+    assert_eq!(
+        index.get_property_value(TEST_PROPERTY_KEY),
+        Some(TEST_PROPERTY_VALUE)
+    );
+    assert_eq!(index.get_property_value("test_prop_doesnt_exist"), None);
+}
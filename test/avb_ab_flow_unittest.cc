@@ -965,6 +965,143 @@ TEST_F(AvbABFlowTest, StoredRollbackIndexBumped) {
   avb_slot_verify_data_free(data);
 }
 
+// The FakeAvbOps used by the bulk rollback index hooks below, and the
+// number of times each was called.
+static FakeAvbOps* bulk_rollback_ops = NULL;
+static size_t read_rollback_indexes_num_calls = 0;
+static size_t write_rollback_indexes_num_calls = 0;
+
+static AvbIOResult read_rollback_indexes_for_test(
+    AvbOps* ops,
+    const size_t* rollback_index_locations,
+    size_t num_locations,
+    uint64_t* out_rollback_indexes) {
+  read_rollback_indexes_num_calls++;
+  for (size_t n = 0; n < num_locations; n++) {
+    AvbIOResult io_ret = bulk_rollback_ops->read_rollback_index(
+        ops, rollback_index_locations[n], &out_rollback_indexes[n]);
+    if (io_ret != AVB_IO_RESULT_OK) {
+      return io_ret;
+    }
+  }
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult write_rollback_indexes_for_test(
+    AvbOps* ops,
+    const size_t* rollback_index_locations,
+    const uint64_t* rollback_indexes,
+    size_t num_locations) {
+  write_rollback_indexes_num_calls++;
+  std::map<size_t, uint64_t> stored =
+      bulk_rollback_ops->get_stored_rollback_indexes();
+  for (size_t n = 0; n < num_locations; n++) {
+    stored[rollback_index_locations[n]] = rollback_indexes[n];
+  }
+  bulk_rollback_ops->set_stored_rollback_indexes(stored);
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult write_rollback_indexes_failing(
+    AvbOps* ops,
+    const size_t* rollback_index_locations,
+    const uint64_t* rollback_indexes,
+    size_t num_locations) {
+  write_rollback_indexes_num_calls++;
+  return AVB_IO_RESULT_ERROR_IO;
+}
+
+static AvbIOResult write_rollback_index_unexpected(AvbOps* ops,
+                                                   size_t rollback_index_slot,
+                                                   uint64_t rollback_index) {
+  ADD_FAILURE() << "write_rollback_index() called";
+  return AVB_IO_RESULT_ERROR_IO;
+}
+
+TEST_F(AvbABFlowTest, StoredRollbackIndexBumpedInSingleTransaction) {
+  AvbSlotVerifyData* data;
+  const char* requested_partitions[] = {"boot", NULL};
+
+  bulk_rollback_ops = &ops_;
+  ops_.avb_ops()->read_rollback_indexes = read_rollback_indexes_for_test;
+  ops_.avb_ops()->write_rollback_indexes = write_rollback_indexes_for_test;
+  ops_.avb_ops()->write_rollback_index = write_rollback_index_unexpected;
+
+  // Both locations are bumped with a single read and a single write.
+  SetMD(15,
+        0,
+        1,
+        SV_OK,
+        4,
+        9,  // A: pri, tries, success, slot_validity, RIs
+        14,
+        0,
+        1,
+        SV_OK,
+        5,
+        7,  // B: pri, tries, success, slot_validity, RIs
+        MakeRollbackIndexes(0, 0));  // stored_rollback_indexes
+  read_rollback_indexes_num_calls = 0;
+  write_rollback_indexes_num_calls = 0;
+  EXPECT_EQ(AVB_AB_FLOW_RESULT_OK,
+            avb_ab_flow(ops_.avb_ab_ops(),
+                        requested_partitions,
+                        AVB_SLOT_VERIFY_FLAGS_NONE,
+                        AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                        &data));
+  ExpMD(15,
+        0,
+        1,  // A: pri, tries, successful
+        14,
+        0,
+        1,                           // B: pri, tries, successful
+        MakeRollbackIndexes(4, 7));  // stored_rollback_indexes
+  EXPECT_EQ(size_t(1), read_rollback_indexes_num_calls);
+  EXPECT_EQ(size_t(1), write_rollback_indexes_num_calls);
+  ASSERT_NE(nullptr, data);
+  avb_slot_verify_data_free(data);
+
+  // Nothing is written if the stored values are already up to date.
+  read_rollback_indexes_num_calls = 0;
+  write_rollback_indexes_num_calls = 0;
+  EXPECT_EQ(AVB_AB_FLOW_RESULT_OK,
+            avb_ab_flow(ops_.avb_ab_ops(),
+                        requested_partitions,
+                        AVB_SLOT_VERIFY_FLAGS_NONE,
+                        AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                        &data));
+  EXPECT_EQ(size_t(1), read_rollback_indexes_num_calls);
+  EXPECT_EQ(size_t(0), write_rollback_indexes_num_calls);
+  ASSERT_NE(nullptr, data);
+  avb_slot_verify_data_free(data);
+
+  // A failed transaction is reported as an I/O error.
+  SetMD(15,
+        0,
+        1,
+        SV_OK,
+        4,
+        9,  // A: pri, tries, success, slot_validity, RIs
+        14,
+        0,
+        1,
+        SV_OK,
+        5,
+        7,  // B: pri, tries, success, slot_validity, RIs
+        MakeRollbackIndexes(0, 0));  // stored_rollback_indexes
+  ops_.avb_ops()->write_rollback_indexes = write_rollback_indexes_failing;
+  write_rollback_indexes_num_calls = 0;
+  EXPECT_EQ(AVB_AB_FLOW_RESULT_ERROR_IO,
+            avb_ab_flow(ops_.avb_ab_ops(),
+                        requested_partitions,
+                        AVB_SLOT_VERIFY_FLAGS_NONE,
+                        AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                        &data));
+  EXPECT_EQ(nullptr, data);
+  EXPECT_EQ(size_t(1), write_rollback_indexes_num_calls);
+  EXPECT_EQ(MakeRollbackIndexes(0, 0), ops_.get_stored_rollback_indexes());
+}
+
 TEST_F(AvbABFlowTest, MarkSlotActive) {
   SetMD(15,
         0,
@@ -24,6 +24,7 @@
 
 #include <base/files/file_util.h>
 #include <gtest/gtest.h>
+#include <libavb/avb_rsa.h>
 #include <libavb_cert/libavb_cert.h>
 #include <openssl/objects.h>
 #include <openssl/pem.h>
@@ -32,6 +33,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <thread>
+#include <vector>
+
 #include "avb_unittest_util.h"
 #include "fake_avb_ops.h"
 
@@ -636,6 +640,176 @@ TEST_F(AvbCertValidateTest, PSKMismatch) {
   EXPECT_FALSE(is_trusted);
 }
 
+TEST_F(AvbCertValidateTest, VerifiedChainCacheSkipsRevalidation) {
+  AvbCertVerifiedChainCache cache;
+  avb_cert_verified_chain_cache_clear(&cache);
+  ops_.avb_cert_ops()->verified_chain_cache = &cache;
+
+  bool is_trusted = false;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_TRUE(is_trusted);
+  EXPECT_EQ(1UL, cache.num_entries);
+
+  // The chain is already known to be valid, so the permanent attributes are
+  // not needed again.
+  fail_read_permanent_attributes_ = true;
+  is_trusted = false;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_TRUE(is_trusted);
+  EXPECT_EQ(1UL, cache.num_entries);
+
+  // Key versions are still reported.
+  EXPECT_EQ(2UL, ops_.get_verified_rollback_indexes().size());
+}
+
+TEST_F(AvbCertValidateTest, VerifiedChainCacheMissOnModifiedMetadata) {
+  AvbCertVerifiedChainCache cache;
+  avb_cert_verified_chain_cache_clear(&cache);
+  ops_.avb_cert_ops()->verified_chain_cache = &cache;
+  bool is_trusted = false;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_TRUE(is_trusted);
+
+  metadata_.product_signing_key_certificate.signed_data.public_key[0] ^= 1;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_FALSE(is_trusted);
+  EXPECT_EQ(1UL, cache.num_entries);
+}
+
+TEST_F(AvbCertValidateTest, VerifiedChainCacheMissOnRollback) {
+  AvbCertVerifiedChainCache cache;
+  avb_cert_verified_chain_cache_clear(&cache);
+  ops_.avb_cert_ops()->verified_chain_cache = &cache;
+  bool is_trusted = false;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_TRUE(is_trusted);
+
+  ops_.set_stored_rollback_indexes(
+      {{AVB_CERT_PIK_VERSION_LOCATION, 0},
+       {AVB_CERT_PSK_VERSION_LOCATION,
+        metadata_.product_signing_key_certificate.signed_data.key_version +
+            1}});
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_FALSE(is_trusted);
+}
+
+TEST_F(AvbCertValidateTest, VerifiedChainCacheMissOnPermanentAttributesHash) {
+  AvbCertVerifiedChainCache cache;
+  avb_cert_verified_chain_cache_clear(&cache);
+  ops_.avb_cert_ops()->verified_chain_cache = &cache;
+  bool is_trusted = false;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_TRUE(is_trusted);
+
+  ops_.set_permanent_attributes_hash("bad_hash");
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_FALSE(is_trusted);
+}
+
+TEST_F(AvbCertValidateTest, VerifiedChainCacheNotPopulatedOnFailure) {
+  AvbCertVerifiedChainCache cache;
+  avb_cert_verified_chain_cache_clear(&cache);
+  ops_.avb_cert_ops()->verified_chain_cache = &cache;
+  metadata_.product_signing_key_certificate.signed_data.key_version ^= 1;
+
+  bool is_trusted = true;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_FALSE(is_trusted);
+  EXPECT_EQ(0UL, cache.num_entries);
+}
+
+// Number of tasks run by the most recent call to run_tasks_in_threads().
+static size_t num_tasks_run = 0;
+
+static void run_tasks_in_threads(AvbCertOps* cert_ops,
+                                 void (*task)(void* arg),
+                                 void* const* task_args,
+                                 size_t num_tasks) {
+  std::vector<std::thread> threads;
+  for (size_t n = 0; n < num_tasks; n++) {
+    threads.emplace_back(task, task_args[n]);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  num_tasks_run = num_tasks;
+}
+
+TEST_F(AvbCertValidateTest, RunTasksSuccess) {
+  ops_.avb_cert_ops()->run_tasks = run_tasks_in_threads;
+  num_tasks_run = 0;
+  bool is_trusted = false;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_TRUE(is_trusted);
+  EXPECT_EQ(2UL, num_tasks_run);
+}
+
+TEST_F(AvbCertValidateTest, RunTasksBadPIKCert) {
+  ops_.avb_cert_ops()->run_tasks = run_tasks_in_threads;
+  metadata_.product_intermediate_key_certificate.signed_data.key_version ^= 1;
+  bool is_trusted = true;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_FALSE(is_trusted);
+}
+
+TEST_F(AvbCertValidateTest, RunTasksBadPSKCert) {
+  ops_.avb_cert_ops()->run_tasks = run_tasks_in_threads;
+  metadata_.product_signing_key_certificate.signed_data.key_version ^= 1;
+  bool is_trusted = true;
+  EXPECT_EQ(AVB_IO_RESULT_OK, Validate(&is_trusted));
+  EXPECT_FALSE(is_trusted);
+}
+
+TEST_F(AvbCertValidateTest, RsaVerifyBatch) {
+  const AvbAlgorithmData* algorithm_data =
+      avb_get_algorithm_data(AVB_ALGORITHM_TYPE_SHA512_RSA4096);
+  const AvbCertCertificate* certs[] = {
+      &metadata_.product_intermediate_key_certificate,
+      &metadata_.product_signing_key_certificate,
+      &metadata_.product_intermediate_key_certificate};
+  const uint8_t* authorities[] = {
+      attributes_.product_root_public_key,
+      metadata_.product_intermediate_key_certificate.signed_data.public_key,
+      attributes_.product_root_public_key};
+  uint8_t hashes[3][AVB_SHA512_DIGEST_SIZE];
+  AvbRSAVerifyInput inputs[3];
+  for (size_t n = 0; n < 3; n++) {
+    SHA512(reinterpret_cast<const uint8_t*>(&certs[n]->signed_data),
+           sizeof(AvbCertCertificateSignedData),
+           hashes[n]);
+    inputs[n] = {authorities[n],
+                 AVB_CERT_PUBLIC_KEY_SIZE,
+                 certs[n]->signature,
+                 AVB_RSA4096_NUM_BYTES,
+                 hashes[n],
+                 AVB_SHA512_DIGEST_SIZE,
+                 algorithm_data->padding,
+                 algorithm_data->padding_len};
+  }
+  bool valid[3] = {false, false, false};
+
+  // The first two are checked together, the third on its own.
+  EXPECT_TRUE(avb_rsa_verify_batch(inputs, 3, valid));
+  EXPECT_TRUE(valid[0]);
+  EXPECT_TRUE(valid[1]);
+  EXPECT_TRUE(valid[2]);
+
+  // A bad signature in a pair must not affect the other one.
+  hashes[1][0] ^= 1;
+  EXPECT_FALSE(avb_rsa_verify_batch(inputs, 3, valid));
+  EXPECT_TRUE(valid[0]);
+  EXPECT_FALSE(valid[1]);
+  EXPECT_TRUE(valid[2]);
+
+  // Nor should an input which can't be checked at all.
+  hashes[1][0] ^= 1;
+  inputs[0].key_num_bytes--;
+  EXPECT_FALSE(avb_rsa_verify_batch(inputs, 3, valid));
+  EXPECT_FALSE(valid[0]);
+  EXPECT_TRUE(valid[1]);
+  EXPECT_TRUE(valid[2]);
+}
+
 TEST_F(AvbCertValidateTest, GenerateUnlockChallenge) {
   fake_random_ = std::string(AVB_CERT_UNLOCK_CHALLENGE_SIZE, 'C');
   AvbCertUnlockChallenge challenge;
@@ -26,8 +26,11 @@
 
 #include <gtest/gtest.h>
 
+#include <libavb/avb_rsa.h>
 #include <libavb/avb_sha.h>
 
+#include <vector>
+
 #include "avb_unittest_util.h"
 
 namespace avb {
@@ -51,6 +54,46 @@ TEST(CryptoOpsTest, Sha256) {
             mem_to_hexstring(avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE));
 }
 
+/* Returns inputs covering batches of same-length messages (as for a
+ * hashtree), a partial batch, and messages whose salt, data, and
+ * padding straddle block boundaries in different ways.
+ */
+static std::vector<AvbSHAMultiInput> MultiInputs(const uint8_t* buf,
+                                                 size_t buf_size) {
+  std::vector<AvbSHAMultiInput> inputs;
+  for (size_t n = 0; n < 19; n++) {
+    inputs.push_back({buf, 32, buf + 512 + n, 4096});
+  }
+  for (size_t salt_len : {0, 1, 63, 64, 200}) {
+    for (size_t data_len : {0, 1, 55, 56, 64, 111, 112, 128, 1000}) {
+      EXPECT_LE(salt_len + data_len, buf_size);
+      inputs.push_back({buf + data_len, salt_len, buf, data_len});
+    }
+  }
+  return inputs;
+}
+
+TEST(CryptoOpsTest, Sha256Multi) {
+  std::vector<uint8_t> buf(8192);
+  for (size_t n = 0; n < buf.size(); n++) {
+    buf[n] = n * 7 + (n >> 8);
+  }
+  std::vector<AvbSHAMultiInput> inputs = MultiInputs(buf.data(), buf.size());
+  std::vector<uint8_t> digests(inputs.size() * AVB_SHA256_DIGEST_SIZE);
+
+  avb_sha256_multi(inputs.data(), inputs.size(), digests.data());
+  for (size_t n = 0; n < inputs.size(); n++) {
+    AvbSHA256Ctx ctx;
+    avb_sha256_init(&ctx);
+    avb_sha256_update(&ctx, inputs[n].salt, inputs[n].salt_len);
+    avb_sha256_update(&ctx, inputs[n].data, inputs[n].data_len);
+    EXPECT_EQ(mem_to_hexstring(avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE),
+              mem_to_hexstring(&digests[n * AVB_SHA256_DIGEST_SIZE],
+                               AVB_SHA256_DIGEST_SIZE))
+        << "Input " << n;
+  }
+}
+
 // Disabled for now because it takes ~30 seconds to run.
 TEST(CryptoOpsTest, DISABLED_Sha256Large) {
   AvbSHA256Ctx ctx;
@@ -90,6 +133,27 @@ TEST(CryptoOpsTest, Sha512) {
       mem_to_hexstring(avb_sha512_final(&ctx), AVB_SHA512_DIGEST_SIZE));
 }
 
+TEST(CryptoOpsTest, Sha512Multi) {
+  std::vector<uint8_t> buf(8192);
+  for (size_t n = 0; n < buf.size(); n++) {
+    buf[n] = n * 7 + (n >> 8);
+  }
+  std::vector<AvbSHAMultiInput> inputs = MultiInputs(buf.data(), buf.size());
+  std::vector<uint8_t> digests(inputs.size() * AVB_SHA512_DIGEST_SIZE);
+
+  avb_sha512_multi(inputs.data(), inputs.size(), digests.data());
+  for (size_t n = 0; n < inputs.size(); n++) {
+    AvbSHA512Ctx ctx;
+    avb_sha512_init(&ctx);
+    avb_sha512_update(&ctx, inputs[n].salt, inputs[n].salt_len);
+    avb_sha512_update(&ctx, inputs[n].data, inputs[n].data_len);
+    EXPECT_EQ(mem_to_hexstring(avb_sha512_final(&ctx), AVB_SHA512_DIGEST_SIZE),
+              mem_to_hexstring(&digests[n * AVB_SHA512_DIGEST_SIZE],
+                               AVB_SHA512_DIGEST_SIZE))
+        << "Input " << n;
+  }
+}
+
 // Disabled for now because it takes ~30 seconds to run.
 TEST(CryptoOpsTest, DISABLED_Sha512Large) {
   AvbSHA512Ctx ctx;
@@ -115,4 +179,46 @@ TEST(CryptoOpsTest, DISABLED_Sha512Large) {
   delete[] megabuf;
 }
 
+#if defined(AVB_USE_ARM_UMAAL)
+// Checks the assembly Montgomery kernel against the C version, which
+// is the reference. Run on target or under qemu-arm.
+TEST(CryptoOpsTest, MontMulAddUmaal) {
+  uint32_t seed = 1;
+  auto next = [&seed]() {
+    seed = seed * 1664525 + 1013904223;
+    return seed;
+  };
+
+  for (size_t len : {64, 128, 256}) {
+    for (int round = 0; round < 50; round++) {
+      std::vector<uint32_t> n(len), b(len), c(len);
+      for (size_t i = 0; i < len; i++) {
+        n[i] = next();
+        // All ones makes the top word carry out.
+        b[i] = round % 5 == 0 ? 0xffffffff : next();
+        c[i] = round % 5 == 0 ? 0xffffffff : next();
+      }
+      n[0] |= 1;
+      n[len - 1] |= 0x80000000;
+      uint32_t a = round % 5 == 0 ? 0xffffffff : next();
+
+      // -1 / n[0] mod 2^32 by Newton iteration.
+      uint32_t inv = n[0];
+      for (int i = 0; i < 5; i++) {
+        inv *= 2 - n[0] * inv;
+      }
+      uint32_t n0inv = -inv;
+
+      std::vector<uint32_t> expected = c;
+      uint32_t expected_carry = avb_rsa_mont_mul_add(
+          expected.data(), a, b.data(), n.data(), n0inv, len);
+      uint32_t carry = avb_rsa_mont_mul_add_umaal(
+          c.data(), a, b.data(), n.data(), n0inv, len);
+      EXPECT_EQ(expected_carry, carry) << len << " " << round;
+      EXPECT_EQ(expected, c) << len << " " << round;
+    }
+  }
+}
+#endif
+
 }  // namespace avb
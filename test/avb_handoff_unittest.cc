@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <base/strings/stringprintf.h>
+#include <libavb/avb_sha.h>
+
+#include "avb_unittest_util.h"
+#include "fake_avb_ops.h"
+
+namespace avb {
+
+class AvbHandoffTest : public BaseAvbToolTest,
+                       public FakeAvbOpsDelegateWithDefaults {
+ public:
+  AvbHandoffTest() {}
+
+  virtual void SetUp() override {
+    BaseAvbToolTest::SetUp();
+    ops_.set_delegate(this);
+    ops_.set_partition_dir(testdir_);
+    ops_.set_stored_rollback_indexes({{0, 0}, {1, 0}, {2, 0}, {3, 0}});
+    ops_.set_stored_is_device_unlocked(false);
+
+    boot_path_ = GenerateImage("boot_a.img", 64 * 1024);
+    EXPECT_COMMAND(0,
+                   "./avbtool.py add_hash_footer"
+                   " --image %s"
+                   " --rollback_index 0"
+                   " --partition_name boot"
+                   " --partition_size %d"
+                   " --salt deadbeef"
+                   " --internal_release_string \"\"",
+                   boot_path_.value().c_str(),
+                   1024 * 1024);
+    GenerateVBMetaImage(
+        "vbmeta_a.img",
+        "SHA256_RSA2048",
+        42,
+        base::FilePath("test/data/testkey_rsa2048.pem"),
+        base::StringPrintf("--include_descriptors_from_image %s"
+                           " --internal_release_string \"\"",
+                           boot_path_.value().c_str()));
+    ops_.set_expected_public_key(
+        PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+    const char* requested_partitions[] = {"boot", NULL};
+    ASSERT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+              avb_slot_verify(ops_.avb_ops(),
+                              requested_partitions,
+                              "_a",
+                              AVB_SLOT_VERIFY_FLAGS_NONE,
+                              AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                              &slot_data_));
+
+    blob_.resize(avb_handoff_get_size(slot_data_));
+    size_t blob_size = 0;
+    ASSERT_TRUE(avb_handoff_write(
+        slot_data_, blob_.data(), blob_.size(), &blob_size));
+    ASSERT_EQ(blob_.size(), blob_size);
+  }
+
+  virtual void TearDown() override {
+    if (slot_data_ != NULL) {
+      avb_slot_verify_data_free(slot_data_);
+    }
+    BaseAvbToolTest::TearDown();
+  }
+
+ protected:
+  base::FilePath boot_path_;
+  AvbSlotVerifyData* slot_data_ = NULL;
+  std::vector<uint8_t> blob_;
+};
+
+TEST_F(AvbHandoffTest, RoundTrip) {
+  AvbHandoff handoff;
+  ASSERT_TRUE(avb_handoff_parse(blob_.data(), blob_.size(), &handoff));
+
+  EXPECT_EQ("_a", std::string(handoff.ab_suffix));
+  EXPECT_EQ(std::string(slot_data_->cmdline), std::string(handoff.cmdline));
+  EXPECT_EQ(slot_data_->resolved_hashtree_error_mode,
+            handoff.resolved_hashtree_error_mode);
+  EXPECT_EQ(42UL, handoff.rollback_indexes[0]);
+  for (size_t n = 0; n < AVB_MAX_NUMBER_OF_ROLLBACK_INDEX_LOCATIONS; n++) {
+    EXPECT_EQ(slot_data_->rollback_indexes[n], handoff.rollback_indexes[n]);
+  }
+  uint8_t vbmeta_digest[AVB_SHA256_DIGEST_SIZE];
+  avb_slot_verify_data_calculate_vbmeta_digest(
+      slot_data_, AVB_DIGEST_TYPE_SHA256, vbmeta_digest);
+  EXPECT_EQ(0,
+            memcmp(vbmeta_digest,
+                   handoff.vbmeta_digest_sha256,
+                   AVB_SHA256_DIGEST_SIZE));
+
+  // The vbmeta images are referenced in place and suitably aligned.
+  ASSERT_EQ(slot_data_->num_vbmeta_images, handoff.num_vbmeta_images);
+  for (size_t n = 0; n < handoff.num_vbmeta_images; n++) {
+    AvbHandoffVBMetaImage image;
+    avb_handoff_get_vbmeta_image(&handoff, n, &image);
+    const AvbVBMetaData* expected = &slot_data_->vbmeta_images[n];
+    EXPECT_EQ(std::string(expected->partition_name),
+              std::string(image.partition_name));
+    EXPECT_EQ(expected->verify_result, image.verify_result);
+    ASSERT_EQ(expected->vbmeta_size, image.vbmeta_size);
+    EXPECT_EQ(0,
+              memcmp(expected->vbmeta_data,
+                     image.vbmeta_data,
+                     image.vbmeta_size));
+    EXPECT_GE(image.vbmeta_data, blob_.data());
+    EXPECT_LT(image.vbmeta_data, blob_.data() + blob_.size());
+    EXPECT_EQ(0U, (image.vbmeta_data - blob_.data()) % AVB_HANDOFF_ALIGNMENT);
+  }
+
+  // The digest of boot is the salted SHA-256 of the image.
+  std::string boot_data;
+  ASSERT_TRUE(base::ReadFileToString(boot_path_, &boot_data));
+  const uint8_t salt[] = {0xde, 0xad, 0xbe, 0xef};
+  AvbSHA256Ctx ctx;
+  avb_sha256_init(&ctx);
+  avb_sha256_update(&ctx, salt, sizeof salt);
+  avb_sha256_update(&ctx,
+                    reinterpret_cast<const uint8_t*>(boot_data.data()),
+                    64 * 1024);
+  const uint8_t* boot_digest = avb_sha256_final(&ctx);
+
+  ASSERT_EQ(1U, handoff.num_partitions);
+  AvbHandoffPartition partition;
+  ASSERT_TRUE(avb_handoff_find_partition(&handoff, "boot", &partition));
+  EXPECT_EQ("boot", std::string(partition.partition_name));
+  EXPECT_EQ(64U * 1024, partition.data_size);
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK, partition.verify_result);
+  ASSERT_EQ(size_t(AVB_SHA256_DIGEST_SIZE), partition.digest_len);
+  EXPECT_EQ(0,
+            memcmp(boot_digest, partition.digest, AVB_SHA256_DIGEST_SIZE));
+  EXPECT_EQ(0,
+            memcmp(slot_data_->loaded_partitions[0].digest,
+                   partition.digest,
+                   AVB_SHA256_DIGEST_SIZE));
+  EXPECT_FALSE(avb_handoff_find_partition(&handoff, "system", &partition));
+
+  // The blob is relocatable to any aligned address...
+  std::vector<uint8_t> moved(blob_.size() + AVB_HANDOFF_ALIGNMENT);
+  memcpy(moved.data() + AVB_HANDOFF_ALIGNMENT, blob_.data(), blob_.size());
+  AvbHandoff moved_handoff;
+  ASSERT_TRUE(avb_handoff_parse(
+      moved.data() + AVB_HANDOFF_ALIGNMENT, blob_.size(), &moved_handoff));
+  EXPECT_EQ(std::string(slot_data_->cmdline),
+            std::string(moved_handoff.cmdline));
+
+  // ... but not to an unaligned one.
+  memcpy(moved.data() + 3, blob_.data(), blob_.size());
+  EXPECT_FALSE(
+      avb_handoff_parse(moved.data() + 3, blob_.size(), &moved_handoff));
+}
+
+TEST_F(AvbHandoffTest, BufferTooSmall) {
+  std::vector<uint8_t> buf(blob_.size() - 1);
+  size_t size = 0;
+  EXPECT_FALSE(avb_handoff_write(slot_data_, buf.data(), buf.size(), &size));
+}
+
+TEST_F(AvbHandoffTest, Corrupted) {
+  AvbHandoff handoff;
+
+  // Truncated.
+  EXPECT_FALSE(avb_handoff_parse(blob_.data(), blob_.size() - 1, &handoff));
+  EXPECT_FALSE(avb_handoff_parse(
+      blob_.data(), sizeof(AvbHandoffHeader) - 1, &handoff));
+
+  // Any flipped bit is detected.
+  for (size_t n = 0; n < blob_.size(); n += 97) {
+    blob_[n] ^= 0x01;
+    EXPECT_FALSE(avb_handoff_parse(blob_.data(), blob_.size(), &handoff))
+        << "offset " << n;
+    blob_[n] ^= 0x01;
+  }
+
+  // Unsupported major version.
+  AvbHandoffHeader* h = reinterpret_cast<AvbHandoffHeader*>(blob_.data());
+  h->version_major = avb_htobe32(AVB_HANDOFF_VERSION_MAJOR + 1);
+  EXPECT_FALSE(avb_handoff_parse(blob_.data(), blob_.size(), &handoff));
+  h->version_major = avb_htobe32(AVB_HANDOFF_VERSION_MAJOR);
+  EXPECT_TRUE(avb_handoff_parse(blob_.data(), blob_.size(), &handoff));
+}
+
+TEST_F(AvbHandoffTest, Malformed) {
+  AvbHandoff handoff;
+  AvbHandoffHeader* h = reinterpret_cast<AvbHandoffHeader*>(blob_.data());
+  AvbHandoffVBMetaEntry* vbmeta_entry =
+      reinterpret_cast<AvbHandoffVBMetaEntry*>(
+          blob_.data() + avb_be32toh(h->vbmeta_entries_offset));
+  AvbHandoffPartitionEntry* partition_entry =
+      reinterpret_cast<AvbHandoffPartitionEntry*>(
+          blob_.data() + avb_be32toh(h->partition_entries_offset));
+
+  // Checks |blob_| after updating the CRC-32 so only the change made by
+  // the caller can make it fail.
+  auto parse = [&]() {
+    size_t crc_start = offsetof(AvbHandoffHeader, crc32) + sizeof(uint32_t);
+    h->crc32 = avb_htobe32(
+        avb_crc32(blob_.data() + crc_start, blob_.size() - crc_start));
+    return avb_handoff_parse(blob_.data(), blob_.size(), &handoff);
+  };
+  ASSERT_TRUE(parse());
+
+  // Reserved fields must be zero.
+  h->reserved[0] = 1;
+  EXPECT_FALSE(parse());
+  h->reserved[0] = 0;
+  vbmeta_entry->reserved[11] = 1;
+  EXPECT_FALSE(parse());
+  vbmeta_entry->reserved[11] = 0;
+  partition_entry->reserved[7] = 1;
+  EXPECT_FALSE(parse());
+  partition_entry->reserved[7] = 0;
+  ASSERT_TRUE(parse());
+
+  // vbmeta images must be aligned, even when in bounds.
+  uint32_t vbmeta_offset = avb_be32toh(vbmeta_entry->vbmeta_offset);
+  vbmeta_entry->vbmeta_offset = avb_htobe32(vbmeta_offset + 4);
+  vbmeta_entry->vbmeta_size =
+      avb_htobe32(avb_be32toh(vbmeta_entry->vbmeta_size) - 4);
+  EXPECT_FALSE(parse());
+}
+
+}  // namespace avb
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <libavb_pvstore/libavb_pvstore.h>
+
+#include "avb_unittest_util.h"
+
+namespace avb {
+
+// Size of the storage used by most tests, two banks of 1 KiB.
+static const uint64_t kStorageSize = 2 * 1024;
+
+// In-memory storage for a persistent value store. If |use_erase| is
+// set it behaves like flash: erased bytes are 0xff and the test fails
+// if a byte is written which hasn't been erased since it was last
+// written.
+class FakePvStoreStorage {
+ public:
+  FakePvStoreStorage(bool use_erase)
+      : data_(kStorageSize, use_erase ? 0xff : 0x00),
+        written_(kStorageSize, false) {
+    memset(&ops_, 0, sizeof(ops_));
+    ops_.user_data = this;
+    ops_.read = Read;
+    ops_.write = Write;
+    if (use_erase) {
+      ops_.erase = Erase;
+    }
+  }
+
+  AvbPvStoreOps* ops() {
+    return &ops_;
+  }
+
+  // Makes the write after the next |num_writes| writes fail after
+  // writing |num_bytes| bytes.
+  void set_torn_write(int num_writes, size_t num_bytes) {
+    torn_write_countdown_ = num_writes;
+    torn_write_bytes_ = num_bytes;
+  }
+
+  size_t num_erases() const {
+    return num_erases_;
+  }
+
+ private:
+  static FakePvStoreStorage* Get(AvbPvStoreOps* ops) {
+    return reinterpret_cast<FakePvStoreStorage*>(ops->user_data);
+  }
+
+  static AvbIOResult Read(AvbPvStoreOps* ops,
+                          uint64_t offset,
+                          size_t num_bytes,
+                          uint8_t* buffer) {
+    FakePvStoreStorage* s = Get(ops);
+    EXPECT_LE(offset + num_bytes, s->data_.size());
+    memcpy(buffer, s->data_.data() + offset, num_bytes);
+    return AVB_IO_RESULT_OK;
+  }
+
+  static AvbIOResult Write(AvbPvStoreOps* ops,
+                           uint64_t offset,
+                           size_t num_bytes,
+                           const uint8_t* buffer) {
+    FakePvStoreStorage* s = Get(ops);
+    EXPECT_LE(offset + num_bytes, s->data_.size());
+    bool torn = (s->torn_write_countdown_-- == 0);
+    if (torn) {
+      num_bytes = s->torn_write_bytes_;
+    }
+    for (size_t n = 0; n < num_bytes; n++) {
+      if (s->ops_.erase != NULL) {
+        EXPECT_FALSE(s->written_[offset + n]) << "offset " << offset + n;
+        s->written_[offset + n] = true;
+      }
+      s->data_[offset + n] = buffer[n];
+    }
+    return torn ? AVB_IO_RESULT_ERROR_IO : AVB_IO_RESULT_OK;
+  }
+
+  static AvbIOResult Erase(AvbPvStoreOps* ops,
+                           uint64_t offset,
+                           uint64_t num_bytes) {
+    FakePvStoreStorage* s = Get(ops);
+    EXPECT_EQ(kStorageSize / 2, num_bytes);
+    for (uint64_t n = 0; n < num_bytes; n++) {
+      s->data_[offset + n] = 0xff;
+      s->written_[offset + n] = false;
+    }
+    s->num_erases_++;
+    return AVB_IO_RESULT_OK;
+  }
+
+  AvbPvStoreOps ops_;
+  std::vector<uint8_t> data_;
+  std::vector<bool> written_;
+  int torn_write_countdown_ = -1;
+  size_t torn_write_bytes_ = 0;
+  size_t num_erases_ = 0;
+};
+
+class AvbPvStoreTest : public ::testing::TestWithParam<bool> {
+ public:
+  AvbPvStoreTest() {
+    Reset();
+  }
+
+  virtual void TearDown() override {
+    Close();
+  }
+
+ protected:
+  void Open(size_t max_values = 8) {
+    Close();
+    ASSERT_EQ(
+        AVB_IO_RESULT_OK,
+        avb_pvstore_open(storage_->ops(), kStorageSize, max_values, &store_));
+  }
+
+  void Close() {
+    if (store_ != NULL) {
+      avb_pvstore_close(store_);
+      store_ = NULL;
+    }
+  }
+
+  // Closes the store and starts over with empty storage.
+  void Reset() {
+    Close();
+    storage_.reset(new FakePvStoreStorage(GetParam()));
+  }
+
+  AvbIOResult Write(const std::string& name, const std::string& value) {
+    return avb_pvstore_write(store_,
+                             name.c_str(),
+                             value.size(),
+                             reinterpret_cast<const uint8_t*>(value.data()));
+  }
+
+  // Returns the value for |name|, or "<none>" if there is none.
+  std::string Read(const std::string& name) {
+    uint8_t buf[256];
+    size_t num_read = 0;
+    AvbIOResult io_ret =
+        avb_pvstore_read(store_, name.c_str(), sizeof(buf), buf, &num_read);
+    if (io_ret == AVB_IO_RESULT_ERROR_NO_SUCH_VALUE) {
+      return "<none>";
+    }
+    EXPECT_EQ(AVB_IO_RESULT_OK, io_ret);
+    return std::string(reinterpret_cast<const char*>(buf), num_read);
+  }
+
+  std::unique_ptr<FakePvStoreStorage> storage_;
+  AvbPvStore* store_ = NULL;
+};
+
+TEST_P(AvbPvStoreTest, ReadWriteDelete) {
+  Open();
+  EXPECT_EQ("<none>", Read("avb.foo"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.foo", "hello"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.bar", "world"));
+  EXPECT_EQ("hello", Read("avb.foo"));
+  EXPECT_EQ("world", Read("avb.bar"));
+
+  // Query the size, as done by the read_persistent_value() callers.
+  size_t num_read = 0;
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE,
+            avb_pvstore_read(store_, "avb.foo", 0, NULL, &num_read));
+  EXPECT_EQ(size_t(5), num_read);
+
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.foo", "goodbye"));
+  EXPECT_EQ("goodbye", Read("avb.foo"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.foo", ""));
+  EXPECT_EQ("<none>", Read("avb.foo"));
+  EXPECT_EQ("world", Read("avb.bar"));
+
+  // The log survives reopening.
+  Open();
+  EXPECT_EQ("<none>", Read("avb.foo"));
+  EXPECT_EQ("world", Read("avb.bar"));
+
+  // Names that are too long aren't supported.
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_NO_SUCH_VALUE,
+            Write(std::string(AVB_PVSTORE_MAX_NAME_LEN + 1, 'x'), "v"));
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_INVALID_VALUE_SIZE,
+            Write("avb.big", std::string(kStorageSize, 'v')));
+}
+
+TEST_P(AvbPvStoreTest, ValueSizeOverflow) {
+  Open();
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.foo", "hello"));
+
+  // A value size which makes the record size wrap around to zero in
+  // size_t is rejected before anything is read from |value|.
+  const char name[] = "avb.foo";
+  size_t value_size =
+      SIZE_MAX - sizeof(AvbPvStoreRecord) - (sizeof(name) - 1) + 1;
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_INVALID_VALUE_SIZE,
+            avb_pvstore_write(store_, name, value_size, NULL));
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_INVALID_VALUE_SIZE,
+            avb_pvstore_write(store_, name, UINT32_MAX, NULL));
+  EXPECT_EQ("hello", Read("avb.foo"));
+}
+
+TEST_P(AvbPvStoreTest, CompactsWhenFull) {
+  Open();
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.keep", "kept"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.gone", "deleted"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.gone", ""));
+
+  // Each record takes 40 bytes, so this fills the 1 KiB banks many
+  // times over.
+  for (int n = 0; n < 200; n++) {
+    std::string value = "value" + std::to_string(n % 10);
+    ASSERT_EQ(AVB_IO_RESULT_OK, Write("avb.counter", value));
+    ASSERT_EQ(value, Read("avb.counter"));
+  }
+  EXPECT_EQ("kept", Read("avb.keep"));
+  EXPECT_EQ("<none>", Read("avb.gone"));
+  if (GetParam()) {
+    EXPECT_GT(storage_->num_erases(), size_t(1));
+  }
+
+  Open();
+  EXPECT_EQ("value9", Read("avb.counter"));
+  EXPECT_EQ("kept", Read("avb.keep"));
+  EXPECT_EQ("<none>", Read("avb.gone"));
+}
+
+TEST_P(AvbPvStoreTest, IncrementalCompaction) {
+  const std::vector<std::string> names = {"avb.a", "avb.b", "avb.c"};
+
+  // Which records are left behind by an abandoned compaction depends on
+  // the order of the index, so try keeping each of the values.
+  for (const std::string& kept : names) {
+    SCOPED_TRACE(kept);
+    Reset();
+    Open();
+    for (const std::string& name : names) {
+      EXPECT_EQ(AVB_IO_RESULT_OK, Write(name, "1"));
+    }
+    EXPECT_FALSE(avb_pvstore_needs_compaction(store_));
+    for (int n = 0; n < 20; n++) {
+      EXPECT_EQ(AVB_IO_RESULT_OK, Write(kept, std::to_string(n % 10)));
+    }
+    EXPECT_TRUE(avb_pvstore_needs_compaction(store_));
+
+    // Copy two of the three records, then delete the other values
+    // which restarts the compaction. The records copied by the first
+    // attempt must not come back.
+    bool done = false;
+    EXPECT_EQ(AVB_IO_RESULT_OK, avb_pvstore_compact_step(store_, 1, &done));
+    EXPECT_FALSE(done);
+    EXPECT_EQ(AVB_IO_RESULT_OK, avb_pvstore_compact_step(store_, 1, &done));
+    EXPECT_FALSE(done);
+    for (const std::string& name : names) {
+      if (name != kept) {
+        EXPECT_EQ(AVB_IO_RESULT_OK, Write(name, ""));
+      }
+    }
+    while (!done) {
+      EXPECT_EQ(AVB_IO_RESULT_OK, avb_pvstore_compact_step(store_, 1, &done));
+    }
+    EXPECT_FALSE(avb_pvstore_needs_compaction(store_));
+
+    for (int reopen = 0; reopen < 2; reopen++) {
+      for (const std::string& name : names) {
+        EXPECT_EQ(name == kept ? "9" : "<none>", Read(name));
+      }
+      Open();
+    }
+
+    // Appending after the compacted records works too.
+    EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.d", "4"));
+    Open();
+    EXPECT_EQ("4", Read("avb.d"));
+    for (const std::string& name : names) {
+      EXPECT_EQ(name == kept ? "9" : "<none>", Read(name));
+    }
+  }
+}
+
+TEST_P(AvbPvStoreTest, TornWrite) {
+  Open();
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.foo", "old"));
+
+  // The new record is only partially written.
+  storage_->set_torn_write(0, 20);
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_IO, Write("avb.foo", "new"));
+
+  Open();
+  EXPECT_EQ("old", Read("avb.foo"));
+  EXPECT_TRUE(avb_pvstore_needs_compaction(store_));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.foo", "newer"));
+  EXPECT_EQ("newer", Read("avb.foo"));
+  Open();
+  EXPECT_EQ("newer", Read("avb.foo"));
+}
+
+TEST_P(AvbPvStoreTest, TornCompaction) {
+  Open();
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.foo", "foo"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.bar", "bar"));
+
+  // Copy both records, then fail before the bank header is written.
+  // The old bank stays active.
+  storage_->set_torn_write(2, 8);
+  bool done = false;
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_IO,
+            avb_pvstore_compact_step(store_, SIZE_MAX, &done));
+  EXPECT_FALSE(done);
+
+  Open();
+  EXPECT_EQ("foo", Read("avb.foo"));
+  EXPECT_EQ("bar", Read("avb.bar"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, avb_pvstore_compact_step(store_, 1, &done));
+  while (!done) {
+    EXPECT_EQ(AVB_IO_RESULT_OK, avb_pvstore_compact_step(store_, 1, &done));
+  }
+  Open();
+  EXPECT_EQ("foo", Read("avb.foo"));
+  EXPECT_EQ("bar", Read("avb.bar"));
+}
+
+TEST_P(AvbPvStoreTest, MaxValues) {
+  Open(2);
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.a", "1"));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.b", "2"));
+  EXPECT_EQ(AVB_IO_RESULT_ERROR_INSUFFICIENT_SPACE, Write("avb.c", "3"));
+
+  // Deleting a value makes room for another one.
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.a", ""));
+  EXPECT_EQ(AVB_IO_RESULT_OK, Write("avb.c", "3"));
+  EXPECT_EQ("<none>", Read("avb.a"));
+  EXPECT_EQ("2", Read("avb.b"));
+  EXPECT_EQ("3", Read("avb.c"));
+}
+
+INSTANTIATE_TEST_SUITE_P(Storage,
+                         AvbPvStoreTest,
+                         ::testing::Values(false, true),
+                         [](const ::testing::TestParamInfo<bool>& info) {
+                           return info.param ? "Flash" : "Overwritable";
+                         });
+
+class AvbPvStoreFileTest : public BaseAvbToolTest {};
+
+TEST_F(AvbPvStoreFileTest, ReadWrite) {
+  std::string path = testdir_.Append("pvstore.bin").value();
+  AvbPvStoreOps ops;
+  AvbPvStore* store = NULL;
+  uint8_t buf[16];
+  size_t num_read = 0;
+
+  ASSERT_TRUE(avb_pvstore_file_ops_init(&ops, path.c_str()));
+  ASSERT_EQ(AVB_IO_RESULT_OK, avb_pvstore_open(&ops, 64 * 1024, 16, &store));
+  EXPECT_EQ(AVB_IO_RESULT_OK,
+            avb_pvstore_write(
+                store, "avb.foo", 3, reinterpret_cast<const uint8_t*>("bar")));
+  avb_pvstore_close(store);
+  avb_pvstore_file_ops_close(&ops);
+
+  ASSERT_TRUE(avb_pvstore_file_ops_init(&ops, path.c_str()));
+  ASSERT_EQ(AVB_IO_RESULT_OK, avb_pvstore_open(&ops, 64 * 1024, 16, &store));
+  EXPECT_EQ(AVB_IO_RESULT_OK,
+            avb_pvstore_read(store, "avb.foo", sizeof(buf), buf, &num_read));
+  EXPECT_EQ("bar", std::string(reinterpret_cast<char*>(buf), num_read));
+  avb_pvstore_close(store);
+  avb_pvstore_file_ops_close(&ops);
+}
+
+}  // namespace avb
@@ -23,10 +23,13 @@
  */
 
 #include <iostream>
+#include <set>
+#include <vector>
 
 #include <base/files/file_util.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <libavb/avb_sha.h>
 
 #include "avb_unittest_util.h"
 #include "fake_avb_ops.h"
@@ -46,11 +49,40 @@ class AvbSlotVerifyTest : public BaseAvbToolTest,
     ops_.set_stored_is_device_unlocked(false);
   }
 
+  AvbIOResult read_from_partition(const char* partition,
+                                  int64_t offset,
+                                  size_t num_bytes,
+                                  void* buffer,
+                                  size_t* out_num_read) override {
+    reads_.push_back({partition, offset, num_bytes});
+    return FakeAvbOpsDelegateWithDefaults::read_from_partition(
+        partition, offset, num_bytes, buffer, out_num_read);
+  }
+
   void CmdlineWithHashtreeVerification(bool hashtree_verification_on);
   void CmdlineWithChainedHashtreeVerification(bool hashtree_verification_on);
   void VerificationDisabled(bool use_avbctl,
                             bool preload,
                             bool has_system_partition);
+
+  // Every read_from_partition() call, in order.
+  struct Read {
+    std::string partition;
+    int64_t offset;
+    size_t num_bytes;
+  };
+  std::vector<Read> reads_;
+
+  // Returns the number of bytes read from |partition| so far.
+  size_t NumBytesRead(const std::string& partition) {
+    size_t num_bytes = 0;
+    for (const Read& read : reads_) {
+      if (read.partition == partition) {
+        num_bytes += read.num_bytes;
+      }
+    }
+    return num_bytes;
+  }
 };
 
 TEST_F(AvbSlotVerifyTest, Basic) {
@@ -94,6 +126,78 @@ TEST_F(AvbSlotVerifyTest, Basic) {
             CalcVBMetaDigest("vbmeta_a.img", "sha256"));
 }
 
+TEST_F(AvbSlotVerifyTest, LargeVBMeta) {
+  // Each property descriptor takes 64 bytes, so this is just under the
+  // 64 KiB limit.
+  std::string props;
+  for (int n = 0; n < 950; n++) {
+    props += base::StringPrintf(" --prop property_%04d:value_%04d", n, n);
+  }
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      props + " --internal_release_string \"\"");
+  ASSERT_GT(vbmeta_image_.size(), 60u * 1024);
+  ASSERT_LE(vbmeta_image_.size(), 64u * 1024);
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  AvbSlotVerifyData* slot_data = NULL;
+  const char* requested_partitions[] = {"boot", NULL};
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  ASSERT_EQ(size_t(1), slot_data->num_vbmeta_images);
+  EXPECT_EQ(vbmeta_image_.size(), slot_data->vbmeta_images[0].vbmeta_size);
+  EXPECT_EQ(0,
+            memcmp(vbmeta_image_.data(),
+                   slot_data->vbmeta_images[0].vbmeta_data,
+                   vbmeta_image_.size()));
+  avb_slot_verify_data_free(slot_data);
+
+  // A modified property is still caught.
+  std::vector<uint8_t> image = vbmeta_image_;
+  image[image.size() - 100] ^= 0x01;
+  ASSERT_EQ(static_cast<int>(image.size()),
+            base::WriteFile(testdir_.Append("vbmeta_a.img"),
+                            reinterpret_cast<const char*>(image.data()),
+                            image.size()));
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+
+  // Images bigger than 64 KiB are rejected.
+  for (int n = 950; n < 1100; n++) {
+    props += base::StringPrintf(" --prop property_%04d:value_%04d", n, n);
+  }
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      props + " --internal_release_string \"\"");
+  ASSERT_GT(vbmeta_image_.size(), 64u * 1024);
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+}
+
 TEST_F(AvbSlotVerifyTest, BasicSha512) {
   GenerateVBMetaImage("vbmeta_a.img",
                       "SHA512_RSA2048",
@@ -140,6 +244,43 @@ TEST_F(AvbSlotVerifyTest, BasicSha512) {
       CalcVBMetaDigest("vbmeta_a.img", "sha512"));
 }
 
+TEST_F(AvbSlotVerifyTest, VBMetaDigestCalculatedWhileLoading) {
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      "--internal_release_string \"\"");
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  AvbSlotVerifyData* slot_data = NULL;
+  const char* requested_partitions[] = {"boot", NULL};
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+
+  // Check that the digests aren't calculated on request by modifying
+  // the vbmeta data behind libavb's back.
+  uint8_t sha256_digest[AVB_SHA256_DIGEST_SIZE];
+  uint8_t sha512_digest[AVB_SHA512_DIGEST_SIZE];
+  slot_data->vbmeta_images[0].vbmeta_data[0] ^= 0xff;
+  avb_slot_verify_data_calculate_vbmeta_digest(
+      slot_data, AVB_DIGEST_TYPE_SHA256, sha256_digest);
+  EXPECT_EQ(CalcVBMetaDigest("vbmeta_a.img", "sha256"),
+            mem_to_hexstring(sha256_digest, AVB_SHA256_DIGEST_SIZE));
+  avb_slot_verify_data_calculate_vbmeta_digest(
+      slot_data, AVB_DIGEST_TYPE_SHA512, sha512_digest);
+  EXPECT_EQ(CalcVBMetaDigest("vbmeta_a.img", "sha512"),
+            mem_to_hexstring(sha512_digest, AVB_SHA512_DIGEST_SIZE));
+  avb_slot_verify_data_free(slot_data);
+}
+
 TEST_F(AvbSlotVerifyTest, BasicUnlocked) {
   GenerateVBMetaImage("vbmeta_a.img",
                       "SHA256_RSA2048",
@@ -787,109 +928,1315 @@ TEST_F(AvbSlotVerifyTest, HashDescriptorInVBMetaWithPreloadedPartition) {
                  " --image %s",
                  boot_path.value().c_str());
 
-  // With no footer, 'avbtool info_image' should fail (exit status 1).
-  EXPECT_COMMAND(
-      1, "./avbtool.py info_image --image %s", boot_path.value().c_str());
+  // With no footer, 'avbtool info_image' should fail (exit status 1).
+  EXPECT_COMMAND(
+      1, "./avbtool.py info_image --image %s", boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+  ops_.enable_get_preloaded_partition();
+  EXPECT_TRUE(ops_.preload_partition("boot_a", boot_path));
+
+  AvbSlotVerifyData* slot_data = NULL;
+  const char* requested_partitions[] = {"boot", NULL};
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_NE(nullptr, slot_data);
+
+  // Now verify the slot data. The vbmeta data should match our
+  // vbmeta_image_ member.
+  EXPECT_EQ(size_t(1), slot_data->num_vbmeta_images);
+  EXPECT_EQ("vbmeta", std::string(slot_data->vbmeta_images[0].partition_name));
+  EXPECT_EQ(slot_data->vbmeta_images[0].vbmeta_size, vbmeta_image_.size());
+  EXPECT_EQ(0,
+            memcmp(vbmeta_image_.data(),
+                   slot_data->vbmeta_images[0].vbmeta_data,
+                   slot_data->vbmeta_images[0].vbmeta_size));
+
+  // The boot image data should match what is generated above with
+  // GenerateImage().
+  EXPECT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_EQ("boot",
+            std::string(slot_data->loaded_partitions[0].partition_name));
+  EXPECT_EQ(boot_image_size, slot_data->loaded_partitions[0].data_size);
+  for (size_t n = 0; n < slot_data->loaded_partitions[0].data_size; n++) {
+    EXPECT_EQ(slot_data->loaded_partitions[0].data[n], uint8_t(n));
+  }
+  EXPECT_TRUE(slot_data->loaded_partitions[0].preloaded);
+
+  avb_slot_verify_data_free(slot_data);
+}
+
+TEST_F(AvbSlotVerifyTest, SmallPreallocatedPreloadedPartitionFailGracefully) {
+  const size_t boot_partition_size = 16 * 1024 * 1024;
+  const size_t boot_image_size = 5 * 1024 * 1024;
+  // Generate vbmeta based on this boot image.
+  base::FilePath boot_path = GenerateImage("boot_a.img", boot_image_size);
+
+  // Preload smaller image than expected on the stack
+  // libavb should not attempt to free this buffer.
+  const size_t fake_preload_image_size = 1024;
+  uint8_t fake_preload_buf[fake_preload_image_size];
+
+  EXPECT_COMMAND(
+      0,
+      "./avbtool.py add_hash_footer"
+      " --image %s"
+      " --rollback_index 0"
+      " --partition_name boot"
+      " --partition_size %zd"
+      " --kernel_cmdline 'cmdline in hash footer $(ANDROID_SYSTEM_PARTUUID)'"
+      " --salt deadbeef"
+      " --internal_release_string \"\"",
+      boot_path.value().c_str(),
+      boot_partition_size);
+
+  GenerateVBMetaImage(
+      "vbmeta_a.img",
+      "SHA256_RSA2048",
+      4,
+      base::FilePath("test/data/testkey_rsa2048.pem"),
+      base::StringPrintf(
+          "--include_descriptors_from_image %s"
+          " --kernel_cmdline 'cmdline in vbmeta $(ANDROID_BOOT_PARTUUID)'"
+          " --internal_release_string \"\"",
+          boot_path.value().c_str()));
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+  ops_.enable_get_preloaded_partition();
+  EXPECT_TRUE(ops_.preload_preallocated_partition(
+      "boot_a", fake_preload_buf, fake_preload_image_size));
+
+  AvbSlotVerifyData* slot_data = NULL;
+  const char* requested_partitions[] = {"boot", NULL};
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_IO,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+}
+
+// The read_from_partition() operation which read_from_partition_counting()
+// forwards to, and the partitions it was called for.
+static AvbIOResult (*forwarded_read_from_partition)(AvbOps* ops,
+                                                    const char* partition,
+                                                    int64_t offset,
+                                                    size_t num_bytes,
+                                                    void* buffer,
+                                                    size_t* out_num_read);
+static std::vector<std::string> read_from_partition_partitions;
+
+static AvbIOResult read_from_partition_counting(AvbOps* ops,
+                                                const char* partition,
+                                                int64_t offset,
+                                                size_t num_bytes,
+                                                void* buffer,
+                                                size_t* out_num_read) {
+  read_from_partition_partitions.push_back(partition);
+  return forwarded_read_from_partition(
+      ops, partition, offset, num_bytes, buffer, out_num_read);
+}
+
+TEST_F(AvbSlotVerifyTest, VBMetaInPreloadedBoot) {
+  const size_t boot_partition_size = 16 * 1024 * 1024;
+  const size_t boot_image_size = 5 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", boot_image_size);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  // There is no vbmeta partition so the vbmeta struct is found via the
+  // footer of the boot partition.
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --algorithm SHA256_RSA2048"
+                 " --key test/data/testkey_rsa2048.pem"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+  ops_.enable_get_preloaded_partition();
+  EXPECT_TRUE(ops_.preload_partition("boot_a", boot_path));
+
+  forwarded_read_from_partition = ops_.avb_ops()->read_from_partition;
+  ops_.avb_ops()->read_from_partition = read_from_partition_counting;
+  read_from_partition_partitions.clear();
+
+  AvbSlotVerifyData* slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+
+  // Neither the footer, the vbmeta struct nor the image was read from
+  // boot_a, everything is used in place.
+  EXPECT_EQ(std::vector<std::string>(), read_from_partition_partitions);
+  ASSERT_EQ(size_t(1), slot_data->num_vbmeta_images);
+  EXPECT_EQ("boot", std::string(slot_data->vbmeta_images[0].partition_name));
+  EXPECT_TRUE(slot_data->vbmeta_images[0].preloaded);
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_TRUE(slot_data->loaded_partitions[0].preloaded);
+  EXPECT_EQ(boot_image_size, slot_data->loaded_partitions[0].data_size);
+  EXPECT_EQ(slot_data->loaded_partitions[0].data + boot_image_size,
+            slot_data->vbmeta_images[0].vbmeta_data);
+
+  // Freeing must not touch the preloaded data.
+  avb_slot_verify_data_free(slot_data);
+}
+
+TEST_F(AvbSlotVerifyTest, VBMetaInPreloadedBootUnaligned) {
+  const size_t boot_partition_size = 16 * 1024 * 1024;
+  const size_t boot_image_size = 5 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", boot_image_size);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --algorithm SHA256_RSA2048"
+                 " --key test/data/testkey_rsa2048.pem"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  // Move the vbmeta struct up by one byte and point the footer at it,
+  // so it is no longer aligned in the preloaded data.
+  std::string boot_data;
+  ASSERT_TRUE(base::ReadFileToString(boot_path, &boot_data));
+  ASSERT_EQ(boot_partition_size, boot_data.size());
+  AvbFooter footer;
+  ASSERT_TRUE(avb_footer_validate_and_byteswap(
+      reinterpret_cast<const AvbFooter*>(boot_data.data() + boot_data.size() -
+                                         AVB_FOOTER_SIZE),
+      &footer));
+  ASSERT_EQ(boot_image_size, footer.vbmeta_offset);
+  boot_data.insert(footer.vbmeta_offset, 1, '\0');
+  boot_data.erase(boot_data.size() - AVB_FOOTER_SIZE - 1, 1);
+  uint64_t unaligned_offset = avb_htobe64(footer.vbmeta_offset + 1);
+  memcpy(&boot_data[boot_data.size() - AVB_FOOTER_SIZE +
+                    offsetof(AvbFooter, vbmeta_offset)],
+         &unaligned_offset,
+         sizeof unaligned_offset);
+  ASSERT_EQ(static_cast<int>(boot_data.size()),
+            base::WriteFile(boot_path, boot_data.data(), boot_data.size()));
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+  ops_.enable_get_preloaded_partition();
+  EXPECT_TRUE(ops_.preload_partition("boot_a", boot_path));
+
+  forwarded_read_from_partition = ops_.avb_ops()->read_from_partition;
+  ops_.avb_ops()->read_from_partition = read_from_partition_counting;
+  read_from_partition_partitions.clear();
+
+  AvbSlotVerifyData* slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+
+  // The vbmeta struct was copied out of the preloaded data rather than
+  // used in place, and still nothing was read from boot_a.
+  EXPECT_EQ(std::vector<std::string>(), read_from_partition_partitions);
+  ASSERT_EQ(size_t(1), slot_data->num_vbmeta_images);
+  EXPECT_FALSE(slot_data->vbmeta_images[0].preloaded);
+  EXPECT_EQ(0u,
+            reinterpret_cast<uintptr_t>(
+                slot_data->vbmeta_images[0].vbmeta_data) %
+                8);
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_TRUE(slot_data->loaded_partitions[0].preloaded);
+  avb_slot_verify_data_free(slot_data);
+}
+
+// Number of times one of the calculate_digest() hooks below was called.
+static size_t calculate_digest_num_calls = 0;
+
+static AvbIOResult calculate_digest_sha256(AvbOps* ops,
+                                           const char* partition,
+                                           const char* hash_algorithm,
+                                           const uint8_t* salt,
+                                           size_t salt_size,
+                                           const uint8_t* data,
+                                           size_t data_size,
+                                           uint8_t* out_digest,
+                                           size_t digest_buf_size,
+                                           size_t* out_digest_size) {
+  calculate_digest_num_calls++;
+  EXPECT_EQ("boot_a", std::string(partition));
+  EXPECT_EQ("sha256", std::string(hash_algorithm));
+  EXPECT_GE(digest_buf_size, size_t(AVB_SHA256_DIGEST_SIZE));
+  AvbSHA256Ctx ctx;
+  avb_sha256_init(&ctx);
+  avb_sha256_update(&ctx, salt, salt_size);
+  avb_sha256_update(&ctx, data, data_size);
+  memcpy(out_digest, avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE);
+  *out_digest_size = AVB_SHA256_DIGEST_SIZE;
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult calculate_digest_bogus(AvbOps* ops,
+                                          const char* partition,
+                                          const char* hash_algorithm,
+                                          const uint8_t* salt,
+                                          size_t salt_size,
+                                          const uint8_t* data,
+                                          size_t data_size,
+                                          uint8_t* out_digest,
+                                          size_t digest_buf_size,
+                                          size_t* out_digest_size) {
+  calculate_digest_num_calls++;
+  memset(out_digest, 0, AVB_SHA256_DIGEST_SIZE);
+  *out_digest_size = AVB_SHA256_DIGEST_SIZE;
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult calculate_digest_unavailable(AvbOps* ops,
+                                                const char* partition,
+                                                const char* hash_algorithm,
+                                                const uint8_t* salt,
+                                                size_t salt_size,
+                                                const uint8_t* data,
+                                                size_t data_size,
+                                                uint8_t* out_digest,
+                                                size_t digest_buf_size,
+                                                size_t* out_digest_size) {
+  calculate_digest_num_calls++;
+  *out_digest_size = 0;
+  return AVB_IO_RESULT_OK;
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorWithCalculateDigestOp) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  // A correct offloaded digest verifies.
+  AvbSlotVerifyData* slot_data = NULL;
+  ops_.avb_ops()->calculate_digest = calculate_digest_sha256;
+  calculate_digest_num_calls = 0;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_NE(nullptr, slot_data);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+  avb_slot_verify_data_free(slot_data);
+
+  // The offloaded digest is used instead of the software one, so a wrong
+  // digest must cause a verification error.
+  ops_.avb_ops()->calculate_digest = calculate_digest_bogus;
+  calculate_digest_num_calls = 0;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+
+  // If the operation reports no digest, libavb falls back to software.
+  ops_.avb_ops()->calculate_digest = calculate_digest_unavailable;
+  calculate_digest_num_calls = 0;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_NE(nullptr, slot_data);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+  avb_slot_verify_data_free(slot_data);
+}
+
+static AvbIOResult get_partition_measurements_for_test(
+    AvbOps* ops,
+    const char* partition,
+    AvbPartitionMeasurement* out_measurements,
+    size_t* out_num_measurements) {
+  EXPECT_EQ("boot_a", std::string(partition));
+  out_measurements[0].digest_type = AVB_DIGEST_TYPE_SHA512;
+  out_measurements[0].salted = false;
+  out_measurements[1].digest_type = AVB_DIGEST_TYPE_SHA256;
+  out_measurements[1].salted = true;
+  *out_num_measurements = 2;
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult get_partition_measurements_too_many(
+    AvbOps* ops,
+    const char* partition,
+    AvbPartitionMeasurement* out_measurements,
+    size_t* out_num_measurements) {
+  *out_num_measurements = AVB_MAX_NUMBER_OF_MEASUREMENTS + 1;
+  return AVB_IO_RESULT_OK;
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorWithMeasurements) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+  ops_.avb_ops()->get_partition_measurements =
+      get_partition_measurements_for_test;
+
+  // Checks the measurements of the single loaded partition in
+  // |slot_data| against digests calculated here.
+  auto check_measurements = [](const AvbSlotVerifyData* slot_data) {
+    ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+    const AvbPartitionData* boot = &slot_data->loaded_partitions[0];
+    ASSERT_EQ(size_t(2), boot->num_measurements);
+
+    AvbSHA512Ctx sha512_ctx;
+    avb_sha512_init(&sha512_ctx);
+    avb_sha512_update(&sha512_ctx, boot->data, boot->data_size);
+    EXPECT_EQ(AVB_DIGEST_TYPE_SHA512, boot->measurements[0].digest_type);
+    EXPECT_FALSE(boot->measurements[0].salted);
+    ASSERT_EQ(size_t(AVB_SHA512_DIGEST_SIZE),
+              boot->measurements[0].digest_len);
+    EXPECT_EQ(0,
+              memcmp(avb_sha512_final(&sha512_ctx),
+                     boot->measurements[0].digest,
+                     AVB_SHA512_DIGEST_SIZE));
+
+    // The salted SHA-256 measurement is the digest from the descriptor.
+    EXPECT_EQ(AVB_DIGEST_TYPE_SHA256, boot->measurements[1].digest_type);
+    EXPECT_TRUE(boot->measurements[1].salted);
+    ASSERT_EQ(size_t(AVB_SHA256_DIGEST_SIZE),
+              boot->measurements[1].digest_len);
+    ASSERT_EQ(size_t(AVB_SHA256_DIGEST_SIZE), boot->digest_len);
+    EXPECT_EQ(0,
+              memcmp(boot->digest,
+                     boot->measurements[1].digest,
+                     AVB_SHA256_DIGEST_SIZE));
+  };
+
+  AvbSlotVerifyData* slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  check_measurements(slot_data);
+  avb_slot_verify_data_free(slot_data);
+
+  // Measurements are still calculated if the digest for verification
+  // is offloaded.
+  ops_.avb_ops()->calculate_digest = calculate_digest_sha256;
+  calculate_digest_num_calls = 0;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+  check_measurements(slot_data);
+  avb_slot_verify_data_free(slot_data);
+
+  // Asking for too many measurements is an error.
+  ops_.avb_ops()->get_partition_measurements =
+      get_partition_measurements_too_many;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_IO,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+}
+
+// Generation stamp returned by read_partition_generation_for_test().
+static uint64_t partition_generation = 0;
+
+static AvbIOResult read_partition_generation_for_test(
+    AvbOps* ops, const char* partition, uint64_t* out_generation) {
+  EXPECT_EQ("boot_a", std::string(partition));
+  *out_generation = partition_generation;
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult read_partition_generation_unavailable(
+    AvbOps* ops, const char* partition, uint64_t* out_generation) {
+  return AVB_IO_RESULT_ERROR_NO_SUCH_VALUE;
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorWithGenerationCache) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  // Use the calculate_digest() hook to count how often boot_a is hashed.
+  ops_.avb_ops()->calculate_digest = calculate_digest_sha256;
+  ops_.avb_ops()->read_partition_generation =
+      read_partition_generation_for_test;
+  partition_generation = 42;
+
+  auto verify = [&](AvbSlotVerifyFlags flags) {
+    AvbSlotVerifyData* slot_data = NULL;
+    EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+              avb_slot_verify(ops_.avb_ops(),
+                              requested_partitions,
+                              "_a",
+                              flags,
+                              AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                              &slot_data));
+    EXPECT_NE(nullptr, slot_data);
+    if (slot_data != NULL) {
+      // The partition is always loaded, even if it wasn't hashed.
+      EXPECT_EQ(size_t(1), slot_data->num_loaded_partitions);
+      EXPECT_EQ(size_t(5 * 1024 * 1024),
+                slot_data->loaded_partitions[0].data_size);
+      avb_slot_verify_data_free(slot_data);
+    }
+  };
+
+  // First boot: nothing cached, so hash and populate the cache.
+  calculate_digest_num_calls = 0;
+  verify(AVB_SLOT_VERIFY_FLAGS_NONE);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+
+  // Same generation: the hash is skipped.
+  calculate_digest_num_calls = 0;
+  verify(AVB_SLOT_VERIFY_FLAGS_NONE);
+  EXPECT_EQ(size_t(0), calculate_digest_num_calls);
+
+  // The cache is never used when verification errors are allowed.
+  calculate_digest_num_calls = 0;
+  verify(AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+
+  // The partition was written: hash again and update the cache.
+  partition_generation++;
+  calculate_digest_num_calls = 0;
+  verify(AVB_SLOT_VERIFY_FLAGS_NONE);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+  calculate_digest_num_calls = 0;
+  verify(AVB_SLOT_VERIFY_FLAGS_NONE);
+  EXPECT_EQ(size_t(0), calculate_digest_num_calls);
+
+  // A corrupted cache entry is ignored.
+  std::string name = std::string(AVB_NPV_GENERATION_CACHE_PREFIX) + "boot_a";
+  uint8_t entry[128];
+  size_t entry_size = 0;
+  EXPECT_EQ(AVB_IO_RESULT_OK,
+            ops_.avb_ops()->read_persistent_value(ops_.avb_ops(),
+                                                  name.c_str(),
+                                                  sizeof entry,
+                                                  entry,
+                                                  &entry_size));
+  entry[entry_size / 2] ^= 0x01;
+  EXPECT_EQ(AVB_IO_RESULT_OK,
+            ops_.avb_ops()->write_persistent_value(
+                ops_.avb_ops(), name.c_str(), entry_size, entry));
+  calculate_digest_num_calls = 0;
+  verify(AVB_SLOT_VERIFY_FLAGS_NONE);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+
+  // Without a trusted stamp the partition is always hashed.
+  ops_.avb_ops()->read_partition_generation =
+      read_partition_generation_unavailable;
+  calculate_digest_num_calls = 0;
+  verify(AVB_SLOT_VERIFY_FLAGS_NONE);
+  EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorWithGenerationCachePreloaded) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+  ops_.avb_ops()->read_partition_generation =
+      read_partition_generation_for_test;
+  partition_generation = 3;
+
+  // Populate the cache from storage.
+  AvbSlotVerifyData* slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_NE(nullptr, slot_data);
+  avb_slot_verify_data_free(slot_data);
+
+  // Preloaded data isn't covered by the storage generation stamp, so
+  // modified data in RAM must be caught even though the cache matches.
+  std::string boot_data;
+  ASSERT_TRUE(base::ReadFileToString(boot_path, &boot_data));
+  boot_data[1000] ^= 0x01;
+  base::FilePath modified_path = testdir_.Append("boot_modified.img");
+  ASSERT_EQ(static_cast<int>(boot_data.size()),
+            base::WriteFile(modified_path, boot_data.data(), boot_data.size()));
+  ops_.enable_get_preloaded_partition();
+  EXPECT_TRUE(ops_.preload_partition("boot_a", modified_path));
+
+  slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorWithGenerationCacheNewDescriptor) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+  ops_.avb_ops()->calculate_digest = calculate_digest_sha256;
+  ops_.avb_ops()->read_partition_generation =
+      read_partition_generation_for_test;
+  partition_generation = 7;
+
+  // Populate the cache, then sign the same partition with a different
+  // salt but the same generation stamp. The cached entry must not be
+  // used for the new descriptor.
+  for (const char* salt : {"deadbeef", "cafebabe"}) {
+    EXPECT_COMMAND(0,
+                   "./avbtool.py add_hash_footer"
+                   " --image %s"
+                   " --rollback_index 0"
+                   " --partition_name boot"
+                   " --partition_size %zd"
+                   " --salt %s"
+                   " --internal_release_string \"\"",
+                   boot_path.value().c_str(),
+                   boot_partition_size,
+                   salt);
+    GenerateVBMetaImage(
+        "vbmeta_a.img",
+        "SHA256_RSA2048",
+        0,
+        base::FilePath("test/data/testkey_rsa2048.pem"),
+        base::StringPrintf("--include_descriptors_from_image %s"
+                           " --internal_release_string \"\"",
+                           boot_path.value().c_str()));
+    EXPECT_COMMAND(0,
+                   "./avbtool.py erase_footer"
+                   " --image %s",
+                   boot_path.value().c_str());
+
+    AvbSlotVerifyData* slot_data = NULL;
+    calculate_digest_num_calls = 0;
+    EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+              avb_slot_verify(ops_.avb_ops(),
+                              requested_partitions,
+                              "_a",
+                              AVB_SLOT_VERIFY_FLAGS_NONE,
+                              AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                              &slot_data));
+    EXPECT_NE(nullptr, slot_data);
+    EXPECT_EQ(size_t(1), calculate_digest_num_calls);
+    avb_slot_verify_data_free(slot_data);
+  }
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorInVBMetaCorruptBoot) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  // So far, so good.
+  AvbSlotVerifyData* slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_NE(nullptr, slot_data);
+  avb_slot_verify_data_free(slot_data);
+
+  // Now corrupt boot_a.img and expect verification error.
+  uint8_t corrupt_data[4] = {0xff, 0xff, 0xff, 0xff};
+  EXPECT_EQ(AVB_IO_RESULT_OK,
+            ops_.avb_ops()->write_to_partition(ops_.avb_ops(),
+                                               "boot_a",
+                                               1024 * 1024,  // offset: 1 MiB
+                                               sizeof corrupt_data,
+                                               corrupt_data));
+
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  EXPECT_NE(nullptr, slot_data);
+  avb_slot_verify_data_free(slot_data);
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorStepwise) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  AvbSlotVerifyData* expected_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &expected_data));
+  ASSERT_NE(nullptr, expected_data);
+
+  // Loading and hashing 5 MiB in 64 KiB steps takes about 160 steps
+  // and gives the same result as avb_slot_verify().
+  AvbSlotVerifyContext* ctx = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_begin(
+                ops_.avb_ops(),
+                requested_partitions,
+                "_a",
+                AVB_SLOT_VERIFY_FLAGS_NONE,
+                AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                &ctx));
+  ASSERT_NE(nullptr, ctx);
+  size_t num_steps = 0;
+  while (avb_slot_verify_step(ctx, 64 * 1024)) {
+    num_steps++;
+  }
+  EXPECT_GT(num_steps, size_t(150));
+  EXPECT_FALSE(avb_slot_verify_step(ctx, 64 * 1024));
+
+  AvbSlotVerifyData* slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_finish(ctx, &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(std::string(expected_data->cmdline),
+            std::string(slot_data->cmdline));
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_EQ("boot",
+            std::string(slot_data->loaded_partitions[0].partition_name));
+  EXPECT_EQ(expected_data->loaded_partitions[0].data_size,
+            slot_data->loaded_partitions[0].data_size);
+  EXPECT_EQ(0,
+            memcmp(expected_data->loaded_partitions[0].data,
+                   slot_data->loaded_partitions[0].data,
+                   slot_data->loaded_partitions[0].data_size));
+  avb_slot_verify_data_free(slot_data);
+  avb_slot_verify_data_free(expected_data);
+
+  // Finishing right away does all the work.
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_begin(
+                ops_.avb_ops(),
+                requested_partitions,
+                "_a",
+                AVB_SLOT_VERIFY_FLAGS_NONE,
+                AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                &ctx));
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_finish(ctx, &slot_data));
+  EXPECT_NE(nullptr, slot_data);
+  avb_slot_verify_data_free(slot_data);
+
+  // Invalid arguments are rejected up front.
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT,
+            avb_slot_verify_begin(
+                ops_.avb_ops(),
+                requested_partitions,
+                "_a",
+                AVB_SLOT_VERIFY_FLAGS_NONE,
+                AVB_HASHTREE_ERROR_MODE_LOGGING,
+                &ctx));
+  EXPECT_EQ(nullptr, ctx);
+
+  // Now corrupt boot_a.img and expect verification error.
+  uint8_t corrupt_data[4] = {0xff, 0xff, 0xff, 0xff};
+  EXPECT_EQ(AVB_IO_RESULT_OK,
+            ops_.avb_ops()->write_to_partition(ops_.avb_ops(),
+                                               "boot_a",
+                                               1024 * 1024,  // offset: 1 MiB
+                                               sizeof corrupt_data,
+                                               corrupt_data));
+
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_begin(
+                ops_.avb_ops(),
+                requested_partitions,
+                "_a",
+                AVB_SLOT_VERIFY_FLAGS_NONE,
+                AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                &ctx));
+  while (avb_slot_verify_step(ctx, 64 * 1024)) {
+  }
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify_finish(ctx, &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_begin(
+                ops_.avb_ops(),
+                requested_partitions,
+                "_a",
+                AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR,
+                AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                &ctx));
+  while (avb_slot_verify_step(ctx, 64 * 1024)) {
+  }
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify_finish(ctx, &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            slot_data->loaded_partitions[0].verify_result);
+  avb_slot_verify_data_free(slot_data);
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorStepwiseBlockAligned) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  size_t boot_image_size = 5 * 1024 * 1024 + 100;
+  base::FilePath boot_path = GenerateImage("boot_a.img", boot_image_size);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py erase_footer"
+                 " --image %s",
+                 boot_path.value().c_str());
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  // Budgets which aren't a multiple of the block size, including one
+  // smaller than a block, still only give block-aligned reads.
+  for (size_t budget : {size_t(1000), size_t(10000), size_t(64 * 1024 + 1)}) {
+    AvbSlotVerifyContext* ctx = NULL;
+    EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+              avb_slot_verify_begin(
+                  ops_.avb_ops(),
+                  requested_partitions,
+                  "_a",
+                  AVB_SLOT_VERIFY_FLAGS_NONE,
+                  AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                  &ctx));
+    ASSERT_NE(nullptr, ctx);
+    reads_.clear();
+    while (avb_slot_verify_step(ctx, budget)) {
+    }
+    AvbSlotVerifyData* slot_data = NULL;
+    EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+              avb_slot_verify_finish(ctx, &slot_data));
+    ASSERT_NE(nullptr, slot_data);
+    ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+    EXPECT_EQ(boot_image_size, slot_data->loaded_partitions[0].data_size);
+    avb_slot_verify_data_free(slot_data);
+
+    EXPECT_EQ(boot_image_size, NumBytesRead("boot_a"));
+    for (const Read& read : reads_) {
+      if (read.partition != "boot_a") {
+        continue;
+      }
+      EXPECT_EQ(0, read.offset % 4096) << "budget " << budget;
+      if (read.offset + read.num_bytes < boot_image_size) {
+        EXPECT_EQ(0u, read.num_bytes % 4096) << "budget " << budget;
+      }
+    }
+  }
+}
+
+TEST_F(AvbSlotVerifyTest, HashDescriptorMemoryBudget) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  size_t boot_image_size = 5 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", boot_image_size);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  GenerateVBMetaImage("vbmeta_a.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      base::StringPrintf("--include_descriptors_from_image %s"
+                                         " --internal_release_string \"\"",
+                                         boot_path.value().c_str()));
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  // Runs a step-wise verification with |budget| and returns the result
+  // and the peak memory usage.
+  auto verify = [&](AvbSlotVerifyFlags flags,
+                    size_t budget,
+                    size_t* out_peak,
+                    AvbSlotVerifyData** out_data) {
+    AvbSlotVerifyContext* ctx = NULL;
+    EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+              avb_slot_verify_begin(
+                  ops_.avb_ops(),
+                  requested_partitions,
+                  "_a",
+                  flags,
+                  AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                  &ctx));
+    avb_slot_verify_set_memory_budget(ctx, budget);
+    while (avb_slot_verify_step(ctx, 1024 * 1024)) {
+    }
+    *out_peak = avb_slot_verify_get_peak_memory_usage(ctx);
+    return avb_slot_verify_finish(ctx, out_data);
+  };
+
+  // Without a budget, the image, the vbmeta struct and the slot data
+  // bookkeeping are accounted for.
+  AvbSlotVerifyData* slot_data = NULL;
+  size_t peak = 0;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            verify(AVB_SLOT_VERIFY_FLAGS_NONE, 0, &peak, &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  ASSERT_EQ(size_t(1), slot_data->num_vbmeta_images);
+  EXPECT_GT(peak,
+            boot_image_size + slot_data->vbmeta_images[0].vbmeta_size +
+                sizeof(AvbSlotVerifyData));
+  EXPECT_LT(peak, boot_image_size + 256 * 1024);
+  avb_slot_verify_data_free(slot_data);
+
+  // The same peak is enough to succeed with a budget...
+  size_t needed = peak;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            verify(AVB_SLOT_VERIFY_FLAGS_NONE, needed, &peak, &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(needed, peak);
+  avb_slot_verify_data_free(slot_data);
+
+  // ... and a byte less fails before the image is loaded.
+  EXPECT_EQ(
+      AVB_SLOT_VERIFY_RESULT_ERROR_OOM,
+      verify(AVB_SLOT_VERIFY_FLAGS_NONE, needed - 1, &peak, &slot_data));
+  EXPECT_EQ(nullptr, slot_data);
+  EXPECT_LT(peak, boot_image_size);
+
+  // With ALLOW_VERIFICATION_ERROR the entire partition is loaded if
+  // the budget allows it...
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            verify(AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR,
+                   0,
+                   &peak,
+                   &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_EQ(boot_partition_size, slot_data->loaded_partitions[0].data_size);
+  EXPECT_GT(peak, boot_partition_size);
+  avb_slot_verify_data_free(slot_data);
+
+  // ... and otherwise only the image from the descriptor.
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            verify(AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR,
+                   needed,
+                   &peak,
+                   &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_EQ(boot_image_size, slot_data->loaded_partitions[0].data_size);
+  EXPECT_LE(peak, needed);
+  avb_slot_verify_data_free(slot_data);
+}
+
+TEST_F(AvbSlotVerifyTest, AddPartitions) {
+  size_t partition_size = 16 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
+  base::FilePath dtbo_path = GenerateImage("dtbo_a.img", 64 * 1024);
+  const char* boot_partitions[] = {"boot", NULL};
+  const char* extra_partitions[] = {"boot", "dtbo", NULL};
+  const char* unknown_partitions[] = {"recovery", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 partition_size);
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --rollback_index 0"
+                 " --partition_name dtbo"
+                 " --partition_size %zd"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 dtbo_path.value().c_str(),
+                 partition_size);
+
+  GenerateVBMetaImage(
+      "vbmeta_a.img",
+      "SHA256_RSA2048",
+      0,
+      base::FilePath("test/data/testkey_rsa2048.pem"),
+      base::StringPrintf("--include_descriptors_from_image %s"
+                         " --include_descriptors_from_image %s"
+                         " --internal_release_string \"\"",
+                         boot_path.value().c_str(),
+                         dtbo_path.value().c_str()));
 
   ops_.set_expected_public_key(
       PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
-  ops_.enable_get_preloaded_partition();
-  EXPECT_TRUE(ops_.preload_partition("boot_a", boot_path));
 
   AvbSlotVerifyData* slot_data = NULL;
-  const char* requested_partitions[] = {"boot", NULL};
   EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
             avb_slot_verify(ops_.avb_ops(),
-                            requested_partitions,
+                            boot_partitions,
                             "_a",
                             AVB_SLOT_VERIFY_FLAGS_NONE,
                             AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
                             &slot_data));
-  EXPECT_NE(nullptr, slot_data);
-
-  // Now verify the slot data. The vbmeta data should match our
-  // vbmeta_image_ member.
-  EXPECT_EQ(size_t(1), slot_data->num_vbmeta_images);
-  EXPECT_EQ("vbmeta", std::string(slot_data->vbmeta_images[0].partition_name));
-  EXPECT_EQ(slot_data->vbmeta_images[0].vbmeta_size, vbmeta_image_.size());
-  EXPECT_EQ(0,
-            memcmp(vbmeta_image_.data(),
-                   slot_data->vbmeta_images[0].vbmeta_data,
-                   slot_data->vbmeta_images[0].vbmeta_size));
-
-  // The boot image data should match what is generated above with
-  // GenerateImage().
+  ASSERT_NE(nullptr, slot_data);
+  std::string cmdline = slot_data->cmdline;
   EXPECT_EQ(size_t(1), slot_data->num_loaded_partitions);
+
+  // "boot" is already loaded so only "dtbo" is added.
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_add_partitions(ops_.avb_ops(),
+                                           extra_partitions,
+                                           AVB_SLOT_VERIFY_FLAGS_NONE,
+                                           slot_data));
+  ASSERT_EQ(size_t(2), slot_data->num_loaded_partitions);
   EXPECT_EQ("boot",
             std::string(slot_data->loaded_partitions[0].partition_name));
-  EXPECT_EQ(boot_image_size, slot_data->loaded_partitions[0].data_size);
-  for (size_t n = 0; n < slot_data->loaded_partitions[0].data_size; n++) {
-    EXPECT_EQ(slot_data->loaded_partitions[0].data[n], uint8_t(n));
-  }
-  EXPECT_TRUE(slot_data->loaded_partitions[0].preloaded);
+  EXPECT_EQ("dtbo",
+            std::string(slot_data->loaded_partitions[1].partition_name));
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            slot_data->loaded_partitions[1].verify_result);
+  EXPECT_EQ(size_t(64 * 1024), slot_data->loaded_partitions[1].data_size);
+  EXPECT_EQ(cmdline, std::string(slot_data->cmdline));
 
+  // Adding them again is a no-op.
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_add_partitions(ops_.avb_ops(),
+                                           extra_partitions,
+                                           AVB_SLOT_VERIFY_FLAGS_NONE,
+                                           slot_data));
+  EXPECT_EQ(size_t(2), slot_data->num_loaded_partitions);
+
+  // Partitions without a hash descriptor can't be added.
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_ARGUMENT,
+            avb_slot_verify_add_partitions(ops_.avb_ops(),
+                                           unknown_partitions,
+                                           AVB_SLOT_VERIFY_FLAGS_NONE,
+                                           slot_data));
+  EXPECT_EQ(size_t(2), slot_data->num_loaded_partitions);
   avb_slot_verify_data_free(slot_data);
-}
 
-TEST_F(AvbSlotVerifyTest, SmallPreallocatedPreloadedPartitionFailGracefully) {
-  const size_t boot_partition_size = 16 * 1024 * 1024;
-  const size_t boot_image_size = 5 * 1024 * 1024;
-  // Generate vbmeta based on this boot image.
-  base::FilePath boot_path = GenerateImage("boot_a.img", boot_image_size);
+  // A corrupted extra partition fails verification, leaving the
+  // slot data unchanged unless verification errors are allowed.
+  uint8_t corrupt_data[4] = {0xff, 0xff, 0xff, 0xff};
+  EXPECT_EQ(AVB_IO_RESULT_OK,
+            ops_.avb_ops()->write_to_partition(ops_.avb_ops(),
+                                               "dtbo_a",
+                                               1024,
+                                               sizeof corrupt_data,
+                                               corrupt_data));
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            boot_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify_add_partitions(ops_.avb_ops(),
+                                           extra_partitions,
+                                           AVB_SLOT_VERIFY_FLAGS_NONE,
+                                           slot_data));
+  EXPECT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            avb_slot_verify_add_partitions(
+                ops_.avb_ops(),
+                extra_partitions,
+                AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR,
+                slot_data));
+  ASSERT_EQ(size_t(2), slot_data->num_loaded_partitions);
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+            slot_data->loaded_partitions[1].verify_result);
+  avb_slot_verify_data_free(slot_data);
+}
 
-  // Preload smaller image than expected on the stack
-  // libavb should not attempt to free this buffer.
-  const size_t fake_preload_image_size = 1024;
-  uint8_t fake_preload_buf[fake_preload_image_size];
+// Alignment used by allocate_io_buffer_aligned().
+static const size_t kIoBufferAlignment = 4096;
 
-  EXPECT_COMMAND(
-      0,
-      "./avbtool.py add_hash_footer"
-      " --image %s"
-      " --rollback_index 0"
-      " --partition_name boot"
-      " --partition_size %zd"
-      " --kernel_cmdline 'cmdline in hash footer $(ANDROID_SYSTEM_PARTUUID)'"
-      " --salt deadbeef"
-      " --internal_release_string \"\"",
-      boot_path.value().c_str(),
-      boot_partition_size);
+// Partitions allocate_io_buffer_aligned() was called for.
+static std::vector<std::string> io_buffer_partitions;
 
-  GenerateVBMetaImage(
-      "vbmeta_a.img",
-      "SHA256_RSA2048",
-      4,
-      base::FilePath("test/data/testkey_rsa2048.pem"),
-      base::StringPrintf(
-          "--include_descriptors_from_image %s"
-          " --kernel_cmdline 'cmdline in vbmeta $(ANDROID_BOOT_PARTUUID)'"
-          " --internal_release_string \"\"",
-          boot_path.value().c_str()));
+// Buffers from allocate_io_buffer_aligned() not yet passed to
+// free_io_buffer_aligned(). These aren't known to avb_free().
+static std::set<void*> io_buffers;
 
-  EXPECT_COMMAND(0,
-                 "./avbtool.py erase_footer"
-                 " --image %s",
-                 boot_path.value().c_str());
+static void* allocate_io_buffer_aligned(AvbOps* ops,
+                                        const char* partition,
+                                        size_t size) {
+  void* buf = nullptr;
+  io_buffer_partitions.push_back(partition);
+  if (posix_memalign(&buf, kIoBufferAlignment, size) != 0) {
+    return nullptr;
+  }
+  io_buffers.insert(buf);
+  return buf;
+}
 
-  ops_.set_expected_public_key(
-      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
-  ops_.enable_get_preloaded_partition();
-  EXPECT_TRUE(ops_.preload_preallocated_partition(
-      "boot_a", fake_preload_buf, fake_preload_image_size));
+static void free_io_buffer_aligned(AvbOps* ops, void* buffer) {
+  EXPECT_EQ(size_t(1), io_buffers.erase(buffer));
+  free(buffer);
+}
 
-  AvbSlotVerifyData* slot_data = NULL;
-  const char* requested_partitions[] = {"boot", NULL};
-  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_IO,
-            avb_slot_verify(ops_.avb_ops(),
-                            requested_partitions,
-                            "_a",
-                            AVB_SLOT_VERIFY_FLAGS_NONE,
-                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
-                            &slot_data));
-  EXPECT_EQ(nullptr, slot_data);
+static void* allocate_io_buffer_unavailable(AvbOps* ops,
+                                            const char* partition,
+                                            size_t size) {
+  io_buffer_partitions.push_back(partition);
+  return NULL;
 }
 
-TEST_F(AvbSlotVerifyTest, HashDescriptorInVBMetaCorruptBoot) {
+TEST_F(AvbSlotVerifyTest, HashDescriptorWithAllocateIoBufferOp) {
   size_t boot_partition_size = 16 * 1024 * 1024;
   base::FilePath boot_path = GenerateImage("boot_a.img", 5 * 1024 * 1024);
   const char* requested_partitions[] = {"boot", NULL};
@@ -921,8 +2268,12 @@ TEST_F(AvbSlotVerifyTest, HashDescriptorInVBMetaCorruptBoot) {
   ops_.set_expected_public_key(
       PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
 
-  // So far, so good.
+  // Both vbmeta and the loaded partition are read into buffers from the
+  // operation.
   AvbSlotVerifyData* slot_data = NULL;
+  ops_.avb_ops()->allocate_io_buffer = allocate_io_buffer_aligned;
+  ops_.avb_ops()->free_io_buffer = free_io_buffer_aligned;
+  io_buffer_partitions.clear();
   EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
             avb_slot_verify(ops_.avb_ops(),
                             requested_partitions,
@@ -930,19 +2281,27 @@ TEST_F(AvbSlotVerifyTest, HashDescriptorInVBMetaCorruptBoot) {
                             AVB_SLOT_VERIFY_FLAGS_NONE,
                             AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
                             &slot_data));
-  EXPECT_NE(nullptr, slot_data);
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(std::vector<std::string>({"vbmeta_a", "boot_a"}),
+            io_buffer_partitions);
+  ASSERT_EQ(size_t(1), slot_data->num_vbmeta_images);
+  uintptr_t vbmeta_addr =
+      reinterpret_cast<uintptr_t>(slot_data->vbmeta_images[0].vbmeta_data);
+  EXPECT_EQ(0U, vbmeta_addr % kIoBufferAlignment);
+  EXPECT_EQ(ops_.avb_ops(), slot_data->vbmeta_images[0].io_buffer_ops);
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  uintptr_t boot_addr =
+      reinterpret_cast<uintptr_t>(slot_data->loaded_partitions[0].data);
+  EXPECT_EQ(0U, boot_addr % kIoBufferAlignment);
+  EXPECT_EQ(ops_.avb_ops(), slot_data->loaded_partitions[0].io_buffer_ops);
+  EXPECT_EQ(size_t(2), io_buffers.size());
   avb_slot_verify_data_free(slot_data);
+  EXPECT_EQ(size_t(0), io_buffers.size());
 
-  // Now corrupt boot_a.img and expect verification error.
-  uint8_t corrupt_data[4] = {0xff, 0xff, 0xff, 0xff};
-  EXPECT_EQ(AVB_IO_RESULT_OK,
-            ops_.avb_ops()->write_to_partition(ops_.avb_ops(),
-                                               "boot_a",
-                                               1024 * 1024,  // offset: 1 MiB
-                                               sizeof corrupt_data,
-                                               corrupt_data));
-
-  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+  // If the operation can't provide a buffer, verification fails.
+  ops_.avb_ops()->allocate_io_buffer = allocate_io_buffer_unavailable;
+  io_buffer_partitions.clear();
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_OOM,
             avb_slot_verify(ops_.avb_ops(),
                             requested_partitions,
                             "_a",
@@ -950,14 +2309,22 @@ TEST_F(AvbSlotVerifyTest, HashDescriptorInVBMetaCorruptBoot) {
                             AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
                             &slot_data));
   EXPECT_EQ(nullptr, slot_data);
-  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_ERROR_VERIFICATION,
+  EXPECT_EQ(std::vector<std::string>({"vbmeta_a"}), io_buffer_partitions);
+
+  // Without free_io_buffer() the operation isn't used at all.
+  ops_.avb_ops()->allocate_io_buffer = allocate_io_buffer_aligned;
+  ops_.avb_ops()->free_io_buffer = NULL;
+  io_buffer_partitions.clear();
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
             avb_slot_verify(ops_.avb_ops(),
                             requested_partitions,
                             "_a",
-                            AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR,
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
                             AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
                             &slot_data));
-  EXPECT_NE(nullptr, slot_data);
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(size_t(0), io_buffer_partitions.size());
+  EXPECT_EQ(nullptr, slot_data->loaded_partitions[0].io_buffer_ops);
   avb_slot_verify_data_free(slot_data);
 }
 
@@ -1147,6 +2514,103 @@ TEST_F(AvbSlotVerifyTest, HashDescriptorInChainedPartition) {
             CalcVBMetaDigest("vbmeta.img", "sha256"));
 }
 
+TEST_F(AvbSlotVerifyTest, HashDescriptorInChainedPartitionStepwise) {
+  size_t boot_partition_size = 16 * 1024 * 1024;
+  const size_t boot_image_size = 5 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot.img", boot_image_size);
+  const char* requested_partitions[] = {"boot", NULL};
+
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer"
+                 " --image %s"
+                 " --kernel_cmdline 'cmdline2 in hash footer'"
+                 " --rollback_index 12"
+                 " --partition_name boot"
+                 " --partition_size %zd"
+                 " --algorithm SHA256_RSA4096"
+                 " --key test/data/testkey_rsa4096.pem"
+                 " --salt deadbeef"
+                 " --internal_release_string \"\"",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  base::FilePath pk_path = testdir_.Append("testkey_rsa4096.avbpubkey");
+  EXPECT_COMMAND(
+      0,
+      "./avbtool.py extract_public_key --key test/data/testkey_rsa4096.pem"
+      " --output %s",
+      pk_path.value().c_str());
+
+  GenerateVBMetaImage(
+      "vbmeta.img",
+      "SHA256_RSA2048",
+      11,
+      base::FilePath("test/data/testkey_rsa2048.pem"),
+      base::StringPrintf("--chain_partition boot:1:%s"
+                         " --kernel_cmdline 'cmdline2 in vbmeta'"
+                         " --internal_release_string \"\"",
+                         pk_path.value().c_str()));
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  AvbSlotVerifyData* expected_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                            &expected_data));
+  ASSERT_NE(nullptr, expected_data);
+
+  AvbSlotVerifyContext* ctx = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_begin(
+                ops_.avb_ops(),
+                requested_partitions,
+                "",
+                AVB_SLOT_VERIFY_FLAGS_NONE,
+                AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                &ctx));
+  ASSERT_NE(nullptr, ctx);
+  reads_.clear();
+
+  // The first step only verifies 'vbmeta'...
+  EXPECT_TRUE(avb_slot_verify_step(ctx, 64 * 1024));
+  EXPECT_GT(NumBytesRead("vbmeta"), size_t(0));
+  EXPECT_EQ(size_t(0), NumBytesRead("boot"));
+
+  // ... the second one the vbmeta image chained in 'boot' but without
+  // loading the partition...
+  EXPECT_TRUE(avb_slot_verify_step(ctx, 64 * 1024));
+  EXPECT_GT(NumBytesRead("boot"), size_t(0));
+  EXPECT_LT(NumBytesRead("boot"), size_t(64 * 1024));
+
+  // ... and the following ones load and hash it.
+  while (avb_slot_verify_step(ctx, 64 * 1024)) {
+  }
+  EXPECT_GT(NumBytesRead("boot"), boot_image_size);
+
+  // The result, including the order of the command-line snippets, is
+  // the same as for avb_slot_verify().
+  AvbSlotVerifyData* slot_data = NULL;
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify_finish(ctx, &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(std::string(expected_data->cmdline),
+            std::string(slot_data->cmdline));
+  ASSERT_EQ(size_t(2), slot_data->num_vbmeta_images);
+  EXPECT_EQ("vbmeta", std::string(slot_data->vbmeta_images[0].partition_name));
+  EXPECT_EQ("boot", std::string(slot_data->vbmeta_images[1].partition_name));
+  EXPECT_EQ(11UL, slot_data->rollback_indexes[0]);
+  EXPECT_EQ(12UL, slot_data->rollback_indexes[1]);
+  ASSERT_EQ(size_t(1), slot_data->num_loaded_partitions);
+  EXPECT_EQ(boot_image_size, slot_data->loaded_partitions[0].data_size);
+  avb_slot_verify_data_free(slot_data);
+  avb_slot_verify_data_free(expected_data);
+}
+
 TEST_F(AvbSlotVerifyTest, HashDescriptorInChainedPartitionNoAB) {
   size_t boot_partition_size = 16 * 1024 * 1024;
   const size_t boot_image_size = 5 * 1024 * 1024;
@@ -2448,6 +3912,101 @@ TEST_F(AvbSlotVerifyTest, CmdlineWithHashtreeVerificationOn) {
   CmdlineWithHashtreeVerification(true);
 }
 
+TEST_F(AvbSlotVerifyTest, CmdlineWithDmModCreate) {
+  const size_t image_size = 1028 * 1024;
+  const size_t partition_size = 1536 * 1024;
+
+  // Generate system and vendor images with known content, the latter
+  // not using A/B.
+  std::vector<uint8_t> image;
+  image.resize(image_size);
+  for (size_t n = 0; n < image_size; n++)
+    image[n] = uint8_t(n);
+  base::FilePath system_path = testdir_.Append("system_a.img");
+  base::FilePath vendor_path = testdir_.Append("vendor.img");
+  for (const base::FilePath& path : {system_path, vendor_path}) {
+    EXPECT_EQ(image_size,
+              static_cast<const size_t>(
+                  base::WriteFile(path,
+                                  reinterpret_cast<const char*>(image.data()),
+                                  image.size())));
+  }
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hashtree_footer --salt d00df00d --image %s "
+                 "--partition_size %d --partition_name system "
+                 "--internal_release_string \"\" "
+                 "--do_not_generate_fec",
+                 system_path.value().c_str(),
+                 (int)partition_size);
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hashtree_footer --salt d00df00d --image %s "
+                 "--partition_size %d --partition_name vendor "
+                 "--hash_algorithm sha256 --do_not_use_ab "
+                 "--check_at_most_once "
+                 "--internal_release_string \"\" "
+                 "--do_not_generate_fec",
+                 vendor_path.value().c_str(),
+                 (int)partition_size);
+
+  GenerateVBMetaImage(
+      "vbmeta_a.img",
+      "SHA256_RSA2048",
+      4,
+      base::FilePath("test/data/testkey_rsa2048.pem"),
+      base::StringPrintf("--include_descriptors_from_image %s "
+                         "--include_descriptors_from_image %s "
+                         "--internal_release_string \"\"",
+                         system_path.value().c_str(),
+                         vendor_path.value().c_str()));
+
+  ops_.set_expected_public_key(
+      PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")));
+
+  AvbSlotVerifyData* slot_data = NULL;
+  const char* requested_partitions[] = {"boot", NULL};
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_DM_MOD_CREATE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(
+      "androidboot.vbmeta.device=PARTUUID=1234-fake-guid-for:vbmeta_a "
+      "androidboot.vbmeta.avb_version=1.3 "
+      "androidboot.vbmeta.device_state=locked "
+      "androidboot.vbmeta.hash_alg=sha256 androidboot.vbmeta.size=1536 "
+      "androidboot.vbmeta.digest="
+      "65ffef6117ac49904424344585574da90dfccf742efb2a7d76aa6eb796b468d7 "
+      "dm-mod.create=\"system,,,ro,0 2056 verity 1 "
+      "PARTUUID=1234-fake-guid-for:system_a "
+      "PARTUUID=1234-fake-guid-for:system_a 4096 4096 257 257 sha1 "
+      "e811611467dcd6e8dc4324e45f706c2bdd51db67 d00df00d 2 "
+      "restart_on_corruption ignore_zero_blocks;"
+      "vendor,,,ro,0 2056 verity 1 "
+      "PARTUUID=1234-fake-guid-for:vendor "
+      "PARTUUID=1234-fake-guid-for:vendor 4096 4096 257 257 sha256 "
+      "b10378ed2fbd732cccb9738a06786ece6c3262843f452c1f86ba4bd72ccd5e0a "
+      "d00df00d 3 check_at_most_once restart_on_corruption "
+      "ignore_zero_blocks\" "
+      "androidboot.veritymode=enforcing",
+      std::string(slot_data->cmdline));
+  avb_slot_verify_data_free(slot_data);
+
+  // Nothing is added without the flag.
+  EXPECT_EQ(AVB_SLOT_VERIFY_RESULT_OK,
+            avb_slot_verify(ops_.avb_ops(),
+                            requested_partitions,
+                            "_a",
+                            AVB_SLOT_VERIFY_FLAGS_NONE,
+                            AVB_HASHTREE_ERROR_MODE_RESTART,
+                            &slot_data));
+  ASSERT_NE(nullptr, slot_data);
+  EXPECT_EQ(nullptr, strstr(slot_data->cmdline, "dm-mod.create"));
+  avb_slot_verify_data_free(slot_data);
+}
+
 void AvbSlotVerifyTest::CmdlineWithChainedHashtreeVerification(
     bool hashtree_verification_on) {
   const size_t system_size = 1028 * 1024;
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <libavb/libavb.h>
+
+namespace avb {
+
+// Key blobs only need to be distinct byte strings for these tests.
+static std::vector<uint8_t> MakeKey(uint8_t seed, size_t size = 1032) {
+  std::vector<uint8_t> key(size);
+  for (size_t n = 0; n < size; n++) {
+    key[n] = static_cast<uint8_t>(seed + n * 7);
+  }
+  return key;
+}
+
+class AvbTrustedKeysTest : public ::testing::Test {
+ protected:
+  bool Validate(const char* partition,
+                const std::vector<uint8_t>& key,
+                const std::vector<uint8_t>& metadata,
+                uint32_t* out_location) {
+    bool is_trusted = true;
+    EXPECT_EQ(AVB_IO_RESULT_OK,
+              avb_trusted_key_set_validate(
+                  set_,
+                  partition,
+                  key.data(),
+                  key.size(),
+                  metadata.empty() ? nullptr : metadata.data(),
+                  metadata.size(),
+                  &is_trusted,
+                  out_location));
+    return is_trusted;
+  }
+
+  void TearDown() override {
+    avb_trusted_key_set_free(set_);
+  }
+
+  AvbTrustedKeySet* set_ = nullptr;
+};
+
+TEST_F(AvbTrustedKeysTest, Lookup) {
+  std::vector<uint8_t> oem = MakeKey(1);
+  std::vector<uint8_t> gsi = MakeKey(2);
+  std::vector<uint8_t> dev = MakeKey(3);
+  std::vector<uint8_t> gsi_md = {'g', 's', 'i'};
+  const char* const gsi_partitions[] = {"vbmeta_system", "system", nullptr};
+  const char* const oem_partitions[] = {"vbmeta", nullptr};
+  AvbTrustedKey keys[] = {
+      {oem.data(), oem.size(), nullptr, 0, oem_partitions, 0},
+      {gsi.data(), gsi.size(), gsi_md.data(), gsi_md.size(), gsi_partitions,
+       2},
+  };
+
+  set_ = avb_trusted_key_set_new(keys, 2);
+  ASSERT_NE(nullptr, set_);
+
+  uint32_t location = 42;
+  EXPECT_TRUE(Validate("vbmeta", oem, {}, &location));
+  EXPECT_EQ(0u, location);
+  // Metadata is ignored for keys without any.
+  EXPECT_TRUE(Validate("vbmeta", oem, {'x'}, nullptr));
+  EXPECT_FALSE(Validate("boot", oem, {}, nullptr));
+
+  location = 42;
+  EXPECT_TRUE(Validate("system", gsi, gsi_md, &location));
+  EXPECT_EQ(2u, location);
+  EXPECT_FALSE(Validate("system", gsi, {}, nullptr));
+  EXPECT_FALSE(Validate("system", gsi, {'g', 's'}, nullptr));
+  EXPECT_FALSE(Validate("vbmeta", gsi, gsi_md, nullptr));
+
+  EXPECT_FALSE(Validate("vbmeta", dev, {}, nullptr));
+  // Same prefix but different length.
+  std::vector<uint8_t> truncated(oem.begin(), oem.end() - 1);
+  EXPECT_FALSE(Validate("vbmeta", truncated, {}, nullptr));
+}
+
+TEST_F(AvbTrustedKeysTest, SameKeyDifferentPartitions) {
+  std::vector<uint8_t> key = MakeKey(1);
+  const char* const boot[] = {"boot", nullptr};
+  const char* const vendor[] = {"vendor_boot", "vendor", nullptr};
+  AvbTrustedKey keys[] = {
+      {key.data(), key.size(), nullptr, 0, boot, 1},
+      {key.data(), key.size(), nullptr, 0, vendor, 3},
+  };
+
+  set_ = avb_trusted_key_set_new(keys, 2);
+  ASSERT_NE(nullptr, set_);
+
+  uint32_t location = 0;
+  EXPECT_TRUE(Validate("boot", key, {}, &location));
+  EXPECT_EQ(1u, location);
+  EXPECT_TRUE(Validate("vendor", key, {}, &location));
+  EXPECT_EQ(3u, location);
+  EXPECT_FALSE(Validate("vbmeta", key, {}, nullptr));
+}
+
+TEST_F(AvbTrustedKeysTest, SuffixedPartitionNames) {
+  std::vector<uint8_t> key = MakeKey(1);
+  const char* const system[] = {"system_a", "system_b", nullptr};
+  AvbTrustedKey keys[] = {
+      {key.data(), key.size(), nullptr, 0, system, 2},
+  };
+
+  set_ = avb_trusted_key_set_new(keys, 1);
+  ASSERT_NE(nullptr, set_);
+
+  // validate_public_key_for_partition() gets the full partition name.
+  uint32_t location = 0;
+  EXPECT_TRUE(Validate("system_a", key, {}, &location));
+  EXPECT_EQ(2u, location);
+  EXPECT_TRUE(Validate("system_b", key, {}, nullptr));
+  EXPECT_FALSE(Validate("system", key, {}, nullptr));
+  EXPECT_FALSE(Validate("system_c", key, {}, nullptr));
+  EXPECT_FALSE(Validate("system_ab", key, {}, nullptr));
+}
+
+TEST_F(AvbTrustedKeysTest, ManyKeys) {
+  const size_t kNumKeys = 200;
+  std::vector<std::vector<uint8_t>> blobs;
+  std::vector<AvbTrustedKey> keys;
+
+  for (size_t n = 0; n < kNumKeys; n++) {
+    blobs.push_back(MakeKey(static_cast<uint8_t>(n), 520 + n));
+  }
+  for (size_t n = 0; n < kNumKeys; n++) {
+    keys.push_back({blobs[n].data(),
+                    blobs[n].size(),
+                    nullptr,
+                    0,
+                    nullptr,
+                    static_cast<uint32_t>(n)});
+  }
+
+  set_ = avb_trusted_key_set_new(keys.data(), keys.size());
+  ASSERT_NE(nullptr, set_);
+
+  for (size_t n = 0; n < kNumKeys; n++) {
+    uint32_t location = 0;
+    EXPECT_TRUE(Validate("vbmeta", blobs[n], {}, &location));
+    EXPECT_EQ(n, location);
+  }
+  EXPECT_FALSE(Validate("vbmeta", MakeKey(0, 1032), {}, nullptr));
+}
+
+TEST_F(AvbTrustedKeysTest, Empty) {
+  set_ = avb_trusted_key_set_new(nullptr, 0);
+  ASSERT_NE(nullptr, set_);
+  EXPECT_FALSE(Validate("vbmeta", MakeKey(1), {}, nullptr));
+}
+
+}  // namespace avb
@@ -25,6 +25,9 @@
 #include <endian.h>
 #include <string.h>
 
+#include <string>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include <libavb/libavb.h>
@@ -542,4 +545,64 @@ TEST_F(UtilTest, Basename) {
   EXPECT_EQ("/", std::string(avb_basename("/")));
 }
 
+TEST_F(UtilTest, LogRing) {
+  char buf[32];
+
+  avb_log_ring_init(buf, sizeof buf);
+  EXPECT_EQ(nullptr, avb_log_ring_pop());
+
+  avb_log_ring_appendv("foo", ":", "1", NULL);
+  avb_log_ring_appendv("bar", NULL);
+  EXPECT_EQ("foo:1", std::string(avb_log_ring_pop()));
+  EXPECT_EQ("bar", std::string(avb_log_ring_pop()));
+  EXPECT_EQ(nullptr, avb_log_ring_pop());
+
+  // Fill the ring with 8-byte messages, then add a message which only fits
+  // after wrapping around. The two oldest messages have to go.
+  avb_log_ring_appendv("msg-0:", "a", NULL);
+  avb_log_ring_appendv("msg-1:", "b", NULL);
+  avb_log_ring_appendv("msg-2:", "c", NULL);
+  avb_log_ring_appendv("msg-3:", "d", NULL);
+  avb_log_ring_appendv("0123456789", NULL);
+  EXPECT_EQ("msg-2:c", std::string(avb_log_ring_pop()));
+  EXPECT_EQ("msg-3:d", std::string(avb_log_ring_pop()));
+  EXPECT_EQ("0123456789", std::string(avb_log_ring_pop()));
+  EXPECT_EQ(nullptr, avb_log_ring_pop());
+
+  // Messages which are too long are truncated.
+  avb_log_ring_appendv("0123456789", "0123456789", "0123456789", "xyz", NULL);
+  EXPECT_EQ("012345678901234567890123456789x",
+            std::string(avb_log_ring_pop()));
+  EXPECT_EQ(nullptr, avb_log_ring_pop());
+
+  avb_log_ring_appendv("foo", NULL);
+  avb_log_ring_flush();
+  EXPECT_EQ(nullptr, avb_log_ring_pop());
+
+  avb_log_ring_init(NULL, 0);
+}
+
+TEST_F(UtilTest, LogRingWrapsRepeatedly) {
+  char buf[64];
+
+  avb_log_ring_init(buf, sizeof buf);
+  for (int n = 0; n < 1000; n++) {
+    std::string message = std::string(n % 13, 'x') + std::to_string(n);
+    avb_log_ring_appendv(message.c_str(), NULL);
+  }
+  // Whatever is left must be the most recent messages, in order.
+  std::vector<std::string> messages;
+  const char* message;
+  while ((message = avb_log_ring_pop()) != NULL) {
+    messages.push_back(message);
+  }
+  ASSERT_FALSE(messages.empty());
+  for (size_t n = 0; n < messages.size(); n++) {
+    int i = 1000 - messages.size() + n;
+    EXPECT_EQ(std::string(i % 13, 'x') + std::to_string(i), messages[n]);
+  }
+
+  avb_log_ring_init(NULL, 0);
+}
+
 }  // namespace avb
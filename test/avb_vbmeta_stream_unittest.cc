@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <base/strings/stringprintf.h>
+
+#include <libavb/libavb.h>
+
+#include "avb_unittest_util.h"
+
+namespace avb {
+
+class AvbVBMetaStreamTest : public BaseAvbToolTest {
+ public:
+  AvbVBMetaStreamTest() {}
+
+ protected:
+  // Streams |data| in chunks of |chunk_size| bytes, collecting the
+  // descriptors in |descriptors_| once the image has been verified.
+  AvbVBMetaVerifyResult Stream(const std::vector<uint8_t>& data,
+                               size_t chunk_size,
+                               size_t max_field_size = 4096,
+                               size_t max_descriptors_size = 1024 * 1024) {
+    AvbVBMetaStream* stream =
+        avb_vbmeta_stream_new(max_field_size, max_descriptors_size);
+    EXPECT_NE(nullptr, stream);
+    descriptors_.clear();
+    descriptors_ok_ = false;
+    public_key_.clear();
+    public_key_metadata_.clear();
+
+    for (size_t pos = 0; pos < data.size(); pos += chunk_size) {
+      size_t n = std::min(chunk_size, data.size() - pos);
+      AvbVBMetaVerifyResult ret =
+          avb_vbmeta_stream_update(stream, data.data() + pos, n);
+      if (ret != AVB_VBMETA_VERIFY_RESULT_OK) {
+        EXPECT_FALSE(avb_vbmeta_stream_foreach_descriptor(
+            stream, CollectDescriptor, this));
+        avb_vbmeta_stream_free(stream);
+        return ret;
+      }
+    }
+    bytes_needed_ = avb_vbmeta_stream_bytes_needed(stream);
+
+    // Nothing is handed out before the image has been verified.
+    EXPECT_FALSE(
+        avb_vbmeta_stream_foreach_descriptor(stream, CollectDescriptor, this));
+    EXPECT_TRUE(descriptors_.empty());
+
+    const uint8_t* pk;
+    size_t pk_len;
+    const uint8_t* pkmd;
+    size_t pkmd_len;
+    AvbVBMetaVerifyResult ret = avb_vbmeta_stream_finish(
+        stream, &header_, &pk, &pk_len, &pkmd, &pkmd_len);
+    if (pk != nullptr) {
+      public_key_.assign(pk, pk + pk_len);
+    }
+    if (pkmd != nullptr) {
+      public_key_metadata_.assign(pkmd, pkmd + pkmd_len);
+    }
+    descriptors_ok_ =
+        avb_vbmeta_stream_foreach_descriptor(stream, CollectDescriptor, this);
+    avb_vbmeta_stream_free(stream);
+    return ret;
+  }
+
+  // The descriptors in |vbmeta_image_| found by avb_descriptor_get_all().
+  std::vector<std::vector<uint8_t>> ExpectedDescriptors() {
+    std::vector<std::vector<uint8_t>> ret;
+    size_t num_descriptors;
+    const AvbDescriptor** descriptors = avb_descriptor_get_all(
+        vbmeta_image_.data(), vbmeta_image_.size(), &num_descriptors);
+    for (size_t n = 0; n < num_descriptors; n++) {
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(descriptors[n]);
+      ret.push_back(std::vector<uint8_t>(
+          p,
+          p + sizeof(AvbDescriptor) +
+              avb_be64toh(descriptors[n]->num_bytes_following)));
+    }
+    avb_free(descriptors);
+    return ret;
+  }
+
+  std::vector<std::vector<uint8_t>> descriptors_;
+  bool descriptors_ok_;
+  std::vector<uint8_t> public_key_;
+  std::vector<uint8_t> public_key_metadata_;
+  AvbVBMetaImageHeader header_;
+  uint64_t bytes_needed_;
+
+ private:
+  static bool CollectDescriptor(const AvbDescriptor* descriptor,
+                                void* user_data) {
+    AvbVBMetaStreamTest* test = static_cast<AvbVBMetaStreamTest*>(user_data);
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(descriptor);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(p) & 7);
+    test->descriptors_.push_back(std::vector<uint8_t>(
+        p,
+        p + sizeof(AvbDescriptor) +
+            avb_be64toh(descriptor->num_bytes_following)));
+    return true;
+  }
+};
+
+TEST_F(AvbVBMetaStreamTest, MatchesImageVerify) {
+  base::FilePath md_path = GenerateImage("md.bin", 1000);
+  GenerateVBMetaImage(
+      "vbmeta.img",
+      "SHA512_RSA4096",
+      42,
+      base::FilePath("test/data/testkey_rsa4096.pem"),
+      base::StringPrintf("--public_key_metadata %s"
+                         " --prop foo:bar --prop answer:42"
+                         " --kernel_cmdline 'quiet splash'"
+                         " --internal_release_string \"\"",
+                         md_path.value().c_str()));
+
+  const uint8_t* pk;
+  size_t pk_len;
+  ASSERT_EQ(AVB_VBMETA_VERIFY_RESULT_OK,
+            avb_vbmeta_image_verify(
+                vbmeta_image_.data(), vbmeta_image_.size(), &pk, &pk_len));
+  std::vector<std::vector<uint8_t>> expected = ExpectedDescriptors();
+  ASSERT_EQ(3u, expected.size());
+  std::string md;
+  ASSERT_TRUE(base::ReadFileToString(md_path, &md));
+
+  for (size_t chunk_size : {1, 7, 64, 257, 4096, 1 << 20}) {
+    SCOPED_TRACE(chunk_size);
+    EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_OK, Stream(vbmeta_image_, chunk_size));
+    EXPECT_EQ(0u, bytes_needed_);
+    EXPECT_TRUE(descriptors_ok_);
+    EXPECT_EQ(expected, descriptors_);
+    EXPECT_EQ(std::vector<uint8_t>(pk, pk + pk_len), public_key_);
+    EXPECT_EQ(std::vector<uint8_t>(md.begin(), md.end()),
+              public_key_metadata_);
+    EXPECT_EQ(42u, header_.rollback_index);
+  }
+}
+
+TEST_F(AvbVBMetaStreamTest, LargerThan64KiB) {
+  std::string props;
+  for (int n = 0; n < 1500; n++) {
+    props += base::StringPrintf(" --prop property_%04d:value_%04d", n, n);
+  }
+  GenerateVBMetaImage("vbmeta.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      props + " --internal_release_string \"\"");
+  ASSERT_GT(vbmeta_image_.size(), 64u * 1024);
+
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_OK, Stream(vbmeta_image_, 4096, 1024));
+  EXPECT_TRUE(descriptors_ok_);
+  EXPECT_EQ(1500u, descriptors_.size());
+  EXPECT_EQ(ExpectedDescriptors(), descriptors_);
+}
+
+TEST_F(AvbVBMetaStreamTest, Unsigned) {
+  GenerateVBMetaImage("vbmeta.img",
+                      "",
+                      0,
+                      base::FilePath(""),
+                      "--prop foo:bar --internal_release_string \"\"");
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_OK_NOT_SIGNED,
+            Stream(vbmeta_image_, 100));
+  EXPECT_TRUE(descriptors_ok_);
+  EXPECT_EQ(1u, descriptors_.size());
+  EXPECT_TRUE(public_key_.empty());
+}
+
+TEST_F(AvbVBMetaStreamTest, Errors) {
+  GenerateVBMetaImage("vbmeta.img",
+                      "SHA256_RSA2048",
+                      0,
+                      base::FilePath("test/data/testkey_rsa2048.pem"),
+                      "--prop foo:bar --internal_release_string \"\"");
+  size_t aux_offset =
+      sizeof(AvbVBMetaImageHeader) +
+      avb_be64toh(reinterpret_cast<AvbVBMetaImageHeader*>(vbmeta_image_.data())
+                      ->authentication_data_block_size);
+
+  // Trailing data is ignored.
+  std::vector<uint8_t> image = vbmeta_image_;
+  image.resize(image.size() + 1000, 0xff);
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_OK, Stream(image, 300));
+
+  // Truncated image.
+  image = vbmeta_image_;
+  image.resize(image.size() - 1);
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER,
+            Stream(image, 300));
+  EXPECT_EQ(1u, bytes_needed_);
+
+  // Modified auxiliary data.
+  image = vbmeta_image_;
+  image[aux_offset + 1] ^= 0x01;
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_HASH_MISMATCH, Stream(image, 300));
+  EXPECT_FALSE(descriptors_ok_);
+  EXPECT_TRUE(descriptors_.empty());
+
+  // Bad magic.
+  image = vbmeta_image_;
+  image[0] = 'X';
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER,
+            Stream(image, 300));
+
+  // Public key doesn't fit in the side buffers.
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER,
+            Stream(vbmeta_image_, 300, 64));
+
+  // Descriptors don't fit in their side buffer.
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_INVALID_VBMETA_HEADER,
+            Stream(vbmeta_image_, 300, 4096, 8));
+
+  // Descriptors not kept.
+  EXPECT_EQ(AVB_VBMETA_VERIFY_RESULT_OK, Stream(vbmeta_image_, 300, 4096, 0));
+  EXPECT_FALSE(descriptors_ok_);
+  EXPECT_TRUE(descriptors_.empty());
+}
+
+}  // namespace avb
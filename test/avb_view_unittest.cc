@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <endian.h>
+#include <string.h>
+
+#include <base/files/file_util.h>
+#include <base/strings/stringprintf.h>
+
+#include <libavb/libavb.h>
+#include <libavb_view/libavb_view.h>
+
+#include "avb_unittest_util.h"
+
+namespace avb {
+
+class AvbViewTest : public BaseAvbToolTest {
+ public:
+  AvbViewTest() {}
+
+ protected:
+  // Generates a vbmeta image with one descriptor of each known type.
+  void GenerateImageWithAllDescriptors() {
+    const size_t partition_size = 1024 * 1024;
+    base::FilePath boot_path = GenerateImage("boot.img", 64 * 1024);
+    EXPECT_COMMAND(0,
+                   "./avbtool.py add_hash_footer"
+                   " --image %s"
+                   " --partition_name boot"
+                   " --partition_size %zd"
+                   " --salt deadbeef"
+                   " --internal_release_string \"\"",
+                   boot_path.value().c_str(),
+                   partition_size);
+
+    base::FilePath system_path = GenerateImage("system.img", 64 * 1024);
+    EXPECT_COMMAND(0,
+                   "./avbtool.py add_hashtree_footer"
+                   " --image %s"
+                   " --partition_name system"
+                   " --partition_size %zd"
+                   " --salt d00df00d"
+                   " --internal_release_string \"\""
+                   " --do_not_generate_fec",
+                   system_path.value().c_str(),
+                   partition_size);
+
+    base::FilePath pk_path = testdir_.Append("testkey_rsa4096.avbpubkey");
+    EXPECT_COMMAND(
+        0,
+        "./avbtool.py extract_public_key --key test/data/testkey_rsa4096.pem"
+        " --output %s",
+        pk_path.value().c_str());
+
+    GenerateVBMetaImage(
+        "vbmeta.img",
+        "SHA256_RSA2048",
+        42,
+        base::FilePath("test/data/testkey_rsa2048.pem"),
+        base::StringPrintf("--include_descriptors_from_image %s"
+                           " --include_descriptors_from_image %s"
+                           " --chain_partition vendor:3:%s"
+                           " --kernel_cmdline 'cmdline in vbmeta'"
+                           " --prop foo:brillo"
+                           " --prop bar:chromeos"
+                           " --internal_release_string \"\"",
+                           boot_path.value().c_str(),
+                           system_path.value().c_str(),
+                           pk_path.value().c_str()));
+  }
+
+  std::optional<VBMetaView> ParseVBMetaImage() {
+    return VBMetaView::Parse(vbmeta_image_.data(), vbmeta_image_.size());
+  }
+};
+
+TEST_F(AvbViewTest, HeaderMatchesLibavb) {
+  GenerateImageWithAllDescriptors();
+  auto view = ParseVBMetaImage();
+  ASSERT_TRUE(view);
+
+  AvbVBMetaImageHeader h;
+  avb_vbmeta_image_header_to_host_byte_order(
+      reinterpret_cast<const AvbVBMetaImageHeader*>(vbmeta_image_.data()),
+      &h);
+  EXPECT_EQ(h.required_libavb_version_major,
+            view->required_libavb_version_major());
+  EXPECT_EQ(h.required_libavb_version_minor,
+            view->required_libavb_version_minor());
+  EXPECT_EQ(AVB_ALGORITHM_TYPE_SHA256_RSA2048, view->algorithm_type());
+  EXPECT_EQ(42UL, view->rollback_index());
+  EXPECT_EQ(h.rollback_index_location, view->rollback_index_location());
+  EXPECT_EQ(h.flags, view->flags());
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(h.release_string)),
+            view->release_string());
+  EXPECT_EQ(sizeof(AvbVBMetaImageHeader) +
+                h.authentication_data_block_size +
+                h.auxiliary_data_block_size,
+            view->bytes().size());
+
+  EXPECT_EQ(h.hash_size, view->hash().size());
+  EXPECT_EQ(h.signature_size, view->signature().size());
+  EXPECT_EQ(PublicKeyAVB(base::FilePath("test/data/testkey_rsa2048.pem")),
+            view->public_key().AsStringView());
+  EXPECT_TRUE(view->public_key_metadata().empty());
+}
+
+TEST_F(AvbViewTest, DescriptorsMatchLibavb) {
+  GenerateImageWithAllDescriptors();
+  auto view = ParseVBMetaImage();
+  ASSERT_TRUE(view);
+  EXPECT_TRUE(view->descriptors().IsWellFormed());
+
+  size_t num_descriptors;
+  const AvbDescriptor** descriptors = avb_descriptor_get_all(
+      vbmeta_image_.data(), vbmeta_image_.size(), &num_descriptors);
+  ASSERT_NE(nullptr, descriptors);
+
+  size_t n = 0;
+  size_t num_properties = 0;
+  for (const DescriptorView& d : view->descriptors()) {
+    ASSERT_LT(n, num_descriptors);
+    EXPECT_EQ(reinterpret_cast<const uint8_t*>(descriptors[n]),
+              d.bytes().data());
+    AvbDescriptor header;
+    ASSERT_TRUE(avb_descriptor_validate_and_byteswap(descriptors[n], &header));
+    EXPECT_EQ(header.tag, d.tag());
+    EXPECT_EQ(header.num_bytes_following, d.num_bytes_following());
+
+    switch (d.tag()) {
+      case AVB_DESCRIPTOR_TAG_PROPERTY: {
+        auto property = PropertyDescriptorView::FromDescriptor(d);
+        ASSERT_TRUE(property);
+        if (num_properties++ == 0) {
+          EXPECT_EQ("foo", property->key());
+          EXPECT_EQ("brillo", property->value());
+        } else {
+          EXPECT_EQ("bar", property->key());
+          EXPECT_EQ("chromeos", property->value());
+        }
+      } break;
+
+      case AVB_DESCRIPTOR_TAG_HASH: {
+        auto hash = HashDescriptorView::FromDescriptor(d);
+        ASSERT_TRUE(hash);
+        AvbHashDescriptor s;
+        ASSERT_TRUE(avb_hash_descriptor_validate_and_byteswap(
+            reinterpret_cast<const AvbHashDescriptor*>(descriptors[n]), &s));
+        EXPECT_EQ(s.image_size, hash->image_size());
+        EXPECT_EQ("sha256", hash->hash_algorithm());
+        EXPECT_EQ(s.flags, hash->flags());
+        EXPECT_EQ("boot", hash->partition_name());
+        EXPECT_EQ("deadbeef", mem_to_hexstring(hash->salt().data(),
+                                               hash->salt().size()));
+        EXPECT_EQ(s.digest_len, hash->digest().size());
+      } break;
+
+      case AVB_DESCRIPTOR_TAG_HASHTREE: {
+        auto hashtree = HashtreeDescriptorView::FromDescriptor(d);
+        ASSERT_TRUE(hashtree);
+        AvbHashtreeDescriptor s;
+        ASSERT_TRUE(avb_hashtree_descriptor_validate_and_byteswap(
+            reinterpret_cast<const AvbHashtreeDescriptor*>(descriptors[n]),
+            &s));
+        EXPECT_EQ(s.dm_verity_version, hashtree->dm_verity_version());
+        EXPECT_EQ(s.image_size, hashtree->image_size());
+        EXPECT_EQ(s.tree_offset, hashtree->tree_offset());
+        EXPECT_EQ(s.tree_size, hashtree->tree_size());
+        EXPECT_EQ(s.data_block_size, hashtree->data_block_size());
+        EXPECT_EQ(s.hash_block_size, hashtree->hash_block_size());
+        EXPECT_EQ(0U, hashtree->fec_num_roots());
+        EXPECT_EQ(s.fec_offset, hashtree->fec_offset());
+        EXPECT_EQ(s.fec_size, hashtree->fec_size());
+        EXPECT_EQ("sha1", hashtree->hash_algorithm());
+        EXPECT_EQ("system", hashtree->partition_name());
+        EXPECT_EQ("d00df00d",
+                  mem_to_hexstring(hashtree->salt().data(),
+                                   hashtree->salt().size()));
+        EXPECT_EQ(s.root_digest_len, hashtree->root_digest().size());
+      } break;
+
+      case AVB_DESCRIPTOR_TAG_KERNEL_CMDLINE: {
+        auto cmdline = KernelCmdlineDescriptorView::FromDescriptor(d);
+        ASSERT_TRUE(cmdline);
+        EXPECT_EQ(0U, cmdline->flags());
+        EXPECT_EQ("cmdline in vbmeta", cmdline->kernel_cmdline());
+      } break;
+
+      case AVB_DESCRIPTOR_TAG_CHAIN_PARTITION: {
+        auto chain = ChainPartitionDescriptorView::FromDescriptor(d);
+        ASSERT_TRUE(chain);
+        EXPECT_EQ(3U, chain->rollback_index_location());
+        EXPECT_EQ(0U, chain->flags());
+        EXPECT_EQ("vendor", chain->partition_name());
+        EXPECT_EQ(
+            PublicKeyAVB(base::FilePath("test/data/testkey_rsa4096.pem")),
+            chain->public_key().AsStringView());
+      } break;
+
+      default:
+        ADD_FAILURE() << "Unexpected tag " << d.tag();
+    }
+
+    // Typed views only accept their own tag.
+    if (d.tag() != AVB_DESCRIPTOR_TAG_PROPERTY) {
+      EXPECT_FALSE(PropertyDescriptorView::FromDescriptor(d));
+    }
+    n++;
+  }
+  EXPECT_EQ(num_descriptors, n);
+  EXPECT_EQ(2UL, num_properties);
+  avb_free(descriptors);
+}
+
+TEST_F(AvbViewTest, GetPropertyValue) {
+  GenerateImageWithAllDescriptors();
+  auto view = ParseVBMetaImage();
+  ASSERT_TRUE(view);
+
+  EXPECT_EQ("brillo", view->GetPropertyValue("foo"));
+  EXPECT_EQ("chromeos", view->GetPropertyValue("bar"));
+  EXPECT_FALSE(view->GetPropertyValue("fo"));
+  EXPECT_FALSE(view->GetPropertyValue("nonexistent"));
+}
+
+TEST_F(AvbViewTest, ParseRejectsMalformedImages) {
+  GenerateImageWithAllDescriptors();
+  ASSERT_TRUE(ParseVBMetaImage());
+
+  EXPECT_FALSE(VBMetaView::Parse(nullptr, 0));
+  EXPECT_FALSE(VBMetaView::Parse(vbmeta_image_.data(),
+                                 sizeof(AvbVBMetaImageHeader) - 1));
+
+  // Truncated inside the auxiliary block.
+  EXPECT_FALSE(
+      VBMetaView::Parse(vbmeta_image_.data(), vbmeta_image_.size() - 64));
+
+  AvbVBMetaImageHeader* h =
+      reinterpret_cast<AvbVBMetaImageHeader*>(vbmeta_image_.data());
+  AvbVBMetaImageHeader saved = *h;
+
+  h->magic[0] = 'X';
+  EXPECT_FALSE(ParseVBMetaImage());
+  *h = saved;
+
+  h->auxiliary_data_block_size =
+      htobe64(be64toh(saved.auxiliary_data_block_size) + 1);
+  EXPECT_FALSE(ParseVBMetaImage());
+  *h = saved;
+
+  h->descriptors_size = htobe64(be64toh(saved.descriptors_size) + 4096);
+  EXPECT_FALSE(ParseVBMetaImage());
+  *h = saved;
+
+  h->signature_offset = htobe64(UINT64_MAX);
+  EXPECT_FALSE(ParseVBMetaImage());
+  *h = saved;
+
+  h->release_string[AVB_RELEASE_STRING_SIZE - 1] = 'X';
+  EXPECT_FALSE(ParseVBMetaImage());
+  *h = saved;
+
+  EXPECT_TRUE(ParseVBMetaImage());
+}
+
+TEST_F(AvbViewTest, MalformedDescriptorStopsIteration) {
+  GenerateImageWithAllDescriptors();
+  auto view = ParseVBMetaImage();
+  ASSERT_TRUE(view);
+
+  // Make the second descriptor's num_bytes_following unaligned.
+  auto it = view->descriptors().begin();
+  ASSERT_NE(view->descriptors().end(), ++it);
+  uint8_t* second = const_cast<uint8_t*>(it->bytes().data());
+  uint64_t num_bytes_following = htobe64(it->num_bytes_following() + 1);
+  memcpy(second + offsetof(AvbDescriptor, num_bytes_following),
+         &num_bytes_following,
+         sizeof(num_bytes_following));
+
+  size_t n = 0;
+  for (const DescriptorView& d : view->descriptors()) {
+    (void)d;
+    n++;
+  }
+  EXPECT_EQ(1UL, n);
+  EXPECT_FALSE(view->descriptors().IsWellFormed());
+}
+
+TEST_F(AvbViewTest, TypedViewsRejectOverflowingLengths) {
+  // A property descriptor whose key claims to run past the descriptor.
+  alignas(8) uint8_t buf[sizeof(AvbPropertyDescriptor) + 8] = {};
+  AvbPropertyDescriptor* p = reinterpret_cast<AvbPropertyDescriptor*>(buf);
+  p->parent_descriptor.tag = htobe64(AVB_DESCRIPTOR_TAG_PROPERTY);
+  p->parent_descriptor.num_bytes_following =
+      htobe64(sizeof(buf) - sizeof(AvbDescriptor));
+  p->key_num_bytes = htobe64(3);
+  p->value_num_bytes = htobe64(3);
+
+  // Each of the key and value is followed by a NUL byte, so exactly 8 bytes
+  // fit.
+  DescriptorRange range(ByteView(buf, sizeof(buf)));
+  ASSERT_NE(range.end(), range.begin());
+  EXPECT_TRUE(PropertyDescriptorView::FromDescriptor(*range.begin()));
+
+  p->value_num_bytes = htobe64(4);
+  EXPECT_FALSE(PropertyDescriptorView::FromDescriptor(*range.begin()));
+
+  p->value_num_bytes = htobe64(UINT64_MAX);
+  EXPECT_FALSE(PropertyDescriptorView::FromDescriptor(*range.begin()));
+}
+
+}  // namespace avb
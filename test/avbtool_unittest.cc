@@ -2952,6 +2952,88 @@ TEST_F(AvbToolTest, VerifyImageWithHashAndZeroedHashtree) {
                  vbmeta_image_path_.value().c_str());
 }
 
+TEST_F(AvbToolTest, VerifyImageWithCache) {
+  const size_t boot_partition_size = 2 * 1024 * 1024;
+  base::FilePath boot_path = GenerateImage("boot.img", 1024 * 1024);
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hash_footer --salt deadbeef --image %s "
+                 "--partition_size %zd --partition_name boot "
+                 "--internal_release_string \"\" ",
+                 boot_path.value().c_str(),
+                 boot_partition_size);
+
+  const size_t system_partition_size = 10 * 1024 * 1024;
+  base::FilePath system_path = GenerateImage("system.img", 8 * 1024 * 1024);
+  EXPECT_COMMAND(0,
+                 "./avbtool.py add_hashtree_footer --salt d00df00d --image %s "
+                 "--partition_size %zd --partition_name system "
+                 "--do_not_generate_fec "
+                 "--internal_release_string \"\" ",
+                 system_path.value().c_str(),
+                 system_partition_size);
+
+  GenerateVBMetaImage(
+      "vbmeta.img",
+      "SHA256_RSA2048",
+      0,
+      base::FilePath("test/data/testkey_rsa2048.pem"),
+      base::StringPrintf("--include_descriptors_from_image %s "
+                         "--include_descriptors_from_image %s ",
+                         boot_path.value().c_str(),
+                         system_path.value().c_str()));
+
+  // The first run populates the cache with one entry per descriptor and
+  // the second one uses it.
+  base::FilePath cache_dir = testdir_.Append("verify_cache");
+  for (int n = 0; n < 2; n++) {
+    EXPECT_COMMAND(0,
+                   "./avbtool.py verify_image --image %s --cache_dir %s",
+                   vbmeta_image_path_.value().c_str(),
+                   cache_dir.value().c_str());
+    EXPECT_COMMAND(0, "test $(ls %s | wc -l) -eq 2", cache_dir.value().c_str());
+  }
+
+  // Any change to an image invalidates its cache entry.
+  EXPECT_COMMAND(
+      0, "./avbtool.py zero_hashtree --image %s", system_path.value().c_str());
+  EXPECT_COMMAND(1,
+                 "./avbtool.py verify_image --image %s --cache_dir %s",
+                 vbmeta_image_path_.value().c_str(),
+                 cache_dir.value().c_str());
+  EXPECT_COMMAND(0,
+                 "./avbtool.py verify_image --image %s --cache_dir %s "
+                 "--accept_zeroed_hashtree",
+                 vbmeta_image_path_.value().c_str(),
+                 cache_dir.value().c_str());
+
+  std::string boot_data;
+  ASSERT_TRUE(base::ReadFileToString(boot_path, &boot_data));
+  boot_data[0] ^= 0x01;
+  ASSERT_EQ(static_cast<int>(boot_data.size()),
+            base::WriteFile(boot_path, boot_data.data(), boot_data.size()));
+  EXPECT_COMMAND(1,
+                 "./avbtool.py verify_image --image %s --cache_dir %s "
+                 "--accept_zeroed_hashtree",
+                 vbmeta_image_path_.value().c_str(),
+                 cache_dir.value().c_str());
+
+  // The cache directory can also be set in the environment, and --no_cache
+  // overrides it.
+  base::FilePath env_cache_dir = testdir_.Append("env_verify_cache");
+  EXPECT_COMMAND(1,
+                 "AVB_VERIFY_CACHE_DIR=%s ./avbtool.py verify_image --image %s "
+                 "--accept_zeroed_hashtree --no_cache",
+                 env_cache_dir.value().c_str(),
+                 vbmeta_image_path_.value().c_str());
+  EXPECT_COMMAND(0, "test ! -e %s", env_cache_dir.value().c_str());
+  EXPECT_COMMAND(1,
+                 "AVB_VERIFY_CACHE_DIR=%s ./avbtool.py verify_image --image %s "
+                 "--accept_zeroed_hashtree",
+                 env_cache_dir.value().c_str(),
+                 vbmeta_image_path_.value().c_str());
+  EXPECT_COMMAND(0, "test -d %s", env_cache_dir.value().c_str());
+}
+
 TEST_F(AvbToolTest, VerifyImageWithNoHashtree) {
   const size_t system_partition_size = 10 * 1024 * 1024;
   const size_t system_image_size = 8 * 1024 * 1024;
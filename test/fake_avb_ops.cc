@@ -612,6 +612,7 @@ FakeAvbOps::FakeAvbOps() {
   avb_ab_ops_.read_ab_metadata = avb_ab_data_read;
   avb_ab_ops_.write_ab_metadata = avb_ab_data_write;
 
+  memset(&avb_cert_ops_, 0, sizeof(avb_cert_ops_));
   avb_cert_ops_.ops = &avb_ops_;
   avb_cert_ops_.read_permanent_attributes = my_ops_read_permanent_attributes;
   avb_cert_ops_.read_permanent_attributes_hash =
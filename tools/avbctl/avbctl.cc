@@ -22,17 +22,46 @@
  * SOFTWARE.
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <sysexits.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
 
 #include <android-base/properties.h>
 
+#include <libavb/avb_sha.h>
 #include <libavb_user/libavb_user.h>
 
 namespace {
 
 static bool g_opt_force = false;
+static bool g_opt_stats = false;
+
+/* Per-partition counters collected by 'verify --stats'. */
+struct PartitionStats {
+  uint64_t bytes_read = 0;
+  uint64_t io_ns = 0;
+  uint64_t bytes_hashed = 0;
+  uint64_t hash_ns = 0;
+};
+
+/* Keyed by partition name, including the A/B suffix. */
+static std::map<std::string, PartitionStats> g_stats;
+
+/* The libavb_user read_from_partition() wrapped by
+ * stats_read_from_partition().
+ */
+static AvbIOResult (*g_user_read_from_partition)(AvbOps* ops,
+                                                 const char* partition,
+                                                 int64_t offset,
+                                                 size_t num_bytes,
+                                                 void* buffer,
+                                                 size_t* out_num_read);
 
 /* Prints program usage to |where|. */
 void usage(FILE* where, int /* argc */, char* argv[]) {
@@ -50,7 +79,26 @@ void usage(FILE* where, int /* argc */, char* argv[]) {
           "  %s get-verification     - Prints whether verification is enabled "
           "in current slot.\n"
           "  %s disable-verification - Disable verification in current slot.\n"
-          "  %s enable-verification  - Enable verification in current slot.\n",
+          "  %s enable-verification  - Enable verification in current slot.\n"
+          "  %s verify               - Runs avb_slot_verify() on current "
+          "slot.\n"
+          "  %s bench                - Measures partition read, hashing and\n"
+          "                          signature checking speed.\n"
+          "\n"
+          "Options:\n"
+          "  --force                - Allow modifying vbmeta on a LOCKED "
+          "device.\n"
+          "  --slot SUFFIX          - Use slot with suffix SUFFIX instead of "
+          "current slot.\n"
+          "  --partition NAME       - Partition to verify or read in 'verify' "
+          "and\n"
+          "                           'bench', may be repeated. Default is "
+          "boot.\n"
+          "  --stats                - Print per-partition I/O, hashing and "
+          "signature\n"
+          "                           checking times in 'verify'.\n",
+          argv[0],
+          argv[0],
           argv[0],
           argv[0],
           argv[0],
@@ -217,6 +265,344 @@ int do_get_verity(AvbOps* ops, const std::string& ab_suffix) {
   return EX_OK;
 }
 
+/* Returns the current time of the monotonic clock in nanoseconds. */
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+double ns_to_ms(uint64_t ns) {
+  return ns / 1e6;
+}
+
+/* Returns the throughput in MiB/s of processing |num_bytes| in |ns|
+ * nanoseconds.
+ */
+double mib_per_sec(uint64_t num_bytes, uint64_t ns) {
+  if (ns == 0) {
+    return 0.0;
+  }
+  return (num_bytes / (1024.0 * 1024.0)) / (ns / 1e9);
+}
+
+/* Wrapper for libavb_user's read_from_partition() which records the
+ * number of bytes read and the time spent in |g_stats|.
+ */
+AvbIOResult stats_read_from_partition(AvbOps* ops,
+                                      const char* partition,
+                                      int64_t offset,
+                                      size_t num_bytes,
+                                      void* buffer,
+                                      size_t* out_num_read) {
+  uint64_t start = now_ns();
+  AvbIOResult ret = g_user_read_from_partition(
+      ops, partition, offset, num_bytes, buffer, out_num_read);
+  PartitionStats& stats = g_stats[partition];
+  stats.io_ns += now_ns() - start;
+  if (ret == AVB_IO_RESULT_OK) {
+    stats.bytes_read += *out_num_read;
+  }
+  return ret;
+}
+
+/* Implementation of the calculate_digest() operation which hashes in
+ * software exactly like libavb would, but records the number of bytes
+ * hashed and the time spent in |g_stats|.
+ */
+AvbIOResult stats_calculate_digest(AvbOps* ops,
+                                   const char* partition,
+                                   const char* hash_algorithm,
+                                   const uint8_t* salt,
+                                   size_t salt_size,
+                                   const uint8_t* data,
+                                   size_t data_size,
+                                   uint8_t* out_digest,
+                                   size_t digest_buf_size,
+                                   size_t* out_digest_size) {
+  uint64_t start = now_ns();
+
+  *out_digest_size = 0;
+  if (strcmp(hash_algorithm, "sha256") == 0 &&
+      digest_buf_size >= AVB_SHA256_DIGEST_SIZE) {
+    AvbSHA256Ctx ctx;
+    avb_sha256_init(&ctx);
+    avb_sha256_update(&ctx, salt, salt_size);
+    avb_sha256_update(&ctx, data, data_size);
+    memcpy(out_digest, avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE);
+    *out_digest_size = AVB_SHA256_DIGEST_SIZE;
+  } else if (strcmp(hash_algorithm, "sha512") == 0 &&
+             digest_buf_size >= AVB_SHA512_DIGEST_SIZE) {
+    AvbSHA512Ctx ctx;
+    avb_sha512_init(&ctx);
+    avb_sha512_update(&ctx, salt, salt_size);
+    avb_sha512_update(&ctx, data, data_size);
+    memcpy(out_digest, avb_sha512_final(&ctx), AVB_SHA512_DIGEST_SIZE);
+    *out_digest_size = AVB_SHA512_DIGEST_SIZE;
+  } else {
+    /* Let libavb deal with (and complain about) anything else. */
+    return AVB_IO_RESULT_OK;
+  }
+
+  PartitionStats& stats = g_stats[partition];
+  stats.hash_ns += now_ns() - start;
+  stats.bytes_hashed += salt_size + data_size;
+  return AVB_IO_RESULT_OK;
+}
+
+/* Prints the counters in |g_stats| and the time it takes to check the
+ * signature of each vbmeta image in |slot_data|. The latter is
+ * measured by verifying the images again since libavb doesn't report
+ * it.
+ */
+void print_verify_stats(AvbSlotVerifyData* slot_data, uint64_t total_ns) {
+  fprintf(stdout,
+          "%-24s %12s %10s %12s %10s\n",
+          "partition",
+          "read (bytes)",
+          "I/O (ms)",
+          "hashed",
+          "hash (ms)");
+  for (const auto& it : g_stats) {
+    const PartitionStats& stats = it.second;
+    fprintf(stdout,
+            "%-24s %12" PRIu64 " %10.3f %12" PRIu64 " %10.3f\n",
+            it.first.c_str(),
+            stats.bytes_read,
+            ns_to_ms(stats.io_ns),
+            stats.bytes_hashed,
+            ns_to_ms(stats.hash_ns));
+  }
+
+  if (slot_data != nullptr) {
+    fprintf(stdout, "\n%-24s %12s %10s\n", "vbmeta", "size", "RSA (ms)");
+    for (size_t n = 0; n < slot_data->num_vbmeta_images; n++) {
+      const AvbVBMetaData* vbmeta = &slot_data->vbmeta_images[n];
+      uint64_t start = now_ns();
+      avb_vbmeta_image_verify(
+          vbmeta->vbmeta_data, vbmeta->vbmeta_size, nullptr, nullptr);
+      fprintf(stdout,
+              "%-24s %12zu %10.3f\n",
+              vbmeta->partition_name,
+              vbmeta->vbmeta_size,
+              ns_to_ms(now_ns() - start));
+    }
+  }
+
+  fprintf(stdout, "\ntotal: %.3f ms\n", ns_to_ms(total_ns));
+}
+
+/* Function to run avb_slot_verify() on |partitions| and report the
+ * result, optionally with statistics. The |ops| parameter should be
+ * an |AvbOps| from libavb_user.
+ */
+int do_verify(AvbOps* ops,
+              const std::string& ab_suffix,
+              const std::vector<const char*>& partitions) {
+  std::vector<const char*> requested_partitions = partitions;
+  AvbSlotVerifyData* slot_data = nullptr;
+  AvbSlotVerifyResult result;
+  uint64_t start;
+  uint64_t total_ns;
+
+  if (g_opt_stats) {
+    g_user_read_from_partition = ops->read_from_partition;
+    ops->read_from_partition = stats_read_from_partition;
+    ops->calculate_digest = stats_calculate_digest;
+  }
+
+  requested_partitions.push_back(nullptr);
+  start = now_ns();
+  result = avb_slot_verify(ops,
+                           requested_partitions.data(),
+                           ab_suffix.c_str(),
+                           AVB_SLOT_VERIFY_FLAGS_NONE,
+                           AVB_HASHTREE_ERROR_MODE_RESTART_AND_INVALIDATE,
+                           &slot_data);
+  total_ns = now_ns() - start;
+
+  if (g_opt_stats) {
+    ops->read_from_partition = g_user_read_from_partition;
+    ops->calculate_digest = nullptr;
+  }
+
+  fprintf(stdout,
+          "avb_slot_verify() returned %s",
+          avb_slot_verify_result_to_string(result));
+  if (ab_suffix != "") {
+    fprintf(stdout, " on slot with suffix %s", ab_suffix.c_str());
+  }
+  fprintf(stdout, ".\n");
+
+  if (g_opt_stats) {
+    fprintf(stdout, "\n");
+    print_verify_stats(slot_data, total_ns);
+  }
+
+  if (slot_data != nullptr) {
+    avb_slot_verify_data_free(slot_data);
+  }
+  return result == AVB_SLOT_VERIFY_RESULT_OK ? EX_OK : EX_SOFTWARE;
+}
+
+/* Measures how fast |partition_name| can be read through |ops|. */
+bool bench_read(AvbOps* ops, const std::string& partition_name) {
+  const size_t kChunkSize = 1024 * 1024;
+  std::vector<uint8_t> buf(kChunkSize);
+  uint64_t partition_size;
+  uint64_t num_read_total = 0;
+  uint64_t start;
+
+  if (ops->get_size_of_partition(
+          ops, partition_name.c_str(), &partition_size) != AVB_IO_RESULT_OK) {
+    fprintf(stderr, "Error getting size of %s.\n", partition_name.c_str());
+    return false;
+  }
+
+  start = now_ns();
+  while (num_read_total < partition_size) {
+    size_t num_read;
+    if (ops->read_from_partition(ops,
+                                 partition_name.c_str(),
+                                 num_read_total,
+                                 kChunkSize,
+                                 buf.data(),
+                                 &num_read) != AVB_IO_RESULT_OK) {
+      fprintf(stderr, "Error reading from %s.\n", partition_name.c_str());
+      return false;
+    }
+    if (num_read == 0) {
+      break;
+    }
+    num_read_total += num_read;
+  }
+
+  fprintf(stdout,
+          "read %-18s %10.1f MiB/s (%" PRIu64 " bytes)\n",
+          partition_name.c_str(),
+          mib_per_sec(num_read_total, now_ns() - start),
+          num_read_total);
+  return true;
+}
+
+/* Measures SHA-256 and SHA-512 throughput. */
+void bench_hash() {
+  const size_t kBufSize = 16 * 1024 * 1024;
+  const int kIterations = 4;
+  std::vector<uint8_t> buf(kBufSize, 0xa5);
+  uint64_t start;
+
+  start = now_ns();
+  for (int n = 0; n < kIterations; n++) {
+    AvbSHA256Ctx ctx;
+    avb_sha256_init(&ctx);
+    avb_sha256_update(&ctx, buf.data(), buf.size());
+    buf[0] ^= avb_sha256_final(&ctx)[0];
+  }
+  fprintf(stdout,
+          "%-23s %10.1f MiB/s\n",
+          "sha256",
+          mib_per_sec(uint64_t(kBufSize) * kIterations, now_ns() - start));
+
+  start = now_ns();
+  for (int n = 0; n < kIterations; n++) {
+    AvbSHA512Ctx ctx;
+    avb_sha512_init(&ctx);
+    avb_sha512_update(&ctx, buf.data(), buf.size());
+    buf[0] ^= avb_sha512_final(&ctx)[0];
+  }
+  fprintf(stdout,
+          "%-23s %10.1f MiB/s\n",
+          "sha512",
+          mib_per_sec(uint64_t(kBufSize) * kIterations, now_ns() - start));
+}
+
+/* Measures how long it takes to check the signature of the vbmeta
+ * image in the vbmeta partition, i.e. with the device's actual key
+ * size and algorithm.
+ */
+bool bench_vbmeta_verify(AvbOps* ops, const std::string& ab_suffix) {
+  const int kIterations = 16;
+  /* Same limit as in avb_slot_verify.c. */
+  const size_t kMaxVBMetaSize = 64 * 1024;
+  std::string partition_name = "vbmeta" + ab_suffix;
+  std::vector<uint8_t> vbmeta(AVB_VBMETA_IMAGE_HEADER_SIZE);
+  AvbVBMetaImageHeader h;
+  uint64_t vbmeta_size;
+  size_t num_read;
+  uint64_t start;
+
+  if (ops->read_from_partition(ops,
+                               partition_name.c_str(),
+                               0,
+                               vbmeta.size(),
+                               vbmeta.data(),
+                               &num_read) != AVB_IO_RESULT_OK ||
+      num_read != vbmeta.size()) {
+    fprintf(stderr, "Error reading from %s.\n", partition_name.c_str());
+    return false;
+  }
+  if (avb_vbmeta_image_header_validate(vbmeta.data(), &h) !=
+          AVB_VBMETA_VERIFY_RESULT_OK ||
+      !avb_safe_add(&vbmeta_size,
+                    sizeof(AvbVBMetaImageHeader),
+                    h.authentication_data_block_size) ||
+      !avb_safe_add(
+          &vbmeta_size, vbmeta_size, h.auxiliary_data_block_size) ||
+      vbmeta_size > kMaxVBMetaSize) {
+    fprintf(stderr, "Invalid vbmeta image in %s.\n", partition_name.c_str());
+    return false;
+  }
+  vbmeta.resize(static_cast<size_t>(vbmeta_size));
+  if (ops->read_from_partition(ops,
+                               partition_name.c_str(),
+                               0,
+                               vbmeta.size(),
+                               vbmeta.data(),
+                               &num_read) != AVB_IO_RESULT_OK ||
+      num_read != vbmeta.size()) {
+    fprintf(stderr, "Error reading from %s.\n", partition_name.c_str());
+    return false;
+  }
+
+  start = now_ns();
+  for (int n = 0; n < kIterations; n++) {
+    if (avb_vbmeta_image_verify(
+            vbmeta.data(), vbmeta.size(), nullptr, nullptr) !=
+        AVB_VBMETA_VERIFY_RESULT_OK) {
+      fprintf(stderr,
+              "Error verifying vbmeta image in %s.\n",
+              partition_name.c_str());
+      return false;
+    }
+  }
+  fprintf(stdout,
+          "%-23s %10.3f ms\n",
+          "vbmeta signature check",
+          ns_to_ms((now_ns() - start) / kIterations));
+  return true;
+}
+
+/* Function to measure partition read, hashing and signature checking
+ * speed. The |ops| parameter should be an |AvbOps| from libavb_user.
+ */
+int do_bench(AvbOps* ops,
+             const std::string& ab_suffix,
+             const std::vector<const char*>& partitions) {
+  int ret = EX_OK;
+
+  for (const char* partition : partitions) {
+    if (!bench_read(ops, partition + ab_suffix)) {
+      ret = EX_SOFTWARE;
+    }
+  }
+  bench_hash();
+  if (!bench_vbmeta_verify(ops, ab_suffix)) {
+    ret = EX_SOFTWARE;
+  }
+  return ret;
+}
+
 /* Helper function to get A/B suffix, if any. If the device isn't
  * using A/B the empty string is returned. Otherwise either "_a",
  * "_b", ... is returned.
@@ -235,6 +621,8 @@ enum class Command {
   kDisableVerification,
   kEnableVerification,
   kGetVerification,
+  kVerify,
+  kBench,
 };
 
 int main(int argc, char* argv[]) {
@@ -242,6 +630,7 @@ int main(int argc, char* argv[]) {
   AvbOps* ops = nullptr;
   std::string ab_suffix = get_ab_suffix();
   Command cmd = Command::kNone;
+  std::vector<const char*> partitions;
 
   if (argc < 2) {
     usage(stderr, argc, argv);
@@ -259,6 +648,12 @@ int main(int argc, char* argv[]) {
   for (int n = 1; n < argc; n++) {
     if (strcmp(argv[n], "--force") == 0) {
       g_opt_force = true;
+    } else if (strcmp(argv[n], "--stats") == 0) {
+      g_opt_stats = true;
+    } else if (strcmp(argv[n], "--slot") == 0 && n + 1 < argc) {
+      ab_suffix = argv[++n];
+    } else if (strcmp(argv[n], "--partition") == 0 && n + 1 < argc) {
+      partitions.push_back(argv[++n]);
     } else if (strcmp(argv[n], "disable-verity") == 0) {
       cmd = Command::kDisableVerity;
     } else if (strcmp(argv[n], "enable-verity") == 0) {
@@ -271,9 +666,17 @@ int main(int argc, char* argv[]) {
       cmd = Command::kEnableVerification;
     } else if (strcmp(argv[n], "get-verification") == 0) {
       cmd = Command::kGetVerification;
+    } else if (strcmp(argv[n], "verify") == 0) {
+      cmd = Command::kVerify;
+    } else if (strcmp(argv[n], "bench") == 0) {
+      cmd = Command::kBench;
     }
   }
 
+  if (partitions.empty()) {
+    partitions.push_back("boot");
+  }
+
   switch (cmd) {
     case Command::kNone:
       usage(stderr, argc, argv);
@@ -297,6 +700,12 @@ int main(int argc, char* argv[]) {
     case Command::kGetVerification:
       ret = do_get_verification(ops, ab_suffix);
       break;
+    case Command::kVerify:
+      ret = do_verify(ops, ab_suffix, partitions);
+      break;
+    case Command::kBench:
+      ret = do_bench(ops, ab_suffix, partitions);
+      break;
   }
 
 out: